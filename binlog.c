@@ -0,0 +1,837 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2023 touchgadgetdev@gmail.com
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "./binlog.h"
+
+#if defined(ARDUINO)
+#include <esp_timer.h>
+
+static uint32_t now_us(void) {
+  return (uint32_t)esp_timer_get_time();
+}
+#else
+#include <time.h>
+
+static uint32_t now_us(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint32_t)((uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000);
+}
+#endif
+
+#define SLOT_DATA_MAX (BINLOG_ARGS * sizeof(uintptr_t))
+
+bool binlog_init(binlog_t *log, binlog_slot_t *slots, size_t size) {
+  if ((size == 0) || (size & (size - 1)) || (size > 0x80000000UL)) {
+    return false;
+  }
+  uint32_t lost = __atomic_load_n(&log->lost, __ATOMIC_RELAXED);
+  memset(log, 0, sizeof(*log));
+  log->lost = lost;
+  memset(slots, 0, size * sizeof(*slots));
+  log->slots = slots;
+  __atomic_store_n(&log->size, (uint32_t)size, __ATOMIC_RELEASE);
+  return true;
+}
+
+/*
+ * Claim count slots. Fails and counts the record lost if they are not free
+ * or the log is not initialized.
+ */
+static bool reserve(binlog_t *log, uint32_t count, uint32_t *index) {
+  uint32_t size = __atomic_load_n(&log->size, __ATOMIC_ACQUIRE);
+  uint32_t head = __atomic_load_n(&log->head, __ATOMIC_RELAXED);
+  do {
+    uint32_t tail = __atomic_load_n(&log->tail, __ATOMIC_ACQUIRE);
+    if (head - tail + count > size) {
+      __atomic_fetch_add(&log->lost, 1, __ATOMIC_RELAXED);
+      return false;
+    }
+  } while (!__atomic_compare_exchange_n(&log->head, &head, head + count,
+        true, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+  *index = head;
+  return true;
+}
+
+static binlog_slot_t *slot_at(binlog_t *log, uint32_t index) {
+  return &log->slots[index & (log->size - 1)];
+}
+
+static void publish(binlog_slot_t *slot, uint32_t index) {
+  __atomic_store_n(&slot->seq, index + 1, __ATOMIC_RELEASE);
+}
+
+void binlog_write(binlog_t *log, const char *format, const uintptr_t *args,
+    size_t argc) {
+  uint32_t index;
+  if (!reserve(log, 1, &index)) return;
+  binlog_slot_t *slot = slot_at(log, index);
+  if (argc > BINLOG_ARGS) argc = BINLOG_ARGS;
+  slot->time_us = now_us();
+  slot->format = format;
+  slot->kind = BINLOG_FORMAT;
+  slot->len = (uint8_t)argc;
+  for (size_t i = 0; i < argc; i++) slot->args[i] = args[i];
+  publish(slot, index);
+}
+
+static void write_bytes(binlog_t *log, uint8_t kind, const void *data,
+    size_t len) {
+  const uint8_t *bytes = (const uint8_t *)data;
+  uint32_t count = (len + SLOT_DATA_MAX - 1) / SLOT_DATA_MAX;
+  uint32_t index;
+  if ((count == 0) || !reserve(log, count, &index)) return;
+  uint32_t time_us = now_us();
+  for (uint32_t i = 0; i < count; i++) {
+    binlog_slot_t *slot = slot_at(log, index + i);
+    size_t chunk = (len > SLOT_DATA_MAX) ? SLOT_DATA_MAX : len;
+    slot->time_us = time_us;
+    slot->format = NULL;
+    slot->kind = kind;
+    slot->len = (uint8_t)chunk;
+    memcpy(slot->data, bytes, chunk);
+    bytes += chunk;
+    len -= chunk;
+    publish(slot, index + i);
+  }
+}
+
+void binlog_text(binlog_t *log, const char *text, size_t len) {
+  write_bytes(log, BINLOG_TEXT, text, len);
+}
+
+void binlog_hex(binlog_t *log, const void *data, size_t len) {
+  write_bytes(log, BINLOG_HEX, data, len);
+}
+
+/*
+ * Parse the conversion starting at the '%' at format. Copies it to spec
+ * without length modifiers and returns the conversion character, 0 if the
+ * format ends first. *end is set past the conversion.
+ */
+static char parse_conversion(const char *format, char *spec, size_t size,
+    const char **end) {
+  const char *p = format + 1;
+  size_t n = 0;
+  spec[n++] = '%';
+  while ((*p != '\0') && (strchr("-+ #0123456789.", *p) != NULL)) {
+    if (n < size - 2) spec[n++] = *p;
+    p++;
+  }
+  while ((*p != '\0') && (strchr("hljztLq", *p) != NULL)) p++;
+  char conversion = *p;
+  if (conversion != '\0') p++;
+  spec[n++] = conversion;
+  spec[n] = '\0';
+  *end = p;
+  return conversion;
+}
+
+// Bit i is set if argument i of format is a %s.
+static uint32_t string_args(const char *format) {
+  uint32_t strings = 0;
+  size_t arg = 0;
+  char spec[16];
+  for (const char *p = format; *p != '\0'; ) {
+    if (*p != '%') {
+      p++;
+      continue;
+    }
+    char conversion = parse_conversion(p, spec, sizeof(spec), &p);
+    if ((conversion == '%') || (conversion == '\0')) continue;
+    if ((conversion == 's') && (arg < 32)) strings |= 1UL << arg;
+    arg++;
+  }
+  return strings;
+}
+
+size_t binlog_format(char *out, size_t size, const char *format,
+    const uint32_t *args, const char *const *strings, size_t argc) {
+  if (size == 0) return 0;
+  size_t n = 0;
+  size_t arg = 0;
+  char spec[16];
+  for (const char *p = format; (*p != '\0') && (n + 1 < size); ) {
+    if (*p != '%') {
+      out[n++] = *p++;
+      continue;
+    }
+    char conversion = parse_conversion(p, spec, sizeof(spec), &p);
+    if (conversion == '%') {
+      out[n++] = '%';
+      continue;
+    }
+    if ((conversion == '\0') || (arg >= argc)) break;
+    uint32_t v = args[arg];
+    const char *s = (strings != NULL) ? strings[arg] : NULL;
+    arg++;
+    int len;
+    switch (conversion) {
+      case 'd':
+      case 'i':
+        len = snprintf(&out[n], size - n, spec, (int)(int32_t)v);
+        break;
+      case 'u':
+      case 'o':
+      case 'x':
+      case 'X':
+        len = snprintf(&out[n], size - n, spec, (unsigned)v);
+        break;
+      case 'c':
+        len = snprintf(&out[n], size - n, spec, (int)(char)v);
+        break;
+      case 's':
+        len = snprintf(&out[n], size - n, spec, (s != NULL) ? s : "(null)");
+        break;
+      case 'p':
+        len = snprintf(&out[n], size - n, "0x%08x", (unsigned)v);
+        break;
+      default:
+        len = snprintf(&out[n], size - n, "%s", spec);
+        break;
+    }
+    if (len > 0) n += ((size_t)len < size - n) ? (size_t)len : size - n - 1;
+  }
+  out[n] = '\0';
+  return n;
+}
+
+static size_t format_lost(char *out, size_t size, uint32_t lost) {
+  int len = snprintf(out, size, "binlog: %lu records lost\r\n",
+      (unsigned long)lost);
+  return ((len > 0) && ((size_t)len < size)) ? (size_t)len : 0;
+}
+
+static size_t format_hex(char *out, size_t size, const uint8_t *data,
+    size_t len) {
+  size_t n = 0;
+  for (size_t i = 0; (i < len) && (n + 4 <= size); i++) {
+    n += snprintf(&out[n], size - n, "%02X,", data[i]);
+  }
+  return n;
+}
+
+static void put_u8(binlog_t *log, uint8_t v) {
+  if (log->out_len < BINLOG_OUT_MAX) log->out[log->out_len++] = v;
+}
+
+static void put_u32(binlog_t *log, uint32_t v) {
+  for (int i = 0; i < 4; i++) put_u8(log, (uint8_t)(v >> (8 * i)));
+}
+
+static void put_bytes(binlog_t *log, const void *data, size_t len) {
+  if (len > BINLOG_OUT_MAX - log->out_len) len = BINLOG_OUT_MAX - log->out_len;
+  memcpy(&log->out[log->out_len], data, len);
+  log->out_len += len;
+}
+
+static uint8_t format_id(binlog_t *log, const char *format) {
+  for (uint32_t i = 0; i < log->format_count; i++) {
+    if (log->formats[i] == format) return (uint8_t)i;
+  }
+  if (log->format_count == BINLOG_FORMATS) log->format_count = 0;
+  uint8_t id = (uint8_t)log->format_count++;
+  log->formats[id] = format;
+  size_t len = strlen(format);
+  if (len > 255) len = 255;
+  put_u8(log, BINLOG_WIRE_DEFINE);
+  put_u8(log, id);
+  put_u8(log, (uint8_t)len);
+  put_bytes(log, format, len);
+  return id;
+}
+
+static void encode_binary(binlog_t *log, const binlog_slot_t *slot) {
+  if (slot->kind != BINLOG_FORMAT) {
+    put_u8(log, (slot->kind == BINLOG_HEX) ? BINLOG_WIRE_HEX :
+        BINLOG_WIRE_TEXT);
+    put_u32(log, slot->time_us);
+    put_u8(log, slot->len);
+    put_bytes(log, slot->data, slot->len);
+    return;
+  }
+  uint8_t id = format_id(log, slot->format);
+  uint32_t strings = string_args(slot->format);
+  put_u8(log, BINLOG_WIRE_FORMAT);
+  put_u8(log, id);
+  put_u32(log, slot->time_us);
+  put_u8(log, slot->len);
+  for (size_t i = 0; i < slot->len; i++) {
+    if (strings & (1UL << i)) {
+      const char *s = (const char *)slot->args[i];
+      if (s == NULL) s = "(null)";
+      size_t len = strnlen(s, BINLOG_STRING_MAX);
+      put_u8(log, (uint8_t)len);
+      put_bytes(log, s, len);
+    } else {
+      put_u32(log, (uint32_t)slot->args[i]);
+    }
+  }
+}
+
+static void encode_text(binlog_t *log, const binlog_slot_t *slot) {
+  char *out = (char *)log->out;
+  if (slot->kind == BINLOG_TEXT) {
+    memcpy(out, slot->data, slot->len);
+    log->out_len = slot->len;
+  } else if (slot->kind == BINLOG_HEX) {
+    log->out_len = format_hex(out, BINLOG_OUT_MAX, slot->data, slot->len);
+  } else {
+    uint32_t args[BINLOG_ARGS];
+    const char *strings[BINLOG_ARGS];
+    uint32_t string_mask = string_args(slot->format);
+    for (size_t i = 0; i < slot->len; i++) {
+      args[i] = (uint32_t)slot->args[i];
+      strings[i] = (string_mask & (1UL << i)) ?
+        (const char *)slot->args[i] : NULL;
+    }
+    log->out_len = binlog_format(out, BINLOG_OUT_MAX, slot->format, args,
+        strings, slot->len);
+  }
+}
+
+/*
+ * Encode the next thing to send into out. Returns false if there is none.
+ */
+static bool encode_next(binlog_t *log, bool binary) {
+  if (binary && !log->header_sent) {
+    put_bytes(log, BINLOG_MAGIC, 4);
+    put_u32(log, BINLOG_VERSION);
+    log->header_sent = true;
+    return true;
+  }
+  uint32_t tail = log->tail;
+  binlog_slot_t *slot = (log->size != 0) ? slot_at(log, tail) : NULL;
+  if ((slot == NULL) ||
+      (__atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) != tail + 1)) {
+    // Report the records lost when the ring has been emptied, after the
+    // records that filled it.
+    uint32_t lost = __atomic_exchange_n(&log->lost, 0, __ATOMIC_RELAXED);
+    if (lost == 0) return false;
+    log->lost_total += lost;
+    if (binary) {
+      put_u8(log, BINLOG_WIRE_LOST);
+      put_u32(log, lost);
+    } else {
+      log->out_len = format_lost((char *)log->out, BINLOG_OUT_MAX, lost);
+    }
+    return true;
+  }
+  if (binary) {
+    encode_binary(log, slot);
+  } else {
+    encode_text(log, slot);
+  }
+  log->records++;
+  __atomic_store_n(&log->tail, tail + 1, __ATOMIC_RELEASE);
+  return true;
+}
+
+size_t binlog_drain(binlog_t *log, bool binary, binlog_sink_fn sink,
+    void *ctx) {
+  size_t written = 0;
+  for (;;) {
+    if (log->out_pos < log->out_len) {
+      size_t n = sink(ctx, &log->out[log->out_pos],
+          log->out_len - log->out_pos);
+      written += n;
+      log->out_pos += n;
+      if (log->out_pos < log->out_len) return written;
+    }
+    log->out_len = 0;
+    log->out_pos = 0;
+    if (!encode_next(log, binary)) return written;
+  }
+}
+
+#if !defined(ARDUINO)
+static bool read_u32(FILE *in, uint32_t *v) {
+  uint8_t b[4];
+  if (fread(b, 1, sizeof(b), in) != sizeof(b)) return false;
+  *v = b[0] | (b[1] << 8) | (b[2] << 16) | ((uint32_t)b[3] << 24);
+  return true;
+}
+
+// Length byte and that many bytes, terminated.
+static bool read_string(FILE *in, uint8_t *buf, size_t *len) {
+  int n = getc(in);
+  if ((n == EOF) || (fread(buf, 1, n, in) != (size_t)n)) return false;
+  buf[n] = '\0';
+  *len = n;
+  return true;
+}
+
+bool binlog_decode(FILE *in, FILE *out, bool times) {
+  uint8_t header[8];
+  if ((fread(header, 1, sizeof(header), in) != sizeof(header)) ||
+      (memcmp(header, BINLOG_MAGIC, 4) != 0) ||
+      (header[4] != BINLOG_VERSION)) {
+    return false;
+  }
+  char (*formats)[256] = (char (*)[256])calloc(BINLOG_FORMATS, 256);
+  char (*strings)[256] = (char (*)[256])calloc(BINLOG_ARGS, 256);
+  char *text = (char *)malloc(BINLOG_OUT_MAX);
+  if ((formats == NULL) || (strings == NULL) || (text == NULL)) {
+    free(formats);
+    free(strings);
+    free(text);
+    return false;
+  }
+  bool line_start = true;
+  bool ok = true;
+  int type;
+  while (ok && ((type = getc(in)) != EOF)) {
+    uint32_t time_us = 0;
+    size_t len = 0;
+    uint8_t bytes[256];
+    switch (type) {
+      case BINLOG_WIRE_DEFINE: {
+        int id = getc(in);
+        ok = (id != EOF) && (id < BINLOG_FORMATS) &&
+          read_string(in, (uint8_t *)formats[id], &len);
+        continue;
+      }
+      case BINLOG_WIRE_FORMAT: {
+        int id = getc(in);
+        int argc;
+        ok = (id != EOF) && (id < BINLOG_FORMATS) && read_u32(in, &time_us) &&
+          ((argc = getc(in)) != EOF) && (argc <= BINLOG_ARGS);
+        if (!ok) break;
+        uint32_t string_mask = string_args(formats[id]);
+        uint32_t args[BINLOG_ARGS];
+        const char *arg_strings[BINLOG_ARGS];
+        for (int i = 0; ok && (i < argc); i++) {
+          arg_strings[i] = NULL;
+          args[i] = 0;
+          if (string_mask & (1UL << i)) {
+            ok = read_string(in, (uint8_t *)strings[i], &len);
+            arg_strings[i] = strings[i];
+          } else {
+            ok = read_u32(in, &args[i]);
+          }
+        }
+        if (ok) {
+          len = binlog_format(text, BINLOG_OUT_MAX, formats[id], args,
+              arg_strings, argc);
+        }
+        break;
+      }
+      case BINLOG_WIRE_TEXT:
+        ok = read_u32(in, &time_us) && read_string(in, bytes, &len);
+        if (ok) memcpy(text, bytes, len);
+        break;
+      case BINLOG_WIRE_HEX:
+        ok = read_u32(in, &time_us) && read_string(in, bytes, &len);
+        if (ok) len = format_hex(text, BINLOG_OUT_MAX, bytes, len);
+        break;
+      case BINLOG_WIRE_LOST: {
+        uint32_t lost;
+        ok = read_u32(in, &lost);
+        if (ok) len = format_lost(text, BINLOG_OUT_MAX, lost);
+        break;
+      }
+      default:
+        // Not in step with the records, or a newer version.
+        ok = false;
+        break;
+    }
+    for (size_t i = 0; ok && (i < len); i++) {
+      if (times && line_start) fprintf(out, "%10lu ", (unsigned long)time_us);
+      putc(text[i], out);
+      line_start = (text[i] == '\n');
+    }
+  }
+  free(formats);
+  free(strings);
+  free(text);
+  return true;
+}
+#endif  /* !ARDUINO */
+
+#if DEBUG_BINLOG_DECODE
+/*
+ * Rebuild the text of a binary log on Linux. Build with
+ *   gcc -O2 -DDEBUG_BINLOG_DECODE=1 -o binlog_decode binlog.c
+ *   ./binlog_decode -t < /dev/ttyACM0
+ * Start it before the ESP32 boots: each format is sent once, the first
+ * time it is used. -t starts each line with its time in microseconds.
+ */
+#include <unistd.h>
+
+int main(int argc, char *argv[]) {
+  bool times = false;
+  int opt;
+  while ((opt = getopt(argc, argv, "t")) != -1) {
+    if (opt != 't') {
+      fprintf(stderr, "usage: %s [-t] [log.bin]\n", argv[0]);
+      return 2;
+    }
+    times = true;
+  }
+  FILE *in = stdin;
+  if ((optind < argc) && ((in = fopen(argv[optind], "rb")) == NULL)) {
+    perror(argv[optind]);
+    return 1;
+  }
+  setvbuf(stdout, NULL, _IOLBF, 0);
+  if (!binlog_decode(in, stdout, times)) {
+    fprintf(stderr, "not a binary log\n");
+    return 1;
+  }
+  return 0;
+}
+#endif  /* DEBUG_BINLOG_DECODE */
+
+#if DEBUG_BINLOG_MAIN
+/*
+ * Build and run on Linux.
+ *   gcc -O2 -pthread -DDEBUG_BINLOG_MAIN=1 -o binlog_test binlog.c
+ *   ./binlog_test
+ * Checks the text drained on the device against snprintf, and the text
+ * decoded from the binary form against it, then measures the cost of a
+ * log call against formatting it where it is logged.
+ */
+#include <inttypes.h>
+#include <pthread.h>
+#include <sched.h>
+
+#define OUT_MAX   (1 << 22)
+
+typedef struct {
+  char *data;
+  size_t len;
+  size_t chunk;       // most bytes taken per call, 0 for no limit
+} out_t;
+
+static int Errors;
+
+static size_t out_sink(void *ctx, const uint8_t *data, size_t len) {
+  out_t *out = (out_t *)ctx;
+  if ((out->chunk != 0) && (len > out->chunk)) len = out->chunk;
+  if (len > OUT_MAX - 1 - out->len) len = OUT_MAX - 1 - out->len;
+  memcpy(&out->data[out->len], data, len);
+  out->len += len;
+  out->data[out->len] = '\0';
+  return len;
+}
+
+static void out_init(out_t *out, size_t chunk) {
+  if (out->data == NULL) out->data = (char *)malloc(OUT_MAX);
+  out->len = 0;
+  out->data[0] = '\0';
+  out->chunk = chunk;
+}
+
+static void drain_all(binlog_t *log, bool binary, out_t *out) {
+  while (binlog_drain(log, binary, out_sink, out) > 0) {}
+}
+
+// Decode the binary form in bin to text.
+static void decode(const out_t *bin, out_t *text) {
+  FILE *in = fmemopen(bin->data, bin->len, "rb");
+  FILE *out = fmemopen(text->data, OUT_MAX, "wb");
+  if (!binlog_decode(in, out, false)) {
+    printf("FAIL decode header\n");
+    Errors++;
+  }
+  text->len = ftell(out);
+  fclose(out);
+  fclose(in);
+  text->data[text->len] = '\0';
+}
+
+static void check_text(const char *what, const char *got, const char *want) {
+  if (strcmp(got, want) != 0) {
+    printf("FAIL %s:\n--- got\n%s\n--- want\n%s\n", what, got, want);
+    Errors++;
+  }
+}
+
+// The same records drained as text in chunks of chunk bytes and drained as
+// binary and decoded must both give want.
+static void log_samples(binlog_t *log) {
+  static const uint8_t map[] = { 0x05, 0x01, 0x09, 0x02, 0xA1, 0x01 };
+  int32_t negative = -1234;
+  uint32_t big = 0xDEADBEEF;
+  uint8_t small = 7;
+  BINLOG(log, "Connected\r\n");
+  BINLOG(log, "%s: peer MTU %u\n", __func__, 247);
+  BINLOG(log, "%d %i %u %x %X %o|", negative, -1, big, big, big, 8);
+  BINLOG(log, "%5d|%-5d|%05u|%c|%%\n", 42, 42, small, 'A');
+  BINLOG(log, "%" PRIu32 " %" PRIi32 " %lu %hhu %zu %p\n", big, negative,
+      (unsigned long)3000000000UL, small, (size_t)5, (void *)0x1234);
+  BINLOG(log, "%s %.3s [%8s] %s\n", "static", "truncated", "pad", NULL);
+  BINLOG(log, "%u %u %u %u %u %u %u %u\n", 1, 2, 3, 4, 5, 6, 7, 8);
+  binlog_text(log, "Connected to: ", 14);
+  const char *long_text = "a text longer than one slot holds, 0123456789 "
+    "0123456789 0123456789 0123456789\r\n";
+  binlog_text(log, long_text, strlen(long_text));
+  binlog_hex(log, map, sizeof(map));
+  binlog_text(log, "\r\n", 2);
+}
+
+static void test_samples(void) {
+  char want[1024];
+  snprintf(want, sizeof(want),
+      "Connected\r\n"
+      "log_samples: peer MTU 247\n"
+      "%d %i %u %x %X %o|%5d|%-5d|%05u|%c|%%\n"
+      "%" PRIu32 " %" PRIi32 " %lu %hhu %zu 0x%08x\n"
+      "static tru [     pad] (null)\n"
+      "1 2 3 4 5 6 7 8\n"
+      "Connected to: a text longer than one slot holds, 0123456789 "
+      "0123456789 0123456789 0123456789\r\n"
+      "05,01,09,02,A1,01,\r\n",
+      -1234, -1, 0xDEADBEEFU, 0xDEADBEEFU, 0xDEADBEEFU, 8, 42, 42, 7, 'A',
+      (uint32_t)0xDEADBEEF, (int32_t)-1234, 3000000000UL, 7, (size_t)5,
+      0x1234);
+  static binlog_slot_t slots[64];
+  static binlog_t log;
+  out_t text = {0}, bin = {0}, decoded = {0};
+  const size_t chunks[] = { 0, 7, 1 };
+  for (size_t i = 0; i < sizeof(chunks) / sizeof(chunks[0]); i++) {
+    binlog_init(&log, slots, 64);
+    log_samples(&log);
+    out_init(&text, chunks[i]);
+    drain_all(&log, false, &text);
+    check_text("text", text.data, want);
+    binlog_init(&log, slots, 64);
+    log_samples(&log);
+    out_init(&bin, chunks[i]);
+    drain_all(&log, true, &bin);
+    out_init(&decoded, 0);
+    decode(&bin, &decoded);
+    check_text("decoded", decoded.data, want);
+  }
+  free(text.data);
+  free(bin.data);
+  free(decoded.data);
+}
+
+// A full ring loses records and says how many, after the ones it kept.
+static void test_full(void) {
+  static binlog_slot_t slots[4];
+  static binlog_t log;
+  out_t text = {0};
+  binlog_init(&log, slots, 4);
+  for (unsigned i = 0; i < 6; i++) BINLOG(&log, "%u\n", i);
+  binlog_text(&log, "a text of two slots or more on any host", 40);
+  out_init(&text, 0);
+  drain_all(&log, false, &text);
+  check_text("full", text.data, "0\n1\n2\n3\nbinlog: 3 records lost\r\n");
+  BINLOG(&log, "after\n");
+  out_init(&text, 0);
+  drain_all(&log, false, &text);
+  check_text("after full", text.data, "after\n");
+  if ((log.records != 5) || (log.lost_total != 3)) {
+    printf("FAIL full: records %" PRIu32 " lost %" PRIu32 "\n", log.records,
+        log.lost_total);
+    Errors++;
+  }
+  free(text.data);
+}
+
+// More formats than there are IDs.
+static void test_format_ids(void) {
+  static char formats[BINLOG_FORMATS * 2][16];
+  static binlog_slot_t slots[256];
+  static binlog_t log;
+  out_t text = {0}, bin = {0}, decoded = {0};
+  for (size_t pass = 0; pass < 2; pass++) {
+    binlog_init(&log, slots, 256);
+    for (size_t i = 0; i < 3 * BINLOG_FORMATS; i++) {
+      size_t f = (i * 7) % (BINLOG_FORMATS * 2);
+      snprintf(formats[f], sizeof(formats[f]), "format %zu %%u\n", f);
+      BINLOG(&log, formats[f], (unsigned)i);
+    }
+    if (pass == 0) {
+      out_init(&text, 0);
+      drain_all(&log, false, &text);
+    } else {
+      out_init(&bin, 0);
+      drain_all(&log, true, &bin);
+      out_init(&decoded, 0);
+      decode(&bin, &decoded);
+      check_text("format IDs", decoded.data, text.data);
+    }
+  }
+  free(text.data);
+  free(bin.data);
+  free(decoded.data);
+}
+
+#define THREADS           (4)
+#define THREAD_RECORDS    (200000)
+
+static binlog_t Thread_Log;
+static volatile bool Producers_Done;
+
+static void *producer(void *arg) {
+  unsigned id = (unsigned)(uintptr_t)arg;
+  for (unsigned i = 0; i < THREAD_RECORDS; i++) {
+    BINLOG(&Thread_Log, "thread %u record %u\n", id, i);
+    if ((i % 64) == 63) sched_yield();
+  }
+  return NULL;
+}
+
+// Count lines per thread while checking their order.
+typedef struct {
+  char line[64];
+  size_t len;
+  unsigned next[THREADS];
+  uint32_t lines;
+} lines_t;
+
+static size_t lines_sink(void *ctx, const uint8_t *data, size_t len) {
+  lines_t *l = (lines_t *)ctx;
+  for (size_t i = 0; i < len; i++) {
+    if (l->len < sizeof(l->line) - 1) l->line[l->len++] = data[i];
+    if (data[i] != '\n') continue;
+    l->line[l->len] = '\0';
+    unsigned id, n;
+    if (sscanf(l->line, "thread %u record %u", &id, &n) == 2) {
+      if ((id >= THREADS) || (n < l->next[id])) {
+        printf("FAIL threads: %s", l->line);
+        Errors++;
+      } else {
+        l->next[id] = n + 1;
+        l->lines++;
+      }
+    } else if (strncmp(l->line, "binlog: ", 8) != 0) {
+      printf("FAIL threads: %s", l->line);
+      Errors++;
+    }
+    l->len = 0;
+  }
+  return len;
+}
+
+static void *consumer(void *arg) {
+  lines_t *l = (lines_t *)arg;
+  while (!__atomic_load_n(&Producers_Done, __ATOMIC_ACQUIRE)) {
+    binlog_drain(&Thread_Log, false, lines_sink, l);
+    sched_yield();
+  }
+  binlog_drain(&Thread_Log, false, lines_sink, l);
+  return NULL;
+}
+
+static void test_threads(void) {
+  static binlog_slot_t slots[4096];
+  static lines_t lines;
+  binlog_init(&Thread_Log, slots, 4096);
+  pthread_t threads[THREADS], drain;
+  pthread_create(&drain, NULL, consumer, &lines);
+  for (uintptr_t i = 0; i < THREADS; i++) {
+    pthread_create(&threads[i], NULL, producer, (void *)i);
+  }
+  for (size_t i = 0; i < THREADS; i++) pthread_join(threads[i], NULL);
+  __atomic_store_n(&Producers_Done, true, __ATOMIC_RELEASE);
+  pthread_join(drain, NULL);
+  if (lines.lines + Thread_Log.lost_total != THREADS * THREAD_RECORDS) {
+    printf("FAIL threads: %" PRIu32 " lines, %" PRIu32 " lost\n",
+        lines.lines, Thread_Log.lost_total);
+    Errors++;
+  }
+  printf("threads: %" PRIu32 " records, %" PRIu32 " lost\n", lines.lines,
+      Thread_Log.lost_total);
+}
+
+static uint64_t nanos(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static size_t null_sink(void *ctx, const uint8_t *data, size_t len) {
+  (void)ctx;
+  (void)data;
+  return len;
+}
+
+#define BENCH_SLOTS   (4096)
+#define BENCH_ROUNDS  (256)
+
+/*
+ * A log call against formatting the same line where it is logged, which is
+ * what Serial.printf() does before it writes to the port. The drain cost
+ * is paid by the log task.
+ */
+static void bench(void) {
+  static binlog_slot_t slots[BENCH_SLOTS];
+  static binlog_t log;
+  static char line[128];
+  uint64_t log_ns = 0, drain_text_ns = 0, drain_binary_ns = 0;
+  size_t count = (size_t)BENCH_SLOTS * BENCH_ROUNDS;
+  uint32_t interval = 7500, latency = 0, device = 1;
+  binlog_init(&log, slots, BENCH_SLOTS);
+  for (int round = 0; round < BENCH_ROUNDS; round++) {
+    uint64_t start = nanos();
+    for (size_t i = 0; i < BENCH_SLOTS; i++) {
+      BINLOG(&log, "Device %u interval %u latency %u\r\n", device, interval,
+          latency++);
+    }
+    uint64_t logged = nanos();
+    binlog_drain(&log, (round & 1) != 0, null_sink, NULL);
+    uint64_t drained = nanos();
+    log_ns += logged - start;
+    if (round & 1) {
+      drain_binary_ns += drained - logged;
+    } else {
+      drain_text_ns += drained - logged;
+    }
+  }
+  uint64_t start = nanos();
+  size_t total = 0;
+  for (size_t i = 0; i < count; i++) {
+    total += snprintf(line, sizeof(line),
+        "Device %u interval %u latency %u\r\n", device, interval, latency++);
+  }
+  uint64_t printf_ns = nanos() - start;
+  if ((log.records != count) || (log.lost_total != 0) || (total == 0)) {
+    printf("FAIL bench: records %" PRIu32 " lost %" PRIu32 "\n", log.records,
+        log.lost_total);
+    Errors++;
+  }
+  printf("ns per record, 3 arguments: log %.1f, snprintf %.1f, "
+      "drain text %.1f, drain binary %.1f\n", (double)log_ns / count,
+      (double)printf_ns / count, (double)drain_text_ns / (count / 2),
+      (double)drain_binary_ns / (count / 2));
+}
+
+int main(void) {
+  test_samples();
+  test_full();
+  test_format_ids();
+  test_threads();
+  bench();
+  printf("errors %d\n", Errors);
+  return Errors != 0;
+}
+#endif  /* DEBUG_BINLOG_MAIN */
@@ -0,0 +1,197 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2023 touchgadgetdev@gmail.com
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef _BINLOG_H_
+#define _BINLOG_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+/*
+ * Deferred debug log. BINLOG() stores a pointer to the format string and
+ * the raw arguments in a ring slot and returns; nothing is formatted or
+ * sent by the task that logs. A low priority task drains the ring, either
+ * formatting the text on the ESP32 or sending the records unformatted for
+ * binlog_decode on a PC, which rebuilds the text.
+ *
+ * Any task may log, but not an ISR. Adding a record is a compare and swap
+ * on head, a clock read, and copying the arguments. If the ring is full the
+ * record is counted lost and the drain reports how many were lost.
+ *
+ * Arguments are stored as integers: formats may use the d i u o x X c p
+ * conversions with any length modifier, and %s only for strings that live
+ * forever such as literals and __func__. Use binlog_text() for others.
+ * No floating point.
+ */
+
+#define BINLOG_ARGS         (8)
+#define BINLOG_STRING_MAX   (64)    // longest %s argument drained
+#define BINLOG_FORMATS      (64)    // binary format IDs before they restart
+#define BINLOG_OUT_MAX      (1024)
+
+enum {
+  BINLOG_FORMAT = 1,    // printf style format and arguments
+  BINLOG_TEXT,          // bytes copied from a string
+  BINLOG_HEX,           // bytes shown in hex
+};
+
+typedef struct {
+  uint32_t seq;         // index + 1 once the slot is written
+  uint32_t time_us;
+  const char *format;
+  uint8_t kind;
+  uint8_t len;          // argument count or bytes in data
+  union {
+    uintptr_t args[BINLOG_ARGS];
+    uint8_t data[BINLOG_ARGS * sizeof(uintptr_t)];
+  };
+} binlog_slot_t;
+
+/*
+ * Writes up to len bytes. Returns the number written.
+ */
+typedef size_t (*binlog_sink_fn)(void *ctx, const uint8_t *data, size_t len);
+
+typedef struct {
+  binlog_slot_t *slots;
+  uint32_t size;
+  // head is moved by the producers with compare and swap, tail only by the
+  // consumer. Free running, the slot is the counter modulo size.
+  uint32_t head __attribute__((aligned(64)));
+  uint32_t lost;        // records lost since the drain last reported it
+  uint32_t tail __attribute__((aligned(64)));
+  // Consumer only
+  uint32_t records;
+  uint32_t lost_total;
+  bool header_sent;
+  const char *formats[BINLOG_FORMATS];  // binary format IDs
+  uint32_t format_count;
+  uint8_t out[BINLOG_OUT_MAX];
+  size_t out_len;
+  size_t out_pos;
+} binlog_t;
+
+// The sketch's debug log when USB_DEBUG is set. report_desc.c logs to it
+// when USB_HID_DEBUG is set.
+extern binlog_t Debug_Log;
+
+/*
+ * Use slots, size of them, a power of 2. Records added before this are
+ * counted lost.
+ */
+bool binlog_init(binlog_t *log, binlog_slot_t *slots, size_t size);
+
+/*
+ * Add a record of format and argc arguments. Use BINLOG().
+ */
+void binlog_write(binlog_t *log, const char *format, const uintptr_t *args,
+    size_t argc);
+
+/*
+ * Add a copy of len bytes of text, in as many slots as it needs.
+ */
+void binlog_text(binlog_t *log, const char *text, size_t len);
+
+/*
+ * Add a copy of len bytes to be shown as hex.
+ */
+void binlog_hex(binlog_t *log, const void *data, size_t len);
+
+/*
+ * Consumer only. Give the records to sink, as text or binary, until the
+ * ring is empty or sink writes less than it was given. Returns the bytes
+ * written.
+ */
+size_t binlog_drain(binlog_t *log, bool binary, binlog_sink_fn sink,
+    void *ctx);
+
+/*
+ * Format as printf would, from arguments stored as uint32_t. strings[i] is
+ * used for a %s argument i. Returns the length written to out, which is
+ * always terminated.
+ */
+size_t binlog_format(char *out, size_t size, const char *format,
+    const uint32_t *args, const char *const *strings, size_t argc);
+
+// Log format and its arguments, at most BINLOG_ARGS.
+//   BINLOG(&log, "device %u connected in %u us\n", index, us);
+#define BINLOG(log, ...) do { \
+    const uintptr_t binlog_args_[] = { 0 BINLOG_CAT_(BINLOG_CAST_, \
+        BINLOG_COUNT_(__VA_ARGS__))(__VA_ARGS__) }; \
+    binlog_write((log), BINLOG_FIRST_(__VA_ARGS__, 0), &binlog_args_[1], \
+        BINLOG_COUNT_(__VA_ARGS__)); \
+  } while (0)
+
+#define BINLOG_FIRST_(format, ...) (format)
+#define BINLOG_COUNT_(...) \
+  BINLOG_NTH_(__VA_ARGS__, 8, 7, 6, 5, 4, 3, 2, 1, 0, 0)
+#define BINLOG_NTH_(f, a1, a2, a3, a4, a5, a6, a7, a8, n, ...) n
+#define BINLOG_CAT_(a, n) BINLOG_CAT2_(a, n)
+#define BINLOG_CAT2_(a, n) a##n
+#define BINLOG_CAST_0(f)
+#define BINLOG_CAST_1(f, a) , (uintptr_t)(a)
+#define BINLOG_CAST_2(f, a, ...) , (uintptr_t)(a) BINLOG_CAST_1(f, __VA_ARGS__)
+#define BINLOG_CAST_3(f, a, ...) , (uintptr_t)(a) BINLOG_CAST_2(f, __VA_ARGS__)
+#define BINLOG_CAST_4(f, a, ...) , (uintptr_t)(a) BINLOG_CAST_3(f, __VA_ARGS__)
+#define BINLOG_CAST_5(f, a, ...) , (uintptr_t)(a) BINLOG_CAST_4(f, __VA_ARGS__)
+#define BINLOG_CAST_6(f, a, ...) , (uintptr_t)(a) BINLOG_CAST_5(f, __VA_ARGS__)
+#define BINLOG_CAST_7(f, a, ...) , (uintptr_t)(a) BINLOG_CAST_6(f, __VA_ARGS__)
+#define BINLOG_CAST_8(f, a, ...) , (uintptr_t)(a) BINLOG_CAST_7(f, __VA_ARGS__)
+
+/*
+ * Binary form, version 1, for binlog_decode. Values are little endian.
+ *   header  "BMXL", version, 3 bytes 0
+ *   BINLOG_WIRE_DEFINE  id, len, len bytes of format
+ *   BINLOG_WIRE_FORMAT  id, time_us (4 bytes), argc, then each argument as
+ *                       4 bytes, or for %s as len and len bytes
+ *   BINLOG_WIRE_TEXT    time_us, len, len bytes
+ *   BINLOG_WIRE_HEX     time_us, len, len bytes
+ *   BINLOG_WIRE_LOST    count (4 bytes)
+ * A format is defined the first time it is sent. When BINLOG_FORMATS IDs
+ * are used they restart at 0 and are defined again.
+ */
+#define BINLOG_MAGIC        "BMXL"
+#define BINLOG_VERSION      (1)
+
+enum {
+  BINLOG_WIRE_DEFINE = 1,
+  BINLOG_WIRE_FORMAT,
+  BINLOG_WIRE_TEXT,
+  BINLOG_WIRE_HEX,
+  BINLOG_WIRE_LOST,
+};
+
+#if !defined(ARDUINO)
+#include <stdio.h>
+
+/*
+ * Read the binary form from in to its end and write the text to out. With
+ * times each line starts with the time_us of its first record. Returns
+ * false if in does not start with the header.
+ */
+bool binlog_decode(FILE *in, FILE *out, bool times);
+#endif
+
+#endif  /* _BINLOG_H_ */
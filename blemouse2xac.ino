@@ -30,6 +30,13 @@
 #define DUMP_REPORT_MAP 0
 #define DEV_INFO_SERVICE 0    // BLE device information
 
+// Which core each task runs on, see Task_Topologies.
+#define TOPOLOGY_SHARED 0
+#define TOPOLOGY_SPLIT  1
+#ifndef TASK_TOPOLOGY
+#define TASK_TOPOLOGY TOPOLOGY_SPLIT
+#endif
+
 // Set to 0 to remove the CDC ACM serial port but XAC seems to tolerate it
 // so it is on by default. Set to 0 if it causes problems. Disabling the
 // CDC port means you must press button(s) on the ESP32S3 to put in bootloader
@@ -37,17 +44,22 @@
 #define USB_DEBUG 0
 
 #if USB_DEBUG
-#define DBG_begin(...)    Serial.begin(__VA_ARGS__)
+// Debug output is logged to a RAM ring and written to the CDC serial port
+// by a task at idle priority, so printing does not change the timing being
+// debugged. See binlog.h and LOG_BINARY.
+#define DBG_begin(...)    log_begin(__VA_ARGS__)
 #define DBG_end(...)      Serial.end(__VA_ARGS__)
-#define DBG_print(...)    Serial.print(__VA_ARGS__)
-#define DBG_println(...)  Serial.println(__VA_ARGS__)
-#define DBG_printf(...)   Serial.printf(__VA_ARGS__)
+#define DBG_print(...)    dbg_print(__VA_ARGS__)
+#define DBG_println(...)  dbg_println(__VA_ARGS__)
+#define DBG_printf(...)   BINLOG(&Debug_Log, __VA_ARGS__)
+#define DBG_hex(...)      binlog_hex(&Debug_Log, __VA_ARGS__)
 #else
 #define DBG_begin(...)
 #define DBG_end(...)
 #define DBG_print(...)
 #define DBG_println(...)
 #define DBG_printf(...)
+#define DBG_hex(...)
 #endif
 
 #include <esp_wifi.h>
@@ -58,11 +70,7 @@
 #include <M5GFX.h>      // https://github.com/m5stack/M5GFX
 /* M5Stack AtomS3 display, RGB LED, button */
 M5GFX display;
-#define TFT_print(...)   do { clrscr(); display.print(__VA_ARGS__); } while (0)
-#define TFT_println(...) do { clrscr(); display.println(__VA_ARGS__); } while (0)
-#define TFT_printf(...)  do { clrscr(); display.printf(__VA_ARGS__); } while (0)
-#define TFT_color(foreground, background)  display.setTextColor(foreground, background)
-#define RGBLed(color)    do { RGBled = color; FastLED.show(); } while (0)
+#define RGBLed(color)    status_set_led(&Status, (uint32_t)(color))
 
 static const int LED_DI_PIN = 35;
 CRGB RGBled;
@@ -70,7 +78,7 @@ CRGB RGBled;
 static const int BTN_PIN = 41;
 OneButton button(BTN_PIN, true);
 
-static const int TEXT_SIZE = 3;
+static const int TEXT_SIZE = 2;
 
 #elif defined(ARDUINO_LILYGO_T_DISPLAY_S3)
 #include "pin_config.h"
@@ -81,51 +89,225 @@ static const int TEXT_SIZE = 3;
 TFT_eSPI tft = TFT_eSPI();
 CRGB RGBled;
 OneButton button(BTN_PIN, true);
-#define TFT_print(...)   do { clrscr(); tft.print(__VA_ARGS__); } while (0)
-#define TFT_println(...) do { clrscr(); tft.println(__VA_ARGS__); } while (0)
-#define TFT_printf(...)  do { clrscr(); tft.printf(__VA_ARGS__); } while (0)
-#define TFT_color(foreground, background)  tft.setTextColor(foreground, background)
-#define RGBLed(color)    do { RGBled = color; FastLED.show(); } while (0)
+#define RGBLed(color)    status_set_led(&Status, (uint32_t)(color))
+
+static const int TEXT_SIZE = 2;
 #else   // No display
-#define TFT_print(...)
-#define TFT_println(...)
-#define TFT_printf(...)
-#define TFT_color(...)
 #define RGBLed(...)
 #endif
 
+#include <LittleFS.h>
 #include "USB.h"
+#include "USBHID.h"
 #include "ESP32_flight_stick.h"
 ESP32_flight_stick FSJoy;
+// Shares the HID interface with FSJoy. Only used for ready().
+USBHID HID_Endpoint;
+
+extern "C" {
+#include "./report_desc.h"
+#include "./layout_cache.h"
+#include "./gatt_cache.h"
+#include "./report_queue.h"
+#include "./motion.h"
+#include "./bridge_os.h"
+#include "./bridge.h"
+#include "./conn_policy.h"
+#include "./scan_policy.h"
+#include "./usb_out.h"
+#include "./device_profile.h"
+#include "./capture.h"
+#include "./binlog.h"
+#include "./status_display.h"
+}
 
+// What the display and RGB LED show. Updated with plain stores and drawn
+// by status_task().
+static status_model_t Status;
+
+// Where the tasks run. TOPOLOGY_SHARED lets FreeRTOS put every task on
+// either core. TOPOLOGY_SPLIT leaves core 0 to the NimBLE host, which calls
+// notifyCB(), and gives core 1 to the bridge task, which decodes, maps and
+// calls FSJoy.write(), at a priority nothing else on core 1 has. Reports
+// cross between the cores in Report_Queue, which takes no lock. The
+// connect, log, status and capture tasks run at low priority on core 0 in
+// the time the NimBLE host leaves, so scanning and connecting never run
+// on core 1. loop() deletes itself so it does not use core 1.
 typedef struct {
-  uint8_t report[32];
-  size_t report_len;
-  uint32_t last_millis = 0;
-  FSJoystick_Report_t joyRpt;
-  int16_t xmin = SCHAR_MIN;
-  int16_t xmax = SCHAR_MAX;
-  int16_t ymin = SCHAR_MIN;
-  int16_t ymax = SCHAR_MAX;
-  bool isNotify;
-  bool available;
-  bool isJellyComb;
-} Mouse_xfer_state_t;
+  const char *name;
+  int ble_core;           // where the NimBLE host runs, set by the library
+  int bridge_core;
+  int ui_core;            // connect, log, status and capture tasks
+  uint32_t bridge_priority;
+} task_topology_t;
+
+static const task_topology_t Task_Topologies[] = {
+  { "shared", BRIDGE_CORE_ANY, BRIDGE_CORE_ANY, BRIDGE_CORE_ANY, 5 },
+  // Above every task on core 1 but the ESP-IDF system tasks.
+  { "split", 0, 1, 0, 20 },
+};
+static const task_topology_t *Topology = &Task_Topologies[TASK_TOPOLOGY];
 
-volatile Mouse_xfer_state_t Mouse_xfer;
+#if USB_DEBUG
+// true sends the debug log unformatted, which is cheaper again for the log
+// task. Rebuild the text on a PC with binlog_decode.
+static const bool LOG_BINARY = false;
+static const size_t LOG_SLOTS = 256;              // power of 2
+static const uint32_t LOG_DRAIN_MS = 20;
+static const uint32_t LOG_TASK_STACK = 4096;
+static const uint32_t LOG_TASK_PRIORITY = 0;      // idle
+static binlog_slot_t Log_Slots[LOG_SLOTS];
+binlog_t Debug_Log;
+
+// Serial.print() and println() for the debug log. Text is copied because
+// it may not outlive the call.
+static inline void dbg_print(const char *s)
+{
+  binlog_text(&Debug_Log, s, strlen(s));
+}
+static inline void dbg_print(char c) { binlog_text(&Debug_Log, &c, 1); }
+static inline void dbg_print(long v, int base = 10)
+{
+  if (base == 16) DBG_printf("%lX", v); else DBG_printf("%ld", v);
+}
+static inline void dbg_print(unsigned long v, int base = 10)
+{
+  if (base == 16) DBG_printf("%lX", v); else DBG_printf("%lu", v);
+}
+static inline void dbg_print(int v, int base = 10)
+{
+  dbg_print((long)v, base);
+}
+static inline void dbg_print(unsigned int v, int base = 10)
+{
+  dbg_print((unsigned long)v, base);
+}
+static inline void dbg_println() { dbg_print("\r\n"); }
+template <typename T> static inline void dbg_println(T v)
+{
+  dbg_print(v);
+  dbg_println();
+}
 
-extern "C" {
-#include "./report_desc.h"
+static size_t log_sink(void *ctx, const uint8_t *data, size_t len)
+{
+  return Serial.write(data, len);
+}
+
+static void log_task(void *arg)
+{
+  for (;;) {
+    binlog_drain(&Debug_Log, LOG_BINARY, log_sink, nullptr);
+    delay(LOG_DRAIN_MS);
+  }
 }
 
-const uint16_t JellyComb_VID = 0x1915;
-const uint16_t JellyComb_PID = 0x0040;
-const uint16_t VRFortune_VID = 0x07d7;
-const uint16_t VRFortune_PID = 0x0000;
+static void log_begin(unsigned long baud)
+{
+  Serial.begin(baud);
+  binlog_init(&Debug_Log, Log_Slots, LOG_SLOTS);
+  bridge_task_start_on(log_task, nullptr, "log", LOG_TASK_STACK,
+      LOG_TASK_PRIORITY, Topology->ui_core);
+}
+#endif
+
+// The bridge task sleeps until one of these is signaled. It handles
+// reports, the idle timeout, and the connection parameter policy. Its core and priority are in Topology.
+static const uint32_t BRIDGE_TASK_STACK = 8192;
+
+// Scanning and connecting run in the connect task, below the bridge task.
+// A connect blocks for many ATT round trips, and write_cccd() for up to
+// 2 s, while the bridge task keeps handling the reports of the devices
+// already connected. The connect task sleeps until one of these is
+// signaled in Connect_Events.
+#define CONNECT_EVENT_ADV     (1u << 0)   // a HID device advertised
+#define CONNECT_EVENT_SCAN    (1u << 1)   // time to run the scan policy
+#define CONNECT_EVENT_STALE   (1u << 2)   // Service Changed received
+#define CONNECT_EVENT_LOST    (1u << 3)   // the bridge task released a device
+static const uint32_t CONNECT_TASK_STACK = 8192;
+static const uint32_t CONNECT_TASK_PRIORITY = 2;  // below the bridge task
+
+// Joystick button of button 1 of each device, 0 based. Buttons of all
+// connected devices are ORed so devices not listed here use 0: button 1 of
+// every device is joystick button 1. The joystick has 16 buttons. For
+// example, put a clicker on joystick buttons 9..16 next to a trackball on
+// buttons 1..8 by adding its address as printed by the scan.
+typedef struct {
+  const char *address;
+  uint8_t button_offset;
+} device_config_t;
+
+static const device_config_t Device_Config[] = {
+  // { "aa:bb:cc:dd:ee:ff", 8 },
+  { nullptr, 0 },
+};
+
+// Mouse motion to joystick deflection. See curve.h. CURVE_RATE moves the
+// stick in proportion to mouse speed, like the original auto-ranging.
+// CURVE_INTEGRATE moves the stick by the mouse motion and lets it drift
+// back to center.
+static const curve_config_t Curve_Config = {
+  CURVE_RATE,
+  256,      // gain, 256 is 1.0
+  0,        // deadzone, counts per USB frame
+  0,        // expo, 0 linear .. 255 cubic
+  0,        // S-curve, 0 none .. 255 smoothstep
+  127,      // counts per USB frame (integrate: total) for full deflection
+  true,     // auto range: grow the range on fast motion
+  2000,     // auto range half life back to the range, ms
+  150,      // integrate: time constant to return to center, ms
+};
+
+// Switch mice to boot protocol when their layout is already known, from
+// the layout cache, a profile, or an earlier connection, and the boot
+// report carries it: at most 3 buttons and 8 bit X, Y. Reports then use a
+// fixed decoder. A device seen for the first time uses report protocol so
+// its report map is read. The wheel and pan a mouse may have are dropped
+// on purpose; the joystick has no axes for them, see
+// hid_layout_boot_compatible().
+static bool Boot_Protocol = false;
+
+// Record every notification with the report maps for capture_replay on a
+// PC, see capture.h. CAPTURE_CDC writes the capture to the USB CDC serial
+// port: set "USB CDC On Boot" to "Enabled" and USB_DEBUG to 0 so no debug
+// text is mixed in. CAPTURE_FLASH writes it to capture.bin in the LittleFS
+// partition, replacing the capture of the last boot. While capturing the
+// layout cache is not used so every report map is read and recorded.
+enum { CAPTURE_OFF, CAPTURE_CDC, CAPTURE_FLASH };
+static uint8_t Capture_To = CAPTURE_OFF;
+static const size_t CAPTURE_RING_SIZE = 16384;    // power of 2
+static const uint32_t CAPTURE_DRAIN_MS = 50;
+static const uint32_t CAPTURE_TASK_STACK = 4096;
+static const uint32_t CAPTURE_TASK_PRIORITY = 1;  // below the bridge task
+static capture_t Capture;
+static bool Capture_On = false;
+static File Capture_File;
+
+// HID reports from the NimBLE host task to the bridge task
+report_queue_t Report_Queue;
+static bridge_events_t Bridge_Events;
+static bridge_t Bridge;
+static bridge_events_t Connect_Events;
+// Joystick reports to the USB endpoint, one per frame, no duplicates
+static usb_out_t Usb_Out;
+static bridge_timer_t Usb_Timer;
+
+// Reports lost because Report_Queue was full, and its deepest backlog,
+// are counted in Report_Queue.dropped and Report_Queue.high_water.
+typedef struct {
+  FSJoystick_Report_t joyRpt;
+} Mouse_xfer_state_t;
+
+Mouse_xfer_state_t Mouse_xfer;
 
 // Install NimBLE-Arduino by h2zero using the IDE library manager.
 #include <NimBLEDevice.h>
 
+#if (TASK_TOPOLOGY == TOPOLOGY_SPLIT) && \
+  defined(CONFIG_BT_NIMBLE_PINNED_TO_CORE) && (CONFIG_BT_NIMBLE_PINNED_TO_CORE != 0)
+#error "TOPOLOGY_SPLIT expects the NimBLE host on core 0"
+#endif
+
 const uint16_t APPEARANCE_HID_GENERIC = 0x3C0;
 const uint16_t APPEARANCE_HID_KEYBOARD = 0x3C1;
 const uint16_t APPEARANCE_HID_MOUSE   = 0x3C2;
@@ -155,24 +337,257 @@ const char HID_REPORT_DATA[] = "2A4D";
 const char HID_PROTOCOL_MODE[] = "2A4E";
 const char HID_BOOT_KEYBOARD_OUTPUT_REPORT[] = "2A32";
 const char HID_BOOT_MOUSE_INPUT_REPORT[] = "2A33";
+const char HID_REPORT_REFERENCE[] = "2908";
+const char CCCD_DESCRIPTOR[] = "2902";
+const char GATT_SERVICE[] = "1801";
+const char GATT_SERVICE_CHANGED[] = "2A05";
+
+// Report Reference descriptor report types
+const uint8_t HID_REPORT_TYPE_INPUT = 1;
+
+// Parsed layouts of bonded devices saved in NVS so the report map is not
+// read again after a reboot.
+static nv_store_t Layout_Store;
+static bool Layout_Store_OK = false;
+
+static const size_t HANDLE_MAP_SIZE = 64;
+
+// Layout of HID_BOOT_MOUSE_INPUT_REPORT
+static hid_layout_t Boot_Layout;
+
+/** One BLE HID device. Up to NIMBLE_MAX_CONNECTIONS are connected at once
+ *  and merged into one joystick by the bridge. The index in Devices[] is
+ *  the device number in report queue entries. A slot keeps the address and
+ *  layout of its device after a disconnect so the device can reconnect
+ *  without reading the report map again.
+ */
+typedef struct {
+  NimBLEAddress address;
+  // Connected or connecting. Set and cleared by the connect task.
+  bool in_use;
+  // Set by the connect task once connected and subscribed. Then the bridge
+  // task runs the connection policy. When the link is lost it releases
+  // the buttons, clears active, and sets released for the connect task to
+  // free the slot.
+  volatile bool active;
+  volatile bool released;
+  bool policy_on;               // bridge task
+  // Connection handle or BLE_HS_CONN_HANDLE_NONE. Set by onConnect() and
+  // onDisconnect() in the NimBLE host task.
+  volatile uint16_t conn;
+  // Parsed report layouts. A new descriptor is parsed into the buffer not
+  // in use then published so reports queued with the old layout stay valid.
+  hid_layout_t layouts[2];
+  const hid_layout_t *layout;
+  // HID_REPORT_DATA characteristic handle to mouse report layout. Indexed
+  // by handle - handle_map_base so notifyCB finds the layout with one
+  // lookup. NULL means the report is not from a mouse.
+  uint16_t handle_map_base;
+  const hid_report_layout_t *handle_map[HANDLE_MAP_SIZE];
+  // HID service handles. Saved for bonded devices so the next connection
+  // after a reboot writes the CCCDs without discovery.
+  gatt_cache_entry_t gatt;
+  // Connected using cached handles. Notifications come from gapEventCB()
+  // because NimBLEClient has not discovered the characteristics.
+  bool fast_path;
+  // In boot protocol. Only used when layout is known and boot protocol
+  // carries all of it.
+  bool boot;
+  // The device indicated Service Changed. CONNECT_EVENT_STALE makes the
+  // connect task drop the cached handles and layout and reconnect with
+  // full discovery.
+  volatile bool stale;
+  // Connection parameters. Runs in the bridge task.
+  conn_policy_t policy;
+  volatile bool conn_updated;
+  volatile int conn_update_status;
+  uint32_t reports_seen;        // Bridge.devices[].reports given to policy
+  volatile uint32_t lost_us;    // onDisconnect() time
+  connect_timing_t timing;
+  uint32_t timing_shown;        // timing.connect_start printed
+} hid_device_t;
+
+static_assert(NIMBLE_MAX_CONNECTIONS <= BRIDGE_DEVICES_MAX,
+    "the bridge merges at most BRIDGE_DEVICES_MAX devices");
+static hid_device_t Devices[NIMBLE_MAX_CONNECTIONS];
+
+/** Device with connection handle conn or nullptr. */
+static hid_device_t *device_by_conn(uint16_t conn)
+{
+  if (conn == BLE_HS_CONN_HANDLE_NONE) return nullptr;
+  for (auto &dev: Devices) {
+    if (dev.in_use && (dev.conn == conn)) return &dev;
+  }
+  return nullptr;
+}
+
+static uint8_t device_index(const hid_device_t *dev)
+{
+  return (uint8_t)(dev - Devices);
+}
+
+static size_t devices_in_use()
+{
+  size_t count = 0;
+  for (auto &dev: Devices) {
+    if (dev.in_use) count++;
+  }
+  return count;
+}
+
+/** Slot for a device to connect: the one it used before, else an unused
+ *  one, preferring slots never used. nullptr if all are in use.
+ */
+static hid_device_t *device_slot_for(const NimBLEAddress &address)
+{
+  hid_device_t *slot = nullptr;
+  for (auto &dev: Devices) {
+    if (dev.in_use) continue;
+    if ((dev.layout != nullptr) && (dev.address == address)) return &dev;
+    if ((slot == nullptr) ||
+        ((slot->layout != nullptr) && (dev.layout == nullptr))) {
+      slot = &dev;
+    }
+  }
+  return slot;
+}
+
+/** Record an event of dev if capturing. */
+static void capture_event(const hid_device_t *dev, uint8_t type,
+    uint16_t handle, const void *data, size_t len)
+{
+  if (Capture_On) {
+    capture_record(&Capture, type, device_index(dev), handle, micros(), data,
+        len);
+  }
+}
+
+/** Record that notifications on handle are decoded with the report layout
+ *  of report_id, or the boot layout. Handle 0 clears the handle map.
+ */
+static void capture_handle(const hid_device_t *dev, uint16_t handle,
+    uint8_t report_id, uint8_t flags)
+{
+  const uint8_t data[2] = { report_id, flags };
+  capture_event(dev, CAPTURE_HANDLE, handle, data, sizeof(data));
+}
+
+/** Button offset for address from Device_Config. */
+static uint8_t button_offset_for(const NimBLEAddress &address)
+{
+  std::string name = address.toString();
+  for (const auto &cfg: Device_Config) {
+    if (cfg.address && (name == cfg.address)) return cfg.button_offset;
+  }
+  return 0;
+}
 
 void scanEndedCB(NimBLEScanResults results);
 
-static NimBLEAdvertisedDevice* advDevice;
+// Finds devices to connect. Runs in the connect task.
+static scan_policy_t Scan_Policy;
+static bridge_timer_t Scan_Timer;
+// Seen while the scan policy waits for a device that disconnected
+static NimBLEAddress Held_Address;
+
+/** HID device advertisements from onResult() in the NimBLE host task to
+ *  the connect task. One producer, one consumer.
+ */
+typedef struct {
+  NimBLEAddress address;
+  bool bonded;
+} adv_seen_t;
+
+static const uint32_t ADV_SEEN_MAX = 8;
+static adv_seen_t Adv_Seen[ADV_SEEN_MAX];
+static uint32_t Adv_Seen_Head;      // written by onResult()
+static uint32_t Adv_Seen_Tail;      // written by the connect task
+
+static void adv_seen_push(const NimBLEAddress &address, bool bonded)
+{
+  uint32_t head = Adv_Seen_Head;
+  if ((head - __atomic_load_n(&Adv_Seen_Tail, __ATOMIC_ACQUIRE)) >= ADV_SEEN_MAX) {
+    return;
+  }
+  Adv_Seen[head % ADV_SEEN_MAX].address = address;
+  Adv_Seen[head % ADV_SEEN_MAX].bonded = bonded;
+  __atomic_store_n(&Adv_Seen_Head, head + 1, __ATOMIC_RELEASE);
+}
+
+static bool adv_seen_pop(adv_seen_t *seen)
+{
+  uint32_t tail = Adv_Seen_Tail;
+  if (tail == __atomic_load_n(&Adv_Seen_Head, __ATOMIC_ACQUIRE)) return false;
+  *seen = Adv_Seen[tail % ADV_SEEN_MAX];
+  __atomic_store_n(&Adv_Seen_Tail, tail + 1, __ATOMIC_RELEASE);
+  return true;
+}
 
-static bool doConnect = false;
 static uint32_t scanTime = 0; /** 0 = scan forever */
 
+#if defined(ARDUINO_LILYGO_T_DISPLAY_S3) || defined(ARDUINO_M5Stack_ATOMS3)
+// The display is redrawn by a task below the bridge task, at most every
+// STATUS_FRAME_MS and only where it changed. Text is in the 6x8 font
+// scaled by TEXT_SIZE, one status_display cell per character. The same
+// task polls the board button every BUTTON_POLL_MS and runs its callbacks,
+// so erasing the bonds or restarting never holds up the bridge task.
+static const uint32_t STATUS_FRAME_MS = 100;
+static const uint32_t BUTTON_POLL_MS = 10;
+static const uint32_t STATUS_TASK_STACK = 4096;
+static const uint32_t STATUS_TASK_PRIORITY = 1;   // below the bridge task
+static const int CELL_W = 6 * TEXT_SIZE;
+static const int CELL_H = 8 * TEXT_SIZE;
+static status_display_t Status_Display;
+
+/** status_draw_fn for the board's display. */
+static void status_draw(void *ctx, uint8_t row, uint8_t col, const char *text,
+    size_t len, uint16_t color)
+{
+  char buf[STATUS_COLS_MAX + 1];
+  memcpy(buf, text, len);
+  buf[len] = '\0';
 #if defined(ARDUINO_M5Stack_ATOMS3)
-void clrscr() {
-  display.clear(TFT_BLACK);
-  // Set "cursor" at top left corner of display (0,0) and select font 2
-  // (cursor will move to next line automatically during printing with 'display.println'
-  //  or stay on the line is there is room for the text with display.print)
-  display.setCursor(0, 0);
-  display.setTextSize(TEXT_SIZE);
+  display.setTextColor(color, TFT_BLACK);
+  display.drawString(buf, col * CELL_W, row * CELL_H);
+#else
+  tft.setTextColor(color, TFT_BLACK);
+  tft.drawString(buf, col * CELL_W, row * CELL_H, 1);
+#endif
+}
+
+/** status_led_fn for the RGB LED. */
+static void status_led(void *ctx, uint32_t rgb)
+{
+  RGBled = CRGB(rgb);
+  FastLED.show();
+}
+
+static void status_task(void *arg)
+{
+  uint32_t drawn = millis() - STATUS_FRAME_MS;
+  for (;;) {
+    button.tick();
+    if ((millis() - drawn) >= STATUS_FRAME_MS) {
+      drawn = millis();
+      status_display_render(&Status_Display, &Status, micros());
+    }
+    delay(BUTTON_POLL_MS);
+  }
 }
 
+/** Start drawing Status on the cleared display, width x height pixels. */
+static void status_start(int width, int height)
+{
+  status_display_init(&Status_Display, height / CELL_H, width / CELL_W,
+      status_draw, status_led, nullptr);
+  if (!bridge_task_start_on(status_task, nullptr, "status", STATUS_TASK_STACK,
+        STATUS_TASK_PRIORITY, Topology->ui_core)) {
+    DBG_println("Status task start failed");
+  }
+}
+#endif
+
+#if defined(ARDUINO_M5Stack_ATOMS3)
 void setup_m5_display() {
   display.begin();
 
@@ -186,10 +601,9 @@ void setup_m5_display() {
   }
 
   display.setColorDepth(8);
-  display.setTextWrap(true);
+  display.setTextWrap(false);
   display.setTextSize(TEXT_SIZE);
-  display.setTextColor(TFT_WHITE, TFT_BLACK);
-  TFT_print("BLE Mouse XAC");
+  display.clear(TFT_BLACK);
 }
 
 void setup_m5stack_atoms3() {
@@ -197,34 +611,24 @@ void setup_m5stack_atoms3() {
   FastLED.addLeds<WS2812, LED_DI_PIN, GRB>(&RGBled, 1);
   RGBLed(CRGB::Black);
   setup_m5_display();
-  display.setTextColor(TFT_YELLOW, TFT_BLACK);
+  status_start(display.width(), display.height());
 }
 #elif defined(ARDUINO_LILYGO_T_DISPLAY_S3)
-void clrscr() {
-  tft.fillScreen(TFT_BLACK);
-  // Set "cursor" at top left corner of display (0,0) and select font 2
-  // (cursor will move to next line automatically during printing with 'tft.println'
-  //  or stay on the line is there is room for the text with tft.print)
-  tft.setCursor(0, 0, 2);
-  // Set the font colour to be white with a black background, set text size multiplier to 1
-  tft.setTextColor(TFT_WHITE, TFT_BLACK);
-  tft.setTextSize(2);
-}
-
 void setup_t_dongle_s3() {
   pinMode(TFT_LEDA_PIN, OUTPUT);
   // Initialise TFT
   tft.init();
   tft.setRotation(1);
   tft.fillScreen(TFT_BLACK);
+  tft.setTextSize(TEXT_SIZE);
   // Turn on backlight
   digitalWrite(TFT_LEDA_PIN, 0);
-  TFT_print("BLE Mouse to XAC Joy");
 
   // Init RGB LED off. BGR ordering is typical
   FastLED.addLeds<APA102, LED_DI_PIN, LED_CI_PIN, BGR>(&RGBled, 1);
   FastLED.setBrightness(64);
   RGBLed(CRGB::Black);
+  status_start(tft.width(), tft.height());
 }
 #endif
 
@@ -233,24 +637,34 @@ void setup_t_dongle_s3() {
 class ClientCallbacks : public NimBLEClientCallbacks {
   void onConnect(NimBLEClient* pClient) {
     DBG_println("Connected");
-    TFT_println("Connected");
-    /** After connection we should change the parameters if we don't need fast response times.
-     *  These settings are 150ms interval, 0 latency, 450ms timout.
-     *  Timeout should be a multiple of the interval, minimum is 100ms.
-     *  I find a multiple of 3-5 * the interval works best for quick response/reconnect.
-     *  Min interval: 120 * 1.25ms = 150, Max interval: 120 * 1.25ms = 150, 0 latency, 60 * 10ms = 600ms timeout
+    status_set_state(&Status, STATUS_CONNECTED);
+    // connectToServer() claimed a slot for the address. Set conn now so
+    // parameter requests during connect reach the device's policy.
+    for (auto &dev: Devices) {
+      if (dev.in_use && (dev.conn == BLE_HS_CONN_HANDLE_NONE) &&
+          (dev.address == pClient->getPeerAddress())) {
+        dev.conn = pClient->getConnId();
+      }
+    }
+    /** The connection parameters are set by the device's policy once the reports
+     *  are subscribed. A mouse needs the shortest interval while it moves.
      */
-    pClient->updateConnParams(120,120,0,60);
     DBG_printf("%s: peer MTU %u\n", __func__, pClient->getMTU());
   };
 
   void onDisconnect(NimBLEClient* pClient) {
+    hid_device_t *dev = device_by_conn(pClient->getConnId());
+    if (dev) {
+      // The bridge task releases the device's buttons, then the connect
+      // task frees its slot and scans for it.
+      dev->lost_us = micros();
+      dev->conn = BLE_HS_CONN_HANDLE_NONE;
+      bridge_events_signal(&Bridge_Events, BRIDGE_EVENT_CONN);
+    }
     DBG_print(pClient->getPeerAddress().toString().c_str());
     DBG_println(" Disconnected - Starting scan");
-    TFT_color(TFT_YELLOW, TFT_BLACK);
-    TFT_print("Disconnect\nScanning");
+    status_set_state(&Status, STATUS_DISCONNECTED);
     RGBLed(CRGB::Yellow);
-    NimBLEDevice::getScan()->start(scanTime, scanEndedCB);
   };
 
   /** Called when the peripheral requests a change to the connection parameters.
@@ -259,8 +673,14 @@ class ClientCallbacks : public NimBLEClientCallbacks {
    */
   bool onConnParamsUpdateRequest(NimBLEClient* pClient, const ble_gap_upd_params* params) {
     // Failing to accepts parameters may result in the remote device
-    // disconnecting.
-    return true;
+    // disconnecting. The policy accepts but remembers the peer's minimum.
+    hid_device_t *dev = device_by_conn(pClient->getConnId());
+    if (dev == nullptr) return true;
+    conn_params_t proposed = {
+      params->itvl_min, params->itvl_max, params->latency,
+      params->supervision_timeout
+    };
+    return conn_policy_peer_request(&dev->policy, &proposed);
   };
 
   /********************* Security handled here **********************
@@ -298,35 +718,98 @@ class AdvertisedDeviceCallbacks: public NimBLEAdvertisedDeviceCallbacks {
         (advType == BLE_HCI_ADV_TYPE_ADV_DIRECT_IND_LD) ||
         (advertisedDevice->haveServiceUUID() && advertisedDevice->isAdvertisingService(NimBLEUUID(HID_SERVICE))))
     {
+      // Already connected. Directed advertising may still be seen.
+      NimBLEClient* pClient =
+        NimBLEDevice::getClientByPeerAddress(advertisedDevice->getAddress());
+      if (pClient && pClient->isConnected()) return;
       DBG_printf("onResult: AdvType= %d\r\n", advType);
       DBG_print("Advertised HID Device found: ");
       DBG_println(advertisedDevice->toString().c_str());
 
-      /** stop scan before connecting */
-      NimBLEDevice::getScan()->stop();
-      /** Save the device reference in a global for the client to use*/
-      advDevice = advertisedDevice;
-      /** Ready to connect now */
-      doConnect = true;
+      /** The scan policy in the connect task decides whether to connect */
+      NimBLEAddress address = advertisedDevice->getAddress();
+      adv_seen_push(address, NimBLEDevice::isBonded(address));
+      bridge_events_signal(&Connect_Events, CONNECT_EVENT_ADV);
     }
   };
 };
 
+/** Pass a HID report from the characteristic with handle on the
+ *  connection of dev to the bridge task and wake it. Never blocks. If the
+ *  bridge task is so far behind the queue is full the report is counted in
+ *  Report_Queue.dropped.
+ */
+static void handle_report(hid_device_t *dev, uint16_t handle,
+    const uint8_t* pData, size_t length) {
+  uint32_t now = micros();
+  if (dev->timing.first_report == 0) dev->timing.first_report = now;
+  status_report(&Status);
+  if (Capture_On) {
+    capture_record(&Capture, CAPTURE_REPORT, device_index(dev), handle, now,
+        pData, length);
+  }
+  uint16_t slot = handle - dev->handle_map_base;
+  const hid_report_layout_t *layout =
+    (slot < HANDLE_MAP_SIZE) ? dev->handle_map[slot] : nullptr;
+  if (layout == nullptr) {
+    // Keyboard, consumer control, etc.
+    return;
+  }
+  report_queue_push(&Report_Queue, now, device_index(dev), layout, handle,
+      pData, length);
+  bridge_events_signal(&Bridge_Events, BRIDGE_EVENT_REPORT);
+}
+
+/** Device of a subscribed characteristic. */
+static hid_device_t *device_of(NimBLERemoteCharacteristic* pRemoteCharacteristic) {
+  return device_by_conn(
+      pRemoteCharacteristic->getRemoteService()->getClient()->getConnId());
+}
+
 /** Notification / Indication receiving handler callback */
 // Notification from 4c:75:25:xx:yy:zz: Service = 0x1812, Characteristic = 0x2a4d, Value = 1,0,0,0,0,
 void notifyCB(NimBLERemoteCharacteristic* pRemoteCharacteristic,
     uint8_t* pData, size_t length, bool isNotify) {
-  if (Mouse_xfer.available) {
-    static uint32_t dropped = 0;
-    printf("drops=%u\r\n", ++dropped);
-  } else {
-    // DBG_println(pRemoteCharacteristic->toString().c_str());
-    Mouse_xfer.isNotify = isNotify;
-    Mouse_xfer.report_len = length;
-    memcpy((void *)Mouse_xfer.report, pData, min(length, sizeof(Mouse_xfer.report)));
-    Mouse_xfer.available = true;
-    Mouse_xfer.last_millis = millis();
+  hid_device_t *dev = device_of(pRemoteCharacteristic);
+  if (dev) handle_report(dev, pRemoteCharacteristic->getHandle(), pData, length);
+}
+
+/** Service Changed indication. The cached handles and layout are stale. */
+void serviceChangedCB(NimBLERemoteCharacteristic* pRemoteCharacteristic,
+    uint8_t* pData, size_t length, bool isNotify) {
+  hid_device_t *dev = device_of(pRemoteCharacteristic);
+  if (dev == nullptr) return;
+  dev->stale = true;
+  bridge_events_signal(&Connect_Events, CONNECT_EVENT_STALE);
+}
+
+/** Sees all GAP events. Used for notifications on the fast path connection
+ *  where NimBLEClient does not know the characteristics.
+ */
+static int gapEventCB(struct ble_gap_event *event, void *arg) {
+  if (event->type == BLE_GAP_EVENT_CONN_UPDATE) {
+    hid_device_t *dev = device_by_conn(event->conn_update.conn_handle);
+    if (dev) {
+      dev->conn_update_status = event->conn_update.status;
+      dev->conn_updated = true;
+      bridge_events_signal(&Bridge_Events, BRIDGE_EVENT_CONN);
+    }
+    return 0;
+  }
+  if (event->type == BLE_GAP_EVENT_NOTIFY_RX) {
+    hid_device_t *dev = device_by_conn(event->notify_rx.conn_handle);
+    if ((dev == nullptr) || !dev->fast_path) return 0;
+    if (event->notify_rx.attr_handle == dev->gatt.service_changed_handle) {
+      dev->stale = true;
+      bridge_events_signal(&Connect_Events, CONNECT_EVENT_STALE);
+      return 0;
+    }
+    uint8_t data[REPORT_QUEUE_DATA_MAX];
+    uint16_t length = 0;
+    ble_hs_mbuf_to_flat(event->notify_rx.om, data, sizeof(data), &length);
+    handle_report(dev, event->notify_rx.attr_handle, data, length);
   }
+  return 0;
 }
 
 /** Callback to process the results of the last scan or restart it */
@@ -335,13 +818,340 @@ void scanEndedCB(NimBLEScanResults results){
 }
 
 
+/** Find the mouse report layout for a HID_REPORT_DATA characteristic using
+ *  its Report Reference descriptor. Returns nullptr for output, feature,
+ *  and non-mouse input reports. Sets *unknown if the input report ID is
+ *  not in the layout which means the layout is not from this device.
+ */
+const hid_report_layout_t *report_layout_for(const hid_device_t *dev,
+    NimBLERemoteCharacteristic* pChr, bool *unknown)
+{
+  NimBLERemoteDescriptor* pDsc = pChr->getDescriptor(NimBLEUUID(HID_REPORT_REFERENCE));
+  if (pDsc) {
+    std::string ref = pDsc->readValue();
+    if (ref.length() >= 2) {
+      uint8_t report_id = (uint8_t)ref[0];
+      uint8_t report_type = (uint8_t)ref[1];
+      DBG_printf("Report Reference: ID %u, type %u\r\n", report_id, report_type);
+      if (report_type != HID_REPORT_TYPE_INPUT) return nullptr;
+      const hid_report_layout_t *layout =
+        hid_layout_find_report(dev->layout, report_id);
+      if (layout == nullptr) {
+        *unknown = true;
+        return nullptr;
+      }
+      if (!layout->is_mouse) return nullptr;
+      return layout;
+    }
+  }
+  // No Report Reference so assume it is the mouse report.
+  return hid_layout_first_mouse(dev->layout);
+}
+
+/** Make layout the one used for new reports of dev. */
+static void publish_layout(hid_device_t *dev, const hid_layout_t *layout)
+{
+  dev->layout = layout;
+}
+
+/** Return the layout buffer of dev not used by dev->layout. */
+static hid_layout_t *spare_layout(hid_device_t *dev)
+{
+  return (dev->layout == &dev->layouts[0]) ?
+    &dev->layouts[1] : &dev->layouts[0];
+}
+
+/** Load the layout of a bonded device from the layout cache. */
+static bool load_cached_layout(hid_device_t *dev, const NimBLEAddress &peer)
+{
+  // A capture needs the report map.
+  if (Capture_On) return false;
+  if (!Layout_Store_OK || !NimBLEDevice::isBonded(peer)) return false;
+  hid_layout_t *layout = spare_layout(dev);
+  if (!layout_cache_load(&Layout_Store, peer.getNative(), layout, nullptr)) {
+    return false;
+  }
+  DBG_println("HID layout from cache");
+  publish_layout(dev, layout);
+  return true;
+}
+
+/** Read the PnP ID of the Device Information Service and use the layout of
+ *  its profile in device_profiles.h, if it has a report map, without
+ *  reading the report map. Saved like a layout read from the device.
+ */
+static bool load_profile_layout(hid_device_t *dev, NimBLEClient* pClient)
+{
+  // A capture needs the report map.
+  if (Capture_On) return false;
+  NimBLERemoteService* pSvc = pClient->getService(DEVICE_INFORMATION_SERVICE);
+  if (pSvc == nullptr) return false;
+  NimBLERemoteCharacteristic* pChr = pSvc->getCharacteristic(DIS_PNP_ID_CHAR);
+  if ((pChr == nullptr) || !pChr->canRead()) return false;
+  // Vendor ID source, vendor ID, product ID, product version, little endian.
+  std::string value = pChr->readValue();
+  if (value.length() < 7) return false;
+  const uint8_t *pnp_id = (const uint8_t *)value.data();
+  uint16_t vid = pnp_id[1] | (pnp_id[2] << 8);
+  uint16_t pid = pnp_id[3] | (pnp_id[4] << 8);
+  DBG_printf("PNP ID: source: %02x, vendor: %04x, product: %04x, version: %04x\r\n",
+      pnp_id[0], vid, pid, pnp_id[5] | (pnp_id[6] << 8));
+  // Vendor ID 0 is not a PnP ID to device_profile_find().
+  if (vid == 0) return false;
+  const device_profile_t *profile = device_profile_find(vid, pid, 0);
+  const hid_layout_t *layout = device_profile_layout(profile);
+  if (layout == nullptr) return false;
+  DBG_printf("HID layout from profile %s\r\n", profile->name);
+  publish_layout(dev, layout);
+  NimBLEAddress peer = pClient->getPeerAddress();
+  if (Layout_Store_OK && NimBLEDevice::isBonded(peer)) {
+    // Hash 0, the report map was not read.
+    layout_cache_save(&Layout_Store, peer.getNative(), 0, layout);
+  }
+  return true;
+}
+
+/** Read and parse HID_REPORT_MAP. Save the layout if the device is bonded. */
+static bool read_report_map(hid_device_t *dev, NimBLERemoteService* pSvc,
+    const NimBLEAddress &peer)
+{
+  // This returns the HID report descriptor like this
+  // HID_REPORT_MAP 0x2a4b Value: 5,1,9,2,A1,1,9,1,A1,0,5,9,19,1,29,5,15,0,25,1,75,1,
+  // Copy and paste the value digits to http://eleccelerator.com/usbdescreqparser/
+  // to see the decoded report descriptor.
+  NimBLERemoteCharacteristic* pChr = pSvc->getCharacteristic(HID_REPORT_MAP);
+  if (pChr == nullptr) {
+    DBG_println("HID REPORT MAP char not found.");
+    return false;
+  }
+  if (!pChr->canRead()) return false;
+  std::string value = pChr->readValue();
+  const uint8_t *desc = (const uint8_t *)value.data();
+  if (Capture_On) {
+    capture_report_map(&Capture, device_index(dev), micros(), desc,
+        value.length());
+  }
+  uint32_t hash = layout_cache_hash(desc, value.length());
+  // Report maps in device_profiles.h were parsed when the firmware was built.
+  const device_profile_t *profile = device_profile_find(0, 0, hash);
+  const hid_layout_t *layout = device_profile_layout(profile);
+  if (layout != nullptr) {
+    DBG_printf("HID layout from profile %s\r\n", profile->name);
+  } else {
+    hid_layout_t *parsed = spare_layout(dev);
+    hid_layout_parse(parsed, desc, value.length(), false);
+    layout = parsed;
+  }
+  publish_layout(dev, layout);
+  if (Layout_Store_OK && NimBLEDevice::isBonded(peer)) {
+    layout_cache_save(&Layout_Store, peer.getNative(), hash, layout);
+  }
+#if DUMP_REPORT_MAP
+  DBG_print("HID_REPORT_MAP ");
+  DBG_print(pChr->getUUID().toString().c_str());
+  DBG_print(" Value: ");
+  DBG_hex(desc, value.length());
+  DBG_println();
+#endif
+  return true;
+}
+
+/** Subscribe to the mouse input reports and fill in the handle map.
+ *  Returns the number of reports subscribed or -1 if a subscribe failed.
+ *  Sets *stale if the device has input reports not in dev->layout.
+ */
+static int subscribe_mouse_reports(hid_device_t *dev, NimBLERemoteService* pSvc,
+    bool *stale)
+{
+  int subscribed = 0;
+  *stale = false;
+  // Subscribe to characteristics HID_REPORT_DATA.
+  // One real device reports 2 with the same UUID but
+  // different handles. Using getCharacteristic() results
+  // in subscribing to only one. Only mouse input reports are
+  // subscribed and added to the handle map.
+  memset(dev->handle_map, 0, sizeof(dev->handle_map));
+  capture_handle(dev, 0, 0, 0);
+  dev->handle_map_base = pSvc->getStartHandle();
+  dev->gatt.service_start = pSvc->getStartHandle();
+  dev->gatt.service_end = pSvc->getEndHandle();
+  dev->gatt.report_count = 0;
+  std::vector<NimBLERemoteCharacteristic*>*charvector;
+  charvector = pSvc->getCharacteristics(true);
+  for (auto &it: *charvector) {
+    if (it->getUUID() == NimBLEUUID(HID_REPORT_DATA)) {
+      DBG_println(it->toString().c_str());
+      const hid_report_layout_t *layout = report_layout_for(dev, it, stale);
+      uint16_t slot = it->getHandle() - dev->handle_map_base;
+      if ((layout == nullptr) || (slot >= HANDLE_MAP_SIZE)) {
+        DBG_println("Not a mouse report, skipping");
+        continue;
+      }
+      dev->handle_map[slot] = layout;
+      capture_handle(dev, it->getHandle(), layout->report_id, 0);
+      NimBLERemoteDescriptor* pCccd = it->getDescriptor(NimBLEUUID(CCCD_DESCRIPTOR));
+      if (pCccd) {
+        gatt_cache_add_report(&dev->gatt, it->getHandle(), pCccd->getHandle(),
+            it->canNotify() ? GATT_CCCD_NOTIFY : GATT_CCCD_INDICATE,
+            layout->report_id);
+      }
+      if (it->canNotify()) {
+        if(it->subscribe(true, notifyCB)) {
+          DBG_println("subscribe notification OK");
+        } else {
+          DBG_println("subscribe notification failed");
+          return -1;
+        }
+      }
+      if (it->canIndicate()) {
+        if(it->subscribe(false, notifyCB)) {
+          DBG_println("subscribe indication OK");
+        } else {
+          DBG_println("subscribe indication failed");
+          return -1;
+        }
+      }
+      subscribed++;
+    }
+  }
+  return subscribed;
+}
+
+/** Subscribe to Service Changed so the device can tell us the cached
+ *  handles are stale. Optional, not all devices have it.
+ */
+static void subscribe_service_changed(hid_device_t *dev, NimBLEClient* pClient)
+{
+  dev->gatt.service_changed_handle = 0;
+  dev->gatt.service_changed_cccd = 0;
+  NimBLERemoteService* pSvc = pClient->getService(GATT_SERVICE);
+  if (pSvc == nullptr) return;
+  NimBLERemoteCharacteristic* pChr = pSvc->getCharacteristic(GATT_SERVICE_CHANGED);
+  if ((pChr == nullptr) || !pChr->canIndicate()) return;
+  NimBLERemoteDescriptor* pCccd = pChr->getDescriptor(NimBLEUUID(CCCD_DESCRIPTOR));
+  if ((pCccd == nullptr) || !pChr->subscribe(false, serviceChangedCB)) return;
+  dev->gatt.service_changed_handle = pChr->getHandle();
+  dev->gatt.service_changed_cccd = pCccd->getHandle();
+}
+
+/** Save the handles of a bonded device for fast_reconnect(). */
+static void save_gatt_cache(hid_device_t *dev, const NimBLEAddress &peer)
+{
+  if (Layout_Store_OK && NimBLEDevice::isBonded(peer) &&
+      (dev->gatt.report_count > 0)) {
+    gatt_cache_save(&Layout_Store, peer.getNative(), &dev->gatt);
+  }
+}
+
+/** Write HID_PROTOCOL_MODE, 0 boot protocol or 1 report protocol. */
+static bool write_protocol_mode(NimBLERemoteService* pSvc, uint8_t mode)
+{
+  NimBLERemoteCharacteristic* pChr = pSvc->getCharacteristic(HID_PROTOCOL_MODE);
+  if ((pChr == nullptr) || !pChr->canWriteNoResponse()) return false;
+  return pChr->writeValue(&mode, 1, false);
+}
+
+/** Switch dev to boot protocol and subscribe to HID_BOOT_MOUSE_INPUT_REPORT
+ *  if its layout is known, from an earlier connection, the layout cache,
+ *  or a profile, and boot protocol carries all of it. A device not seen
+ *  before uses report protocol, so its report map is read once and nothing
+ *  it sends is clipped to boot reports. Returns false to use report
+ *  protocol. The handles are not cached, fast_reconnect() is for report
+ *  protocol.
+ */
+static bool boot_protocol(hid_device_t *dev, NimBLERemoteService* pSvc)
+{
+  const hid_layout_t *known = dev->layout;
+  if ((known == nullptr) || !hid_layout_boot_compatible(known)) return false;
+  NimBLERemoteCharacteristic* pChr =
+    pSvc->getCharacteristic(HID_BOOT_MOUSE_INPUT_REPORT);
+  if ((pChr == nullptr) || !pChr->canNotify()) return false;
+  uint16_t slot = pChr->getHandle() - pSvc->getStartHandle();
+  if (slot >= HANDLE_MAP_SIZE) return false;
+  if (!write_protocol_mode(pSvc, 0)) return false;
+  memset(dev->handle_map, 0, sizeof(dev->handle_map));
+  dev->handle_map_base = pSvc->getStartHandle();
+  dev->handle_map[slot] = &Boot_Layout.reports[0];
+  capture_handle(dev, 0, 0, 0);
+  capture_handle(dev, pChr->getHandle(), 0, CAPTURE_HANDLE_BOOT);
+  dev->gatt.report_count = 0;
+  if (!pChr->subscribe(true, notifyCB)) {
+    DBG_println("subscribe boot mouse report failed");
+    write_protocol_mode(pSvc, 1);
+    return false;
+  }
+  dev->boot = true;
+  return true;
+}
+
+static SemaphoreHandle_t Cccd_Write_Done;
+static volatile int Cccd_Write_Status;
+
+static int cccd_write_cb(uint16_t conn_handle, const struct ble_gatt_error *error,
+    struct ble_gatt_attr *attr, void *arg)
+{
+  Cccd_Write_Status = error->status;
+  xSemaphoreGive(Cccd_Write_Done);
+  return 0;
+}
+
+/** gatt_ops_t write_cccd for NimBLE. Waits for the write response. */
+static bool write_cccd(void *ctx, uint16_t cccd_handle, uint16_t value)
+{
+  NimBLEClient* pClient = (NimBLEClient *)ctx;
+  uint8_t data[2] = { (uint8_t)value, (uint8_t)(value >> 8) };
+  if (ble_gattc_write_flat(pClient->getConnId(), cccd_handle, data, sizeof(data),
+        cccd_write_cb, nullptr) != 0) {
+    return false;
+  }
+  if (xSemaphoreTake(Cccd_Write_Done, pdMS_TO_TICKS(2000)) != pdTRUE) {
+    return false;
+  }
+  return Cccd_Write_Status == 0;
+}
+
+/** Reconnect a bonded device using the cached layout and handles. No
+ *  discovery, no report map read. Returns false if the caches are missing
+ *  or stale; the caller then does the full discovery.
+ */
+static bool fast_reconnect(hid_device_t *dev, NimBLEClient* pClient)
+{
+  NimBLEAddress peer = pClient->getPeerAddress();
+  if (!Layout_Store_OK || !NimBLEDevice::isBonded(peer)) return false;
+  if (!gatt_cache_load(&Layout_Store, peer.getNative(), &dev->gatt)) return false;
+  if (!load_cached_layout(dev, peer)) return false;
+  // HID reports need an encrypted link. Use the bond keys.
+  if (!pClient->secureConnection()) return false;
+  memset(dev->handle_map, 0, sizeof(dev->handle_map));
+  capture_handle(dev, 0, 0, 0);
+  dev->handle_map_base = dev->gatt.service_start;
+  for (size_t i = 0; i < dev->gatt.report_count; i++) {
+    const gatt_cache_report_t *report = &dev->gatt.reports[i];
+    const hid_report_layout_t *layout =
+      hid_layout_find_report(dev->layout, report->report_id);
+    uint16_t slot = report->value_handle - dev->handle_map_base;
+    if ((layout == nullptr) || !layout->is_mouse || (slot >= HANDLE_MAP_SIZE)) {
+      return false;
+    }
+    dev->handle_map[slot] = layout;
+    capture_handle(dev, report->value_handle, report->report_id, 0);
+  }
+  dev->fast_path = true;
+  gatt_ops_t ops = { write_cccd, pClient };
+  if (!gatt_cache_subscribe(&dev->gatt, &ops)) {
+    DBG_println("Cached handles are stale");
+    dev->fast_path = false;
+    gatt_cache_erase(&Layout_Store, peer.getNative());
+    return false;
+  }
+  return true;
+}
+
 /** Create a single global instance of the callback class to be used by all clients */
 static ClientCallbacks clientCB;
 
-static NimBLEAddress LastBLEAddress;
-
 /** Handles the provisioning of clients and connects / interfaces with the server */
-bool connectToServer()
+bool connectToServer(hid_device_t *dev)
 {
   NimBLEClient* pClient = nullptr;
   bool reconnected = false;
@@ -353,19 +1163,18 @@ bool connectToServer()
      *  second argument in connect() to prevent refreshing the service database.
      *  This saves considerable time and power.
      */
-    pClient = NimBLEDevice::getClientByPeerAddress(advDevice->getAddress());
+    pClient = NimBLEDevice::getClientByPeerAddress(dev->address);
     if(pClient) {
-      if (pClient->getPeerAddress() == LastBLEAddress) {
-        if(!pClient->connect(advDevice, false)) {
+      // The slot still has the layout of this device.
+      if (dev->layout != nullptr) {
+        if(!pClient->connect(dev->address, false)) {
           DBG_println("Reconnect failed");
-          TFT_color(TFT_YELLOW, TFT_BLACK);
+          status_set_state(&Status, STATUS_RECONNECT_FAILED);
           RGBLed(CRGB::Yellow);
-          TFT_println("Reconnect failed");
           return false;
         }
         DBG_println("Reconnected client");
-        TFT_color(TFT_GREEN, TFT_BLACK);
-        TFT_println("Reconnected client");
+        status_set_state(&Status, STATUS_RECONNECTED);
         RGBLed(CRGB::Green);
         reconnected = true;
       }
@@ -400,7 +1209,7 @@ bool connectToServer()
     pClient->setConnectTimeout(5);
 
 
-    if (!pClient->connect(advDevice)) {
+    if (!pClient->connect(dev->address)) {
       /** Created a client but failed to connect, don't need to keep it as it has no data */
       NimBLEDevice::deleteClient(pClient);
       DBG_println("Failed to connect, deleted client");
@@ -409,28 +1218,35 @@ bool connectToServer()
   }
 
   if(!pClient->isConnected()) {
-    if (!pClient->connect(advDevice)) {
+    if (!pClient->connect(dev->address)) {
       DBG_println("Failed to connect");
       return false;
     }
   }
 
-  LastBLEAddress = pClient->getPeerAddress();
+  dev->timing.connected = micros();
   DBG_print("Connected to: ");
   DBG_println(pClient->getPeerAddress().toString().c_str());
+  int rssi = pClient->getRssi();
   DBG_print("RSSI: ");
-  DBG_println(pClient->getRssi());
+  DBG_println(rssi);
+  status_set_rssi(&Status, rssi);
 
   /** Now we can read/write/subscribe the charateristics of the services we are interested in */
   NimBLERemoteService* pSvc = nullptr;
-  NimBLERemoteCharacteristic* pChr = nullptr;
-  NimBLERemoteDescriptor* pDsc = nullptr;
 
-  
-  Mouse_xfer.xmin = SCHAR_MIN;
-  Mouse_xfer.xmax = SCHAR_MAX;
-  Mouse_xfer.ymin = SCHAR_MIN;
-  Mouse_xfer.ymax = SCHAR_MAX;
+  if (!reconnected && fast_reconnect(dev, pClient)) {
+    dev->timing.from_cache = true;
+    dev->timing.subscribed = micros();
+    DBG_println("Reconnected using cached handles");
+    return true;
+  }
+
+  // Other devices may be moving the stick.
+  if (devices_in_use() == 1) {
+    bridge_reset_range(&Bridge);
+    capture_event(dev, CAPTURE_RESET_RANGE, 0, nullptr, 0);
+  }
 
 #if DEV_INFO_SERVICE
   // Device Information Service
@@ -446,96 +1262,573 @@ bool connectToServer()
         DBG_println(it->readValue().c_str());
       }
     }
-    pChr = pSvc->getCharacteristic(DIS_PNP_ID_CHAR);
-    if(pChr) {     /** make sure it's not null */
-      if(pChr->canRead()) {
-        typedef struct __attribute__((__packed__)) {
-          uint8_t vendor_id_source;
-          uint16_t vendor_id;
-          uint16_t product_id;
-          uint16_t product_version;
-        } pnp_id_t;
-        pnp_id_t *pnp_id = (pnp_id_t *)pChr->readValue().data();
-        uint16_t vid = pnp_id->vendor_id;
-        uint16_t pid = pnp_id->product_id;
-        DBG_printf("PNP ID: source: %02x, vendor: %04x, product: %04x, version: %04x\r\n",
-            pnp_id->vendor_id_source, vid, pid, pnp_id->product_version);
-        Mouse_xfer.isJellyComb =
-          ((vid == JellyComb_VID) && (pid == JellyComb_PID));
-      }
-    }
   } else {
     DBG_println("Device Information Service not found.");
   }
 #endif
 
+  // The layout comes from the slot, the layout cache, a profile found by
+  // the PnP ID, or the report map, the first that has it.
+  NimBLEAddress peer = pClient->getPeerAddress();
+  bool from_cache = false;
+  bool from_profile = false;
+  bool need_layout = !reconnected || (dev->layout == nullptr);
+  if (need_layout) {
+    from_cache = load_cached_layout(dev, peer);
+    from_profile = !from_cache && load_profile_layout(dev, pClient);
+  }
+
   pSvc = pClient->getService(HID_SERVICE);
   if(pSvc) {     /** make sure it's not null */
-      // This returns the HID report descriptor like this
-      // HID_REPORT_MAP 0x2a4b Value: 5,1,9,2,A1,1,9,1,A1,0,5,9,19,1,29,5,15,0,25,1,75,1,
-      // Copy and paste the value digits to http://eleccelerator.com/usbdescreqparser/
-      // to see the decoded report descriptor.
-      pChr = pSvc->getCharacteristic(HID_REPORT_MAP);
-      if(pChr) {     /** make sure it's not null */
-        if(pChr->canRead()) {
-          std::string value = pChr->readValue();
-          if (!reconnected) {
-            parse_hid_report_descriptor((const uint8_t *)value.c_str(),
-                (size_t) value.length(), false);
-          }
-#if DUMP_REPORT_MAP
-          DBG_print("HID_REPORT_MAP ");
-          DBG_print(pChr->getUUID().toString().c_str());
-          DBG_print(" Value: ");
-          uint8_t *p = (uint8_t *)value.data();
-          for (size_t i = 0; i < value.length(); i++) {
-            DBG_print(p[i], HEX);
-            DBG_print(',');
-          }
-          DBG_println();
-#endif
-        }
+    if (Boot_Protocol && boot_protocol(dev, pSvc)) {
+      dev->timing.boot_protocol = true;
+      dev->timing.subscribed = micros();
+      DBG_println("Boot protocol");
+      return true;
+    }
+    if (need_layout && !from_cache && !from_profile &&
+        !read_report_map(dev, pSvc, peer)) {
+      DBG_println("No report map, cannot decode reports");
+      pClient->disconnect();
+      return false;
+    }
+    bool stale;
+    int subscribed = subscribe_mouse_reports(dev, pSvc, &stale);
+    if ((from_cache || from_profile) && (stale || (subscribed == 0))) {
+      if (from_cache) {
+        // The device changed its report map since it was cached.
+        DBG_println("Cached HID layout does not match");
+        layout_cache_erase(&Layout_Store, peer.getNative());
+      } else {
+        DBG_println("Profile HID layout does not match");
+        from_profile = false;
       }
-      else {
-        DBG_println("HID REPORT MAP char not found.");
-      }
-
-    // Subscribe to characteristics HID_REPORT_DATA.
-    // One real device reports 2 with the same UUID but
-    // different handles. Using getCharacteristic() results
-    // in subscribing to only one.
-    std::vector<NimBLERemoteCharacteristic*>*charvector;
-    charvector = pSvc->getCharacteristics(true);
-    for (auto &it: *charvector) {
-      if (it->getUUID() == NimBLEUUID(HID_REPORT_DATA)) {
-        DBG_println(it->toString().c_str());
-        if (it->canNotify()) {
-          if(it->subscribe(true, notifyCB)) {
-            DBG_println("subscribe notification OK");
-          } else {
-            /** Disconnect if subscribe failed */
-            DBG_println("subscribe notification failed");
-            pClient->disconnect();
-            return false;
-          }
-        }
-        if (it->canIndicate()) {
-          if(it->subscribe(false, notifyCB)) {
-            DBG_println("subscribe indication OK");
-          } else {
-            /** Disconnect if subscribe failed */
-            DBG_println("subscribe indication failed");
-            pClient->disconnect();
-            return false;
-          }
-        }
+      if (!read_report_map(dev, pSvc, peer)) {
+        pClient->disconnect();
+        return false;
       }
+      subscribed = subscribe_mouse_reports(dev, pSvc, &stale);
+    }
+    if (subscribed < 0) {
+      /** Disconnect if subscribe failed */
+      pClient->disconnect();
+      return false;
     }
+    subscribe_service_changed(dev, pClient);
+    save_gatt_cache(dev, peer);
   }
+  dev->timing.from_profile = from_profile;
+  dev->timing.subscribed = micros();
   DBG_println("Done with this device!");
   return true;
 }
 
+static bool usb_ready(void *ctx)
+{
+  return HID_Endpoint.ready();
+}
+
+static bool usb_send(void *ctx, const void *report, size_t len)
+{
+  return FSJoy.write((void *)report, len);
+}
+
+/** usb_out sent callback. The write and total latency end here, when the
+ *  report goes to the endpoint, after any frames it waited in Usb_Out.
+ */
+static void usb_sent(void *ctx, const usb_out_stamp_t *stamp)
+{
+  bridge_report_sent(&Bridge, stamp->made_us, stamp->oldest_us, micros());
+}
+
+static void usb_timer_cb(void *arg)
+{
+  bridge_events_signal(&Bridge_Events, BRIDGE_EVENT_USB);
+}
+
+/** Send the next joystick report if the endpoint is free, else try again
+ *  when Usb_Timer fires.
+ */
+static void usb_flush()
+{
+  uint32_t retry_us = usb_out_poll(&Usb_Out, micros());
+  if (retry_us) bridge_timer_once(&Usb_Timer, retry_us);
+}
+
+/** bridge_write_fn for ESP32_flight_stick. Button changes are events so
+ *  each one reaches the XAC. Merged buttons 9..16 go in buttons_b.
+ */
+static void joy_write(void *ctx, const joy_output_t *out)
+{
+  uint8_t buttons_a = (uint8_t)out->buttons;
+  uint8_t buttons_b = (uint8_t)(out->buttons >> 8);
+  bool event = (Mouse_xfer.joyRpt.buttons_a != buttons_a) ||
+    (Mouse_xfer.joyRpt.buttons_b != buttons_b);
+  Mouse_xfer.joyRpt.buttons_a = buttons_a;
+  Mouse_xfer.joyRpt.buttons_b = buttons_b;
+  Mouse_xfer.joyRpt.x = out->x;
+  Mouse_xfer.joyRpt.y = out->y;
+  usb_out_stamp_t stamp = { out->decoded_us, out->oldest_us, out->measure };
+  usb_out_submit_stamped(&Usb_Out, &Mouse_xfer.joyRpt, event, &stamp);
+  usb_flush();
+}
+
+/** Ask for the connection parameters the policy wants and print its
+ *  decisions.
+ */
+static void conn_policy_send(hid_device_t *dev, bool send,
+    const conn_params_t *req)
+{
+  if (send) {
+    NimBLEClient* pClient = NimBLEDevice::getClientByID(dev->conn);
+    if (pClient) {
+      pClient->updateConnParams(req->min_interval, req->max_interval,
+          req->latency, req->timeout);
+    }
+  }
+  static conn_policy_state_t state_shown[NIMBLE_MAX_CONNECTIONS];
+  static uint16_t interval_shown[NIMBLE_MAX_CONNECTIONS];
+  static uint16_t latency_shown[NIMBLE_MAX_CONNECTIONS];
+  const conn_policy_t *policy = &dev->policy;
+  uint8_t i = device_index(dev);
+  if ((policy->state != state_shown[i]) ||
+      (policy->interval != interval_shown[i]) ||
+      (policy->latency != latency_shown[i])) {
+    state_shown[i] = policy->state;
+    interval_shown[i] = policy->interval;
+    latency_shown[i] = policy->latency;
+    DBG_printf("Conn policy %u %s: interval %u latency %u, requests %u updates %u failures %u peer requests %u\r\n",
+        i, conn_policy_state_name(policy->state), policy->interval,
+        policy->latency, policy->stats.requests, policy->stats.updates,
+        policy->stats.failures, policy->stats.peer_requests);
+  }
+}
+
+/** Start the connection parameter policy on the new connection of dev. */
+static void conn_policy_start(hid_device_t *dev)
+{
+  dev->policy_on = true;
+  ble_gap_conn_desc desc;
+  if (ble_gap_conn_find(dev->conn, &desc) != 0) return;
+  dev->conn_updated = false;
+  dev->reports_seen = Bridge.devices[device_index(dev)].reports;
+  conn_params_t req;
+  bool send = conn_policy_connected(&dev->policy, desc.conn_itvl,
+      desc.conn_latency, micros(), &req);
+  conn_policy_send(dev, send, &req);
+}
+
+/** Feed reports, idle time, and connection updates to the policy of each
+ *  connected device.
+ */
+static void conn_policy_run(uint32_t events)
+{
+  uint32_t now = micros();
+  for (auto &dev: Devices) {
+    if (!dev.policy_on || (dev.conn == BLE_HS_CONN_HANDLE_NONE)) continue;
+    conn_params_t req;
+    bool send = false;
+    if ((events & BRIDGE_EVENT_CONN) && dev.conn_updated) {
+      dev.conn_updated = false;
+      ble_gap_conn_desc desc;
+      if (ble_gap_conn_find(dev.conn, &desc) == 0) {
+        send = conn_policy_updated(&dev.policy, dev.conn_update_status,
+            desc.conn_itvl, desc.conn_latency, now, &req);
+      }
+    }
+    uint32_t reports = Bridge.devices[device_index(&dev)].reports;
+    if ((events & BRIDGE_EVENT_REPORT) && (reports != dev.reports_seen)) {
+      dev.reports_seen = reports;
+      send = conn_policy_report(&dev.policy, now, &req) || send;
+    }
+    if (events & (BRIDGE_EVENT_REPORT | BRIDGE_EVENT_IDLE)) {
+      send = conn_policy_tick(&dev.policy, now, &req) || send;
+    }
+    conn_policy_send(&dev, send, &req);
+  }
+}
+
+static void scan_timer_cb(void *arg)
+{
+  bridge_events_signal(&Connect_Events, CONNECT_EVENT_SCAN);
+}
+
+/** Put bonded devices on the controller's filter accept list. Returns
+ *  false if there are none. Call while not scanning.
+ */
+static bool allowlist_bonds()
+{
+  int bonds = NimBLEDevice::getNumBonds();
+  for (int i = 0; i < bonds; i++) {
+    NimBLEAddress address = NimBLEDevice::getBondedAddress(i);
+    if (!NimBLEDevice::onWhiteList(address)) NimBLEDevice::whiteListAdd(address);
+  }
+  return bonds > 0;
+}
+
+/** (Re)start the scan with params. Queued advertisements are dropped
+ *  because the new scan reports the devices again.
+ */
+static void scan_apply(const scan_params_t *params)
+{
+  NimBLEScan* pScan = NimBLEDevice::getScan();
+  pScan->stop();
+  adv_seen_t seen;
+  while (adv_seen_pop(&seen)) {}
+  pScan->setFilterPolicy(params->allowlist ?
+      BLE_HCI_SCAN_FILT_USE_WL : BLE_HCI_SCAN_FILT_NO_WL);
+  pScan->setInterval(params->interval);
+  pScan->setWindow(params->window);
+  pScan->start(scanTime, scanEndedCB);
+  DBG_printf("Scan %s: interval %u window %u ms\r\n",
+      scan_policy_state_name(Scan_Policy.state), params->interval,
+      params->window);
+}
+
+/** Scan while a connection is free. */
+static void scan_start()
+{
+  if (devices_in_use() >= NIMBLE_MAX_CONNECTIONS) return;
+  scan_params_t params;
+  scan_policy_start(&Scan_Policy, micros(), allowlist_bonds(), &params);
+  scan_apply(&params);
+  bridge_timer_periodic(&Scan_Timer, SCAN_POLICY_TICK_US);
+}
+
+static void scan_stop()
+{
+  bridge_timer_stop(&Scan_Timer);
+  scan_policy_stop(&Scan_Policy);
+  NimBLEDevice::getScan()->stop();
+}
+
+static void connect_device(const NimBLEAddress &address);
+
+/** Give the advertisements queued by onResult() to the scan policy and
+ *  connect the device it picks.
+ */
+static void scan_results()
+{
+  adv_seen_t seen;
+  while (adv_seen_pop(&seen)) {
+    scan_decision_t decision = scan_policy_result(&Scan_Policy, micros(),
+        seen.address.getNative(), seen.bonded);
+    if (decision == SCAN_HOLD) {
+      Held_Address = seen.address;
+    } else if (decision == SCAN_CONNECT) {
+      connect_device(seen.address);
+      return;
+    }
+  }
+}
+
+/** Scan_Timer fired: move to the next scan phase or connect a held device.
+ *  Also starts the first scan after setup().
+ */
+static void scan_tick()
+{
+  if (Scan_Policy.state == SCAN_POLICY_IDLE) {
+    scan_start();
+    return;
+  }
+  scan_params_t params;
+  uint8_t address[6];
+  switch (scan_policy_tick(&Scan_Policy, micros(), &params, address)) {
+    case SCAN_TICK_RESTART:
+      scan_apply(&params);
+      break;
+    case SCAN_TICK_CONNECT_HELD:
+      connect_device(Held_Address);
+      break;
+    default:
+      break;
+  }
+}
+
+/** Stop scanning and connect to address. Keep scanning for more devices
+ *  while there is a free slot.
+ */
+static void connect_device(const NimBLEAddress &address)
+{
+  scan_stop();
+  status_set_name(&Status, address.toString().c_str());
+  hid_device_t *dev = device_slot_for(address);
+  if (dev == nullptr) {
+    DBG_println("No free device slot");
+    return;
+  }
+  uint32_t lost_us = (dev->address == address) ? dev->lost_us : 0;
+  if (dev->address != address) {
+    // The slot was used by another device. Its reports have been handled.
+    dev->address = address;
+    dev->layout = nullptr;
+  }
+  dev->in_use = true;
+  dev->conn = BLE_HS_CONN_HANDLE_NONE;
+  dev->fast_path = false;
+  dev->stale = false;
+  dev->boot = false;
+  memset(&dev->timing, 0, sizeof(dev->timing));
+  dev->timing.disconnected = lost_us;
+  dev->timing.connect_start = micros();
+  uint8_t button_offset = button_offset_for(address);
+  bridge_add_device(&Bridge, device_index(dev), button_offset);
+  capture_event(dev, CAPTURE_CONNECT, 0, &button_offset, sizeof(button_offset));
+
+  /** Found a device we want to connect to, do it now */
+  if(connectToServer(dev)) {
+    DBG_printf("Success! device %u of %u, we should now be getting notifications!\r\n",
+        device_index(dev), (unsigned)devices_in_use());
+    // The bridge task starts the connection policy.
+    dev->active = true;
+    bridge_events_signal(&Bridge_Events, BRIDGE_EVENT_CONNECT);
+    status_set_state(&Status, STATUS_ACTIVE);
+    RGBLed(CRGB::Green);
+    scan_start();
+  } else {
+    DBG_println("Failed to connect, starting scan");
+    // Still expected if it was.
+    if (lost_us) scan_policy_lost(&Scan_Policy, lost_us, address.getNative());
+    dev->in_use = false;
+    dev->conn = BLE_HS_CONN_HANDLE_NONE;
+    dev->fast_path = false;
+    status_set_state(&Status, STATUS_CONNECT_FAILED);
+    RGBLed(CRGB::Yellow);
+    scan_start();
+  }
+}
+
+/** Start the connection policy of devices the connect task connected. */
+static void start_devices()
+{
+  for (auto &dev: Devices) {
+    if (dev.active && !dev.policy_on) conn_policy_start(&dev);
+  }
+}
+
+/** Release the buttons of devices that disconnected and stop their
+ *  policy. Called in the bridge task after their queued reports are
+ *  handled. The connect task frees their slots.
+ */
+static void release_devices()
+{
+  bool lost = false;
+  for (auto &dev: Devices) {
+    if (!dev.active || (dev.conn != BLE_HS_CONN_HANDLE_NONE)) continue;
+    bridge_remove_device(&Bridge, device_index(&dev));
+    if (dev.policy_on) {
+      conn_policy_disconnected(&dev.policy);
+      conn_policy_send(&dev, false, nullptr);
+      dev.policy_on = false;
+    }
+    dev.active = false;
+    dev.released = true;
+    lost = true;
+  }
+  if (lost) bridge_events_signal(&Connect_Events, CONNECT_EVENT_LOST);
+}
+
+/** Free the slots of devices released by the bridge task and scan for
+ *  them.
+ */
+static void free_devices()
+{
+  bool lost = false;
+  for (auto &dev: Devices) {
+    if (!dev.in_use || !dev.released) continue;
+    dev.released = false;
+    capture_event(&dev, CAPTURE_DISCONNECT, 0, nullptr, 0);
+    dev.fast_path = false;
+    dev.in_use = false;
+    scan_policy_lost(&Scan_Policy, dev.lost_us, dev.address.getNative());
+    lost = true;
+  }
+  if (lost) scan_start();
+}
+
+/** A device changed its attributes. Forget the caches and reconnect with
+ *  full discovery.
+ */
+static void forget_devices()
+{
+  for (auto &dev: Devices) {
+    if (!dev.in_use || !dev.stale) continue;
+    DBG_println("Service Changed");
+    dev.stale = false;
+    if (Layout_Store_OK) {
+      gatt_cache_erase(&Layout_Store, dev.address.getNative());
+      layout_cache_erase(&Layout_Store, dev.address.getNative());
+    }
+    NimBLEClient* pClient = NimBLEDevice::getClientByPeerAddress(dev.address);
+    if (pClient) {
+      NimBLEDevice::deleteClient(pClient);
+    }
+    dev.layout = nullptr;
+  }
+}
+
+#if USB_DEBUG
+static const uint32_t LATENCY_REPORT_MS = 10000;
+
+static void print_latency(const char *name, const latency_hist_t *h)
+{
+  latency_summary_t s;
+  latency_hist_summary(h, &s);
+  DBG_printf("%s latency us: p50 %u p99 %u max %u count %u\r\n", name,
+      s.p50, s.p99, s.max, s.count);
+}
+#endif
+
+#if defined(ARDUINO_LILYGO_T_DISPLAY_S3) || defined(ARDUINO_M5Stack_ATOMS3)
+/** Show notification to joystick write latency once the mouse stops.
+ *  The summary walks the histogram, too slow to do for every report.
+ */
+static void show_latency()
+{
+  static uint32_t writes_shown = 0;
+  if (Bridge.writes == writes_shown) return;
+  writes_shown = Bridge.writes;
+  latency_summary_t s;
+  latency_hist_summary(&Bridge.total_latency, &s);
+  status_set_latency(&Status, s.p50, s.p99);
+}
+#endif
+
+static void report_stats()
+{
+#if USB_DEBUG
+  // Logged to Debug_Log, formatted and written later by log_task().
+  static uint32_t dropped_logged = 0;
+  if (Report_Queue.dropped != dropped_logged) {
+    dropped_logged = Report_Queue.dropped;
+    DBG_printf("Report queue: dropped %u high water %u\r\n", dropped_logged,
+        Report_Queue.high_water);
+  }
+#endif
+  for (auto &dev: Devices) {
+    const connect_timing_t *timing = &dev.timing;
+    if (!dev.policy_on || (timing->first_report == 0) ||
+        (dev.timing_shown == timing->connect_start)) {
+      continue;
+    }
+    dev.timing_shown = timing->connect_start;
+    DBG_printf("Device %u connect to first report %s: connect %u us, subscribe %u us, first report %u us\r\n",
+        device_index(&dev), timing->from_cache ? "(cached)" :
+        timing->boot_protocol ? "(boot protocol)" :
+        timing->from_profile ? "(profile)" : "(discovery)",
+        timing->connected - timing->connect_start,
+        timing->subscribed - timing->connected,
+        timing->first_report - timing->connect_start);
+    if (timing->disconnected) {
+      DBG_printf("Device %u disconnect to first report %u us, scan found it in %u us\r\n",
+          device_index(&dev), timing->first_report - timing->disconnected,
+          Scan_Policy.stats.lost_us);
+    }
+  }
+#if USB_DEBUG
+  static uint32_t latency_reported = 0;
+  if ((millis() - latency_reported) >= LATENCY_REPORT_MS) {
+    latency_reported = millis();
+    print_latency("Decode", &Bridge.decode_latency);
+    print_latency("Write", &Bridge.write_latency);
+    print_latency("Total", &Bridge.total_latency);
+    latency_summary_t s;
+    latency_hist_summary(&Bridge.total_latency, &s);
+    DBG_printf("Topology %s: total latency jitter p99-p50 %u us max-p50 %u us\r\n",
+        Topology->name, s.p99 - s.p50, s.max - s.p50);
+    DBG_printf("USB reports: submitted %u sent %u suppressed %u merged %u busy %u\r\n",
+        Usb_Out.stats.submitted, Usb_Out.stats.sent, Usb_Out.stats.suppressed,
+        Usb_Out.stats.merged, Usb_Out.stats.busy);
+  }
+#endif
+}
+
+/** capture_sink_fn for Capture_To. */
+static size_t capture_sink(void *ctx, const uint8_t *data, size_t len)
+{
+  if (Capture_To == CAPTURE_FLASH) return Capture_File.write(data, len);
+  return Serial.write(data, len);
+}
+
+/** Writes the capture ring out. Runs below the bridge task so slow flash
+ *  or a full CDC buffer only delays the capture. Records are lost, and
+ *  counted in the capture, only if the ring fills.
+ */
+static void capture_task(void *arg)
+{
+  for (;;) {
+    if (capture_drain(&Capture, capture_sink, nullptr) &&
+        (Capture_To == CAPTURE_FLASH)) {
+      Capture_File.flush();
+    }
+    delay(CAPTURE_DRAIN_MS);
+  }
+}
+
+static void capture_start()
+{
+  if (Capture_To == CAPTURE_OFF) return;
+  if (Capture_To == CAPTURE_FLASH) {
+    if (!LittleFS.begin(true) ||
+        !(Capture_File = LittleFS.open("/capture.bin", FILE_WRITE))) {
+      DBG_println("Capture file open failed");
+      return;
+    }
+  } else {
+    Serial.begin(115200);
+  }
+  uint8_t *ring = (uint8_t *)malloc(CAPTURE_RING_SIZE);
+  if ((ring == nullptr) || !capture_init(&Capture, ring, CAPTURE_RING_SIZE)) {
+    DBG_println("Capture init failed");
+    return;
+  }
+  Capture_On = true;
+  if (!bridge_task_start_on(capture_task, nullptr, "capture", CAPTURE_TASK_STACK,
+        CAPTURE_TASK_PRIORITY, Topology->ui_core)) {
+    DBG_println("Capture task start failed");
+    Capture_On = false;
+  }
+}
+
+/** Sleeps until notifyCB, a timer, or the connect task signals an event.
+ *  Replaces polling in loop(). Never waits for the BLE host.
+ */
+static void bridge_task(void *arg)
+{
+  bridge_events_bind(&Bridge_Events);
+  for (;;) {
+    uint32_t events = bridge_events_wait(&Bridge_Events, BRIDGE_WAIT_FOREVER);
+    // Queued reports first: before the buttons of a lost device are
+    // released.
+    bridge_handle_events(&Bridge, events);
+    // A device may be lost before its policy starts.
+    if (events & (BRIDGE_EVENT_CONN | BRIDGE_EVENT_CONNECT)) release_devices();
+    if (events & BRIDGE_EVENT_CONNECT) start_devices();
+    if (events & BRIDGE_EVENT_USB) usb_flush();
+    conn_policy_run(events);
+    if (events & BRIDGE_EVENT_REPORT) report_stats();
+#if defined(ARDUINO_LILYGO_T_DISPLAY_S3) || defined(ARDUINO_M5Stack_ATOMS3)
+    if (events & BRIDGE_EVENT_IDLE) show_latency();
+#endif
+  }
+}
+
+/** Sleeps until an advertisement, the scan timer, the bridge task, or a
+ *  Service Changed indication signals an event. Connects one device at a
+ *  time.
+ */
+static void connect_task(void *arg)
+{
+  bridge_events_bind(&Connect_Events);
+  for (;;) {
+    uint32_t events = bridge_events_wait(&Connect_Events, BRIDGE_WAIT_FOREVER);
+    if (events & CONNECT_EVENT_LOST) free_devices();
+    if (events & CONNECT_EVENT_ADV) scan_results();
+    if (events & CONNECT_EVENT_SCAN) scan_tick();
+    if (events & CONNECT_EVENT_STALE) forget_devices();
+  }
+}
+
 void setup ()
 {
   // esp_wifi_stop();
@@ -554,23 +1847,26 @@ void setup ()
   // as needed.
 #if 0
   button.attachClick([] {
-      TFT_color(TFT_RED, TFT_BLACK);
-      TFT_print("Button click");
+      status_set_message(&Status, "Button click", STATUS_RED);
       DBG_println("Button click");
       RGBLed(CRGB::Red);
       });
+#endif
+  // The latency histograms count from boot, over every connection, until
+  // a double click clears them. The callbacks run in status_task(); the
+  // bridge task, which fills the histograms, clears them when it next
+  // wakes up.
   button.attachDoubleClick([] {
-      TFT_color(TFT_GREEN, TFT_BLACK);
-      TFT_print("Button double click");
-      DBG_println("Button double click");
-      RGBLed(CRGB::Green);
+      bridge_reset_latency(&Bridge);
+      status_set_latency(&Status, 0, 0);
+      status_set_message(&Status, "Latency reset", STATUS_GREEN);
+      DBG_println("Latency reset");
       });
-#endif
   button.attachMultiClick([] {
       //reset settings - wipe bonding credentials
       NimBLEDevice::deleteAllBonds();
-      TFT_color(TFT_RED, TFT_BLACK);
-      TFT_print("Bonds Erased");
+      if (Layout_Store_OK) layout_cache_clear(&Layout_Store);
+      status_set_message(&Status, "Bonds Erased", STATUS_RED);
       DBG_println("Bonds Erased");
       RGBLed(CRGB::Red);
       delay(1000);
@@ -578,20 +1874,17 @@ void setup ()
       });
 #if 0
   button.attachLongPressStart([] {
-      TFT_color(TFT_MAGENTA, TFT_BLACK);
-      TFT_print("Button long press start");
+      status_set_message(&Status, "Button long press start", STATUS_MAGENTA);
       DBG_println("Button long press start");
       RGBLed(CRGB::Magenta);
       });
   button.attachDuringLongPress([] {
-      TFT_color(TFT_YELLOW, TFT_BLACK);
-      TFT_print("Button during long press");
+      status_set_message(&Status, "Button during long press", STATUS_YELLOW);
       DBG_println("Button during long press");
       RGBLed(CRGB::Yellow);
       });
   button.attachLongPressStop([] {
-      TFT_color(TFT_WHITE, TFT_BLACK);
-      TFT_print("Button long press stop");
+      status_set_message(&Status, "Button long press stop", STATUS_WHITE);
       DBG_println("Button long press stop");
       RGBLed(CRGB::White);
       });
@@ -604,6 +1897,37 @@ void setup ()
 #endif
   DBG_println("Starting XAC Joystick");
 
+  report_queue_init(&Report_Queue);
+  bridge_events_init(&Bridge_Events);
+  bridge_events_init(&Connect_Events);
+  static const usb_out_endpoint_t usb_ep =
+    { usb_ready, usb_send, nullptr, usb_sent };
+  if (!usb_out_init(&Usb_Out, &usb_ep, sizeof(FSJoystick_Report_t),
+        USB_OUT_INTERVAL_US) ||
+      !bridge_timer_init(&Usb_Timer, "usb", usb_timer_cb, nullptr)) {
+    DBG_println("USB output init failed");
+  }
+  for (auto &dev: Devices) {
+    dev.conn = BLE_HS_CONN_HANDLE_NONE;
+    conn_policy_init(&dev.policy, nullptr);
+  }
+  scan_policy_init(&Scan_Policy);
+  hid_layout_boot_mouse(&Boot_Layout);
+  if (!bridge_timer_init(&Scan_Timer, "scan", scan_timer_cb, nullptr)) {
+    DBG_println("Scan timer init failed");
+  }
+  capture_start();
+  bool bridge_ok =
+    bridge_init(&Bridge, &Report_Queue, &Bridge_Events, joy_write, nullptr);
+  bridge_latency_on_sent(&Bridge);
+  if (!bridge_set_curve(&Bridge, &Curve_Config)) {
+    DBG_println("Invalid Curve_Config, using the default");
+  }
+  if (!bridge_ok ||
+      !bridge_task_start_on(bridge_task, nullptr, "bridge", BRIDGE_TASK_STACK,
+        Topology->bridge_priority, Topology->bridge_core)) {
+    DBG_println("Bridge task start failed");
+  }
   DBG_println("Starting NimBLE HID Client");
   /** Initialize NimBLE, no device name spcified as we are not advertising */
   NimBLEDevice::init("");
@@ -611,6 +1935,9 @@ void setup ()
     DBG_printf("%s: setMTU(512) failed\n", __func__);
   }
   DBG_printf("%s: getMTU %d\n", __func__, NimBLEDevice::getMTU());
+  Layout_Store_OK = nv_store_nvs_init(&Layout_Store, "blemouse2xac");
+  Cccd_Write_Done = xSemaphoreCreateBinary();
+  NimBLEDevice::setCustomGapHandler(gapEventCB);
 
   /** Set the IO capabilities of the device, each option will trigger a different pairing method.
    *  BLE_HS_IO_KEYBOARD_ONLY    - Passkey pairing
@@ -640,81 +1967,28 @@ void setup ()
   /** create a callback that gets called when advertisers are found */
   pScan->setAdvertisedDeviceCallbacks(new AdvertisedDeviceCallbacks());
 
-  /** Set scan interval (how often) and window (how long) in milliseconds */
-  pScan->setInterval(22);
-  pScan->setWindow(11);
+  /** Scan interval (how often), window (how long) and the filter accept
+   *  list of bonded devices are set by the scan policy in the connect task.
+   */
 
   /** Active scan will gather scan response data from advertisers
    *  but will use more energy from both devices
    */
   pScan->setActiveScan(false);
-  /** Start scanning for advertisers for the scan time specified (in seconds) 0 = forever
-   *  Optional callback for when scanning stops.
+  /** The connect task starts scanning for advertisers, forever
+   *  (scanTime 0), while a connection is free.
    */
-  TFT_color(TFT_YELLOW, TFT_BLACK);
-  TFT_print("Scanning");
+  status_set_state(&Status, STATUS_SCANNING);
   RGBLed(CRGB::Yellow);
-  pScan->start(scanTime, scanEndedCB);
+  if (!bridge_task_start_on(connect_task, nullptr, "connect", CONNECT_TASK_STACK,
+        CONNECT_TASK_PRIORITY, Topology->ui_core)) {
+    DBG_println("Connect task start failed");
+  }
+  bridge_events_signal(&Connect_Events, CONNECT_EVENT_SCAN);
 }
 
-static inline int smin(int x, int y) {return (x < y) ? x : y;}
-static inline int smax(int x, int y) {return (x > y) ? x : y;}
-
 void loop ()
 {
-#if defined(ARDUINO_LILYGO_T_DISPLAY_S3) || defined(ARDUINO_M5Stack_ATOMS3)
-  button.tick();
-#endif
-  /** Loop here until we find a device we want to connect to */
-  if (doConnect) {
-    TFT_println(advDevice->toString().c_str());
-    doConnect = false;
-
-    /** Found a device we want to connect to, do it now */
-    if(connectToServer()) {
-      DBG_println("Success! we should now be getting notifications!");
-      TFT_color(TFT_GREEN, TFT_BLACK);
-      TFT_print("Mouse to XAC");
-      RGBLed(CRGB::Green);
-    } else {
-      DBG_println("Failed to connect, starting scan");
-      TFT_color(TFT_YELLOW, TFT_BLACK);
-      TFT_print("Connect fail\nScanning");
-      RGBLed(CRGB::Yellow);
-      NimBLEDevice::getScan()->start(scanTime, scanEndedCB);
-    }
-  }
-  else if (Mouse_xfer.available) {
-#if 0
-    DBG_printf("%s:", __func__);
-    for (size_t i = 0; i < Mouse_xfer.report_len; i++) {
-      DBG_printf(" %02x", Mouse_xfer.report[i]);
-    }
-    DBG_println();
-#endif
-    mouse_values_t ble_mouse;
-    extract_mouse_values((const uint8_t *)Mouse_xfer.report, &ble_mouse);
-    Mouse_xfer.available = false;
-    // DBG_printf("id %d buttons %x, x %d, y %d\n", ble_mouse.report_id,
-    //    ble_mouse.buttons, ble_mouse.x, ble_mouse.y);
-    Mouse_xfer.joyRpt.buttons_a = ble_mouse.buttons;
-    Mouse_xfer.xmin = smin(ble_mouse.x, Mouse_xfer.xmin);
-    Mouse_xfer.xmax = smax(ble_mouse.x, Mouse_xfer.xmax);
-    Mouse_xfer.ymin = smin(ble_mouse.y, Mouse_xfer.ymin);
-    Mouse_xfer.ymax = smax(ble_mouse.y, Mouse_xfer.ymax);
-    Mouse_xfer.joyRpt.x = map(ble_mouse.x,
-        Mouse_xfer.xmin, Mouse_xfer.xmax, 0, 1023);
-    Mouse_xfer.joyRpt.y = map(ble_mouse.y,
-        Mouse_xfer.ymin, Mouse_xfer.ymax, 0, 1023);
-    FSJoy.write((void *)&Mouse_xfer.joyRpt, sizeof(Mouse_xfer.joyRpt));
-  }
-  else {
-    if ((millis() - Mouse_xfer.last_millis) > 31) {
-      // Center x,y if no HID report for 32 ms. Preserve the buttons.
-      Mouse_xfer.joyRpt.x = 511;
-      Mouse_xfer.joyRpt.y = 511;
-      FSJoy.write((void *)&Mouse_xfer.joyRpt, sizeof(Mouse_xfer.joyRpt));
-      Mouse_xfer.last_millis = millis();
-    }
-  }
+  // Everything runs in bridge_task() and connect_task().
+  vTaskDelete(NULL);
 }
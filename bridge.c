@@ -0,0 +1,594 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2023 touchgadgetdev@gmail.com
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <string.h>
+#include "./bridge.h"
+
+// Curve deflection to 0..JOY_AXIS_MAX
+static inline uint16_t joy_axis(int32_t deflection) {
+  int32_t v = JOY_AXIS_CENTER + deflection;
+  return (uint16_t)((v < 0) ? 0 : (v > JOY_AXIS_MAX) ? JOY_AXIS_MAX : v);
+}
+
+static void idle_timer_cb(void *arg) {
+  bridge_t *b = (bridge_t *)arg;
+  bridge_events_signal(b->events, BRIDGE_EVENT_IDLE);
+}
+
+static void clear_latency(bridge_t *b) {
+  latency_hist_init(&b->decode_latency);
+  latency_hist_init(&b->write_latency);
+  latency_hist_init(&b->total_latency);
+}
+
+bool bridge_init(bridge_t *b, report_queue_t *queue, bridge_events_t *events,
+    bridge_write_fn write, void *write_ctx) {
+  memset(b, 0, sizeof(*b));
+  b->queue = queue;
+  b->events = events;
+  b->write = write;
+  b->write_ctx = write_ctx;
+  b->out.x = JOY_AXIS_CENTER;
+  b->out.y = JOY_AXIS_CENTER;
+  motion_init(&b->motion);
+  curve_init(&b->curve, NULL);
+  clear_latency(b);
+  if (!bridge_timer_init(&b->idle_timer, "idle", idle_timer_cb, b)) {
+    return false;
+  }
+  bridge_timer_once(&b->idle_timer, BRIDGE_IDLE_US);
+  return true;
+}
+
+bool bridge_set_curve(bridge_t *b, const curve_config_t *cfg) {
+  return curve_init(&b->curve, cfg);
+}
+
+// bridge_t requests bits of bridge_reset_range() and
+// bridge_reset_latency(), after the device bits
+#define REQUEST_RESET_RANGE   (1u << BRIDGE_DEVICES_MAX)
+#define REQUEST_RESET_LATENCY (1u << (BRIDGE_DEVICES_MAX + 1))
+
+void bridge_reset_range(bridge_t *b) {
+  __atomic_fetch_or(&b->requests, REQUEST_RESET_RANGE, __ATOMIC_RELEASE);
+}
+
+void bridge_reset_latency(bridge_t *b) {
+  __atomic_fetch_or(&b->requests, REQUEST_RESET_LATENCY, __ATOMIC_RELEASE);
+}
+
+void bridge_latency_on_sent(bridge_t *b) {
+  b->latency_on_sent = true;
+}
+
+void bridge_report_sent(bridge_t *b, uint32_t decoded_us, uint32_t oldest_us,
+    uint32_t sent_us) {
+  latency_hist_add(&b->write_latency, sent_us - decoded_us);
+  latency_hist_add(&b->total_latency, sent_us - oldest_us);
+}
+
+void bridge_add_device(bridge_t *b, uint8_t device, uint8_t button_offset) {
+  if (device >= BRIDGE_DEVICES_MAX) return;
+  b->devices[device].add_offset = (button_offset < BRIDGE_BUTTONS_MAX) ?
+    button_offset : BRIDGE_BUTTONS_MAX - 1;
+  __atomic_fetch_or(&b->requests, 1u << device, __ATOMIC_RELEASE);
+}
+
+// Apply the requests of other tasks. The bridge task calls this before it
+// decodes each report, so a device added before its reports were queued
+// is added before the first is merged.
+static void apply_requests(bridge_t *b) {
+  if (__atomic_load_n(&b->requests, __ATOMIC_RELAXED) == 0) return;
+  uint32_t requests = __atomic_exchange_n(&b->requests, 0, __ATOMIC_ACQUIRE);
+  for (uint8_t i = 0; i < BRIDGE_DEVICES_MAX; i++) {
+    if ((requests & (1u << i)) == 0) continue;
+    bridge_device_t *dev = &b->devices[i];
+    dev->buttons = 0;
+    dev->button_offset = dev->add_offset;
+    dev->reports = 0;
+  }
+  if (requests & REQUEST_RESET_RANGE) curve_reset(&b->curve);
+  if (requests & REQUEST_RESET_LATENCY) clear_latency(b);
+}
+
+// Buttons of all devices ORed together
+static uint32_t merged_buttons(const bridge_t *b) {
+  uint32_t buttons = 0;
+  for (size_t i = 0; i < BRIDGE_DEVICES_MAX; i++) {
+    buttons |= b->devices[i].buttons;
+  }
+  return buttons;
+}
+
+// Replace the buttons of the device that sent mv with the merged buttons.
+static void merge_report(bridge_t *b, uint8_t device, mouse_values_t *mv) {
+  bridge_device_t *dev = &b->devices[device % BRIDGE_DEVICES_MAX];
+  dev->buttons = (mv->buttons << dev->button_offset) &
+    ((1UL << BRIDGE_BUTTONS_MAX) - 1);
+  dev->reports++;
+  mv->buttons = merged_buttons(b);
+}
+
+// One USB report with the net motion since the last one, more if buttons
+// changed. measure adds the write and total times to the histograms.
+static void write_frames(bridge_t *b, uint32_t decoded_us, uint32_t oldest_us,
+    bool measure) {
+  motion_frame_t frame;
+  while (motion_take(&b->motion, &frame)) {
+    int32_t x, y;
+    curve_apply(&b->curve, frame.dx, frame.dy, decoded_us, &x, &y);
+    b->out.buttons = frame.buttons;
+    b->out.x = joy_axis(x);
+    b->out.y = joy_axis(y);
+    b->out.decoded_us = decoded_us;
+    b->out.oldest_us = oldest_us;
+    b->out.measure = measure;
+    b->write(b->write_ctx, &b->out);
+    b->writes++;
+    if (measure && !b->latency_on_sent) {
+      bridge_report_sent(b, decoded_us, oldest_us, bridge_micros());
+    }
+  }
+}
+
+void bridge_remove_device(bridge_t *b, uint8_t device) {
+  if ((device >= BRIDGE_DEVICES_MAX) || (b->devices[device].buttons == 0)) {
+    return;
+  }
+  b->devices[device].buttons = 0;
+  motion_set_buttons(&b->motion, merged_buttons(b));
+  uint32_t now = bridge_micros();
+  b->out.timestamp_us = now;
+  write_frames(b, now, now, false);
+}
+
+static void handle_reports(bridge_t *b) {
+  const report_entry_t *entry;
+  bool any = false;
+  uint32_t oldest_us = 0;
+  uint32_t decoded_us = 0;
+  // Drain everything queued since the last wakeup.
+  while ((entry = report_queue_peek(b->queue)) != NULL) {
+    apply_requests(b);
+    mouse_values_t mv;
+    extract_report_values(entry->layout, entry->data, entry->len, &mv);
+    decoded_us = bridge_micros();
+    latency_hist_add(&b->decode_latency, decoded_us - entry->timestamp_us);
+    if (!any) oldest_us = entry->timestamp_us;
+    b->out.timestamp_us = entry->timestamp_us;
+    merge_report(b, entry->device, &mv);
+    report_queue_pop(b->queue);
+    motion_add(&b->motion, &mv);
+    any = true;
+  }
+  if (!any) return;
+  write_frames(b, decoded_us, oldest_us, true);
+  b->last_report_us = bridge_micros();
+  bridge_timer_once(&b->idle_timer, BRIDGE_IDLE_US);
+}
+
+static void handle_idle(bridge_t *b) {
+  // The timer may have fired just before reports restarted it.
+  uint32_t now = bridge_micros();
+  if ((now - b->last_report_us) < BRIDGE_IDLE_US) return;
+  // Center x,y if no HID report for BRIDGE_IDLE_US, or let the stick
+  // drift back in CURVE_INTEGRATE. Preserve the buttons.
+  int32_t x, y;
+  curve_idle(&b->curve, now, &x, &y);
+  b->out.x = joy_axis(x);
+  b->out.y = joy_axis(y);
+  b->out.timestamp_us = now;
+  b->out.measure = false;
+  b->write(b->write_ctx, &b->out);
+  b->idle_writes++;
+  b->last_report_us = now;
+  bridge_timer_once(&b->idle_timer, BRIDGE_IDLE_US);
+}
+
+void bridge_handle_events(bridge_t *b, uint32_t events) {
+  b->wakeups++;
+  apply_requests(b);
+  if (events & BRIDGE_EVENT_REPORT) handle_reports(b);
+  if (events & BRIDGE_EVENT_IDLE) handle_idle(b);
+}
+
+#if DEBUG_BRIDGE_MAIN
+/*
+ * Wakeup latency test. Build and run on Linux with
+ *   gcc -O2 -pthread -DDEBUG_BRIDGE_MAIN=1 -o bridge_test bridge.c \
+ *     bridge_os.c report_queue.c motion.c report_desc.c latency_hist.c \
+ *     curve.c -lm
+ * A producer thread stands in for notifyCB: it pushes a boot mouse report
+ * every millisecond and signals the bridge task, which runs the same event
+ * loop as the ESP32. Prints the time from push to joystick write (p50, p99,
+ * max) and checks every report is handled, no idle report is sent while
+ * reports arrive, X, Y are centered BRIDGE_IDLE_US after they stop, and the
+ * bridge latency histograms count every report and are no less than the
+ * times measured here. Then reports from a second device with a button
+ * offset of 8 check the buttons of both are merged and released when the
+ * second device is removed.
+ */
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include "./hid_corpus.h"
+
+#define TEST_REPORTS  (2000)
+
+static report_queue_t Queue;
+static bridge_events_t Events;
+static bridge_t Bridge;
+static hid_layout_t Layout;
+static uint32_t Latency[TEST_REPORTS];
+static uint32_t Latency_Count;
+static uint32_t Last_Push_us;
+static volatile uint32_t Center_us;
+static volatile int Phase;    // 0 warm up, 1 reports, 2 after reports
+static joy_output_t Last_Out;
+
+static void test_write(void *ctx, const joy_output_t *out) {
+  (void)ctx;
+  uint32_t now = bridge_micros();
+  Last_Out = *out;
+  if (Phase == 2) {
+    if (Center_us == 0) Center_us = now;
+  } else if ((Phase == 1) && (Latency_Count < TEST_REPORTS)) {
+    Latency[Latency_Count++] = now - out->timestamp_us;
+  }
+}
+
+static void bridge_task(void *arg) {
+  (void)arg;
+  bridge_events_bind(&Events);
+  for (;;) {
+    uint32_t events = bridge_events_wait(&Events, BRIDGE_WAIT_FOREVER);
+    bridge_handle_events(&Bridge, events);
+    // The sketch removes a device when its link is lost.
+    if (events & BRIDGE_EVENT_CONN) bridge_remove_device(&Bridge, 1);
+  }
+}
+
+static int cmp_u32(const void *a, const void *b) {
+  uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+  return (x > y) - (x < y);
+}
+
+int main(void) {
+  int errors = 0;
+  const uint8_t report[3] = { 0x01, 0x05, 0xFB };
+  hid_layout_parse(&Layout, boot_mouse_desc, sizeof(boot_mouse_desc), false);
+  const hid_report_layout_t *layout = hid_layout_first_mouse(&Layout);
+  report_queue_init(&Queue);
+  bridge_events_init(&Events);
+  if (!bridge_init(&Bridge, &Queue, &Events, test_write, NULL) ||
+      !bridge_task_start(bridge_task, NULL, "bridge", 8192, 5)) {
+    printf("start FAIL\n");
+    return 1;
+  }
+  // Let the first idle report go by.
+  usleep(2 * BRIDGE_IDLE_US);
+  uint32_t idle_before = Bridge.idle_writes;
+  Phase = 1;
+  for (uint32_t i = 0; i < TEST_REPORTS; i++) {
+    Last_Push_us = bridge_micros();
+    report_queue_push(&Queue, Last_Push_us, 0, layout, 0, report,
+        sizeof(report));
+    bridge_events_signal(&Events, BRIDGE_EVENT_REPORT);
+    usleep(1000);
+  }
+  uint32_t idle_during = Bridge.idle_writes - idle_before;
+  Phase = 2;
+  usleep(3 * BRIDGE_IDLE_US);
+
+  if (Bridge.motion.reports != TEST_REPORTS) errors++;
+  if ((Latency_Count == 0) || (idle_during != 0)) errors++;
+  uint32_t center_after = Center_us - Last_Push_us;
+  if ((Center_us == 0) || (center_after < BRIDGE_IDLE_US) ||
+      (center_after > 2 * BRIDGE_IDLE_US)) {
+    errors++;
+  }
+  qsort(Latency, Latency_Count, sizeof(Latency[0]), cmp_u32);
+  printf("reports %"PRIu32" writes %"PRIu32" wakeups %"PRIu32
+      " latency us p50 %"PRIu32" p99 %"PRIu32" max %"PRIu32"\n",
+      Bridge.motion.reports, Bridge.writes, Bridge.wakeups,
+      Latency[Latency_Count / 2], Latency[Latency_Count * 99 / 100],
+      Latency[Latency_Count - 1]);
+  latency_summary_t total;
+  latency_hist_summary(&Bridge.total_latency, &total);
+  if ((total.count != Bridge.writes) ||
+      (Bridge.decode_latency.total != Bridge.motion.reports) ||
+      (total.p50 < Latency[Latency_Count / 2]) ||
+      (total.max < Latency[Latency_Count - 1])) {
+    errors++;
+  }
+  printf("histogram us p50 %"PRIu32" p99 %"PRIu32" max %"PRIu32
+      " count %"PRIu32"\n", total.p50, total.p99, total.max, total.count);
+  printf("idle reports during stream %"PRIu32", centered %"PRIu32
+      " us after last report\n", idle_during, center_after);
+
+  // Device 0 buttons 1, device 1 buttons 1, 2 as joystick buttons 9, 10.
+  Phase = 3;
+  bridge_add_device(&Bridge, 1, 8);
+  static const uint8_t press[3] = { 0x01, 0x00, 0x00 };
+  static const uint8_t press2[3] = { 0x03, 0x00, 0x00 };
+  static const uint8_t release[3] = { 0x00, 0x00, 0x00 };
+  static const struct {
+    uint8_t device;
+    const uint8_t *report;
+    uint32_t expect;
+  } steps[] = {
+    { 0, press, 0x0001 },
+    { 1, press2, 0x0301 },
+    { 0, release, 0x0300 },
+    { 0, press, 0x0301 },
+  };
+  uint32_t merge_errors = 0;
+  for (size_t i = 0; i < sizeof(steps) / sizeof(steps[0]); i++) {
+    report_queue_push(&Queue, bridge_micros(), steps[i].device, layout, 0,
+        steps[i].report, sizeof(press));
+    bridge_events_signal(&Events, BRIDGE_EVENT_REPORT);
+    usleep(2000);
+    if (Last_Out.buttons != steps[i].expect) merge_errors++;
+  }
+  bridge_events_signal(&Events, BRIDGE_EVENT_CONN);
+  usleep(2000);
+  if ((Last_Out.buttons != 0x0001) || (Bridge.devices[1].reports != 1)) {
+    merge_errors++;
+  }
+  printf("merged buttons of 2 devices, errors %"PRIu32"\n", merge_errors);
+  errors += merge_errors;
+  printf("errors %d\n", errors);
+  return errors;
+}
+#endif
+
+#if DEBUG_AXIS_MAIN
+/*
+ * Axis accuracy benchmark. Build and run on Linux with
+ *   gcc -O2 -pthread -DDEBUG_AXIS_MAIN=1 -o axis_bench bridge.c \
+ *     bridge_os.c report_queue.c motion.c report_desc.c latency_hist.c \
+ *     curve.c -lm
+ * Replays 1000 Hz streams of a 16000 CPI mouse, from slow drift to a
+ * flick, through the steps the bridge uses: reports encoded for each
+ * corpus device with X, Y, decoded by extract_report_values(), coalesced
+ * by motion, mapped by the linear curve with the range set to the peak
+ * speed, and joy_axis(). A device clips counts to its field size, as a
+ * real one does. The error is the axis value minus the exact deflection
+ * of the same counts, in axis steps, per frame and averaged over
+ * AXIS_AVERAGE frames. Checks no value wraps, every frame is within one
+ * step, and the average within a quarter step. Then prints reports per
+ * second through the whole path.
+ */
+#include <inttypes.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "./hid_corpus.h"
+
+#define AXIS_REPORTS  (20000)     // 20 s at 1000 Hz
+#define AXIS_AVERAGE  (8)
+#define AXIS_CPI      (16000)
+#define USAGE_X       (0x00010030UL)
+#define USAGE_Y       (0x00010031UL)
+
+typedef struct {
+  const char *name;
+  double peak_mm_s;
+  uint32_t per_frame;       // reports coalesced into one USB frame
+} axis_stream_t;
+
+static const axis_stream_t Streams[] = {
+  { "drift 5 mm/s", 5, 1 },
+  { "move 200 mm/s", 200, 1 },
+  { "fast 1 m/s", 1000, 1 },
+  { "flick 10 m/s", 10000, 1 },
+  { "flick, 8 per frame", 10000, 8 },
+};
+
+static const field_t *find_field(const hid_report_layout_t *layout,
+    uint32_t usage) {
+  for (uint32_t i = 0; i < layout->field_count; i++) {
+    if (layout->fields[i].usage == usage) return &layout->fields[i];
+  }
+  return NULL;
+}
+
+static void put_bits(uint8_t *report, const field_t *f, int32_t v) {
+  for (uint32_t i = 0; i < f->len_in_bits; i++) {
+    uint32_t bit = f->offset_byte * 8 + f->offset_bit + i;
+    if ((v >> i) & 1) {
+      report[bit / 8] |= 1 << (bit % 8);
+    } else {
+      report[bit / 8] &= ~(1 << (bit % 8));
+    }
+  }
+}
+
+static int32_t clip(int32_t v, const field_t *f) {
+  int32_t max = (1L << (f->len_in_bits - 1)) - 1;
+  return (v > max) ? max : (v < -max - 1) ? -max - 1 : v;
+}
+
+typedef struct {
+  uint8_t data[16];
+  int32_t dx, dy;           // after clipping by the device
+} axis_report_t;
+
+static axis_report_t Reports[AXIS_REPORTS];
+static uint16_t Out_X[AXIS_REPORTS];
+static uint16_t Out_Y[AXIS_REPORTS];
+
+// Sensor counts of one report: position rounded to counts, X a sine of
+// the speed, Y the same speed reversed and a quarter period later.
+static void make_stream(const axis_stream_t *s, const field_t *fx,
+    const field_t *fy, uint32_t *clipped) {
+  const double peak = s->peak_mm_s * AXIS_CPI / 25.4 / 1000;   // counts/ms
+  const double period = 2000;
+  double px = 0, py = 0;
+  int32_t cx = 0, cy = 0;
+  *clipped = 0;
+  for (uint32_t i = 0; i < AXIS_REPORTS; i++) {
+    px += peak * sin(2 * M_PI * i / period);
+    py -= peak * cos(2 * M_PI * i / period);
+    int32_t dx = (int32_t)lround(px) - cx;
+    int32_t dy = (int32_t)lround(py) - cy;
+    cx += dx;
+    cy += dy;
+    axis_report_t *r = &Reports[i];
+    memset(r->data, 0, sizeof(r->data));
+    r->dx = clip(dx, fx);
+    r->dy = clip(dy, fy);
+    if ((r->dx != dx) || (r->dy != dy)) (*clipped)++;
+    put_bits(r->data, fx, r->dx);
+    put_bits(r->data, fy, r->dy);
+  }
+}
+
+// The bridge path for every report. Returns the number of frames.
+static uint32_t replay(const hid_report_layout_t *layout, size_t len,
+    uint32_t per_frame, curve_t *curve, motion_t *motion) {
+  uint32_t frames = 0;
+  for (uint32_t i = 0; i < AXIS_REPORTS; i++) {
+    mouse_values_t mv;
+    extract_report_values(layout, Reports[i].data, len, &mv);
+    motion_add(motion, &mv);
+    if (((i + 1) % per_frame) != 0) continue;
+    motion_frame_t frame;
+    while (motion_take(motion, &frame)) {
+      int32_t x, y;
+      curve_apply(curve, frame.dx, frame.dy, i * 1000, &x, &y);
+      Out_X[frames] = joy_axis(x);
+      Out_Y[frames] = joy_axis(y);
+      frames++;
+    }
+  }
+  return frames;
+}
+
+static double exact_axis(int64_t counts, uint32_t range) {
+  double d = (double)counts / range;
+  if (d > 1) d = 1;
+  if (d < -1) d = -1;
+  double v = JOY_AXIS_CENTER + d * CURVE_OUT_MAX;
+  return (v < 0) ? 0 : (v > JOY_AXIS_MAX) ? JOY_AXIS_MAX : v;
+}
+
+typedef struct {
+  double max;
+  double sum;
+  double sum_sq;
+  double avg_max;
+  uint32_t count;
+  uint32_t wrapped;         // output on the wrong side of center
+} axis_error_t;
+
+static void measure(axis_error_t *e, const uint16_t *out, uint32_t frames,
+    uint32_t per_frame, uint32_t range, bool y) {
+  double window = 0;
+  for (uint32_t f = 0; f < frames; f++) {
+    int64_t counts = 0;
+    for (uint32_t i = 0; i < per_frame; i++) {
+      const axis_report_t *r = &Reports[f * per_frame + i];
+      counts += y ? r->dy : r->dx;
+    }
+    double err = out[f] - exact_axis(counts, range);
+    if (fabs(err) > e->max) e->max = fabs(err);
+    e->sum += err;
+    e->sum_sq += err * err;
+    e->count++;
+    if (((counts > 0) && (out[f] < JOY_AXIS_CENTER)) ||
+        ((counts < 0) && (out[f] > JOY_AXIS_CENTER))) {
+      e->wrapped++;
+    }
+    window += err;
+    if ((f % AXIS_AVERAGE) == AXIS_AVERAGE - 1) {
+      double avg = fabs(window / AXIS_AVERAGE);
+      if (avg > e->avg_max) e->avg_max = avg;
+      window = 0;
+    }
+  }
+}
+
+int main(void) {
+  int errors = 0;
+  static curve_t curve;
+  static motion_t motion;
+  static hid_layout_t layout;
+  printf("%-20s %-20s %7s %8s %8s %8s %8s %7s\n", "device", "stream",
+      "clipped", "max", "rms", "mean", "avg8 max", "wrapped");
+  for (size_t d = 0; d < sizeof(HID_Corpus) / sizeof(HID_Corpus[0]); d++) {
+    const corpus_device_t *dev = &HID_Corpus[d];
+    hid_layout_parse(&layout, dev->desc, dev->desc_len, dev->report_id);
+    const hid_report_layout_t *mouse = hid_layout_first_mouse(&layout);
+    const field_t *fx = mouse ? find_field(mouse, USAGE_X) : NULL;
+    const field_t *fy = mouse ? find_field(mouse, USAGE_Y) : NULL;
+    if ((fx == NULL) || (fy == NULL)) continue;
+    size_t len = (mouse->total_bits + 7) / 8;
+    for (size_t s = 0; s < sizeof(Streams) / sizeof(Streams[0]); s++) {
+      const axis_stream_t *stream = &Streams[s];
+      uint32_t clipped;
+      make_stream(stream, fx, fy, &clipped);
+      uint32_t peak = 0;
+      for (uint32_t i = 0; i < AXIS_REPORTS; i++) {
+        uint32_t m = (uint32_t)abs(Reports[i].dx);
+        if (m > peak) peak = m;
+      }
+      curve_config_t cfg = CURVE_CONFIG_DEFAULT;
+      cfg.auto_range = false;
+      uint32_t range = peak * stream->per_frame;
+      cfg.range = (range > UINT16_MAX) ? UINT16_MAX : (uint16_t)range;
+      curve_init(&curve, &cfg);
+      motion_init(&motion);
+      uint32_t frames = replay(mouse, len, stream->per_frame, &curve, &motion);
+      axis_error_t e = { 0 };
+      measure(&e, Out_X, frames, stream->per_frame, cfg.range, false);
+      measure(&e, Out_Y, frames, stream->per_frame, cfg.range, true);
+      bool ok = (frames == AXIS_REPORTS / stream->per_frame) &&
+        (e.wrapped == 0) && (e.max <= 1.0) && (e.avg_max <= 0.25) &&
+        (motion.saturated == 0);
+      printf("%-20s %-20s %7"PRIu32" %8.3f %8.3f %8.4f %8.3f %7"PRIu32" %s\n",
+          dev->name, stream->name, clipped, e.max, sqrt(e.sum_sq / e.count),
+          e.sum / e.count, e.avg_max, e.wrapped, ok ? "OK" : "FAIL");
+      if (!ok) errors++;
+    }
+    // Throughput of the whole path on the fast stream.
+    make_stream(&Streams[2], fx, fy, &(uint32_t){ 0 });
+    curve_init(&curve, NULL);
+    motion_init(&motion);
+    const uint32_t loops = 50;
+    struct timespec t0, t1;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    for (uint32_t n = 0; n < loops; n++) replay(mouse, len, 1, &curve, &motion);
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    double ns = ((t1.tv_sec - t0.tv_sec) * 1e9 + (t1.tv_nsec - t0.tv_nsec)) /
+      ((double)loops * AXIS_REPORTS);
+    printf("%-20s decode + motion + curve + axis %.1f ns per report, %.1f M reports/s\n",
+        dev->name, ns, 1000 / ns);
+  }
+  printf("errors %d\n", errors);
+  return errors;
+}
+#endif
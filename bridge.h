@@ -0,0 +1,185 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2023 touchgadgetdev@gmail.com
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef _BRIDGE_H_
+#define _BRIDGE_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include "./bridge_os.h"
+#include "./report_queue.h"
+#include "./motion.h"
+#include "./latency_hist.h"
+#include "./curve.h"
+
+/*
+ * The report path of the bridge task: queued HID reports are decoded,
+ * merged, coalesced, mapped to the joystick axes by the transfer curve and
+ * written. The task sleeps until notifyCB signals BRIDGE_EVENT_REPORT or the
+ * idle timer signals BRIDGE_EVENT_IDLE. The other event bits are handled by
+ * the caller.
+ *
+ * Reports from up to BRIDGE_DEVICES_MAX connected devices are merged into
+ * one joystick. The buttons of each device are shifted by its button
+ * offset and ORed with the buttons of the others. X, Y motion of all
+ * devices is summed, so a trackball and a clicker work together.
+ */
+
+#define BRIDGE_EVENT_REPORT   (1u << 0)   // reports queued
+#define BRIDGE_EVENT_IDLE     (1u << 1)   // no reports for BRIDGE_IDLE_US
+#define BRIDGE_EVENT_CONNECT  (1u << 3)   // a HID device connected
+#define BRIDGE_EVENT_CONN     (1u << 5)   // connection parameters changed or link lost
+#define BRIDGE_EVENT_USB      (1u << 6)   // time to retry the USB endpoint
+
+// Center X, Y when no report arrives for this long. Repeated while idle.
+#define BRIDGE_IDLE_US        (32000)
+
+// Devices merged, report_entry_t.device is 0..BRIDGE_DEVICES_MAX-1
+#define BRIDGE_DEVICES_MAX    (4)
+// Joystick buttons. Device buttons shifted past this are lost.
+#define BRIDGE_BUTTONS_MAX    (16)
+
+#define JOY_AXIS_MAX          (1023)
+#define JOY_AXIS_CENTER       (511)
+
+/*
+ * Joystick values for one USB report. timestamp_us is the arrival time of
+ * the newest BLE report included. If measure is true the report counts in
+ * the write and total latency: decoded_us is when the newest report was
+ * decoded and oldest_us when the oldest arrived.
+ */
+typedef struct {
+  uint16_t x;
+  uint16_t y;
+  uint32_t buttons;
+  uint32_t timestamp_us;
+  uint32_t decoded_us;
+  uint32_t oldest_us;
+  bool measure;
+} joy_output_t;
+
+typedef void (*bridge_write_fn)(void *ctx, const joy_output_t *out);
+
+/*
+ * Merge state of one device.
+ */
+typedef struct {
+  uint32_t buttons;         // last buttons, shifted by button_offset
+  uint8_t button_offset;    // joystick button of device button 1, 0 based
+  uint8_t add_offset;       // button_offset of bridge_add_device()
+  uint32_t reports;         // reports decoded
+} bridge_device_t;
+
+typedef struct {
+  report_queue_t *queue;
+  bridge_events_t *events;
+  bridge_timer_t idle_timer;
+  bridge_write_fn write;
+  void *write_ctx;
+  bridge_device_t devices[BRIDGE_DEVICES_MAX];
+  motion_t motion;
+  joy_output_t out;
+  curve_t curve;
+  uint32_t last_report_us;
+  bool latency_on_sent;     // see bridge_latency_on_sent()
+  // bridge_add_device(), bridge_reset_range() and bridge_reset_latency()
+  // calls not yet applied by the bridge task. Bit n is device n.
+  uint32_t requests;
+  // Statistics
+  uint32_t wakeups;
+  uint32_t writes;
+  uint32_t idle_writes;
+  // Latency in us. BLE notification to report decoded, decoded to
+  // joystick report sent to the endpoint, and notification to sent. The
+  // last is from the oldest report in the USB report.
+  latency_hist_t decode_latency;
+  latency_hist_t write_latency;
+  latency_hist_t total_latency;
+} bridge_t;
+
+/*
+ * Start the idle timer. write is called from the bridge task for every
+ * joystick report.
+ */
+bool bridge_init(bridge_t *b, report_queue_t *queue, bridge_events_t *events,
+    bridge_write_fn write, void *write_ctx);
+
+/*
+ * Replace the transfer curve. cfg NULL for the default. Call before the
+ * bridge task starts or from it. Returns false if cfg is invalid; the
+ * default is used.
+ */
+bool bridge_set_curve(bridge_t *b, const curve_config_t *cfg);
+
+/*
+ * Forget the axis ranges and stick position. Call when a new device
+ * connects. Any task may call it; the bridge task applies it before it
+ * decodes the next report.
+ */
+void bridge_reset_range(bridge_t *b);
+
+/*
+ * Start merging a newly connected device. Its button 1 becomes joystick
+ * button button_offset + 1. Any task may call it before the reports of
+ * the device are subscribed; the bridge task applies it before it decodes
+ * the first of them.
+ */
+void bridge_add_device(bridge_t *b, uint8_t device, uint8_t button_offset);
+
+/*
+ * Release the buttons of a device that disconnected. The joystick report
+ * is sent at once if the merged buttons change. Call from the bridge task
+ * after the reports queued by the device have been handled.
+ */
+void bridge_remove_device(bridge_t *b, uint8_t device);
+
+/*
+ * Clear the latency histograms. Any task may call it; the bridge task
+ * applies it when it next wakes up.
+ */
+void bridge_reset_latency(bridge_t *b);
+
+/*
+ * For a write function that queues reports instead of sending them. The
+ * write and total latency are no longer taken when write returns; call
+ * bridge_report_sent() from the bridge task when each report measured
+ * goes to the endpoint.
+ */
+void bridge_latency_on_sent(bridge_t *b);
+
+/*
+ * Add the write and total latency of a report sent at sent_us, with the
+ * decoded_us and oldest_us of its joy_output_t.
+ */
+void bridge_report_sent(bridge_t *b, uint32_t decoded_us, uint32_t oldest_us,
+    uint32_t sent_us);
+
+/*
+ * Handle BRIDGE_EVENT_REPORT and BRIDGE_EVENT_IDLE. Call from the bridge
+ * task with the bits returned by bridge_events_wait().
+ */
+void bridge_handle_events(bridge_t *b, uint32_t events);
+
+#endif  /* _BRIDGE_H_ */
@@ -0,0 +1,285 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2023 touchgadgetdev@gmail.com
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#if !defined(ARDUINO)
+#define _GNU_SOURCE     // pthread_setaffinity_np()
+#endif
+#include <string.h>
+#include "./bridge_os.h"
+
+// The event bits are kept in pending on both platforms. The OS object is
+// only used to sleep and wake, so a signal before the task waits is not lost.
+
+#if defined(ARDUINO)
+
+void bridge_events_init(bridge_events_t *ev) {
+  memset(ev, 0, sizeof(*ev));
+}
+
+void bridge_events_bind(bridge_events_t *ev) {
+  __atomic_store_n(&ev->task, xTaskGetCurrentTaskHandle(), __ATOMIC_RELEASE);
+}
+
+void bridge_events_signal(bridge_events_t *ev, uint32_t bits) {
+  __atomic_fetch_or(&ev->pending, bits, __ATOMIC_RELEASE);
+  TaskHandle_t task = __atomic_load_n(&ev->task, __ATOMIC_ACQUIRE);
+  if (task != NULL) xTaskNotifyGive(task);
+}
+
+uint32_t bridge_events_wait(bridge_events_t *ev, uint32_t timeout_ms) {
+  uint32_t bits = __atomic_exchange_n(&ev->pending, 0, __ATOMIC_ACQUIRE);
+  if (bits != 0) return bits;
+  ulTaskNotifyTake(pdTRUE, (timeout_ms == BRIDGE_WAIT_FOREVER) ?
+      portMAX_DELAY : pdMS_TO_TICKS(timeout_ms));
+  return __atomic_exchange_n(&ev->pending, 0, __ATOMIC_ACQUIRE);
+}
+
+static void timer_cb(void *arg) {
+  bridge_timer_t *t = (bridge_timer_t *)arg;
+  t->fn(t->arg);
+}
+
+bool bridge_timer_init(bridge_timer_t *t, const char *name,
+    bridge_timer_fn fn, void *arg) {
+  memset(t, 0, sizeof(*t));
+  t->fn = fn;
+  t->arg = arg;
+  esp_timer_create_args_t args = {
+    .callback = timer_cb,
+    .arg = t,
+    .dispatch_method = ESP_TIMER_TASK,
+    .name = name,
+  };
+  return esp_timer_create(&args, &t->handle) == ESP_OK;
+}
+
+void bridge_timer_once(bridge_timer_t *t, uint32_t timeout_us) {
+  esp_timer_stop(t->handle);    // fails harmlessly if not running
+  esp_timer_start_once(t->handle, timeout_us);
+}
+
+void bridge_timer_periodic(bridge_timer_t *t, uint32_t period_us) {
+  esp_timer_stop(t->handle);
+  esp_timer_start_periodic(t->handle, period_us);
+}
+
+void bridge_timer_stop(bridge_timer_t *t) {
+  esp_timer_stop(t->handle);
+}
+
+bool bridge_task_start(void (*fn)(void *), void *arg, const char *name,
+    uint32_t stack_size, uint32_t priority) {
+  return xTaskCreate(fn, name, stack_size, arg, priority, NULL) == pdPASS;
+}
+
+bool bridge_task_start_on(void (*fn)(void *), void *arg, const char *name,
+    uint32_t stack_size, uint32_t priority, int core) {
+  return xTaskCreatePinnedToCore(fn, name, stack_size, arg, priority, NULL,
+      (core == BRIDGE_CORE_ANY) ? tskNO_AFFINITY : (BaseType_t)core) == pdPASS;
+}
+
+uint32_t bridge_micros(void) {
+  return (uint32_t)esp_timer_get_time();
+}
+
+#else
+#include <sched.h>
+#include <time.h>
+#include <unistd.h>
+
+static uint64_t now_us(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static void to_timespec(uint64_t us, struct timespec *ts) {
+  ts->tv_sec = us / 1000000;
+  ts->tv_nsec = (us % 1000000) * 1000;
+}
+
+static void init_monotonic(pthread_mutex_t *lock, pthread_cond_t *cond) {
+  pthread_condattr_t attr;
+  pthread_mutex_init(lock, NULL);
+  pthread_condattr_init(&attr);
+  pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+  pthread_cond_init(cond, &attr);
+  pthread_condattr_destroy(&attr);
+}
+
+void bridge_events_init(bridge_events_t *ev) {
+  memset(ev, 0, sizeof(*ev));
+  init_monotonic(&ev->lock, &ev->cond);
+}
+
+void bridge_events_bind(bridge_events_t *ev) {
+  (void)ev;
+}
+
+void bridge_events_signal(bridge_events_t *ev, uint32_t bits) {
+  __atomic_fetch_or(&ev->pending, bits, __ATOMIC_RELEASE);
+  pthread_mutex_lock(&ev->lock);
+  ev->wake = true;
+  pthread_cond_signal(&ev->cond);
+  pthread_mutex_unlock(&ev->lock);
+}
+
+uint32_t bridge_events_wait(bridge_events_t *ev, uint32_t timeout_ms) {
+  uint32_t bits = __atomic_exchange_n(&ev->pending, 0, __ATOMIC_ACQUIRE);
+  if (bits != 0) return bits;
+  struct timespec deadline;
+  to_timespec(now_us() + (uint64_t)timeout_ms * 1000, &deadline);
+  pthread_mutex_lock(&ev->lock);
+  while (!ev->wake) {
+    if (timeout_ms == BRIDGE_WAIT_FOREVER) {
+      pthread_cond_wait(&ev->cond, &ev->lock);
+    } else if (pthread_cond_timedwait(&ev->cond, &ev->lock, &deadline) != 0) {
+      break;
+    }
+  }
+  ev->wake = false;
+  pthread_mutex_unlock(&ev->lock);
+  return __atomic_exchange_n(&ev->pending, 0, __ATOMIC_ACQUIRE);
+}
+
+// One thread per timer sleeps until the deadline. Starting or stopping the
+// timer wakes it to recompute the deadline.
+static void *timer_thread(void *arg) {
+  bridge_timer_t *t = (bridge_timer_t *)arg;
+  pthread_mutex_lock(&t->lock);
+  for (;;) {
+    if (!t->armed) {
+      pthread_cond_wait(&t->cond, &t->lock);
+      continue;
+    }
+    uint64_t now = now_us();
+    if (now < t->deadline_us) {
+      struct timespec deadline;
+      to_timespec(t->deadline_us, &deadline);
+      pthread_cond_timedwait(&t->cond, &t->lock, &deadline);
+      continue;
+    }
+    if (t->period_us != 0) {
+      t->deadline_us += t->period_us;
+    } else {
+      t->armed = false;
+    }
+    pthread_mutex_unlock(&t->lock);
+    t->fn(t->arg);
+    pthread_mutex_lock(&t->lock);
+  }
+  return NULL;
+}
+
+bool bridge_timer_init(bridge_timer_t *t, const char *name,
+    bridge_timer_fn fn, void *arg) {
+  (void)name;
+  memset(t, 0, sizeof(*t));
+  t->fn = fn;
+  t->arg = arg;
+  init_monotonic(&t->lock, &t->cond);
+  if (pthread_create(&t->thread, NULL, timer_thread, t) != 0) return false;
+  pthread_detach(t->thread);
+  return true;
+}
+
+static void timer_arm(bridge_timer_t *t, uint32_t us, uint32_t period_us) {
+  pthread_mutex_lock(&t->lock);
+  t->deadline_us = now_us() + us;
+  t->period_us = period_us;
+  t->armed = true;
+  pthread_cond_signal(&t->cond);
+  pthread_mutex_unlock(&t->lock);
+}
+
+void bridge_timer_once(bridge_timer_t *t, uint32_t timeout_us) {
+  timer_arm(t, timeout_us, 0);
+}
+
+void bridge_timer_periodic(bridge_timer_t *t, uint32_t period_us) {
+  timer_arm(t, period_us, period_us);
+}
+
+void bridge_timer_stop(bridge_timer_t *t) {
+  pthread_mutex_lock(&t->lock);
+  t->armed = false;
+  pthread_cond_signal(&t->cond);
+  pthread_mutex_unlock(&t->lock);
+}
+
+typedef struct {
+  void (*fn)(void *);
+  void *arg;
+  int core;
+} task_start_t;
+
+static task_start_t Task_Starts[8];
+static uint32_t Task_Start_Count;
+
+static void *task_thread(void *arg) {
+  task_start_t *start = (task_start_t *)arg;
+  if (start->core != BRIDGE_CORE_ANY) bridge_thread_pin(start->core);
+  start->fn(start->arg);
+  return NULL;
+}
+
+bool bridge_thread_pin(int core) {
+  if ((core < 0) || (core >= CPU_SETSIZE) ||
+      (core >= sysconf(_SC_NPROCESSORS_ONLN))) {
+    return false;
+  }
+  cpu_set_t cpus;
+  CPU_ZERO(&cpus);
+  CPU_SET(core, &cpus);
+  return pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus) == 0;
+}
+
+bool bridge_task_start(void (*fn)(void *), void *arg, const char *name,
+    uint32_t stack_size, uint32_t priority) {
+  return bridge_task_start_on(fn, arg, name, stack_size, priority,
+      BRIDGE_CORE_ANY);
+}
+
+bool bridge_task_start_on(void (*fn)(void *), void *arg, const char *name,
+    uint32_t stack_size, uint32_t priority, int core) {
+  (void)name;
+  (void)stack_size;
+  (void)priority;
+  pthread_t thread;
+  uint32_t i = __atomic_fetch_add(&Task_Start_Count, 1, __ATOMIC_RELAXED);
+  if (i >= sizeof(Task_Starts) / sizeof(Task_Starts[0])) return false;
+  Task_Starts[i].fn = fn;
+  Task_Starts[i].arg = arg;
+  Task_Starts[i].core = core;
+  if (pthread_create(&thread, NULL, task_thread, &Task_Starts[i]) != 0) {
+    return false;
+  }
+  pthread_detach(thread);
+  return true;
+}
+
+uint32_t bridge_micros(void) {
+  return (uint32_t)now_us();
+}
+#endif
@@ -0,0 +1,148 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2023 touchgadgetdev@gmail.com
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef _BRIDGE_OS_H_
+#define _BRIDGE_OS_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+/*
+ * The few OS services the bridge task needs: event bits to wake one task,
+ * timers, task creation, and a microsecond clock. On the ESP32 these are
+ * FreeRTOS task notifications, esp_timer, and xTaskCreate. On a Linux host
+ * they are pthreads so the same task code can be run and timed without
+ * hardware.
+ */
+
+#if defined(ARDUINO)
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <esp_timer.h>
+#else
+#include <pthread.h>
+#endif
+
+#define BRIDGE_WAIT_FOREVER (UINT32_MAX)
+
+/*
+ * Event bits for one waiting task. Any task or timer callback may signal.
+ * Only the task that called bridge_events_bind() may wait.
+ */
+typedef struct {
+  uint32_t pending;
+#if defined(ARDUINO)
+  TaskHandle_t task;
+#else
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+  bool wake;
+#endif
+} bridge_events_t;
+
+typedef void (*bridge_timer_fn)(void *arg);
+
+typedef struct {
+  bridge_timer_fn fn;
+  void *arg;
+#if defined(ARDUINO)
+  esp_timer_handle_t handle;
+#else
+  pthread_t thread;
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+  uint64_t deadline_us;
+  uint32_t period_us;     // 0 for one shot
+  bool armed;
+#endif
+} bridge_timer_t;
+
+void bridge_events_init(bridge_events_t *ev);
+
+/*
+ * Make the calling task the one woken by bridge_events_signal().
+ */
+void bridge_events_bind(bridge_events_t *ev);
+
+/*
+ * Set bits and wake the waiting task. Never blocks. Not for ISRs.
+ */
+void bridge_events_signal(bridge_events_t *ev, uint32_t bits);
+
+/*
+ * Wait up to timeout_ms for at least one bit. Returns the bits set since
+ * the last call and clears them. Returns 0 on timeout.
+ */
+uint32_t bridge_events_wait(bridge_events_t *ev, uint32_t timeout_ms);
+
+/*
+ * Create a stopped timer. fn runs in a timer task/thread, not in the task
+ * that started the timer, so it should only signal events.
+ */
+bool bridge_timer_init(bridge_timer_t *t, const char *name,
+    bridge_timer_fn fn, void *arg);
+
+/*
+ * Start the timer to fire once after timeout_us. Restarts it if it is
+ * already running.
+ */
+void bridge_timer_once(bridge_timer_t *t, uint32_t timeout_us);
+
+/*
+ * Start the timer to fire every period_us. Restarts it if it is already
+ * running.
+ */
+void bridge_timer_periodic(bridge_timer_t *t, uint32_t period_us);
+
+void bridge_timer_stop(bridge_timer_t *t);
+
+/*
+ * Start fn(arg) in a new task. priority is a FreeRTOS priority and is
+ * ignored on Linux.
+ */
+bool bridge_task_start(void (*fn)(void *), void *arg, const char *name,
+    uint32_t stack_size, uint32_t priority);
+
+#define BRIDGE_CORE_ANY (-1)
+
+/*
+ * Like bridge_task_start() but the task only runs on core, or on any core
+ * if core is BRIDGE_CORE_ANY. On Linux the thread is pinned to CPU core if
+ * the host has it and runs on any CPU if not.
+ */
+bool bridge_task_start_on(void (*fn)(void *), void *arg, const char *name,
+    uint32_t stack_size, uint32_t priority, int core);
+
+#if !defined(ARDUINO)
+/*
+ * Pin the calling thread to CPU core. Returns false, leaving the thread
+ * where it was, if the host does not have that CPU.
+ */
+bool bridge_thread_pin(int core);
+#endif
+
+uint32_t bridge_micros(void);
+
+#endif  /* _BRIDGE_OS_H_ */
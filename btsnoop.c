@@ -0,0 +1,1154 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2023 touchgadgetdev@gmail.com
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#if !defined(ARDUINO)
+#include <stdlib.h>
+#include <string.h>
+#include "./btsnoop.h"
+#include "./report_desc.h"
+
+// btsnoop datalink types
+#define DATALINK_HCI      (1001)  // no packet type byte
+#define DATALINK_H4       (1002)  // packet type byte first
+
+#define H4_ACL            (0x02)
+#define H4_EVENT          (0x04)
+
+#define FLAG_RECEIVED     (0x01)  // controller to host
+#define FLAG_CONTROL      (0x02)  // command or event
+
+#define EVENT_DISCONNECTION_COMPLETE  (0x05)
+#define EVENT_LE_META                 (0x3E)
+#define LE_CONNECTION_COMPLETE        (0x01)
+#define LE_ENHANCED_CONNECTION_COMPLETE (0x0A)
+
+#define L2CAP_CID_ATT     (0x0004)
+#define PACKET_MAX        (2048)
+#define L2CAP_MAX         (1024)  // ATT MTU is at most 517
+
+enum {
+  ATT_ERROR_RSP = 0x01,
+  ATT_FIND_INFO_RSP = 0x05,
+  ATT_READ_BY_TYPE_REQ = 0x08,
+  ATT_READ_BY_TYPE_RSP = 0x09,
+  ATT_READ_REQ = 0x0A,
+  ATT_READ_RSP = 0x0B,
+  ATT_READ_BLOB_REQ = 0x0C,
+  ATT_READ_BLOB_RSP = 0x0D,
+  ATT_NOTIFY = 0x1B,
+  ATT_INDICATE = 0x1D,
+};
+
+enum {
+  UUID_CHARACTERISTIC = 0x2803,
+  UUID_REPORT_REFERENCE = 0x2908,
+  UUID_BOOT_MOUSE_INPUT = 0x2A33,
+  UUID_REPORT_MAP = 0x2A4B,
+  UUID_REPORT = 0x2A4D,
+};
+
+#define REPORT_TYPE_INPUT (1)
+
+typedef struct {
+  uint16_t handle;
+  uint16_t uuid;          // 0 for 128 bit UUIDs
+  uint8_t report_id;      // Report Reference of a report characteristic
+  uint8_t report_type;    // 0 if not read
+  bool emitted;           // CAPTURE_HANDLE written this connection
+} attr_t;
+
+typedef struct {
+  bool in_use;
+  uint8_t address[6];
+  attr_t attrs[BTSNOOP_ATTRS];
+  size_t attr_count;
+  uint8_t map[BTSNOOP_MAP_MAX];
+  size_t map_len;
+  hid_layout_t layout;
+  bool layout_valid;
+} device_t;
+
+// ATT request waiting for its response
+typedef struct {
+  uint8_t opcode;
+  uint16_t handle;
+  uint16_t offset;
+  uint16_t uuid;
+} pending_t;
+
+// L2CAP reassembly of one direction
+typedef struct {
+  uint8_t data[L2CAP_MAX];
+  size_t len;
+  size_t expect;          // 0 when not in a PDU
+} l2cap_t;
+
+typedef struct {
+  bool in_use;
+  uint16_t handle;
+  uint8_t device;
+  l2cap_t l2cap[2];       // by FLAG_RECEIVED
+  pending_t pending[2];   // by direction of the request
+} conn_t;
+
+typedef struct {
+  FILE *in;
+  btsnoop_record_fn record;
+  void *ctx;
+  btsnoop_stats_t *stats;
+  uint32_t datalink;
+  uint64_t first_us;
+  bool have_first;
+  uint32_t time_us;
+  device_t devices[BTSNOOP_DEVICES];
+  conn_t conns[BTSNOOP_CONNS];
+  uint8_t packet[PACKET_MAX];
+} importer_t;
+
+static uint16_t le16(const uint8_t *p) {
+  return p[0] | (p[1] << 8);
+}
+
+static uint32_t be32(const uint8_t *p) {
+  return ((uint32_t)p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+}
+
+static void emit(importer_t *im, uint8_t type, uint8_t device,
+    uint16_t handle, const uint8_t *data, size_t len) {
+  if (len > CAPTURE_DATA_MAX) len = CAPTURE_DATA_MAX;
+  capture_record_t rec = { im->time_us, handle, type, device, (uint8_t)len };
+  im->record(im->ctx, &rec, data);
+}
+
+static attr_t *find_attr(device_t *d, uint16_t handle) {
+  for (size_t i = 0; i < d->attr_count; i++) {
+    if (d->attrs[i].handle == handle) return &d->attrs[i];
+  }
+  return NULL;
+}
+
+static attr_t *add_attr(device_t *d, uint16_t handle, uint16_t uuid) {
+  attr_t *a = find_attr(d, handle);
+  if (a == NULL) {
+    if (d->attr_count >= BTSNOOP_ATTRS) return NULL;
+    a = &d->attrs[d->attr_count++];
+    memset(a, 0, sizeof(*a));
+    a->handle = handle;
+  }
+  a->uuid = uuid;
+  return a;
+}
+
+// Device of a peer address. Connections seen without their connection
+// complete event, because the log started later, have address 0.
+static int device_for(importer_t *im, const uint8_t address[6]) {
+  int free_slot = -1;
+  static const uint8_t none[6] = {0};
+  for (int i = 0; i < BTSNOOP_DEVICES; i++) {
+    device_t *d = &im->devices[i];
+    if (!d->in_use) {
+      if (free_slot < 0) free_slot = i;
+    } else if ((memcmp(address, none, 6) != 0) &&
+        (memcmp(d->address, address, 6) == 0)) {
+      return i;
+    }
+  }
+  if (free_slot >= 0) {
+    device_t *d = &im->devices[free_slot];
+    memset(d, 0, sizeof(*d));
+    d->in_use = true;
+    memcpy(d->address, address, 6);
+  }
+  return free_slot;
+}
+
+static conn_t *find_conn(importer_t *im, uint16_t handle) {
+  for (size_t i = 0; i < BTSNOOP_CONNS; i++) {
+    if (im->conns[i].in_use && (im->conns[i].handle == handle)) {
+      return &im->conns[i];
+    }
+  }
+  return NULL;
+}
+
+static conn_t *open_conn(importer_t *im, uint16_t handle,
+    const uint8_t address[6]) {
+  conn_t *c = find_conn(im, handle);
+  if (c == NULL) {
+    for (size_t i = 0; i < BTSNOOP_CONNS; i++) {
+      if (!im->conns[i].in_use) {
+        c = &im->conns[i];
+        break;
+      }
+    }
+  }
+  int device = device_for(im, address);
+  if ((c == NULL) || (device < 0)) return NULL;
+  memset(c, 0, sizeof(*c));
+  c->in_use = true;
+  c->handle = handle;
+  c->device = (uint8_t)device;
+  device_t *d = &im->devices[device];
+  for (size_t i = 0; i < d->attr_count; i++) d->attrs[i].emitted = false;
+  im->stats->connections++;
+  uint8_t button_offset = 0;
+  emit(im, CAPTURE_CONNECT, c->device, 0, &button_offset, 1);
+  return c;
+}
+
+static void report_map_data(importer_t *im, conn_t *c, uint16_t offset,
+    const uint8_t *data, size_t len) {
+  device_t *d = &im->devices[c->device];
+  if (offset == 0) {
+    d->map_len = 0;
+    im->stats->report_maps++;
+  }
+  if ((offset != d->map_len) || (offset + len > BTSNOOP_MAP_MAX)) return;
+  memcpy(&d->map[offset], data, len);
+  d->map_len += len;
+  d->layout_valid = false;
+  // Split as capture_report_map() does.
+  for (size_t done = 0; done < len; ) {
+    size_t chunk = len - done;
+    if (chunk > CAPTURE_DATA_MAX) chunk = CAPTURE_DATA_MAX;
+    emit(im, CAPTURE_MAP, c->device, offset + done, &data[done], chunk);
+    done += chunk;
+  }
+}
+
+// The value of a read of a handle not discovered in this log. Mouse
+// report maps start with Usage Page (Generic Desktop), Usage (Mouse).
+static bool looks_like_report_map(const uint8_t *data, size_t len) {
+  return (len >= 4) && (data[0] == 0x05) && (data[1] == 0x01) &&
+    (data[2] == 0x09) && (data[3] == 0x02);
+}
+
+// Report characteristic that owns a descriptor: the last one before it.
+static attr_t *report_of_descriptor(device_t *d, uint16_t handle) {
+  attr_t *owner = NULL;
+  for (size_t i = 0; i < d->attr_count; i++) {
+    attr_t *a = &d->attrs[i];
+    if ((a->uuid == UUID_REPORT) && (a->handle < handle) &&
+        ((owner == NULL) || (a->handle > owner->handle))) {
+      owner = a;
+    }
+  }
+  return owner;
+}
+
+static void notification(importer_t *im, conn_t *c, uint16_t handle,
+    const uint8_t *value, size_t len) {
+  device_t *d = &im->devices[c->device];
+  attr_t *a = find_attr(d, handle);
+  bool discovered = false;
+  for (size_t i = 0; i < d->attr_count; i++) {
+    if (d->attrs[i].uuid == UUID_CHARACTERISTIC) discovered = true;
+  }
+  if (a == NULL) {
+    // Without discovery every notification is taken as a mouse report.
+    a = discovered ? NULL : add_attr(d, handle, UUID_REPORT);
+  }
+  if ((a == NULL) ||
+      ((a->uuid != UUID_REPORT) && (a->uuid != UUID_BOOT_MOUSE_INPUT)) ||
+      ((a->report_type != 0) && (a->report_type != REPORT_TYPE_INPUT))) {
+    im->stats->skipped++;
+    return;
+  }
+  if (!a->emitted) {
+    uint8_t data[2] = { a->report_id, 0 };
+    if (a->uuid == UUID_BOOT_MOUSE_INPUT) {
+      data[1] = CAPTURE_HANDLE_BOOT;
+    } else if (a->report_type == 0) {
+      // No Report Reference. The sketch uses the first mouse report.
+      if (!d->layout_valid && (d->map_len > 0)) {
+        hid_layout_parse(&d->layout, d->map, d->map_len, false);
+        d->layout_valid = true;
+      }
+      const hid_report_layout_t *mouse =
+        d->layout_valid ? hid_layout_first_mouse(&d->layout) : NULL;
+      data[0] = (mouse != NULL) ? mouse->report_id : 0;
+    }
+    emit(im, CAPTURE_HANDLE, c->device, handle, data, sizeof(data));
+    a->emitted = true;
+  }
+  im->stats->reports++;
+  emit(im, CAPTURE_REPORT, c->device, handle, value, len);
+}
+
+static void att_pdu(importer_t *im, conn_t *c, bool received,
+    const uint8_t *pdu, size_t len) {
+  if (len < 1) return;
+  im->stats->att_pdus++;
+  device_t *d = &im->devices[c->device];
+  pending_t *request = &c->pending[received];
+  pending_t *answered = &c->pending[!received];
+  uint8_t opcode = pdu[0];
+  switch (opcode) {
+    case ATT_READ_BY_TYPE_REQ:
+      if (len < 7) return;
+      request->opcode = opcode;
+      request->uuid = (len == 7) ? le16(&pdu[5]) : 0;
+      break;
+    case ATT_READ_REQ:
+      if (len < 3) return;
+      request->opcode = opcode;
+      request->handle = le16(&pdu[1]);
+      request->offset = 0;
+      break;
+    case ATT_READ_BLOB_REQ:
+      if (len < 5) return;
+      request->opcode = opcode;
+      request->handle = le16(&pdu[1]);
+      request->offset = le16(&pdu[3]);
+      break;
+    case ATT_ERROR_RSP:
+      answered->opcode = 0;
+      break;
+    case ATT_READ_BY_TYPE_RSP: {
+      if ((answered->opcode != ATT_READ_BY_TYPE_REQ) || (len < 2)) return;
+      size_t entry = pdu[1];
+      if (entry < 2) return;
+      for (size_t p = 2; p + entry <= len; p += entry) {
+        const uint8_t *e = &pdu[p];
+        if ((answered->uuid == UUID_CHARACTERISTIC) && (entry >= 7)) {
+          // Declaration: properties, value handle, UUID
+          add_attr(d, le16(e), UUID_CHARACTERISTIC);
+          add_attr(d, le16(&e[3]), (entry == 7) ? le16(&e[5]) : 0);
+        } else if (answered->uuid == UUID_REPORT_MAP) {
+          add_attr(d, le16(e), UUID_REPORT_MAP);
+          report_map_data(im, c, 0, &e[2], entry - 2);
+        }
+      }
+      answered->opcode = 0;
+      break;
+    }
+    case ATT_FIND_INFO_RSP:
+      // Format 1 is handle, 16 bit UUID pairs.
+      if ((len < 2) || (pdu[1] != 1)) return;
+      for (size_t p = 2; p + 4 <= len; p += 4) {
+        attr_t *a = find_attr(d, le16(&pdu[p]));
+        // Keep what the characteristic declarations said.
+        if ((a == NULL) || (a->uuid == 0)) {
+          add_attr(d, le16(&pdu[p]), le16(&pdu[p + 2]));
+        }
+      }
+      break;
+    case ATT_READ_RSP:
+    case ATT_READ_BLOB_RSP: {
+      bool blob = (opcode == ATT_READ_BLOB_RSP);
+      if (answered->opcode != (blob ? ATT_READ_BLOB_REQ : ATT_READ_REQ)) return;
+      answered->opcode = 0;
+      attr_t *a = find_attr(d, answered->handle);
+      if ((a == NULL) && !blob && looks_like_report_map(&pdu[1], len - 1)) {
+        a = add_attr(d, answered->handle, UUID_REPORT_MAP);
+      }
+      if (a == NULL) return;
+      if (a->uuid == UUID_REPORT_MAP) {
+        report_map_data(im, c, answered->offset, &pdu[1], len - 1);
+      } else if ((a->uuid == UUID_REPORT_REFERENCE) && (len >= 3)) {
+        attr_t *report = report_of_descriptor(d, a->handle);
+        if (report != NULL) {
+          report->report_id = pdu[1];
+          report->report_type = pdu[2];
+        }
+      }
+      break;
+    }
+    case ATT_NOTIFY:
+    case ATT_INDICATE:
+      if (len >= 3) notification(im, c, le16(&pdu[1]), &pdu[3], len - 3);
+      break;
+  }
+}
+
+static void acl_packet(importer_t *im, bool received, const uint8_t *p,
+    size_t len) {
+  if (len < 4) return;
+  uint16_t handle = le16(p) & 0x0FFF;
+  uint8_t pb = (le16(p) >> 12) & 0x03;
+  size_t data_len = le16(&p[2]);
+  if (data_len > len - 4) {
+    im->stats->dropped++;
+    return;
+  }
+  p += 4;
+  conn_t *c = find_conn(im, handle);
+  if (c == NULL) {
+    // The log started after the connection.
+    static const uint8_t unknown[6] = {0};
+    c = open_conn(im, handle, unknown);
+    if (c == NULL) return;
+  }
+  l2cap_t *l = &c->l2cap[received];
+  if (pb != 0x01) {
+    // First fragment of a PDU
+    if (l->expect != 0) im->stats->dropped++;
+    l->len = 0;
+    l->expect = 0;
+    if (data_len < 4) return;
+    l->expect = 4 + le16(p);
+    if (l->expect > L2CAP_MAX) {
+      im->stats->dropped++;
+      l->expect = 0;
+      return;
+    }
+  } else if (l->expect == 0) {
+    return;
+  }
+  if (l->len + data_len > l->expect) {
+    im->stats->dropped++;
+    l->expect = 0;
+    return;
+  }
+  memcpy(&l->data[l->len], p, data_len);
+  l->len += data_len;
+  if (l->len < l->expect) return;
+  l->expect = 0;
+  if (le16(&l->data[2]) == L2CAP_CID_ATT) {
+    att_pdu(im, c, received, &l->data[4], l->len - 4);
+  }
+}
+
+static void event_packet(importer_t *im, const uint8_t *p, size_t len) {
+  if ((len < 2) || (len - 2 < p[1])) return;
+  const uint8_t *param = &p[2];
+  size_t param_len = p[1];
+  if ((p[0] == EVENT_DISCONNECTION_COMPLETE) && (param_len >= 3) &&
+      (param[0] == 0)) {
+    conn_t *c = find_conn(im, le16(&param[1]) & 0x0FFF);
+    if (c == NULL) return;
+    emit(im, CAPTURE_DISCONNECT, c->device, 0, NULL, 0);
+    c->in_use = false;
+  } else if ((p[0] == EVENT_LE_META) && (param_len >= 12) &&
+      ((param[0] == LE_CONNECTION_COMPLETE) ||
+       (param[0] == LE_ENHANCED_CONNECTION_COMPLETE)) && (param[1] == 0)) {
+    // Subevent, status, handle, role, peer address type, peer address
+    open_conn(im, le16(&param[2]) & 0x0FFF, &param[6]);
+  }
+}
+
+bool btsnoop_import(FILE *in, btsnoop_record_fn record, void *ctx,
+    btsnoop_stats_t *stats) {
+  uint8_t header[16];
+  memset(stats, 0, sizeof(*stats));
+  if ((fread(header, 1, sizeof(header), in) != sizeof(header)) ||
+      (memcmp(header, "btsnoop\0", 8) != 0) || (be32(&header[8]) != 1)) {
+    return false;
+  }
+  importer_t *im = (importer_t *)calloc(1, sizeof(*im));
+  if (im == NULL) return false;
+  im->in = in;
+  im->record = record;
+  im->ctx = ctx;
+  im->stats = stats;
+  im->datalink = be32(&header[12]);
+  if ((im->datalink != DATALINK_HCI) && (im->datalink != DATALINK_H4)) {
+    free(im);
+    return false;
+  }
+  stats->bytes = sizeof(header);
+  uint8_t rec[24];
+  size_t got;
+  while ((got = fread(rec, 1, sizeof(rec), in)) == sizeof(rec)) {
+    // Original length, included length, flags, drops, time
+    uint32_t len = be32(&rec[4]);
+    uint32_t flags = be32(&rec[8]);
+    uint64_t us = ((uint64_t)be32(&rec[16]) << 32) | be32(&rec[20]);
+    stats->bytes += sizeof(rec) + len;
+    if (len > PACKET_MAX) {
+      // Skip it without keeping it.
+      stats->dropped++;
+      while (len > 0) {
+        size_t chunk = (len > PACKET_MAX) ? PACKET_MAX : len;
+        if (fread(im->packet, 1, chunk, in) != chunk) break;
+        len -= chunk;
+      }
+      if (len > 0) {
+        stats->truncated = true;
+        break;
+      }
+      continue;
+    }
+    if (fread(im->packet, 1, len, in) != len) {
+      stats->truncated = true;
+      break;
+    }
+    stats->packets++;
+    if (!im->have_first) {
+      im->first_us = us;
+      im->have_first = true;
+    }
+    im->time_us = (uint32_t)(us - im->first_us);
+    const uint8_t *p = im->packet;
+    bool received = (flags & FLAG_RECEIVED) != 0;
+    uint8_t type;
+    if (im->datalink == DATALINK_H4) {
+      if (len < 1) continue;
+      type = p[0];
+      p++;
+      len--;
+    } else {
+      // Commands are sent and events received.
+      type = (flags & FLAG_CONTROL) ? (received ? H4_EVENT : 0) : H4_ACL;
+    }
+    if (type == H4_ACL) {
+      acl_packet(im, received, p, len);
+    } else if (type == H4_EVENT) {
+      event_packet(im, p, len);
+    }
+  }
+  if (got != 0) stats->truncated = true;
+  free(im);
+  return true;
+}
+
+#if DEBUG_BTSNOOP_IMPORT
+/*
+ * Import a btsnoop log on Linux. Build with
+ *   gcc -O2 -pthread -DDEBUG_BTSNOOP_IMPORT=1 -o btsnoop_import btsnoop.c \
+ *     capture.c report_desc.c
+ *   ./btsnoop_import -o capture.bin btsnoop_hci.log
+ * -o writes a capture for capture_replay. -c prints each report map with
+ * up to 16 of its distinct mouse reports and their decoded values in the
+ * format of hid_corpus.h. The reports start with the report ID byte if the
+ * map has report IDs, as hid_test expects for parse_hid_report_descriptor()
+ * and extract_mouse_values(). Without -o or -c each mouse report is
+ * printed as time_us,device,handle,bytes. Boot protocol reports are not
+ * made into fixtures; they do not follow the report map.
+ */
+#include <inttypes.h>
+#include <unistd.h>
+#include "./hid_corpus.h"
+
+#define FIXTURE_REPORTS   (16)
+#define FIXTURE_HANDLES   (16)
+#define FIXTURE_MAPS      (16)    // maps printed, to skip repeats
+
+typedef struct {
+  uint16_t handle;
+  uint8_t report_id;
+  uint8_t flags;
+} fixture_handle_t;
+
+typedef struct {
+  uint8_t map[BTSNOOP_MAP_MAX];
+  size_t map_len;
+  bool map_dirty;
+  hid_layout_t layout;
+  bool report_ids;
+  fixture_handle_t handles[FIXTURE_HANDLES];
+  size_t handle_count;
+  corpus_report_t reports[FIXTURE_REPORTS];
+  size_t report_count;
+} fixture_t;
+
+static const char *KERNEL_NAMES[] = {
+  "HID_KERNEL_GENERIC", "HID_KERNEL_XY8", "HID_KERNEL_XY16",
+  "HID_KERNEL_XY12", "HID_KERNEL_BOOT",
+};
+
+static fixture_t Fixtures[BTSNOOP_DEVICES];
+static uint8_t Printed_Maps[FIXTURE_MAPS][BTSNOOP_MAP_MAX];
+static size_t Printed_Lens[FIXTURE_MAPS];
+static size_t Printed_Count;
+static FILE *Capture_Out;
+static bool Corpus;
+
+static void print_bytes(const uint8_t *data, size_t len, const char *indent) {
+  for (size_t i = 0; i < len; i++) {
+    if ((i % 12) == 0) printf("%s", indent);
+    printf("0x%02X,%s", data[i],
+        (((i % 12) == 11) || (i == len - 1)) ? "\n" : " ");
+  }
+}
+
+static void print_fixture(fixture_t *f) {
+  if ((f->map_len == 0) || (f->report_count == 0)) return;
+  for (size_t i = 0; i < Printed_Count; i++) {
+    if ((Printed_Lens[i] == f->map_len) &&
+        (memcmp(Printed_Maps[i], f->map, f->map_len) == 0)) return;
+  }
+  size_t n = Printed_Count;
+  if (n < FIXTURE_MAPS) {
+    memcpy(Printed_Maps[n], f->map, f->map_len);
+    Printed_Lens[n] = f->map_len;
+    Printed_Count++;
+  }
+  printf("static const uint8_t imported_%zu_desc[] = {\n", n);
+  print_bytes(f->map, f->map_len, "  ");
+  printf("};\n\nstatic const corpus_report_t imported_%zu_reports[] = {\n", n);
+  for (size_t i = 0; i < f->report_count; i++) {
+    const corpus_report_t *r = &f->reports[i];
+    printf("  { %u, {", r->len);
+    for (size_t j = 0; j < r->len; j++) {
+      printf(" 0x%02X%s", r->data[j], (j + 1 < r->len) ? "," : " ");
+    }
+    printf("}, { 0x%" PRIX32 ", %" PRIi32 ", %" PRIi32 ", %" PRIi32 ", %"
+        PRIi32 ", %u } },\n", r->expect.buttons, r->expect.x, r->expect.y,
+        r->expect.wheel, r->expect.pan, r->expect.report_id);
+  }
+  const hid_report_layout_t *mouse = hid_layout_first_mouse(&f->layout);
+  printf("};\n\n// CORPUS_DEVICE(\"imported_%zu\", imported_%zu_desc, %s,\n"
+      "//     %s, imported_%zu_reports),\n\n", n, n,
+      f->report_ids ? "true" : "false",
+      KERNEL_NAMES[(mouse != NULL) ? mouse->kernel : HID_KERNEL_GENERIC], n);
+  f->report_count = 0;
+}
+
+static void fixture_report(fixture_t *f, uint16_t handle, const uint8_t *data,
+    size_t len) {
+  const fixture_handle_t *h = NULL;
+  for (size_t i = 0; i < f->handle_count; i++) {
+    if (f->handles[i].handle == handle) h = &f->handles[i];
+  }
+  if ((h == NULL) || (h->flags & CAPTURE_HANDLE_BOOT) || (f->map_len == 0)) {
+    return;
+  }
+  if (f->map_dirty) {
+    hid_layout_parse(&f->layout, f->map, f->map_len, false);
+    f->report_ids = false;
+    for (size_t i = 0; i < f->layout.report_count; i++) {
+      if (f->layout.reports[i].report_id != 0) f->report_ids = true;
+    }
+    if (f->report_ids) {
+      hid_layout_parse(&f->layout, f->map, f->map_len, true);
+    }
+    f->map_dirty = false;
+  }
+  const hid_report_layout_t *layout =
+    hid_layout_find_report(&f->layout, h->report_id);
+  if ((layout == NULL) || !layout->is_mouse) return;
+  corpus_report_t r;
+  memset(&r, 0, sizeof(r));
+  size_t id_len = f->report_ids ? 1 : 0;
+  if ((len + id_len > sizeof(r.data)) ||
+      (f->report_count >= FIXTURE_REPORTS)) {
+    return;
+  }
+  r.data[0] = h->report_id;
+  memcpy(&r.data[id_len], data, len);
+  r.len = (uint8_t)(len + id_len);
+  for (size_t i = 0; i < f->report_count; i++) {
+    if ((f->reports[i].len == r.len) &&
+        (memcmp(f->reports[i].data, r.data, r.len) == 0)) return;
+  }
+  hid_layout_extract(&f->layout, r.data, r.len, &r.expect);
+  f->reports[f->report_count++] = r;
+}
+
+static void on_record(void *ctx, const capture_record_t *rec,
+    const uint8_t *data) {
+  (void)ctx;
+  if (Capture_Out != NULL) {
+    uint8_t header[CAPTURE_RECORD_LEN];
+    capture_encode_record(header, rec);
+    fwrite(header, 1, sizeof(header), Capture_Out);
+    fwrite(data, 1, rec->len, Capture_Out);
+  }
+  if (!Corpus) {
+    if ((Capture_Out == NULL) && (rec->type == CAPTURE_REPORT)) {
+      printf("%" PRIu32 ",%u,%u,", rec->time_us, rec->device, rec->handle);
+      for (size_t i = 0; i < rec->len; i++) printf("%02x", data[i]);
+      printf("\n");
+    }
+    return;
+  }
+  fixture_t *f = &Fixtures[rec->device];
+  switch (rec->type) {
+    case CAPTURE_MAP:
+      if (rec->handle == 0) {
+        print_fixture(f);
+        f->map_len = 0;
+      }
+      if ((rec->handle == f->map_len) &&
+          (f->map_len + rec->len <= BTSNOOP_MAP_MAX)) {
+        memcpy(&f->map[f->map_len], data, rec->len);
+        f->map_len += rec->len;
+        f->map_dirty = true;
+      }
+      break;
+    case CAPTURE_HANDLE:
+      if (f->handle_count < FIXTURE_HANDLES) {
+        fixture_handle_t *h = &f->handles[f->handle_count++];
+        for (size_t i = 0; i + 1 < f->handle_count; i++) {
+          if (f->handles[i].handle == rec->handle) {
+            h = &f->handles[i];
+            f->handle_count--;
+          }
+        }
+        h->handle = rec->handle;
+        h->report_id = (rec->len > 0) ? data[0] : 0;
+        h->flags = (rec->len > 1) ? data[1] : 0;
+      }
+      break;
+    case CAPTURE_REPORT:
+      fixture_report(f, rec->handle, data, rec->len);
+      break;
+  }
+}
+
+int main(int argc, char *argv[]) {
+  const char *out_name = NULL;
+  int opt;
+  while ((opt = getopt(argc, argv, "co:")) != -1) {
+    switch (opt) {
+      case 'c': Corpus = true; break;
+      case 'o': out_name = optarg; break;
+      default:
+        fprintf(stderr, "usage: %s [-c] [-o capture.bin] btsnoop.log\n",
+            argv[0]);
+        return 2;
+    }
+  }
+  if (optind != argc - 1) {
+    fprintf(stderr, "usage: %s [-c] [-o capture.bin] btsnoop.log\n", argv[0]);
+    return 2;
+  }
+  FILE *in = fopen(argv[optind], "rb");
+  if (in == NULL) {
+    perror(argv[optind]);
+    return 1;
+  }
+  if (out_name != NULL) {
+    Capture_Out = fopen(out_name, "wb");
+    if (Capture_Out == NULL) {
+      perror(out_name);
+      return 1;
+    }
+    uint8_t header[CAPTURE_HEADER_LEN];
+    capture_encode_header(header);
+    fwrite(header, 1, sizeof(header), Capture_Out);
+  }
+  btsnoop_stats_t stats;
+  if (!btsnoop_import(in, on_record, NULL, &stats)) {
+    fprintf(stderr, "%s: not a btsnoop HCI log\n", argv[optind]);
+    return 1;
+  }
+  fclose(in);
+  if (Corpus) {
+    for (size_t i = 0; i < BTSNOOP_DEVICES; i++) print_fixture(&Fixtures[i]);
+  }
+  if ((Capture_Out != NULL) && (fclose(Capture_Out) != 0)) {
+    perror(out_name);
+    return 1;
+  }
+  fprintf(stderr, "packets %" PRIu32 " att %" PRIu32 " connections %" PRIu32
+      " report maps %" PRIu32 " reports %" PRIu32 " skipped %" PRIu32
+      " dropped %" PRIu32 "%s\n", stats.packets, stats.att_pdus,
+      stats.connections, stats.report_maps, stats.reports, stats.skipped,
+      stats.dropped, stats.truncated ? " truncated" : "");
+  return 0;
+}
+#endif  /* DEBUG_BTSNOOP_IMPORT */
+
+#if DEBUG_BTSNOOP_MAIN
+/*
+ * Build and run on Linux.
+ *   gcc -O2 -pthread -DDEBUG_BTSNOOP_MAIN=1 -o btsnoop_test btsnoop.c \
+ *     capture.c report_desc.c
+ *   ./btsnoop_test
+ * Writes btsnoop logs of a mouse that is discovered, a mouse whose log
+ * starts after discovery, and a reconnect, and checks the records and
+ * decoded values against hid_corpus.h. Then measures import throughput.
+ */
+#include <inttypes.h>
+#include <time.h>
+#include "./hid_corpus.h"
+
+#define TEST_RECORDS      (256)
+#define ACL_FRAGMENT      (27)    // ACL data bytes per packet
+
+typedef struct {
+  capture_record_t rec;
+  uint8_t data[CAPTURE_DATA_MAX];
+} test_record_t;
+
+static test_record_t Records[TEST_RECORDS];
+static size_t Record_Count;
+static uint32_t Datalink;
+static uint64_t Now_us;
+static int Errors;
+
+static void on_record(void *ctx, const capture_record_t *rec,
+    const uint8_t *data) {
+  (void)ctx;
+  if (Record_Count >= TEST_RECORDS) return;
+  Records[Record_Count].rec = *rec;
+  memcpy(Records[Record_Count].data, data, rec->len);
+  Record_Count++;
+}
+
+static void on_record_count(void *ctx, const capture_record_t *rec,
+    const uint8_t *data) {
+  (void)data;
+  if (rec->type == CAPTURE_REPORT) (*(uint32_t *)ctx)++;
+}
+
+static void put_be32(FILE *f, uint32_t v) {
+  uint8_t b[4] = { v >> 24, v >> 16, v >> 8, v };
+  fwrite(b, 1, 4, f);
+}
+
+static void put_header(FILE *f, uint32_t datalink) {
+  fwrite("btsnoop\0", 1, 8, f);
+  put_be32(f, 1);
+  put_be32(f, datalink);
+  Datalink = datalink;
+}
+
+static void put_packet(FILE *f, uint8_t h4_type, bool received,
+    const uint8_t *data, size_t len) {
+  size_t h4 = (Datalink == DATALINK_H4) ? 1 : 0;
+  uint32_t flags = received ? FLAG_RECEIVED : 0;
+  if ((Datalink == DATALINK_HCI) && (h4_type != H4_ACL)) flags |= FLAG_CONTROL;
+  put_be32(f, len + h4);
+  put_be32(f, len + h4);
+  put_be32(f, flags);
+  put_be32(f, 0);
+  put_be32(f, Now_us >> 32);
+  put_be32(f, (uint32_t)Now_us);
+  if (h4) fputc(h4_type, f);
+  fwrite(data, 1, len, f);
+}
+
+static void put_event(FILE *f, uint8_t code, const uint8_t *param,
+    size_t len) {
+  uint8_t p[2 + 255];
+  p[0] = code;
+  p[1] = (uint8_t)len;
+  memcpy(&p[2], param, len);
+  put_packet(f, H4_EVENT, true, p, 2 + len);
+}
+
+static void put_connect(FILE *f, uint16_t conn, uint8_t address_last) {
+  uint8_t param[19] = { LE_CONNECTION_COMPLETE, 0, conn & 0xFF, conn >> 8,
+    0, 1, 0x11, 0x22, 0x33, 0x44, 0x55, address_last };
+  put_event(f, EVENT_LE_META, param, sizeof(param));
+}
+
+static void put_disconnect(FILE *f, uint16_t conn) {
+  uint8_t param[4] = { 0, conn & 0xFF, conn >> 8, 0x13 };
+  put_event(f, EVENT_DISCONNECTION_COMPLETE, param, sizeof(param));
+}
+
+// ATT PDU in an L2CAP frame split into ACL_FRAGMENT byte ACL packets.
+static void put_att(FILE *f, uint16_t conn, bool received, const uint8_t *pdu,
+    size_t len) {
+  uint8_t frame[4 + L2CAP_MAX];
+  frame[0] = len & 0xFF;
+  frame[1] = len >> 8;
+  frame[2] = L2CAP_CID_ATT;
+  frame[3] = 0;
+  memcpy(&frame[4], pdu, len);
+  for (size_t done = 0; done < len + 4; done += ACL_FRAGMENT) {
+    size_t chunk = len + 4 - done;
+    if (chunk > ACL_FRAGMENT) chunk = ACL_FRAGMENT;
+    uint16_t pb = (done == 0) ? 0x2000 : 0x1000;
+    uint8_t acl[4 + ACL_FRAGMENT] = { conn & 0xFF, (conn | pb) >> 8,
+      chunk & 0xFF, chunk >> 8 };
+    memcpy(&acl[4], &frame[done], chunk);
+    put_packet(f, H4_ACL, received, acl, 4 + chunk);
+  }
+}
+
+static void put_read(FILE *f, uint16_t conn, uint16_t handle,
+    const uint8_t *value, size_t len, size_t mtu) {
+  // Read the value with a Read and then Read Blobs, as NimBLE does.
+  for (size_t offset = 0; offset == 0 || offset < len; ) {
+    uint8_t req[5] = { ATT_READ_REQ, handle & 0xFF, handle >> 8,
+      offset & 0xFF, offset >> 8 };
+    if (offset != 0) req[0] = ATT_READ_BLOB_REQ;
+    put_att(f, conn, false, req, (offset == 0) ? 3 : 5);
+    size_t chunk = len - offset;
+    if (chunk > mtu - 1) chunk = mtu - 1;
+    uint8_t rsp[L2CAP_MAX];
+    rsp[0] = (offset == 0) ? ATT_READ_RSP : ATT_READ_BLOB_RSP;
+    memcpy(&rsp[1], &value[offset], chunk);
+    put_att(f, conn, true, rsp, 1 + chunk);
+    offset += chunk;
+    if (chunk < mtu - 1) break;
+  }
+}
+
+static void put_notify(FILE *f, uint16_t conn, uint16_t handle,
+    const uint8_t *value, size_t len) {
+  uint8_t pdu[3 + 16] = { ATT_NOTIFY, handle & 0xFF, handle >> 8 };
+  memcpy(&pdu[3], value, len);
+  put_att(f, conn, true, pdu, 3 + len);
+}
+
+/*
+ * Mouse with the mouse_xy16 report map. Its HID service has
+ *   0x0010 report map declaration, 0x0011 value
+ *   0x0012 report declaration, 0x0013 value, 0x0014 CCCD,
+ *   0x0015 Report Reference
+ *   0x0016 battery level declaration, 0x0017 value
+ */
+static void put_discovered_mouse(FILE *f, uint16_t conn, size_t mtu) {
+  put_connect(f, conn, 0x66);
+  Now_us += 2000;
+  uint8_t by_type[7] = { ATT_READ_BY_TYPE_REQ, 0x01, 0x00, 0xFF, 0xFF,
+    0x03, 0x28 };
+  put_att(f, conn, false, by_type, sizeof(by_type));
+  uint8_t decls[] = { ATT_READ_BY_TYPE_RSP, 7,
+    0x10, 0x00, 0x02, 0x11, 0x00, 0x4B, 0x2A,
+    0x12, 0x00, 0x12, 0x13, 0x00, 0x4D, 0x2A,
+    0x16, 0x00, 0x12, 0x17, 0x00, 0x19, 0x2A };
+  put_att(f, conn, true, decls, sizeof(decls));
+  uint8_t find[5] = { 0x04, 0x14, 0x00, 0x15, 0x00 };
+  put_att(f, conn, false, find, sizeof(find));
+  uint8_t info[] = { ATT_FIND_INFO_RSP, 1,
+    0x14, 0x00, 0x02, 0x29, 0x15, 0x00, 0x08, 0x29 };
+  put_att(f, conn, true, info, sizeof(info));
+  put_read(f, conn, 0x0011, mouse_xy16_desc, sizeof(mouse_xy16_desc), mtu);
+  uint8_t reference[2] = { 0, REPORT_TYPE_INPUT };
+  put_read(f, conn, 0x0015, reference, sizeof(reference), mtu);
+}
+
+static const uint32_t Report_Interval_us = 7500;
+
+static void put_reports(FILE *f, uint16_t conn, uint16_t handle,
+    const corpus_report_t *reports, size_t count) {
+  for (size_t i = 0; i < count; i++) {
+    Now_us += Report_Interval_us;
+    put_notify(f, conn, handle, reports[i].data, reports[i].len);
+  }
+}
+
+// Connected with discovery, a battery notification, disconnected, and
+// reconnected without discovery.
+static FILE *discovered_log(uint32_t datalink) {
+  FILE *f = tmpfile();
+  Now_us = 0;
+  put_header(f, datalink);
+  put_discovered_mouse(f, 0x0040, 23);
+  put_reports(f, 0x0040, 0x0013, mouse_xy16_reports, 4);
+  uint8_t battery = 90;
+  put_notify(f, 0x0040, 0x0017, &battery, 1);
+  put_disconnect(f, 0x0040);
+  Now_us += 100000;
+  put_connect(f, 0x0041, 0x66);
+  put_reports(f, 0x0041, 0x0013, mouse_xy16_reports, 4);
+  rewind(f);
+  return f;
+}
+
+static void fail(const char *what, size_t i) {
+  printf("FAIL %s, record %zu\n", what, i);
+  Errors++;
+}
+
+/*
+ * Check the records of one device: the report map, the handle, and the
+ * values decoded from the reports with the parser.
+ */
+static void check_device(uint8_t device, const uint8_t *desc,
+    size_t desc_len, uint16_t handle, const corpus_report_t *reports,
+    size_t report_count, size_t connects) {
+  uint8_t map[BTSNOOP_MAP_MAX];
+  size_t map_len = 0;
+  size_t connected = 0;
+  size_t decoded = 0;
+  uint32_t last_us = 0;
+  bool have_handle = false;
+  uint8_t report_id = 0;
+  hid_layout_t layout;
+  for (size_t i = 0; i < Record_Count; i++) {
+    const capture_record_t *rec = &Records[i].rec;
+    const uint8_t *data = Records[i].data;
+    if (rec->device != device) continue;
+    switch (rec->type) {
+      case CAPTURE_CONNECT:
+        connected++;
+        have_handle = false;
+        last_us = 0;
+        break;
+      case CAPTURE_MAP:
+        if (rec->handle != map_len) fail("map offset", i);
+        memcpy(&map[map_len], data, rec->len);
+        map_len += rec->len;
+        break;
+      case CAPTURE_HANDLE:
+        if ((rec->handle != handle) || (rec->len != 2) || (data[1] != 0)) {
+          fail("handle", i);
+        }
+        have_handle = true;
+        report_id = data[0];
+        break;
+      case CAPTURE_REPORT: {
+        if (!have_handle) fail("report before handle", i);
+        if ((map_len != desc_len) || (memcmp(map, desc, desc_len) != 0)) {
+          fail("map", i);
+          return;
+        }
+        size_t n = decoded % report_count;
+        if ((last_us != 0) && (rec->time_us - last_us != Report_Interval_us)) {
+          fail("time", i);
+        }
+        last_us = rec->time_us;
+        hid_layout_parse(&layout, map, map_len, false);
+        mouse_values_t m;
+        extract_report_values(hid_layout_find_report(&layout, report_id),
+            data, rec->len, &m);
+        const mouse_values_t *e = &reports[n].expect;
+        if ((m.buttons != e->buttons) || (m.x != e->x) || (m.y != e->y) ||
+            (m.wheel != e->wheel) || (m.pan != e->pan)) {
+          fail("values", i);
+        }
+        decoded++;
+        break;
+      }
+    }
+  }
+  if ((connected != connects) || (decoded != report_count * connects)) {
+    printf("FAIL device %u: %zu connects %zu reports\n", device, connected,
+        decoded);
+    Errors++;
+  }
+}
+
+static void test_discovered(uint32_t datalink) {
+  FILE *f = discovered_log(datalink);
+  btsnoop_stats_t stats;
+  Record_Count = 0;
+  if (!btsnoop_import(f, on_record, NULL, &stats)) {
+    printf("FAIL datalink %" PRIu32 " not imported\n", datalink);
+    Errors++;
+  }
+  fclose(f);
+  check_device(0, mouse_xy16_desc, sizeof(mouse_xy16_desc), 0x0013,
+      mouse_xy16_reports, 4, 2);
+  if ((stats.connections != 2) || (stats.report_maps != 1) ||
+      (stats.reports != 8) || (stats.skipped != 1) || (stats.dropped != 0) ||
+      stats.truncated) {
+    printf("FAIL datalink %" PRIu32 " stats: connections %" PRIu32
+        " maps %" PRIu32 " reports %" PRIu32 " skipped %" PRIu32
+        " dropped %" PRIu32 "\n", datalink, stats.connections,
+        stats.report_maps, stats.reports, stats.skipped, stats.dropped);
+    Errors++;
+  }
+}
+
+// The log starts after discovery, the report map is read again with a
+// large MTU, and the mouse has no Report Reference.
+static void test_undiscovered(void) {
+  FILE *f = tmpfile();
+  Now_us = 1000;
+  put_header(f, DATALINK_H4);
+  put_connect(f, 0x0042, 0x77);
+  put_read(f, 0x0042, 0x0020, boot_mouse_desc, sizeof(boot_mouse_desc), 247);
+  put_reports(f, 0x0042, 0x0022, boot_mouse_reports, 4);
+  // Connection without its connection complete event
+  uint8_t report[3] = { 1, 2, 3 };
+  put_notify(f, 0x0043, 0x0030, report, sizeof(report));
+  rewind(f);
+  btsnoop_stats_t stats;
+  Record_Count = 0;
+  btsnoop_import(f, on_record, NULL, &stats);
+  fclose(f);
+  check_device(0, boot_mouse_desc, sizeof(boot_mouse_desc), 0x0022,
+      boot_mouse_reports, 4, 1);
+  if ((stats.connections != 2) || (stats.reports != 5) ||
+      (stats.skipped != 0)) {
+    printf("FAIL undiscovered: connections %" PRIu32 " reports %" PRIu32 "\n",
+        stats.connections, stats.reports);
+    Errors++;
+  }
+}
+
+static void test_bad_logs(void) {
+  btsnoop_stats_t stats;
+  FILE *f = tmpfile();
+  fwrite("BMXC\x01\0\0\0", 1, 8, f);
+  rewind(f);
+  if (btsnoop_import(f, on_record, NULL, &stats)) {
+    printf("FAIL capture imported as btsnoop\n");
+    Errors++;
+  }
+  fclose(f);
+
+  // A packet too long to keep, then one cut short by the end of the log.
+  f = tmpfile();
+  put_header(f, DATALINK_H4);
+  static uint8_t big[PACKET_MAX + 100];
+  put_packet(f, H4_ACL, true, big, sizeof(big));
+  put_connect(f, 0x0040, 0x66);
+  put_be32(f, 100);
+  put_be32(f, 100);
+  fwrite(big, 1, 20, f);
+  rewind(f);
+  Record_Count = 0;
+  if (!btsnoop_import(f, on_record, NULL, &stats) || !stats.truncated ||
+      (stats.dropped != 1) || (stats.connections != 1)) {
+    printf("FAIL truncated log: dropped %" PRIu32 " connections %" PRIu32
+        " truncated %d\n", stats.dropped, stats.connections, stats.truncated);
+    Errors++;
+  }
+  fclose(f);
+}
+
+static uint64_t nanos(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+// Import speed of a long log of notifications.
+static void bench(size_t reports) {
+  FILE *f = tmpfile();
+  Now_us = 0;
+  put_header(f, DATALINK_H4);
+  put_discovered_mouse(f, 0x0040, 23);
+  for (size_t i = 0; i < reports; i++) {
+    Now_us += 1000;
+    const corpus_report_t *r = &mouse_xy16_reports[i % 3];
+    put_notify(f, 0x0040, 0x0013, r->data, r->len);
+  }
+  rewind(f);
+  btsnoop_stats_t stats;
+  uint32_t count = 0;
+  uint64_t start = nanos();
+  btsnoop_import(f, on_record_count, &count, &stats);
+  double s = (nanos() - start) / 1e9;
+  fclose(f);
+  if (count != reports) {
+    printf("FAIL bench: %" PRIu32 " reports of %zu\n", count, reports);
+    Errors++;
+  }
+  printf("%.1f MB in %.3f s: %.0f MB/s, %.0f reports/s, state %zu bytes\n",
+      stats.bytes / 1e6, s, stats.bytes / 1e6 / s, count / s,
+      sizeof(importer_t));
+}
+
+int main(void) {
+  test_discovered(DATALINK_H4);
+  test_discovered(DATALINK_HCI);
+  test_undiscovered();
+  test_bad_logs();
+  bench(1000000);
+  printf("errors %d\n", Errors);
+  return Errors != 0;
+}
+#endif  /* DEBUG_BTSNOOP_MAIN */
+#endif  /* !ARDUINO */
@@ -0,0 +1,82 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2023 touchgadgetdev@gmail.com
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef _BTSNOOP_H_
+#define _BTSNOOP_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include "./capture.h"
+
+/*
+ * Import of btsnoop HCI logs, as saved by Android ("Bluetooth HCI snoop
+ * log") and by btmon -w on Linux, into capture records. Host only.
+ *
+ * The ATT traffic of each LE connection is followed: characteristic and
+ * descriptor discovery, reads of the HID report map (0x2A4B) and Report
+ * Reference descriptors, and notifications of HID reports (0x2A4D) and
+ * boot mouse reports (0x2A33). A device is one peer address; it keeps its
+ * handles and report map when it reconnects, as bonded devices do not
+ * discover again. If a log starts after discovery, a read response that
+ * looks like a mouse report map is taken as the report map and every
+ * notification of the device is taken as a mouse report.
+ *
+ * The log is read one packet at a time, so memory does not grow with the
+ * size of the log.
+ */
+
+#define BTSNOOP_DEVICES   (16)    // peer addresses, capture device numbers
+#define BTSNOOP_CONNS     (8)     // connections open at once
+#define BTSNOOP_ATTRS     (64)    // handles remembered per device
+#define BTSNOOP_MAP_MAX   (4096)
+
+typedef struct {
+  uint64_t bytes;
+  uint32_t packets;
+  uint32_t att_pdus;
+  uint32_t connections;
+  uint32_t report_maps;
+  uint32_t reports;       // notifications imported as reports
+  uint32_t skipped;       // notifications of other characteristics
+  uint32_t dropped;       // packets or L2CAP PDUs too long or out of order
+  bool truncated;         // the log ends in the middle of a packet
+} btsnoop_stats_t;
+
+/*
+ * Called for each capture record, in log order. time_us is from the first
+ * packet of the log.
+ */
+typedef void (*btsnoop_record_fn)(void *ctx, const capture_record_t *rec,
+    const uint8_t *data);
+
+/*
+ * Read a btsnoop log from in to its end. Returns false if in is not a
+ * btsnoop log with HCI UART (H4) or HCI un-encapsulated packets.
+ */
+bool btsnoop_import(FILE *in, btsnoop_record_fn record, void *ctx,
+    btsnoop_stats_t *stats);
+
+#endif  /* _BTSNOOP_H_ */
@@ -0,0 +1,725 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2023 touchgadgetdev@gmail.com
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <string.h>
+#include "./capture.h"
+
+// One lock for the producers. Records come from the NimBLE host task and
+// the bridge task. On the ESP32 a critical section so a producer is never
+// preempted while holding it.
+#if defined(ARDUINO)
+#include <freertos/FreeRTOS.h>
+static portMUX_TYPE Capture_Lock = portMUX_INITIALIZER_UNLOCKED;
+#define CAPTURE_LOCK()    portENTER_CRITICAL(&Capture_Lock)
+#define CAPTURE_UNLOCK()  portEXIT_CRITICAL(&Capture_Lock)
+#else
+#include <pthread.h>
+static pthread_mutex_t Capture_Lock = PTHREAD_MUTEX_INITIALIZER;
+#define CAPTURE_LOCK()    pthread_mutex_lock(&Capture_Lock)
+#define CAPTURE_UNLOCK()  pthread_mutex_unlock(&Capture_Lock)
+#endif
+
+static void put_bytes(capture_t *c, uint32_t head, const void *data,
+    size_t len) {
+  uint32_t index = head & (c->size - 1);
+  size_t first = c->size - index;
+  if (first > len) first = len;
+  memcpy(&c->ring[index], data, first);
+  memcpy(c->ring, (const uint8_t *)data + first, len - first);
+}
+
+void capture_encode_header(uint8_t *header) {
+  memcpy(header, CAPTURE_MAGIC, 4);
+  header[4] = CAPTURE_VERSION;
+  header[5] = header[6] = header[7] = 0;
+}
+
+void capture_encode_record(uint8_t *header, const capture_record_t *rec) {
+  header[0] = (uint8_t)rec->time_us;
+  header[1] = (uint8_t)(rec->time_us >> 8);
+  header[2] = (uint8_t)(rec->time_us >> 16);
+  header[3] = (uint8_t)(rec->time_us >> 24);
+  header[4] = (uint8_t)rec->handle;
+  header[5] = (uint8_t)(rec->handle >> 8);
+  header[6] = (uint8_t)((rec->type & 0x0F) | (rec->device << 4));
+  header[7] = rec->len;
+}
+
+// Caller holds the lock and has checked there is room.
+static uint32_t put_record(capture_t *c, uint32_t head, uint8_t type,
+    uint8_t device, uint16_t handle, uint32_t time_us, const void *data,
+    size_t len) {
+  const capture_record_t rec = { time_us, handle, type, device, (uint8_t)len };
+  uint8_t header[CAPTURE_RECORD_LEN];
+  capture_encode_record(header, &rec);
+  put_bytes(c, head, header, sizeof(header));
+  put_bytes(c, head + sizeof(header), data, len);
+  c->records++;
+  return head + sizeof(header) + len;
+}
+
+bool capture_init(capture_t *c, uint8_t *ring, size_t size) {
+  memset(c, 0, sizeof(*c));
+  if ((size < 2 * (CAPTURE_RECORD_LEN + CAPTURE_DATA_MAX)) ||
+      ((size & (size - 1)) != 0) || (size > UINT32_MAX / 2)) {
+    return false;
+  }
+  c->ring = ring;
+  c->size = (uint32_t)size;
+  uint8_t header[CAPTURE_HEADER_LEN];
+  capture_encode_header(header);
+  put_bytes(c, 0, header, sizeof(header));
+  c->head = sizeof(header);
+  return true;
+}
+
+bool capture_record(capture_t *c, uint8_t type, uint8_t device,
+    uint16_t handle, uint32_t time_us, const void *data, size_t len) {
+  bool truncated = (len > CAPTURE_DATA_MAX);
+  if (truncated) len = CAPTURE_DATA_MAX;
+  CAPTURE_LOCK();
+  uint32_t head = c->head;
+  uint32_t used = head - __atomic_load_n(&c->tail, __ATOMIC_ACQUIRE);
+  size_t need = CAPTURE_RECORD_LEN + len;
+  // Say how many were lost before the first record that fits.
+  if (c->lost) need += CAPTURE_RECORD_LEN + sizeof(c->lost);
+  bool ok = (need <= c->size - used);
+  if (ok) {
+    if (c->lost) {
+      uint8_t lost[4] = {
+        (uint8_t)c->lost, (uint8_t)(c->lost >> 8), (uint8_t)(c->lost >> 16),
+        (uint8_t)(c->lost >> 24),
+      };
+      head = put_record(c, head, CAPTURE_LOST, device, 0, time_us, lost,
+          sizeof(lost));
+      c->lost = 0;
+    }
+    head = put_record(c, head, type, device, handle, time_us, data, len);
+    if (truncated) c->truncated++;
+    __atomic_store_n(&c->head, head, __ATOMIC_RELEASE);
+  } else {
+    c->lost++;
+    c->lost_total++;
+  }
+  CAPTURE_UNLOCK();
+  return ok;
+}
+
+bool capture_report_map(capture_t *c, uint8_t device, uint32_t time_us,
+    const uint8_t *map, size_t len) {
+  bool ok = true;
+  size_t offset = 0;
+  do {
+    size_t chunk = len - offset;
+    if (chunk > CAPTURE_DATA_MAX) chunk = CAPTURE_DATA_MAX;
+    ok = capture_record(c, CAPTURE_MAP, device, (uint16_t)offset, time_us,
+        &map[offset], chunk) && ok;
+    offset += chunk;
+  } while ((offset < len) && (offset <= UINT16_MAX));
+  return ok;
+}
+
+size_t capture_drain(capture_t *c, capture_sink_fn sink, void *ctx) {
+  size_t total = 0;
+  uint32_t tail = c->tail;
+  uint32_t head = __atomic_load_n(&c->head, __ATOMIC_ACQUIRE);
+  while (head != tail) {
+    uint32_t index = tail & (c->size - 1);
+    size_t len = head - tail;
+    if (len > c->size - index) len = c->size - index;
+    size_t written = sink(ctx, &c->ring[index], len);
+    if (written > len) written = len;
+    tail += written;
+    total += written;
+    __atomic_store_n(&c->tail, tail, __ATOMIC_RELEASE);
+    if (written < len) break;
+  }
+  c->drained += total;
+  return total;
+}
+
+bool capture_reader_init(capture_reader_t *r, const uint8_t *data, size_t len) {
+  memset(r, 0, sizeof(*r));
+  if ((len < CAPTURE_HEADER_LEN) || (memcmp(data, CAPTURE_MAGIC, 4) != 0) ||
+      (data[4] == 0) || (data[4] > CAPTURE_VERSION)) {
+    return false;
+  }
+  r->data = data;
+  r->len = len;
+  r->pos = CAPTURE_HEADER_LEN;
+  r->version = data[4];
+  return true;
+}
+
+bool capture_reader_next(capture_reader_t *r, capture_record_t *rec,
+    const uint8_t **data) {
+  if (r->len - r->pos < CAPTURE_RECORD_LEN) return false;
+  const uint8_t *p = &r->data[r->pos];
+  if (r->len - r->pos - CAPTURE_RECORD_LEN < p[7]) return false;
+  rec->time_us = p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+  rec->handle = p[4] | (p[5] << 8);
+  rec->type = p[6] & 0x0F;
+  rec->device = p[6] >> 4;
+  rec->len = p[7];
+  *data = &p[CAPTURE_RECORD_LEN];
+  r->pos += CAPTURE_RECORD_LEN + rec->len;
+  return true;
+}
+
+#if DEBUG_CAPTURE_MAIN
+/*
+ * Host test. Build and run on Linux with
+ *   gcc -O2 -pthread -DDEBUG_CAPTURE_MAIN=1 -o capture_test capture.c
+ *   ./capture_test
+ * Records a report map and reports, drains them through a sink that takes
+ * a few bytes at a time and reads them back. Fills the ring to check lost
+ * records are counted and reported, checks the reader stops at a cut
+ * record, then runs two producer threads against a draining consumer and
+ * checks every record arrives once and in order or is counted lost.
+ * Prints the time to add a record. Exit status is the number of errors.
+ */
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+#include "./hid_corpus.h"
+
+#define OUT_MAX       (1 << 23)
+#define THREAD_RECORDS (200000)
+
+static uint8_t Out[OUT_MAX];
+static size_t Out_Len;
+static size_t Sink_Chunk = OUT_MAX;
+
+static size_t sink(void *ctx, const uint8_t *data, size_t len) {
+  (void)ctx;
+  if (len > Sink_Chunk) len = Sink_Chunk;
+  if (len > OUT_MAX - Out_Len) len = OUT_MAX - Out_Len;
+  memcpy(&Out[Out_Len], data, len);
+  Out_Len += len;
+  return len;
+}
+
+static uint64_t nanos(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static capture_t Capture;
+static uint8_t Ring[4096];
+static uint8_t Thread_Ring[1 << 16];
+static volatile bool Producers_Done;
+
+static void *producer(void *arg) {
+  uint8_t device = (uint8_t)(uintptr_t)arg;
+  for (uint32_t i = 0; i < THREAD_RECORDS; i++) {
+    capture_record(&Capture, CAPTURE_REPORT, device, 0x20, i, &i, sizeof(i));
+    // Bursts, so the consumer runs even on one CPU.
+    if ((i & 255) == 255) usleep(100);
+  }
+  return NULL;
+}
+
+static void *consumer(void *arg) {
+  (void)arg;
+  while (!Producers_Done) capture_drain(&Capture, sink, NULL);
+  capture_drain(&Capture, sink, NULL);
+  return NULL;
+}
+
+int main(void) {
+  int errors = 0;
+  const corpus_device_t *dev = &HID_Corpus[2];    // composite_xy12
+  uint8_t big_map[600];
+  for (size_t i = 0; i < sizeof(big_map); i++) big_map[i] = (uint8_t)i;
+
+  // Round trip through a sink that takes 7 bytes at a time.
+  capture_init(&Capture, Ring, sizeof(Ring));
+  capture_report_map(&Capture, 1, 100, dev->desc, dev->desc_len);
+  capture_report_map(&Capture, 2, 200, big_map, sizeof(big_map));
+  uint8_t ref[2] = { 1, 0 };
+  capture_record(&Capture, CAPTURE_HANDLE, 1, 0x1B, 300, ref, sizeof(ref));
+  for (size_t i = 0; i < dev->report_count; i++) {
+    capture_record(&Capture, CAPTURE_REPORT, 1, 0x1B, 1000 + i,
+        dev->reports[i].data, dev->reports[i].len);
+  }
+  Out_Len = 0;
+  Sink_Chunk = 7;
+  while (capture_drain(&Capture, sink, NULL) > 0) {
+  }
+  Sink_Chunk = OUT_MAX;
+  capture_reader_t reader;
+  capture_record_t rec;
+  const uint8_t *data;
+  uint8_t map[sizeof(big_map)];
+  size_t map_len = 0;
+  size_t reports = 0;
+  if (!capture_reader_init(&reader, Out, Out_Len)) {
+    printf("FAIL header\n");
+    errors++;
+  }
+  while (capture_reader_next(&reader, &rec, &data)) {
+    if ((rec.type == CAPTURE_MAP) && (rec.device == 2)) {
+      if (rec.handle != map_len) errors++;
+      memcpy(&map[map_len], data, rec.len);
+      map_len += rec.len;
+    } else if (rec.type == CAPTURE_MAP) {
+      if ((rec.len != dev->desc_len) || memcmp(data, dev->desc, rec.len)) {
+        printf("FAIL report map\n");
+        errors++;
+      }
+    } else if (rec.type == CAPTURE_REPORT) {
+      const corpus_report_t *r = &dev->reports[reports];
+      if ((rec.device != 1) || (rec.handle != 0x1B) ||
+          (rec.time_us != 1000 + reports) || (rec.len != r->len) ||
+          memcmp(data, r->data, r->len)) {
+        printf("FAIL report %zu\n", reports);
+        errors++;
+      }
+      reports++;
+    }
+  }
+  if ((reader.pos != Out_Len) || (reports != dev->report_count) ||
+      (map_len != sizeof(big_map)) || memcmp(map, big_map, map_len)) {
+    printf("FAIL round trip: %zu of %zu bytes, %zu reports, map %zu\n",
+        reader.pos, Out_Len, reports, map_len);
+    errors++;
+  }
+  // A capture cut in the middle of a record ends at the record before.
+  capture_reader_init(&reader, Out, Out_Len - 1);
+  reports = 0;
+  while (capture_reader_next(&reader, &rec, &data)) {
+    if (rec.type == CAPTURE_REPORT) reports++;
+  }
+  if (reports != dev->report_count - 1) {
+    printf("FAIL cut capture %zu reports\n", reports);
+    errors++;
+  }
+  if (capture_reader_init(&reader, Out + 1, Out_Len - 1)) {
+    printf("FAIL bad header accepted\n");
+    errors++;
+  }
+
+  // Fill the ring. The next record that fits says how many were lost.
+  capture_init(&Capture, Ring, sizeof(Ring));
+  uint8_t report[16] = {0};
+  uint32_t added = 0;
+  while (capture_record(&Capture, CAPTURE_REPORT, 0, 0x20, added, report,
+        sizeof(report))) {
+    added++;
+  }
+  for (int i = 0; i < 4; i++) {
+    capture_record(&Capture, CAPTURE_REPORT, 0, 0x20, 0, report, sizeof(report));
+  }
+  Out_Len = 0;
+  capture_drain(&Capture, sink, NULL);
+  capture_record(&Capture, CAPTURE_REPORT, 0, 0x20, 0, report, sizeof(report));
+  capture_drain(&Capture, sink, NULL);
+  capture_reader_init(&reader, Out, Out_Len);
+  uint32_t got = 0, lost = 0;
+  while (capture_reader_next(&reader, &rec, &data)) {
+    if (rec.type == CAPTURE_REPORT) got++;
+    if (rec.type == CAPTURE_LOST) lost = data[0] | (data[1] << 8);
+  }
+  if ((got != added + 1) || (lost != 5) || (Capture.lost_total != 5)) {
+    printf("FAIL full ring: %" PRIu32 " of %" PRIu32 " reports, lost %" PRIu32
+        "\n", got, added + 1, lost);
+    errors++;
+  }
+
+  // Two producers and a consumer.
+  capture_init(&Capture, Thread_Ring, sizeof(Thread_Ring));
+  Out_Len = 0;
+  Producers_Done = false;
+  pthread_t threads[3];
+  pthread_create(&threads[0], NULL, consumer, NULL);
+  pthread_create(&threads[1], NULL, producer, (void *)1);
+  pthread_create(&threads[2], NULL, producer, (void *)2);
+  pthread_join(threads[1], NULL);
+  pthread_join(threads[2], NULL);
+  Producers_Done = true;
+  pthread_join(threads[0], NULL);
+  // Flush the lost count.
+  capture_record(&Capture, CAPTURE_REPORT, 3, 0x20, 0, NULL, 0);
+  capture_drain(&Capture, sink, NULL);
+  capture_reader_init(&reader, Out, Out_Len);
+  uint32_t next[3] = {0};
+  got = 0;
+  lost = 0;
+  while (capture_reader_next(&reader, &rec, &data)) {
+    if (rec.type == CAPTURE_LOST) {
+      lost += data[0] | (data[1] << 8) | (data[2] << 16) | (data[3] << 24);
+    } else if ((rec.type == CAPTURE_REPORT) && (rec.device < 3)) {
+      uint32_t seq;
+      memcpy(&seq, data, sizeof(seq));
+      if ((seq < next[rec.device]) || (seq != rec.time_us)) {
+        printf("FAIL producer %u record %" PRIu32 " out of order\n",
+            rec.device, seq);
+        errors++;
+        break;
+      }
+      next[rec.device] = seq + 1;
+      got++;
+    }
+  }
+  if ((got + lost != 2 * THREAD_RECORDS) || (lost != Capture.lost_total) ||
+      (reader.pos != Out_Len)) {
+    printf("FAIL threads: %" PRIu32 " records, %" PRIu32 " lost\n", got, lost);
+    errors++;
+  }
+  printf("threads: %" PRIu32 " records, %" PRIu32 " lost\n", got, lost);
+
+  // Time to add a record with nothing else running.
+  capture_init(&Capture, Ring, sizeof(Ring));
+  uint64_t start = nanos();
+  for (uint32_t i = 0; i < THREAD_RECORDS; i++) {
+    capture_record(&Capture, CAPTURE_REPORT, 0, 0x20, i, report, 7);
+    if ((i & 63) == 63) {
+      Out_Len = 0;
+      capture_drain(&Capture, sink, NULL);
+    }
+  }
+  printf("record and drain %.1f ns/report\n",
+      (double)(nanos() - start) / THREAD_RECORDS);
+  printf("errors %d\n", errors);
+  return errors;
+}
+#endif
+
+#if DEBUG_CAPTURE_REPLAY
+/*
+ * Replay a capture through the parser, bridge and USB output on Linux.
+ * Build with
+ *   gcc -O2 -pthread -DDEBUG_CAPTURE_REPLAY=1 -o capture_replay capture.c \
+ *     bridge.c bridge_os.c report_queue.c motion.c report_desc.c \
+ *     latency_hist.c curve.c usb_out.c -lm
+ *   ./capture_replay capture.bin
+ * The report maps are parsed and each notification is queued for the
+ * bridge task when its recorded time comes, so the joystick output and the
+ * latency histograms are those of the recorded stream on this host. With
+ * -f the notifications are queued as fast as the bridge takes them, to
+ * measure throughput. Every joystick report sent is printed as
+ * time_us,x,y,buttons unless -q is given. Uses the default transfer curve.
+ */
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+#include "./bridge.h"
+#include "./usb_out.h"
+
+#define REPLAY_DEVICES      (16)    // device numbers in a capture
+#define REPLAY_HANDLES      (16)
+#define REPLAY_MAP_MAX      (4096)
+
+typedef struct {
+  uint16_t handle;
+  uint8_t report_id;
+  uint8_t flags;
+} replay_handle_t;
+
+typedef struct {
+  uint8_t map[REPLAY_MAP_MAX];
+  size_t map_len;
+  bool map_dirty;
+  // A new map is parsed into the buffer not in use, as in the sketch, so
+  // reports queued with the old layout stay valid.
+  hid_layout_t layouts[2];
+  const hid_layout_t *layout;
+  replay_handle_t handles[REPLAY_HANDLES];
+  size_t handle_count;
+} replay_device_t;
+
+typedef struct __attribute__((packed)) {
+  uint16_t x;
+  uint16_t y;
+  uint16_t buttons;
+} replay_joy_t;
+
+static replay_device_t Replay_Devices[REPLAY_DEVICES];
+static hid_layout_t Boot_Layout;
+static report_queue_t Queue;
+static bridge_events_t Events;
+static bridge_t Bridge;
+static usb_out_t Usb;
+static bridge_timer_t Usb_Timer;
+static replay_joy_t Joy;
+static uint32_t Start_us;
+static bool Quiet;
+static volatile uint32_t Joy_Sent;
+
+static bool usb_send(void *ctx, const void *report, size_t len) {
+  (void)ctx;
+  (void)len;
+  const replay_joy_t *joy = (const replay_joy_t *)report;
+  if (!Quiet) {
+    printf("%" PRIu32 ",%u,%u,%u\n", bridge_micros() - Start_us, joy->x,
+        joy->y, joy->buttons);
+  }
+  Joy_Sent++;
+  return true;
+}
+
+// The report went to the endpoint, after any wait in Usb.
+static void usb_sent(void *ctx, const usb_out_stamp_t *stamp) {
+  (void)ctx;
+  bridge_report_sent(&Bridge, stamp->made_us, stamp->oldest_us,
+      bridge_micros());
+}
+
+static void usb_timer_cb(void *arg) {
+  (void)arg;
+  bridge_events_signal(&Events, BRIDGE_EVENT_USB);
+}
+
+static void usb_flush(void) {
+  uint32_t retry_us = usb_out_poll(&Usb, bridge_micros());
+  if (retry_us) bridge_timer_once(&Usb_Timer, retry_us);
+}
+
+// Same as joy_write() in the sketch.
+static void joy_write(void *ctx, const joy_output_t *out) {
+  (void)ctx;
+  bool event = (Joy.buttons != (uint16_t)out->buttons);
+  Joy.buttons = (uint16_t)out->buttons;
+  Joy.x = out->x;
+  Joy.y = out->y;
+  usb_out_stamp_t stamp = { out->decoded_us, out->oldest_us, out->measure };
+  usb_out_submit_stamped(&Usb, &Joy, event, &stamp);
+  usb_flush();
+}
+
+static void bridge_task(void *arg) {
+  (void)arg;
+  bridge_events_bind(&Events);
+  for (;;) {
+    uint32_t events = bridge_events_wait(&Events, BRIDGE_WAIT_FOREVER);
+    bridge_handle_events(&Bridge, events);
+    if (events & BRIDGE_EVENT_USB) usb_flush();
+  }
+}
+
+// Layout of a notification, NULL if the sketch would not queue it.
+static const hid_report_layout_t *replay_layout(replay_device_t *d,
+    uint16_t handle) {
+  if (d->map_dirty) {
+    hid_layout_t *spare = (d->layout == &d->layouts[0]) ?
+      &d->layouts[1] : &d->layouts[0];
+    hid_layout_parse(spare, d->map, d->map_len, false);
+    d->layout = spare;
+    d->map_dirty = false;
+  }
+  for (size_t i = 0; i < d->handle_count; i++) {
+    const replay_handle_t *h = &d->handles[i];
+    if (h->handle != handle) continue;
+    if (h->flags & CAPTURE_HANDLE_BOOT) return &Boot_Layout.reports[0];
+    if (d->layout == NULL) return NULL;
+    const hid_report_layout_t *layout =
+      hid_layout_find_report(d->layout, h->report_id);
+    return ((layout != NULL) && layout->is_mouse) ? layout : NULL;
+  }
+  return NULL;
+}
+
+static void add_handle(replay_device_t *d, uint16_t handle,
+    const uint8_t *data, size_t len) {
+  replay_handle_t *h = NULL;
+  for (size_t i = 0; i < d->handle_count; i++) {
+    if (d->handles[i].handle == handle) h = &d->handles[i];
+  }
+  if ((h == NULL) && (d->handle_count < REPLAY_HANDLES)) {
+    h = &d->handles[d->handle_count++];
+  }
+  if (h == NULL) return;
+  h->handle = handle;
+  h->report_id = (len > 0) ? data[0] : 0;
+  h->flags = (len > 1) ? data[1] : 0;
+}
+
+static void sleep_until_us(uint32_t us) {
+  int32_t wait;
+  while ((wait = (int32_t)(us - bridge_micros())) > 0) {
+    usleep((wait > 1000) ? wait - 500 : 50);
+  }
+}
+
+static void print_latency(const char *name, const latency_hist_t *h) {
+  latency_summary_t s;
+  latency_hist_summary(h, &s);
+  printf("%s latency us: p50 %" PRIu32 " p99 %" PRIu32 " max %" PRIu32
+      " count %" PRIu32 "\n", name, s.p50, s.p99, s.max, s.count);
+}
+
+int main(int argc, char *argv[]) {
+  bool fast = false;
+  int opt;
+  while ((opt = getopt(argc, argv, "fq")) != -1) {
+    switch (opt) {
+      case 'f':
+        fast = true;
+        break;
+      case 'q':
+        Quiet = true;
+        break;
+      default:
+        fprintf(stderr, "usage: %s [-f] [-q] capture.bin\n"
+            "  -f  queue reports as fast as the bridge takes them\n"
+            "  -q  print only the summary\n", argv[0]);
+        return 2;
+    }
+  }
+  if (optind >= argc) {
+    fprintf(stderr, "no capture file\n");
+    return 2;
+  }
+  FILE *f = fopen(argv[optind], "rb");
+  if (f == NULL) {
+    perror(argv[optind]);
+    return 2;
+  }
+  fseek(f, 0, SEEK_END);
+  long file_len = ftell(f);
+  fseek(f, 0, SEEK_SET);
+  uint8_t *file = (uint8_t *)malloc(file_len > 0 ? file_len : 1);
+  size_t len = fread(file, 1, file_len, f);
+  fclose(f);
+  capture_reader_t reader;
+  if (!capture_reader_init(&reader, file, len)) {
+    fprintf(stderr, "%s is not a capture\n", argv[optind]);
+    return 2;
+  }
+
+  hid_layout_boot_mouse(&Boot_Layout);
+  report_queue_init(&Queue);
+  bridge_events_init(&Events);
+  static const usb_out_endpoint_t ep = { NULL, usb_send, NULL, usb_sent };
+  if (!usb_out_init(&Usb, &ep, sizeof(Joy), USB_OUT_INTERVAL_US) ||
+      !bridge_timer_init(&Usb_Timer, "usb", usb_timer_cb, NULL) ||
+      !bridge_init(&Bridge, &Queue, &Events, joy_write, NULL)) {
+    fprintf(stderr, "bridge start failed\n");
+    return 1;
+  }
+  bridge_latency_on_sent(&Bridge);
+  if (!bridge_task_start(bridge_task, NULL, "bridge", 8192, 5)) {
+    fprintf(stderr, "bridge start failed\n");
+    return 1;
+  }
+
+  capture_record_t rec;
+  const uint8_t *data;
+  uint32_t records = 0, reports = 0, queued = 0, lost = 0, retries = 0;
+  bool first = true;
+  uint32_t first_us = 0;
+  Start_us = bridge_micros();
+  while (capture_reader_next(&reader, &rec, &data)) {
+    records++;
+    if (first) {
+      first_us = rec.time_us;
+      first = false;
+    }
+    if (!fast) sleep_until_us(Start_us + (rec.time_us - first_us));
+    replay_device_t *d = &Replay_Devices[rec.device];
+    switch (rec.type) {
+      case CAPTURE_REPORT: {
+        reports++;
+        const hid_report_layout_t *layout = replay_layout(d, rec.handle);
+        if (layout == NULL) break;
+        bool pushed;
+        while (!(pushed = report_queue_push(&Queue, bridge_micros(),
+                rec.device, layout, rec.handle, data, rec.len)) && fast) {
+          // With -f wait for the bridge. In real time a report that does
+          // not fit is lost as on the ESP32 and counted in Queue.dropped.
+          retries++;
+          Queue.dropped--;
+          bridge_events_signal(&Events, BRIDGE_EVENT_REPORT);
+          usleep(1);
+        }
+        if (pushed) queued++;
+        bridge_events_signal(&Events, BRIDGE_EVENT_REPORT);
+        break;
+      }
+      case CAPTURE_MAP:
+        if (rec.handle == 0) d->map_len = 0;
+        if ((rec.handle == d->map_len) &&
+            (d->map_len + rec.len <= REPLAY_MAP_MAX)) {
+          memcpy(&d->map[d->map_len], data, rec.len);
+          d->map_len += rec.len;
+          d->map_dirty = true;
+        }
+        break;
+      case CAPTURE_HANDLE:
+        add_handle(d, rec.handle, data, rec.len);
+        break;
+      case CAPTURE_CONNECT:
+        if (rec.device < BRIDGE_DEVICES_MAX) {
+          d->handle_count = 0;
+          bridge_add_device(&Bridge, rec.device, (rec.len > 0) ? data[0] : 0);
+        }
+        break;
+      case CAPTURE_DISCONNECT:
+        // The sketch removes a device after its queued reports.
+        while (report_queue_count(&Queue) > 0) usleep(100);
+        if (rec.device < BRIDGE_DEVICES_MAX) {
+          bridge_remove_device(&Bridge, rec.device);
+        }
+        break;
+      case CAPTURE_RESET_RANGE:
+        bridge_reset_range(&Bridge);
+        break;
+      case CAPTURE_LOST:
+        if (rec.len >= 4) {
+          lost += data[0] | (data[1] << 8) | (data[2] << 16) |
+            ((uint32_t)data[3] << 24);
+        }
+        break;
+    }
+  }
+  while (report_queue_count(&Queue) > 0) usleep(100);
+  uint32_t elapsed_us = bridge_micros() - Start_us;
+  // Let the last joystick reports out.
+  usleep(2 * USB_OUT_INTERVAL_US);
+
+  printf("records %" PRIu32 ", reports %" PRIu32 ", queued %" PRIu32
+      ", dropped %" PRIu32 ", lost while recording %" PRIu32 "\n", records,
+      reports, queued, Queue.dropped, lost);
+  if (reader.pos != len) {
+    printf("capture cut at byte %zu of %zu\n", reader.pos, len);
+  }
+  printf("joystick writes %" PRIu32 ", sent %" PRIu32 ", suppressed %" PRIu32
+      ", merged %" PRIu32 "\n", Bridge.writes, Usb.stats.sent,
+      Usb.stats.suppressed, Usb.stats.merged);
+  print_latency("decode", &Bridge.decode_latency);
+  print_latency("write", &Bridge.write_latency);
+  print_latency("total", &Bridge.total_latency);
+  printf("%.3f s, %.0f reports/s", elapsed_us / 1e6,
+      queued * 1e6 / (elapsed_us ? elapsed_us : 1));
+  if (fast) printf(", queue full %" PRIu32 " times", retries);
+  printf("\n");
+  free(file);
+  return 0;
+}
+#endif
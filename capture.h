@@ -0,0 +1,162 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2023 touchgadgetdev@gmail.com
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef _CAPTURE_H_
+#define _CAPTURE_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+/*
+ * Capture of what the bridge receives from its BLE HID devices: every
+ * notification with its arrival time and handle, the report maps, and
+ * which handles the bridge decodes as mouse reports. Records go to a RAM
+ * ring without blocking; a background task drains the ring to the CDC
+ * serial port or a file in flash. capture_replay feeds a capture back
+ * through the parser, bridge and USB output on a PC.
+ *
+ * Format, version 1. Values are little endian.
+ *   header  "BMXC", version, 3 bytes 0
+ *   record  time_us (4 bytes), handle (2), type | device << 4 (1), len (1),
+ *           then len bytes of data
+ * time_us is micros() when the record was made. It wraps after 71 minutes.
+ * A reader skips record types it does not know.
+ */
+
+#define CAPTURE_MAGIC       "BMXC"
+#define CAPTURE_VERSION     (1)
+#define CAPTURE_HEADER_LEN  (8)
+#define CAPTURE_RECORD_LEN  (8)
+#define CAPTURE_DATA_MAX    (255)
+
+enum {
+  // Notification. handle is the characteristic value handle.
+  CAPTURE_REPORT = 1,
+  // Report map bytes. handle is their offset in the report map, offset 0
+  // starts a new report map for the device.
+  CAPTURE_MAP,
+  // handle is decoded as a mouse report. data is the report ID and flags.
+  CAPTURE_HANDLE,
+  // Device connected and added to the bridge. data is its button offset.
+  CAPTURE_CONNECT,
+  // Device disconnected and removed from the bridge.
+  CAPTURE_DISCONNECT,
+  // bridge_reset_range() when the device connected.
+  CAPTURE_RESET_RANGE,
+  // data is the number of records lost before this one because the ring
+  // was full, uint32_t.
+  CAPTURE_LOST,
+};
+
+// CAPTURE_HANDLE flags
+#define CAPTURE_HANDLE_BOOT (0x01)    // boot protocol mouse report
+
+typedef struct {
+  uint32_t time_us;
+  uint16_t handle;
+  uint8_t type;
+  uint8_t device;
+  uint8_t len;
+} capture_record_t;
+
+/*
+ * Writes up to len bytes. Returns the number written.
+ */
+typedef size_t (*capture_sink_fn)(void *ctx, const uint8_t *data, size_t len);
+
+/*
+ * Ring of encoded records. Any task may add records; one task drains.
+ */
+typedef struct {
+  uint8_t *ring;
+  uint32_t size;
+  // head is written by the producers under a lock, tail only by the
+  // consumer. Free running, the index is the counter modulo size.
+  uint32_t head __attribute__((aligned(64)));
+  uint32_t lost;          // records lost since the last CAPTURE_LOST
+  uint32_t records;
+  uint32_t lost_total;
+  uint32_t truncated;     // data longer than CAPTURE_DATA_MAX
+  uint32_t tail __attribute__((aligned(64)));
+  uint32_t drained;       // bytes given to the sink
+} capture_t;
+
+/*
+ * Use ring, size bytes, a power of 2. The capture header is the first
+ * thing drained.
+ */
+bool capture_init(capture_t *c, uint8_t *ring, size_t size);
+
+/*
+ * Add a record. Never blocks, may be called from any task but not from an
+ * ISR. Data past CAPTURE_DATA_MAX bytes is not recorded. Returns false and
+ * counts the record lost if the ring is full.
+ */
+bool capture_record(capture_t *c, uint8_t type, uint8_t device,
+    uint16_t handle, uint32_t time_us, const void *data, size_t len);
+
+/*
+ * Add a report map as CAPTURE_MAP records.
+ */
+bool capture_report_map(capture_t *c, uint8_t device, uint32_t time_us,
+    const uint8_t *map, size_t len);
+
+/*
+ * Consumer only. Give the recorded bytes to sink until the ring is empty
+ * or sink writes less than it was given. Returns the bytes written.
+ */
+size_t capture_drain(capture_t *c, capture_sink_fn sink, void *ctx);
+
+/*
+ * Encode the capture header, CAPTURE_HEADER_LEN bytes, and record headers,
+ * CAPTURE_RECORD_LEN bytes, for writers that do not use the ring.
+ */
+void capture_encode_header(uint8_t *header);
+void capture_encode_record(uint8_t *header, const capture_record_t *rec);
+
+/*
+ * Reads records from a capture in memory.
+ */
+typedef struct {
+  const uint8_t *data;
+  size_t len;
+  size_t pos;
+  uint8_t version;
+} capture_reader_t;
+
+/*
+ * Returns false if data does not start with a capture header of a version
+ * this reader knows.
+ */
+bool capture_reader_init(capture_reader_t *r, const uint8_t *data, size_t len);
+
+/*
+ * Next record and its data. Returns false at the end of the capture or at
+ * a record cut short, for example by a reset while recording.
+ */
+bool capture_reader_next(capture_reader_t *r, capture_record_t *rec,
+    const uint8_t **data);
+
+#endif  /* _CAPTURE_H_ */
@@ -0,0 +1,371 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2023 touchgadgetdev@gmail.com
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <string.h>
+#include "./conn_policy.h"
+
+static const conn_policy_config_t Defaults = {
+  CONN_POLICY_ACTIVE_MIN,
+  CONN_POLICY_ACTIVE_MAX,
+  CONN_POLICY_IDLE_INTERVAL,
+  CONN_POLICY_IDLE_LATENCY,
+  CONN_POLICY_TIMEOUT,
+  CONN_POLICY_IDLE_US,
+};
+
+// The supervision timeout must be longer than
+// (1 + latency) * interval * 2, in ms: timeout * 10 > (1 + latency) *
+// interval * 2.5.
+static uint16_t max_latency(uint16_t interval, uint16_t timeout) {
+  if (interval == 0) return 0;
+  uint32_t events = ((uint32_t)timeout * 4 - 1) / interval;
+  return (events > 1) ? (uint16_t)(events - 1) : 0;
+}
+
+void conn_policy_init(conn_policy_t *p, const conn_policy_config_t *cfg) {
+  memset(p, 0, sizeof(*p));
+  p->cfg = (cfg == NULL) ? Defaults : *cfg;
+  uint16_t latency = max_latency(p->cfg.idle_interval, p->cfg.timeout);
+  if (p->cfg.idle_latency > latency) p->cfg.idle_latency = latency;
+  p->state = CONN_POLICY_DISCONNECTED;
+}
+
+void conn_policy_target(const conn_policy_t *p, conn_params_t *target) {
+  uint16_t floor = __atomic_load_n(&p->floor, __ATOMIC_RELAXED);
+  uint16_t interval;
+  uint16_t latency;
+  if (p->state == CONN_POLICY_IDLE) {
+    interval = (floor > p->cfg.idle_interval) ? floor : p->cfg.idle_interval;
+    latency = max_latency(interval, p->cfg.timeout);
+    if (latency > p->cfg.idle_latency) latency = p->cfg.idle_latency;
+  } else {
+    interval = (floor > p->cfg.active_min) ? floor : p->cfg.active_min;
+    latency = 0;
+  }
+  target->min_interval = interval;
+  target->max_interval = interval;
+  target->latency = latency;
+  target->timeout = p->cfg.timeout;
+}
+
+static bool satisfied(const conn_policy_t *p, const conn_params_t *target) {
+  if (p->latency != target->latency) return false;
+  if (p->state == CONN_POLICY_IDLE) return p->interval == target->max_interval;
+  return p->interval <= target->max_interval;
+}
+
+static bool maybe_request(conn_policy_t *p, uint32_t now_us, conn_params_t *req) {
+  if ((p->state == CONN_POLICY_DISCONNECTED) || p->pending) return false;
+  conn_params_t target;
+  conn_policy_target(p, &target);
+  if (satisfied(p, &target)) {
+    p->attempts = 0;
+    return false;
+  }
+  if (p->attempts >= CONN_POLICY_ATTEMPTS) return false;
+  p->attempts++;
+  p->pending = true;
+  p->pending_us = now_us;
+  p->stats.requests++;
+  *req = target;
+  return true;
+}
+
+static void set_state(conn_policy_t *p, conn_policy_state_t state) {
+  if (p->state == state) return;
+  if (state == CONN_POLICY_IDLE) p->stats.to_idle++;
+  if (state == CONN_POLICY_ACTIVE) p->stats.to_active++;
+  p->state = state;
+  p->attempts = 0;
+}
+
+bool conn_policy_connected(conn_policy_t *p, uint16_t interval,
+    uint16_t latency, uint32_t now_us, conn_params_t *req) {
+  p->state = CONN_POLICY_ACTIVE;
+  p->interval = interval;
+  p->latency = latency;
+  p->pending = false;
+  p->attempts = 0;
+  p->last_report_us = now_us;
+  return maybe_request(p, now_us, req);
+}
+
+void conn_policy_disconnected(conn_policy_t *p) {
+  p->state = CONN_POLICY_DISCONNECTED;
+  p->pending = false;
+  __atomic_store_n(&p->floor, 0, __ATOMIC_RELAXED);
+}
+
+bool conn_policy_report(conn_policy_t *p, uint32_t now_us, conn_params_t *req) {
+  if (p->state == CONN_POLICY_DISCONNECTED) return false;
+  p->last_report_us = now_us;
+  set_state(p, CONN_POLICY_ACTIVE);
+  return maybe_request(p, now_us, req);
+}
+
+bool conn_policy_tick(conn_policy_t *p, uint32_t now_us, conn_params_t *req) {
+  if (p->state == CONN_POLICY_DISCONNECTED) return false;
+  if (p->pending && ((now_us - p->pending_us) >= CONN_POLICY_PENDING_US)) {
+    p->pending = false;
+    p->stats.failures++;
+  }
+  if ((p->state == CONN_POLICY_ACTIVE) &&
+      ((now_us - p->last_report_us) >= p->cfg.idle_us)) {
+    set_state(p, CONN_POLICY_IDLE);
+  }
+  return maybe_request(p, now_us, req);
+}
+
+bool conn_policy_updated(conn_policy_t *p, int status, uint16_t interval,
+    uint16_t latency, uint32_t now_us, conn_params_t *req) {
+  if (p->state == CONN_POLICY_DISCONNECTED) return false;
+  bool ours = p->pending;
+  p->pending = false;
+  if (status == 0) {
+    if ((interval != p->interval) || (latency != p->latency)) p->stats.updates++;
+    p->interval = interval;
+    p->latency = latency;
+  } else if (ours) {
+    p->stats.failures++;
+    if (p->state == CONN_POLICY_ACTIVE) {
+      // Refused. Try active_max, then double the interval.
+      conn_params_t target;
+      conn_policy_target(p, &target);
+      uint16_t floor = target.max_interval * 2;
+      if ((target.max_interval < p->cfg.active_max) &&
+          (floor > p->cfg.active_max)) {
+        floor = p->cfg.active_max;
+      }
+      __atomic_store_n(&p->floor, floor, __ATOMIC_RELAXED);
+    }
+  }
+  return maybe_request(p, now_us, req);
+}
+
+bool conn_policy_peer_request(conn_policy_t *p, const conn_params_t *proposed) {
+  __atomic_fetch_add(&p->stats.peer_requests, 1, __ATOMIC_RELAXED);
+  uint16_t floor = __atomic_load_n(&p->floor, __ATOMIC_RELAXED);
+  if ((proposed->min_interval > p->cfg.active_min) &&
+      (proposed->min_interval > floor)) {
+    __atomic_store_n(&p->floor, proposed->min_interval, __ATOMIC_RELAXED);
+  }
+  return true;
+}
+
+const char *conn_policy_state_name(conn_policy_state_t state) {
+  switch (state) {
+    case CONN_POLICY_DISCONNECTED: return "disconnected";
+    case CONN_POLICY_ACTIVE: return "active";
+    case CONN_POLICY_IDLE: return "idle";
+  }
+  return "?";
+}
+
+#if DEBUG_CONN_POLICY_MAIN
+/*
+ * State machine test against a simulated peer in virtual time. Build and
+ * run on Linux with
+ *   gcc -O2 -DDEBUG_CONN_POLICY_MAIN=1 -o conn_policy_test conn_policy.c
+ * The peer applies updates after a few connection events and refuses
+ * intervals shorter than it supports. The mouse sends a report at every
+ * connection event while it moves, so the time from starting to move to
+ * the first report is at most one interval. Each scenario checks the
+ * parameters reached and the delay of the first report after an idle
+ * period.
+ */
+#include <inttypes.h>
+#include <stdio.h>
+
+#define STEP_US       (250)
+#define TICK_US       (32000)
+#define UPDATE_EVENTS (6)
+
+typedef struct {
+  uint16_t min_interval;    // shortest supported
+  bool silent;              // never answers update requests
+  conn_params_t ask;        // peer initiated update, 0 if none
+  uint32_t ask_at_us;
+  // Link state
+  uint16_t interval;
+  uint16_t latency;
+  uint32_t next_event_us;
+  bool update_pending;
+  conn_params_t update;
+  uint32_t update_us;
+} test_peer_t;
+
+static uint32_t Now;
+
+static void peer_request(test_peer_t *peer, const conn_params_t *req) {
+  if (peer->silent) return;
+  peer->update_pending = true;
+  peer->update = *req;
+  peer->update_us = Now + UPDATE_EVENTS * peer->interval * 1250;
+}
+
+/*
+ * Run from Now to end_us. The mouse moves during [move_start, move_end).
+ * Returns the delay from move_start to the first report.
+ */
+static uint32_t run(conn_policy_t *p, test_peer_t *peer, uint32_t end_us,
+    uint32_t move_start, uint32_t move_end) {
+  conn_params_t req;
+  uint32_t first_report = 0;
+  for (; Now < end_us; Now += STEP_US) {
+    if (peer->ask.min_interval && (Now >= peer->ask_at_us)) {
+      if (conn_policy_peer_request(p, &peer->ask)) {
+        peer->interval = peer->ask.max_interval;
+        peer->latency = peer->ask.latency;
+        if (conn_policy_updated(p, 0, peer->interval, peer->latency, Now, &req)) {
+          peer_request(peer, &req);
+        }
+      }
+      peer->ask.min_interval = 0;
+    }
+    if (peer->update_pending && (Now >= peer->update_us)) {
+      peer->update_pending = false;
+      int status = 0;
+      if (peer->update.max_interval < peer->min_interval) {
+        status = 0x23e;   // BLE_ERR_UNACCEPT_CONN_PARAMS
+      } else {
+        peer->interval = (peer->update.min_interval > peer->min_interval) ?
+          peer->update.min_interval : peer->min_interval;
+        peer->latency = peer->update.latency;
+      }
+      if (conn_policy_updated(p, status, peer->interval, peer->latency, Now, &req)) {
+        peer_request(peer, &req);
+      }
+    }
+    if (Now >= peer->next_event_us) {
+      peer->next_event_us += peer->interval * 1250;
+      if ((Now >= move_start) && (Now < move_end)) {
+        if (first_report == 0) first_report = Now;
+        if (conn_policy_report(p, Now, &req)) peer_request(peer, &req);
+      }
+    }
+    if ((Now % TICK_US) == 0) {
+      if (conn_policy_tick(p, Now, &req)) peer_request(peer, &req);
+    }
+  }
+  return (first_report != 0) ? first_report - move_start : UINT32_MAX;
+}
+
+static void connect(conn_policy_t *p, test_peer_t *peer) {
+  conn_params_t req;
+  Now = 1000000;
+  peer->interval = 12;      // setConnectionParams() in connectToServer
+  peer->latency = 0;
+  peer->next_event_us = Now;
+  peer->update_pending = false;
+  conn_policy_init(p, NULL);
+  if (conn_policy_connected(p, peer->interval, peer->latency, Now, &req)) {
+    peer_request(peer, &req);
+  }
+}
+
+static int expect(const char *name, const conn_policy_t *p,
+    conn_policy_state_t state, uint16_t interval, uint16_t latency,
+    uint32_t delay, uint32_t max_delay) {
+  bool ok = (p->state == state) && (p->interval == interval) &&
+    (p->latency == latency) && (delay <= max_delay);
+  printf("%-28s %-6s interval %3u latency %2u first report %6"PRIu32
+      " us requests %"PRIu32" failures %"PRIu32" %s\n", name,
+      conn_policy_state_name(p->state), p->interval, p->latency, delay,
+      p->stats.requests, p->stats.failures, ok ? "OK" : "FAIL");
+  return ok ? 0 : 1;
+}
+
+int main(void) {
+  int errors = 0;
+  conn_policy_t p;
+  test_peer_t peer;
+  uint32_t delay;
+
+  // Fast peer. Active at 7.5 ms, idle after 2 s, back on the first report.
+  peer = (test_peer_t){ .min_interval = 6 };
+  connect(&p, &peer);
+  delay = run(&p, &peer, Now + 1000000, Now, Now + 1000000);
+  errors += expect("fast peer moving", &p, CONN_POLICY_ACTIVE, 6, 0, delay, 0);
+  delay = run(&p, &peer, Now + 3000000, UINT32_MAX, 0);
+  errors += expect("fast peer idle", &p, CONN_POLICY_IDLE,
+      CONN_POLICY_IDLE_INTERVAL, CONN_POLICY_IDLE_LATENCY, 0, 0);
+  uint32_t start = Now + 1234;
+  delay = run(&p, &peer, Now + 500000, start, Now + 500000);
+  errors += expect("fast peer moving again", &p, CONN_POLICY_ACTIVE, 6, 0,
+      delay, CONN_POLICY_IDLE_INTERVAL * 1250);
+  if ((p.stats.to_idle != 1) || (p.stats.to_active != 1) ||
+      (p.stats.requests != 3) || (p.stats.failures != 0)) {
+    printf("fast peer stats FAIL\n");
+    errors++;
+  }
+
+  // Peer that only does 15 ms. Refuses 7.5 ms, accepts 15 ms.
+  peer = (test_peer_t){ .min_interval = 12 };
+  connect(&p, &peer);
+  delay = run(&p, &peer, Now + 1000000, Now, Now + 1000000);
+  errors += expect("15 ms peer", &p, CONN_POLICY_ACTIVE, 12, 0, delay, 0);
+  if (p.stats.failures != 1) errors++;
+
+  // Peer asks for 30..50 ms. Accepted, then held at its minimum.
+  peer = (test_peer_t){ .min_interval = 6 };
+  peer.ask = (conn_params_t){ 24, 40, 0, 300 };
+  connect(&p, &peer);
+  peer.ask_at_us = Now + 200000;
+  delay = run(&p, &peer, Now + 1000000, Now, Now + 1000000);
+  errors += expect("peer asks 30..50 ms", &p, CONN_POLICY_ACTIVE, 24, 0, delay, 0);
+  if (p.stats.peer_requests != 1) errors++;
+
+  // Peer never answers. Requests time out and stop after
+  // CONN_POLICY_ATTEMPTS.
+  peer = (test_peer_t){ .min_interval = 6 };
+  peer.silent = true;
+  connect(&p, &peer);
+  delay = run(&p, &peer, Now + 30000000, Now, Now + 30000000);
+  errors += expect("silent peer", &p, CONN_POLICY_ACTIVE, 12, 0, delay, 0);
+  if ((p.stats.requests != CONN_POLICY_ATTEMPTS) ||
+      (p.stats.failures != CONN_POLICY_ATTEMPTS) || p.pending) {
+    errors++;
+  }
+
+  // Peripheral latency limited by the supervision timeout.
+  conn_policy_config_t cfg = {
+    6, 12, 80, 30, CONN_POLICY_TIMEOUT, CONN_POLICY_IDLE_US,
+  };
+  conn_policy_init(&p, &cfg);
+  if (p.cfg.idle_latency != 13) {
+    printf("latency limit %u FAIL\n", p.cfg.idle_latency);
+    errors++;
+  }
+
+  // Disconnected: no requests.
+  conn_params_t req;
+  conn_policy_disconnected(&p);
+  if (conn_policy_report(&p, Now, &req) || conn_policy_tick(&p, Now, &req)) {
+    errors++;
+  }
+
+  printf("errors %d\n", errors);
+  return errors;
+}
+#endif
@@ -0,0 +1,152 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2023 touchgadgetdev@gmail.com
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef _CONN_POLICY_H_
+#define _CONN_POLICY_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+/*
+ * BLE connection parameter policy. While the mouse moves ask for the
+ * shortest connection interval the peer supports, 7.5 to 15 ms with no
+ * peripheral latency, because a report waits for the next connection event.
+ * After CONN_POLICY_IDLE_US without reports back off to a longer interval
+ * with peripheral latency so the mouse can sleep through events. The first
+ * report after that switches back.
+ *
+ * The policy does no I/O. Each call that may change the wanted parameters
+ * returns true and fills in req when the caller should send a connection
+ * parameter update. The result comes back in conn_policy_updated().
+ * Intervals are in 1.25 ms units, supervision timeouts in 10 ms units, as
+ * in ble_gap_upd_params. Times are bridge_micros().
+ */
+
+#define CONN_POLICY_ACTIVE_MIN    (6)         // 7.5 ms
+#define CONN_POLICY_ACTIVE_MAX    (12)        // 15 ms
+#define CONN_POLICY_IDLE_INTERVAL (24)        // 30 ms
+#define CONN_POLICY_IDLE_LATENCY  (15)        // mouse may skip 15 events
+#define CONN_POLICY_TIMEOUT       (300)       // 3 s
+#define CONN_POLICY_IDLE_US       (2000000)
+// Give up on an update request with no result after this long
+#define CONN_POLICY_PENDING_US    (5000000)
+// Requests for the same state before giving up until the state changes
+#define CONN_POLICY_ATTEMPTS      (3)
+
+typedef enum {
+  CONN_POLICY_DISCONNECTED,
+  CONN_POLICY_ACTIVE,
+  CONN_POLICY_IDLE,
+} conn_policy_state_t;
+
+typedef struct {
+  uint16_t min_interval;
+  uint16_t max_interval;
+  uint16_t latency;
+  uint16_t timeout;
+} conn_params_t;
+
+typedef struct {
+  uint16_t active_min;
+  uint16_t active_max;
+  uint16_t idle_interval;
+  uint16_t idle_latency;
+  uint16_t timeout;
+  uint32_t idle_us;
+} conn_policy_config_t;
+
+typedef struct {
+  uint32_t requests;          // updates asked for
+  uint32_t updates;           // parameters changed
+  uint32_t failures;          // requests refused or timed out
+  uint32_t peer_requests;     // updates asked for by the peer
+  uint32_t to_idle;
+  uint32_t to_active;
+} conn_policy_stats_t;
+
+typedef struct {
+  conn_policy_config_t cfg;
+  conn_policy_state_t state;
+  uint16_t interval;          // in use, from the controller
+  uint16_t latency;
+  // Shortest interval the peer accepts. Raised by refused requests and by
+  // peer requests with a longer minimum.
+  uint16_t floor;
+  bool pending;
+  uint32_t pending_us;
+  uint32_t attempts;
+  uint32_t last_report_us;
+  conn_policy_stats_t stats;
+} conn_policy_t;
+
+/*
+ * cfg NULL for the defaults above. Peripheral latency is reduced if the
+ * timeout is too short for it.
+ */
+void conn_policy_init(conn_policy_t *p, const conn_policy_config_t *cfg);
+
+/*
+ * The connection is ready with the given parameters. Starts active. Peer
+ * requests since conn_policy_disconnected() are kept.
+ */
+bool conn_policy_connected(conn_policy_t *p, uint16_t interval,
+    uint16_t latency, uint32_t now_us, conn_params_t *req);
+
+void conn_policy_disconnected(conn_policy_t *p);
+
+/*
+ * A mouse report arrived.
+ */
+bool conn_policy_report(conn_policy_t *p, uint32_t now_us, conn_params_t *req);
+
+/*
+ * Call periodically, at least every few hundred ms while connected, to
+ * detect idle and lost update results.
+ */
+bool conn_policy_tick(conn_policy_t *p, uint32_t now_us, conn_params_t *req);
+
+/*
+ * Result of a connection parameter update, ours or the peer's. status is
+ * 0 on success; interval and latency are the parameters now in use.
+ */
+bool conn_policy_updated(conn_policy_t *p, int status, uint16_t interval,
+    uint16_t latency, uint32_t now_us, conn_params_t *req);
+
+/*
+ * The peer asks for new parameters. Returns true to accept. Always accepts
+ * since some peers disconnect when refused, but a longer minimum interval
+ * is remembered so later requests stay inside what the peer supports.
+ * May be called from the BLE host task.
+ */
+bool conn_policy_peer_request(conn_policy_t *p, const conn_params_t *proposed);
+
+/*
+ * Parameters wanted in the current state.
+ */
+void conn_policy_target(const conn_policy_t *p, conn_params_t *target);
+
+const char *conn_policy_state_name(conn_policy_state_t state);
+
+#endif  /* _CONN_POLICY_H_ */
@@ -0,0 +1,389 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2023 touchgadgetdev@gmail.com
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <math.h>
+#include <string.h>
+#include "./curve.h"
+
+static const curve_config_t Default_Config = CURVE_CONFIG_DEFAULT;
+
+static bool config_ok(const curve_config_t *cfg) {
+  return ((cfg->mode == CURVE_RATE) || (cfg->mode == CURVE_INTEGRATE)) &&
+    (cfg->gain > 0) && (cfg->range > 0);
+}
+
+static void set_range(curve_t *c, curve_axis_t *a, uint32_t range) {
+  a->range = range;
+  a->recip = ((1ULL << 32) + range / 2) / range;
+  c->divisions++;
+}
+
+static void build_tables(curve_t *c) {
+  const float expo = c->cfg.expo / 255.0f;
+  const float s = c->cfg.s_curve / 255.0f;
+  for (int i = 0; i <= CURVE_LUT_SIZE; i++) {
+    float u = (float)i / CURVE_LUT_SIZE;
+    float f = (1.0f - expo) * u + expo * u * u * u;
+    f = (1.0f - s) * f + s * f * f * (3.0f - 2.0f * f);
+    c->lut[i] = (uint16_t)lroundf(f * (CURVE_OUT_MAX << CURVE_LUT_FRAC_BITS));
+  }
+  for (int i = 0; i < CURVE_DECAY_STEPS; i++) {
+    float keep = (c->cfg.decay_ms == 0) ? 1.0f :
+      expf(-(i * 1.024f) / c->cfg.decay_ms);
+    long q = lroundf(keep * 65536.0f);
+    c->decay[i] = (q > 65535) ? 65535 : (uint16_t)q;
+  }
+  float keep = (c->cfg.range_decay_ms == 0) ? 1.0f :
+    powf(0.5f, (CURVE_RANGE_STEP_US / 1000.0f) / c->cfg.range_decay_ms);
+  long q = lroundf(keep * 65536.0f);
+  c->range_keep = (q > 65535) ? 65535 : (uint16_t)q;
+}
+
+bool curve_init(curve_t *c, const curve_config_t *cfg) {
+  bool ok = true;
+  memset(c, 0, sizeof(*c));
+  if (cfg == NULL) {
+    cfg = &Default_Config;
+  } else if (!config_ok(cfg)) {
+    cfg = &Default_Config;
+    ok = false;
+  }
+  c->cfg = *cfg;
+  build_tables(c);
+  curve_reset(c);
+  return ok;
+}
+
+void curve_reset(curve_t *c) {
+  curve_axis_t *axes[2] = { &c->x, &c->y };
+  for (int i = 0; i < 2; i++) {
+    axes[i]->residual = 0;
+    axes[i]->carry = 0;
+    axes[i]->position = 0;
+    set_range(c, axes[i], c->cfg.range);
+  }
+}
+
+// Table lookup with linear interpolation. u is Q24, 0..1 << CURVE_U_BITS.
+// Returns deflection << CURVE_FRAC_BITS, rounded.
+static inline int32_t lookup(const curve_t *c, uint32_t u) {
+  const int shift = CURVE_U_BITS - CURVE_LUT_BITS;
+  const int up = CURVE_FRAC_BITS - CURVE_LUT_FRAC_BITS;
+  uint32_t i = u >> shift;
+  if (i >= CURVE_LUT_SIZE) return c->lut[CURVE_LUT_SIZE] << up;
+  uint32_t f = u & ((1UL << shift) - 1);
+  int32_t lo = c->lut[i];
+  int64_t d = (int64_t)(c->lut[i + 1] - lo) * f;
+  return (lo << up) + (int32_t)((d + (1 << (shift - up - 1))) >> (shift - up));
+}
+
+// Counts / range, or the position, to table input. v is Q32.
+static inline uint32_t table_input(uint64_t v) {
+  v = (v + (1 << (31 - CURVE_U_BITS))) >> (32 - CURVE_U_BITS);
+  return (v > (1UL << CURVE_U_BITS)) ? (1UL << CURVE_U_BITS) : (uint32_t)v;
+}
+
+// Round to whole steps, half away from zero.
+static inline int32_t round_steps(int32_t v) {
+  const int32_t half = 1 << (CURVE_FRAC_BITS - 1);
+  return (v < 0) ? -((half - v) >> CURVE_FRAC_BITS) :
+    (v + half) >> CURVE_FRAC_BITS;
+}
+
+// Gain with the remainder carried, then the deadzone. Result is limited
+// to +-CURVE_INPUT_MAX.
+static inline int32_t gain(const curve_t *c, curve_axis_t *a, int32_t v) {
+  int64_t scaled = (int64_t)v * c->cfg.gain + a->residual;
+  int64_t g = scaled >> 8;
+  a->residual = (int32_t)(scaled - (g << 8));
+  if (g > c->cfg.deadzone) {
+    g -= c->cfg.deadzone;
+  } else if (g < -(int64_t)c->cfg.deadzone) {
+    g += c->cfg.deadzone;
+  } else {
+    g = 0;
+  }
+  if (g > CURVE_INPUT_MAX) g = CURVE_INPUT_MAX;
+  if (g < -CURVE_INPUT_MAX) g = -CURVE_INPUT_MAX;
+  return (int32_t)g;
+}
+
+// The rounding remainder is carried so the deflection averaged over
+// frames keeps the fraction of a step.
+static inline int32_t rate(curve_t *c, curve_axis_t *a, int32_t g) {
+  uint32_t mag = (g < 0) ? -g : g;
+  if (c->cfg.auto_range && (mag > a->range)) set_range(c, a, mag);
+  int32_t d = lookup(c, table_input((uint64_t)mag * a->recip));
+  int32_t v = ((g < 0) ? -d : d) + a->carry;
+  int32_t steps = round_steps(v);
+  a->carry = v - steps * (1 << CURVE_FRAC_BITS);
+  return steps;
+}
+
+static inline int32_t position(const curve_t *c, const curve_axis_t *a) {
+  int64_t p = a->position;
+  int32_t d = round_steps(lookup(c, table_input((p < 0) ? -p : p)));
+  return (p < 0) ? -d : d;
+}
+
+// Decay the stick positions toward center for dt_us.
+static void decay(curve_t *c, uint32_t dt_us) {
+  if (c->cfg.decay_ms == 0) return;
+  uint32_t steps = dt_us >> 10;
+  uint32_t keep = 65536;
+  for (int n = 0; (steps > 0) && (n < 16); n++) {
+    uint32_t s = (steps < CURVE_DECAY_STEPS) ? steps : CURVE_DECAY_STEPS - 1;
+    keep = (keep * c->decay[s]) >> 16;
+    steps -= s;
+  }
+  if (steps > 0) keep = 0;
+  c->x.position = (c->x.position * keep) >> 16;
+  c->y.position = (c->y.position * keep) >> 16;
+}
+
+// Shrink the auto ranges toward the configured range, one step per
+// CURVE_RANGE_STEP_US since the last call.
+static void shrink_ranges(curve_t *c, uint32_t now_us) {
+  if (!c->cfg.auto_range || (c->cfg.range_decay_ms == 0)) return;
+  uint32_t steps = (now_us - c->range_step_us) / CURVE_RANGE_STEP_US;
+  if (steps == 0) return;
+  c->range_step_us += steps * CURVE_RANGE_STEP_US;
+  curve_axis_t *axes[2] = { &c->x, &c->y };
+  for (int i = 0; i < 2; i++) {
+    curve_axis_t *a = axes[i];
+    if (a->range <= c->cfg.range) continue;
+    uint32_t excess = a->range - c->cfg.range;
+    for (uint32_t n = 0; (n < steps) && (excess > 0); n++) {
+      uint32_t keep = (uint32_t)(((uint64_t)excess * c->range_keep) >> 16);
+      excess = (keep < excess) ? keep : excess - 1;
+    }
+    set_range(c, a, c->cfg.range + excess);
+  }
+}
+
+void curve_apply(curve_t *c, int32_t dx, int32_t dy, uint32_t now_us,
+    int32_t *x, int32_t *y) {
+  c->frames++;
+  int32_t gx = gain(c, &c->x, dx);
+  int32_t gy = gain(c, &c->y, dy);
+  if (c->cfg.mode == CURVE_RATE) {
+    shrink_ranges(c, now_us);
+    *x = rate(c, &c->x, gx);
+    *y = rate(c, &c->y, gy);
+  } else {
+    decay(c, now_us - c->last_us);
+    const int64_t full = 1LL << 32;
+    c->x.position += (int64_t)gx * (int64_t)c->x.recip;
+    c->y.position += (int64_t)gy * (int64_t)c->y.recip;
+    if (c->x.position > full) c->x.position = full;
+    if (c->x.position < -full) c->x.position = -full;
+    if (c->y.position > full) c->y.position = full;
+    if (c->y.position < -full) c->y.position = -full;
+    *x = position(c, &c->x);
+    *y = position(c, &c->y);
+  }
+  c->last_us = now_us;
+}
+
+void curve_idle(curve_t *c, uint32_t now_us, int32_t *x, int32_t *y) {
+  if (c->cfg.mode == CURVE_RATE) {
+    shrink_ranges(c, now_us);
+    c->x.carry = 0;
+    c->y.carry = 0;
+    *x = 0;
+    *y = 0;
+  } else {
+    decay(c, now_us - c->last_us);
+    *x = position(c, &c->x);
+    *y = position(c, &c->y);
+  }
+  c->last_us = now_us;
+}
+
+#if DEBUG_CURVE_MAIN
+/*
+ * Build and run on Linux with
+ *   gcc -O2 -DDEBUG_CURVE_MAIN=1 -o curve_test curve.c -lm
+ * Checks linear, deadzone, expo and S-curve responses, that a fast flick
+ * only reduces the sensitivity for a few seconds, that the gain remainder
+ * and stick position do not drift, that the stick returns to center, and
+ * prints the time per frame.
+ */
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#define FRAME_US  (1000)
+
+static int check(const char *name, int32_t got, int32_t lo, int32_t hi) {
+  bool ok = (got >= lo) && (got <= hi);
+  printf("%-36s %6"PRId32" expect %6"PRId32"..%-6"PRId32" %s\n", name, got,
+      lo, hi, ok ? "OK" : "FAIL");
+  return ok ? 0 : 1;
+}
+
+// Deflection of one frame, without the remainder of earlier frames.
+static int32_t one(curve_t *c, int32_t dx, uint32_t now_us) {
+  int32_t x, y;
+  c->x.carry = 0;
+  curve_apply(c, dx, 0, now_us, &x, &y);
+  return x;
+}
+
+int main(void) {
+  int errors = 0;
+  static curve_t c;
+  curve_config_t cfg = CURVE_CONFIG_DEFAULT;
+  int32_t x, y;
+  uint32_t now = 1000000;
+
+  // Linear, fixed range. Full deflection at range counts.
+  cfg.auto_range = false;
+  curve_init(&c, &cfg);
+  errors += check("linear 0", one(&c, 0, now), 0, 0);
+  errors += check("linear 127", one(&c, 127, now), 512, 512);
+  errors += check("linear -127", one(&c, -127, now), -512, -512);
+  errors += check("linear 64", one(&c, 64, now), 257, 259);
+  errors += check("linear 1000 clamped", one(&c, 1000, now), 512, 512);
+
+  // Deadzone
+  cfg.deadzone = 2;
+  curve_init(&c, &cfg);
+  errors += check("deadzone 2", one(&c, 2, now), 0, 0);
+  errors += check("deadzone -2", one(&c, -2, now), 0, 0);
+  errors += check("deadzone 3", one(&c, 3, now), 4, 5);
+  cfg.deadzone = 0;
+
+  // Expo and S-curve: monotonic, ends fixed, expo below linear.
+  cfg.expo = 255;
+  curve_init(&c, &cfg);
+  int32_t prev = 0, bad = 0;
+  for (int32_t v = 0; v <= 127; v++) {
+    int32_t d = one(&c, v, now);
+    if ((d < prev) || (d > (v * 512 + 126) / 127)) bad++;
+    prev = d;
+  }
+  errors += check("expo monotonic, below linear", bad, 0, 0);
+  errors += check("expo 64 (cubic)", one(&c, 64, now), 64, 67);
+  errors += check("expo 127", one(&c, 127, now), 512, 512);
+  cfg.expo = 0;
+  cfg.s_curve = 255;
+  curve_init(&c, &cfg);
+  errors += check("s-curve 32", one(&c, 32, now), 70, 90);
+  errors += check("s-curve 64", one(&c, 64, now), 256, 260);
+  errors += check("s-curve 127", one(&c, 127, now), 512, 512);
+  cfg.s_curve = 0;
+
+  // Slow motion below one step per frame is not lost: 1 count per frame
+  // of range 4000 is 0.128 steps, 1 of 127 is 4.03.
+  cfg.range = 4000;
+  curve_init(&c, &cfg);
+  int32_t steps = 0;
+  int32_t steps_y = 0;
+  for (int i = 0; i < 1000; i++) {
+    curve_apply(&c, 1, -1, now, &x, &y);
+    steps += x;
+    steps_y += y;
+  }
+  errors += check("1/4000 x 1000 frames", steps, 127, 129);
+  errors += check("-1/4000 x 1000 frames", steps_y, -129, -127);
+  cfg.range = 127;
+  curve_init(&c, &cfg);
+  steps = 0;
+  for (int i = 0; i < 1000; i++) {
+    curve_apply(&c, 1, 0, now, &x, &y);
+    steps += x;
+  }
+  errors += check("1/127 x 1000 frames", steps, 4031, 4032);
+
+  // Auto range: a flick of 1000 reduces sensitivity, recovers in seconds.
+  cfg.auto_range = true;
+  curve_init(&c, &cfg);
+  one(&c, 1000, now);
+  errors += check("after flick 64", one(&c, 64, now += FRAME_US), 30, 36);
+  curve_idle(&c, now += 2000000, &prev, &bad);
+  errors += check("flick + 2 s, 64", one(&c, 64, now), 50, 70);
+  curve_idle(&c, now += 10000000, &prev, &bad);
+  errors += check("flick + 12 s, 64", one(&c, 64, now), 254, 259);
+  errors += check("idle centered", (curve_idle(&c, now, &prev, &bad), prev), 0, 0);
+
+  // Integrate. Random walk that sums to 0 returns exactly to center with
+  // no decay, for any gain.
+  cfg.mode = CURVE_INTEGRATE;
+  cfg.decay_ms = 0;
+  cfg.range = 2000;
+  cfg.gain = 77;
+  curve_init(&c, &cfg);
+  srand(1);
+  int32_t walk[1000];
+  int32_t sum = 0;
+  for (int i = 0; i < 1000; i++) {
+    walk[i] = (rand() % 41) - 20;
+    sum += walk[i];
+  }
+  int32_t peak = 0;
+  for (int i = 0; i < 1000; i++) {
+    int32_t d = one(&c, walk[i], now += FRAME_US);
+    if (abs(d) > peak) peak = abs(d);
+  }
+  one(&c, -sum, now += FRAME_US);
+  errors += check("walk returns to center", one(&c, 0, now += FRAME_US), 0, 0);
+  errors += check("walk position exact", (int32_t)c.x.position, 0, 0);
+  errors += check("walk moved the stick", peak, 1, 512);
+  // Push to half, then let it decay.
+  cfg.gain = 256;
+  cfg.decay_ms = 100;
+  curve_init(&c, &cfg);
+  errors += check("integrate 1000 of 2000", one(&c, 1000, now), 255, 257);
+  curve_idle(&c, now += 100000, &x, &y);
+  errors += check("after 100 ms (1/e)", x, 90, 100);
+  curve_idle(&c, now += 1000000, &x, &y);
+  errors += check("after 1.1 s", x, 0, 0);
+
+  // Cost per frame
+  cfg = (curve_config_t)CURVE_CONFIG_DEFAULT;
+  cfg.expo = 128;
+  curve_init(&c, &cfg);
+  const uint32_t n = 10000000;
+  uint32_t seed = 1;
+  int64_t total = 0;
+  struct timespec t0, t1;
+  clock_gettime(CLOCK_MONOTONIC, &t0);
+  for (uint32_t i = 0; i < n; i++) {
+    seed = seed * 1103515245 + 12345;
+    curve_apply(&c, (int32_t)((seed >> 16) & 0xFF) - 128,
+        (int32_t)((seed >> 8) & 0xFF) - 128, i * FRAME_US, &x, &y);
+    total += x + y;
+  }
+  clock_gettime(CLOCK_MONOTONIC, &t1);
+  double ns = ((t1.tv_sec - t0.tv_sec) * 1e9 + (t1.tv_nsec - t0.tv_nsec)) / n;
+  printf("%.2f ns per frame, %"PRIu32" divisions in %"PRIu32" frames (%"PRId64")\n",
+      ns, c.divisions, c.frames, total & 1);
+  // At most an expansion and a shrink per axis per range step.
+  if (c.divisions > 4 * (n / (CURVE_RANGE_STEP_US / FRAME_US)) + 16) errors++;
+  printf("errors %d\n", errors);
+  return errors;
+}
+#endif
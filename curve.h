@@ -0,0 +1,136 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2023 touchgadgetdev@gmail.com
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef _CURVE_H_
+#define _CURVE_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+/*
+ * Mouse motion to joystick deflection. The mouse counts of one USB frame
+ * are multiplied by the gain, with the fraction carried to the next frame,
+ * less the deadzone. Then either
+ *   CURVE_RATE       deflection follows mouse speed: counts per frame
+ *                    divided by the range. With auto_range the range grows
+ *                    to the fastest frame seen and shrinks back to range
+ *                    with a half life of range_decay_ms.
+ *   CURVE_INTEGRATE  the counts move the stick; range counts is full
+ *                    deflection. The stick returns to center with a time
+ *                    constant of decay_ms.
+ * The magnitude then goes through a lookup table with linear, expo (cubic)
+ * and S-curve response.
+ *
+ * The tables and the reciprocal of the range are computed by curve_init()
+ * and when the range changes, so a frame costs a few multiplies and a
+ * table lookup, no division. Deflection is -CURVE_OUT_MAX..CURVE_OUT_MAX.
+ *
+ * Counts are int32 from the decoder to here, 8, 12 and 16 bit mice alike.
+ * The table is indexed by counts / range in Q24 and interpolated to 1/256
+ * steps, then rounded to the nearest step. In CURVE_RATE the rounding
+ * remainder is carried to the next frame, so slow motion of a high
+ * resolution mouse is not lost below one step: the average deflection
+ * over a few frames is exact.
+ */
+
+#define CURVE_OUT_MAX         (512)
+#define CURVE_LUT_BITS        (8)
+#define CURVE_LUT_SIZE        (1 << CURVE_LUT_BITS)
+#define CURVE_LUT_FRAC_BITS   (6)       // table entries are deflection * 64
+#define CURVE_FRAC_BITS       (8)       // interpolated deflection * 256
+#define CURVE_U_BITS          (24)      // counts / range, table index
+#define CURVE_DECAY_STEPS     (256)     // decay table, 1024 us steps
+#define CURVE_RANGE_STEP_US   (65536)   // auto range shrinks this often
+#define CURVE_INPUT_MAX       (1 << 20) // counts per frame after gain
+
+typedef enum {
+  CURVE_RATE,
+  CURVE_INTEGRATE,
+} curve_mode_t;
+
+typedef struct {
+  curve_mode_t mode;
+  uint16_t gain;            // Q8, 256 is 1.0
+  uint16_t deadzone;        // counts per frame, after gain, ignored
+  uint8_t expo;             // 0 linear .. 255 cubic
+  uint8_t s_curve;          // 0 none .. 255 smoothstep
+  uint16_t range;           // counts for full deflection
+  bool auto_range;          // CURVE_RATE only
+  uint16_t range_decay_ms;  // auto range half life, 0 to keep the largest
+  uint16_t decay_ms;        // CURVE_INTEGRATE return to center, 0 never
+} curve_config_t;
+
+// Defaults. Close to the old auto-ranging but a fast flick no longer
+// reduces the sensitivity until the next connect.
+#define CURVE_CONFIG_DEFAULT { CURVE_RATE, 256, 0, 0, 0, 127, true, 2000, 150 }
+
+typedef struct {
+  int32_t residual;         // gain remainder, Q8
+  int32_t carry;            // CURVE_RATE rounding remainder, 1/256 steps
+  int64_t position;         // CURVE_INTEGRATE, Q32 of full deflection
+  uint32_t range;           // counts for full deflection
+  uint64_t recip;           // 2^32 / range
+} curve_axis_t;
+
+typedef struct {
+  curve_config_t cfg;
+  // Deflection << CURVE_LUT_FRAC_BITS at i / CURVE_LUT_SIZE
+  uint16_t lut[CURVE_LUT_SIZE + 1];
+  uint16_t decay[CURVE_DECAY_STEPS];  // Q16 remaining after i * 1024 us
+  uint16_t range_keep;                // Q16 of the excess range kept per step
+  curve_axis_t x;
+  curve_axis_t y;
+  uint32_t last_us;
+  uint32_t range_step_us;
+  // Statistics
+  uint32_t frames;
+  uint32_t divisions;       // range reciprocals computed
+} curve_t;
+
+/*
+ * cfg NULL for CURVE_CONFIG_DEFAULT. Returns false and uses the default if
+ * cfg is invalid. Builds the tables, which takes floating point math.
+ */
+bool curve_init(curve_t *c, const curve_config_t *cfg);
+
+/*
+ * Forget the auto range, residuals, and stick position. Call when a new
+ * device connects.
+ */
+void curve_reset(curve_t *c);
+
+/*
+ * Deflection for the counts of one frame.
+ */
+void curve_apply(curve_t *c, int32_t dx, int32_t dy, uint32_t now_us,
+    int32_t *x, int32_t *y);
+
+/*
+ * Deflection when no report arrived. Centered in CURVE_RATE, decaying
+ * toward center in CURVE_INTEGRATE.
+ */
+void curve_idle(curve_t *c, uint32_t now_us, int32_t *x, int32_t *y);
+
+#endif  /* _CURVE_H_ */
@@ -0,0 +1,224 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2023 touchgadgetdev@gmail.com
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+#include "./device_profile.h"
+#include "./layout_cache.h"
+#include "./device_profiles.h"
+#if !DEBUG_DEVICE_PROFILE_GEN
+#include "./device_profile_gen.h"
+
+_Static_assert(sizeof(Device_Profiles) / sizeof(Device_Profiles[0]) ==
+    DEVICE_PROFILE_GEN_COUNT, "device_profile_gen.h is out of date");
+
+const device_profile_t *device_profile_find(uint16_t vendor_id,
+    uint16_t product_id, uint32_t desc_hash) {
+  for (size_t i = 0; i < Device_Profile_Count; i++) {
+    const device_profile_t *p = &Device_Profiles[i];
+    bool pnp = (p->vendor_id != 0);
+    bool desc = (p->desc != NULL);
+    if (!pnp && !desc) continue;
+    if (pnp && ((p->vendor_id != vendor_id) || (p->product_id != product_id))) {
+      continue;
+    }
+    if (desc) {
+      // Found by its PnP ID alone before the report map is read.
+      if ((desc_hash == 0) && !pnp) continue;
+      if ((desc_hash != 0) && (Device_Profile_Hash[i] != desc_hash)) continue;
+    }
+    return p;
+  }
+  return NULL;
+}
+
+const hid_layout_t *device_profile_layout(const device_profile_t *profile) {
+  if ((profile == NULL) || (profile->desc == NULL)) return NULL;
+  return &Device_Profile_Layout[profile - Device_Profiles];
+}
+#endif
+
+#if DEBUG_DEVICE_PROFILE_GEN
+/*
+ * Writes device_profile_gen.h. Build and run on Linux with
+ *   gcc -O2 -DDEBUG_DEVICE_PROFILE_GEN=1 -o device_profile_gen \
+ *     device_profile.c report_desc.c layout_cache.c nv_store.c
+ *   ./device_profile_gen > device_profile_gen.h
+ * The layouts are parsed with report_id false as the bridge does for BLE
+ * report maps. Only the fields the parser sets are written; the rest are
+ * 0 as after hid_layout_parse().
+ */
+static void print_report(const hid_report_layout_t *r) {
+  printf("      {\n        .fields = {\n");
+  for (uint32_t f = 0; f < r->field_count; f++) {
+    const field_t *field = &r->fields[f];
+    printf("          { 0x%08" PRIX32 ", %u, %u, %u, %u },\n", field->usage,
+        field->offset_byte, field->offset_bit, field->len_in_bits,
+        field->filler);
+  }
+  printf("        },\n");
+  printf("        .field_count = %" PRIu32 ", .total_bits = %" PRIu32
+      ", .app_usage = 0x%08" PRIX32 ",\n", r->field_count, r->total_bits,
+      r->app_usage);
+  printf("        .report_id = %u, .is_mouse = %s, .kernel = %u,"
+      " .min_report_len = %u,\n", r->report_id,
+      r->is_mouse ? "true" : "false", r->kernel, r->min_report_len);
+  printf("        .buttons_offset = %u, .buttons_mask = 0x%02X,"
+      " .x_offset = %u, .y_offset = %u,\n", r->buttons_offset,
+      r->buttons_mask, r->x_offset, r->y_offset);
+  printf("        .wheel_offset = %u,\n      },\n", r->wheel_offset);
+}
+
+// The host test profiles, the first PROFILE_HOST_COUNT, are left out of
+// the firmware as in device_profiles.h.
+static void print_host_only(size_t i) {
+  if (i == 0) printf("#if !defined(ARDUINO)\n");
+  if (i == PROFILE_HOST_COUNT) printf("#endif\n");
+}
+
+int main(void) {
+  printf("/*\n * Generated by device_profile_gen from device_profiles.h."
+      " Do not edit.\n */\n\n");
+  printf("#ifndef _DEVICE_PROFILE_GEN_H_\n#define _DEVICE_PROFILE_GEN_H_\n\n");
+  printf("#if !defined(ARDUINO)\n#define DEVICE_PROFILE_GEN_COUNT (%zu)\n"
+      "#else\n#define DEVICE_PROFILE_GEN_COUNT (%zu)\n#endif\n\n",
+      Device_Profile_Count, Device_Profile_Count - PROFILE_HOST_COUNT);
+  printf("// layout_cache_hash() of each report map, 0 if none\n");
+  printf("static const uint32_t Device_Profile_Hash[DEVICE_PROFILE_GEN_COUNT] = {\n");
+  for (size_t i = 0; i < Device_Profile_Count; i++) {
+    const device_profile_t *p = &Device_Profiles[i];
+    uint32_t hash = p->desc ? layout_cache_hash(p->desc, p->desc_len) : 0;
+    print_host_only(i);
+    printf("  0x%08" PRIX32 ",   // %s\n", hash, p->name);
+  }
+  print_host_only(Device_Profile_Count);
+  printf("};\n\n");
+  printf("static const hid_layout_t Device_Profile_Layout[DEVICE_PROFILE_GEN_COUNT] = {\n");
+  for (size_t i = 0; i < Device_Profile_Count; i++) {
+    const device_profile_t *p = &Device_Profiles[i];
+    print_host_only(i);
+    printf("  // %s\n", p->name);
+    if (p->desc == NULL) {
+      printf("  { .report_count = 0 },\n");
+      continue;
+    }
+    hid_layout_t layout;
+    hid_layout_parse(&layout, p->desc, p->desc_len, false);
+    printf("  {\n    .reports = {\n");
+    for (uint32_t r = 0; r < layout.report_count; r++) {
+      print_report(&layout.reports[r]);
+    }
+    printf("    },\n    .report_count = %" PRIu32 ",\n"
+        "    .has_report_id = %s,\n  },\n", layout.report_count,
+        layout.has_report_id ? "true" : "false");
+  }
+  print_host_only(Device_Profile_Count);
+  printf("};\n\n#endif  /* _DEVICE_PROFILE_GEN_H_ */\n");
+  return 0;
+}
+#endif
+
+#if DEBUG_DEVICE_PROFILE_MAIN
+/*
+ * Host test. Build and run on Linux with
+ *   gcc -O2 -DDEBUG_DEVICE_PROFILE_MAIN=1 -o device_profile_test \
+ *     device_profile.c report_desc.c layout_cache.c nv_store.c
+ *   ./device_profile_test
+ * Checks the layouts and hashes in device_profile_gen.h are what the
+ * runtime parser gives for every profile, and the profile lookups. Then
+ * prints the time to parse each report map against the time to find its
+ * profile. Exit status is the number of failures.
+ */
+#include <time.h>
+
+#define TIME_LOOPS  (100000)
+
+static uint64_t nanos(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+int main(void) {
+  int failures = 0;
+  static hid_layout_t layout;
+  for (size_t i = 0; i < Device_Profile_Count; i++) {
+    const device_profile_t *p = &Device_Profiles[i];
+    uint32_t hash = p->desc ? layout_cache_hash(p->desc, p->desc_len) : 0;
+    const hid_layout_t *built = device_profile_layout(p);
+    bool ok = (Device_Profile_Hash[i] == hash);
+    if (p->desc) {
+      // Same bytes as the runtime parser, padding included.
+      hid_layout_parse(&layout, p->desc, p->desc_len, false);
+      ok = ok && (built != NULL) &&
+        (memcmp(built, &layout, sizeof(layout)) == 0);
+    } else {
+      ok = ok && (built == NULL);
+    }
+    // Found by its keys. A profile keyed by both is found by its PnP ID
+    // before the report map is read, not by the report map alone, and not
+    // if the report map read does not match.
+    const device_profile_t *found =
+      device_profile_find(p->vendor_id, p->product_id, hash);
+    ok = ok && (found == p);
+    if (p->vendor_id && p->desc) {
+      ok = ok && (device_profile_find(0, 0, hash) != p) &&
+        (device_profile_find(p->vendor_id, p->product_id, 0) == p) &&
+        (device_profile_find(p->vendor_id, p->product_id, hash ^ 1) != p);
+    }
+    printf("%-20s hash 0x%08" PRIX32 " %s\n", p->name, hash,
+        ok ? "OK" : "FAIL");
+    if (!ok) failures++;
+  }
+  if ((device_profile_find(0, 0, 0) != NULL) ||
+      (device_profile_find(0x1234, 0x5678, 0x12345678) != NULL)) {
+    printf("FAIL unknown device has a profile\n");
+    failures++;
+  }
+
+  printf("\n%-20s %12s %12s\n", "profile", "parse ns", "lookup ns");
+  volatile uintptr_t sink = 0;
+  for (size_t i = 0; i < Device_Profile_Count; i++) {
+    const device_profile_t *p = &Device_Profiles[i];
+    if (p->desc == NULL) continue;
+    uint32_t hash = layout_cache_hash(p->desc, p->desc_len);
+    uint64_t start = nanos();
+    for (int n = 0; n < TIME_LOOPS; n++) {
+      hid_layout_parse(&layout, p->desc, p->desc_len, false);
+      sink += layout.report_count;
+    }
+    double parse_ns = (double)(nanos() - start) / TIME_LOOPS;
+    start = nanos();
+    for (int n = 0; n < TIME_LOOPS; n++) {
+      sink += (uintptr_t)device_profile_layout(
+          device_profile_find(0, 0, hash + sink * 0));
+    }
+    double lookup_ns = (double)(nanos() - start) / TIME_LOOPS;
+    printf("%-20s %12.0f %12.1f\n", p->name, parse_ns, lookup_ns);
+  }
+  printf("%zu profiles, %d failures\n", Device_Profile_Count, failures);
+  return failures;
+}
+#endif
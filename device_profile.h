@@ -0,0 +1,70 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2023 touchgadgetdev@gmail.com
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef _DEVICE_PROFILE_H_
+#define _DEVICE_PROFILE_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include "./report_desc.h"
+
+/*
+ * Profiles of known devices. A profile is keyed by the PnP ID of the
+ * Device Information Service, by the report map, or both. The report map
+ * of a profile is parsed when the firmware is built, not when the device
+ * connects: device_profile_gen.h holds the hash and parsed layout of each
+ * profile and is written by the generator in device_profile.c. Regenerate
+ * it after changing a profile in device_profiles.h or the parser output.
+ */
+
+typedef struct {
+  const char *name;
+  uint16_t vendor_id;         // PnP ID, 0 if not keyed by PnP ID
+  uint16_t product_id;
+  const uint8_t *desc;        // report map, NULL if not keyed by it
+  size_t desc_len;
+} device_profile_t;
+
+extern const device_profile_t Device_Profiles[];
+extern const size_t Device_Profile_Count;
+
+/*
+ * Find the profile of a device. vendor_id is 0 if the PnP ID was not read,
+ * desc_hash is 0 if the report map was not read. desc_hash is
+ * layout_cache_hash() of the report map. The PnP ID of a profile must
+ * match, and its report map must match if it was read, so a profile keyed
+ * by both gives the layout before the report map is read. A profile keyed
+ * only by its report map needs desc_hash. Returns NULL if there is none.
+ */
+const device_profile_t *device_profile_find(uint16_t vendor_id,
+    uint16_t product_id, uint32_t desc_hash);
+
+/*
+ * Layout parsed from the report map of profile at build time. NULL if the
+ * profile has no report map.
+ */
+const hid_layout_t *device_profile_layout(const device_profile_t *profile);
+
+#endif  /* _DEVICE_PROFILE_H_ */
@@ -0,0 +1,86 @@
+/*
+ * Generated by device_profile_gen from device_profiles.h. Do not edit.
+ */
+
+#ifndef _DEVICE_PROFILE_GEN_H_
+#define _DEVICE_PROFILE_GEN_H_
+
+#if !defined(ARDUINO)
+#define DEVICE_PROFILE_GEN_COUNT (3)
+#else
+#define DEVICE_PROFILE_GEN_COUNT (2)
+#endif
+
+// layout_cache_hash() of each report map, 0 if none
+static const uint32_t Device_Profile_Hash[DEVICE_PROFILE_GEN_COUNT] = {
+#if !defined(ARDUINO)
+  0x9473F2F7,   // Test boot mouse
+#endif
+  0x9473F2F7,   // HID boot mouse
+  0xDB1B9741,   // HID wheel mouse
+};
+
+static const hid_layout_t Device_Profile_Layout[DEVICE_PROFILE_GEN_COUNT] = {
+#if !defined(ARDUINO)
+  // Test boot mouse
+  {
+    .reports = {
+      {
+        .fields = {
+          { 0x00090000, 0, 0, 3, 0 },
+          { 0x0001FFFF, 0, 3, 5, 0 },
+          { 0x00010030, 1, 0, 8, 0 },
+          { 0x00010031, 2, 0, 8, 0 },
+        },
+        .field_count = 4, .total_bits = 24, .app_usage = 0x00010002,
+        .report_id = 0, .is_mouse = true, .kernel = 1, .min_report_len = 3,
+        .buttons_offset = 0, .buttons_mask = 0x07, .x_offset = 1, .y_offset = 2,
+        .wheel_offset = 255,
+      },
+    },
+    .report_count = 1,
+    .has_report_id = false,
+  },
+#endif
+  // HID boot mouse
+  {
+    .reports = {
+      {
+        .fields = {
+          { 0x00090000, 0, 0, 3, 0 },
+          { 0x0001FFFF, 0, 3, 5, 0 },
+          { 0x00010030, 1, 0, 8, 0 },
+          { 0x00010031, 2, 0, 8, 0 },
+        },
+        .field_count = 4, .total_bits = 24, .app_usage = 0x00010002,
+        .report_id = 0, .is_mouse = true, .kernel = 1, .min_report_len = 3,
+        .buttons_offset = 0, .buttons_mask = 0x07, .x_offset = 1, .y_offset = 2,
+        .wheel_offset = 255,
+      },
+    },
+    .report_count = 1,
+    .has_report_id = false,
+  },
+  // HID wheel mouse
+  {
+    .reports = {
+      {
+        .fields = {
+          { 0x00090000, 0, 0, 3, 0 },
+          { 0x0001FFFF, 0, 3, 5, 0 },
+          { 0x00010030, 1, 0, 8, 0 },
+          { 0x00010031, 2, 0, 8, 0 },
+          { 0x00010038, 3, 0, 8, 0 },
+        },
+        .field_count = 5, .total_bits = 32, .app_usage = 0x00010002,
+        .report_id = 0, .is_mouse = true, .kernel = 1, .min_report_len = 4,
+        .buttons_offset = 0, .buttons_mask = 0x07, .x_offset = 1, .y_offset = 2,
+        .wheel_offset = 3,
+      },
+    },
+    .report_count = 1,
+    .has_report_id = false,
+  },
+};
+
+#endif  /* _DEVICE_PROFILE_GEN_H_ */
@@ -0,0 +1,78 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2023 touchgadgetdev@gmail.com
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef _DEVICE_PROFILES_H_
+#define _DEVICE_PROFILES_H_
+
+/*
+ * Known devices. Included once, by device_profile.c. After changing this
+ * list regenerate device_profile_gen.h, see README.md.
+ */
+
+#define PROFILE_DESC(desc)  desc, sizeof(desc)
+
+// Profiles for the host tests come first and are left out of the
+// firmware. The generator puts the same #if around them in
+// device_profile_gen.h.
+#define PROFILE_HOST_COUNT  (1)
+
+// HID 1.11 appendix E.10 boot mouse descriptor. Many simple mice send it
+// unchanged.
+static const uint8_t hid_boot_mouse_desc[] = {
+  0x05, 0x01, 0x09, 0x02, 0xA1, 0x01, 0x09, 0x01, 0xA1, 0x00, 0x05, 0x09,
+  0x19, 0x01, 0x29, 0x03, 0x15, 0x00, 0x25, 0x01, 0x95, 0x03, 0x75, 0x01,
+  0x81, 0x02, 0x95, 0x01, 0x75, 0x05, 0x81, 0x01, 0x05, 0x01, 0x09, 0x30,
+  0x09, 0x31, 0x15, 0x81, 0x25, 0x7F, 0x75, 0x08, 0x95, 0x02, 0x81, 0x06,
+  0xC0, 0xC0,
+};
+
+// Same with a wheel, the usual layout of a 3 button wheel mouse.
+static const uint8_t hid_wheel_mouse_desc[] = {
+  0x05, 0x01, 0x09, 0x02, 0xA1, 0x01, 0x09, 0x01, 0xA1, 0x00, 0x05, 0x09,
+  0x19, 0x01, 0x29, 0x03, 0x15, 0x00, 0x25, 0x01, 0x95, 0x03, 0x75, 0x01,
+  0x81, 0x02, 0x95, 0x01, 0x75, 0x05, 0x81, 0x01, 0x05, 0x01, 0x09, 0x30,
+  0x09, 0x31, 0x09, 0x38, 0x15, 0x81, 0x25, 0x7F, 0x75, 0x08, 0x95, 0x03,
+  0x81, 0x06, 0xC0, 0xC0,
+};
+
+// The first profile that matches is used, so profiles keyed by PnP ID and
+// report map come before those keyed by the report map alone. A profile
+// is only used for its report map, so a device needs one here only if
+// the map is worth not reading. The Jelly Comb (1915:0040) and VR Fortune
+// (07D7:0000) mice the sketch once matched by PnP ID are not listed: the
+// parser decodes their report maps.
+const device_profile_t Device_Profiles[] = {
+#if !defined(ARDUINO)
+  // Company ID 0xFFFF is for testing. The boot_mouse peer of the host
+  // simulation has this PnP ID, so it connects without a report map read.
+  { "Test boot mouse", 0xFFFF, 0x0001, PROFILE_DESC(hid_boot_mouse_desc) },
+#endif
+  { "HID boot mouse", 0, 0, PROFILE_DESC(hid_boot_mouse_desc) },
+  { "HID wheel mouse", 0, 0, PROFILE_DESC(hid_wheel_mouse_desc) },
+};
+
+const size_t Device_Profile_Count =
+  sizeof(Device_Profiles) / sizeof(Device_Profiles[0]);
+
+#endif  /* _DEVICE_PROFILES_H_ */
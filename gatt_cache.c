@@ -0,0 +1,121 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2023 touchgadgetdev@gmail.com
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include "./gatt_cache.h"
+#include "./layout_cache.h"
+
+#define GATT_CACHE_MAGIC    (0x54544147UL)  // "GATT"
+#define GATT_CACHE_VERSION  (1)
+
+typedef struct {
+  uint32_t magic;
+  uint16_t version;
+  uint16_t entry_size;
+  uint8_t peer[6];
+  uint16_t reserved;
+  uint32_t check;       // hash of entry
+  gatt_cache_entry_t entry;
+} gatt_cache_record_t;
+
+static void cache_key(const uint8_t peer[6], char key[NV_STORE_KEY_MAX + 1]) {
+  snprintf(key, NV_STORE_KEY_MAX + 1, "G%02x%02x%02x%02x%02x%02x",
+      peer[5], peer[4], peer[3], peer[2], peer[1], peer[0]);
+}
+
+bool gatt_cache_load(const nv_store_t *store, const uint8_t peer[6],
+    gatt_cache_entry_t *entry) {
+  gatt_cache_record_t record;
+  char key[NV_STORE_KEY_MAX + 1];
+  cache_key(peer, key);
+  if (!store->read(store->ctx, key, &record, sizeof(record))) return false;
+  if ((record.magic != GATT_CACHE_MAGIC) ||
+      (record.version != GATT_CACHE_VERSION) ||
+      (record.entry_size != sizeof(gatt_cache_entry_t)) ||
+      (memcmp(record.peer, peer, sizeof(record.peer)) != 0) ||
+      (record.entry.report_count > GATT_CACHE_REPORTS_MAX) ||
+      (record.check != layout_cache_hash((const uint8_t *)&record.entry,
+                                         sizeof(record.entry)))) {
+    store->erase(store->ctx, key);
+    return false;
+  }
+  memcpy(entry, &record.entry, sizeof(*entry));
+  return true;
+}
+
+bool gatt_cache_save(const nv_store_t *store, const uint8_t peer[6],
+    const gatt_cache_entry_t *entry) {
+  gatt_cache_record_t record;
+  char key[NV_STORE_KEY_MAX + 1];
+  memset(&record, 0, sizeof(record));
+  record.magic = GATT_CACHE_MAGIC;
+  record.version = GATT_CACHE_VERSION;
+  record.entry_size = sizeof(gatt_cache_entry_t);
+  memcpy(record.peer, peer, sizeof(record.peer));
+  memcpy(&record.entry, entry, sizeof(record.entry));
+  record.check = layout_cache_hash((const uint8_t *)&record.entry,
+      sizeof(record.entry));
+  cache_key(peer, key);
+  return store->write(store->ctx, key, &record, sizeof(record));
+}
+
+bool gatt_cache_erase(const nv_store_t *store, const uint8_t peer[6]) {
+  char key[NV_STORE_KEY_MAX + 1];
+  cache_key(peer, key);
+  return store->erase(store->ctx, key);
+}
+
+bool gatt_cache_add_report(gatt_cache_entry_t *entry, uint16_t value_handle,
+    uint16_t cccd_handle, uint16_t cccd_value, uint8_t report_id) {
+  if (entry->report_count >= GATT_CACHE_REPORTS_MAX) return false;
+  gatt_cache_report_t *report = &entry->reports[entry->report_count++];
+  report->value_handle = value_handle;
+  report->cccd_handle = cccd_handle;
+  report->cccd_value = cccd_value;
+  report->report_id = report_id;
+  report->reserved = 0;
+  return true;
+}
+
+bool gatt_cache_subscribe(const gatt_cache_entry_t *entry, const gatt_ops_t *ops) {
+  if (entry->report_count == 0) return false;
+  for (size_t i = 0; i < entry->report_count; i++) {
+    const gatt_cache_report_t *report = &entry->reports[i];
+    if ((report->cccd_handle < entry->service_start) ||
+        (report->cccd_handle > entry->service_end)) {
+      return false;
+    }
+    if (!ops->write_cccd(ops->ctx, report->cccd_handle, report->cccd_value)) {
+      return false;
+    }
+  }
+  if (entry->service_changed_cccd != 0) {
+    if (!ops->write_cccd(ops->ctx, entry->service_changed_cccd,
+          GATT_CCCD_INDICATE)) {
+      return false;
+    }
+  }
+  return true;
+}
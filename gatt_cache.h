@@ -0,0 +1,109 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2023 touchgadgetdev@gmail.com
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef _GATT_CACHE_H_
+#define _GATT_CACHE_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include "./nv_store.h"
+
+/*
+ * Cache of the HID service attribute handles of bonded devices. With the
+ * handles and the cached layout (layout_cache.h) the bridge enables
+ * notifications by writing the CCCDs directly, skipping service and
+ * characteristic discovery.
+ */
+
+#define GATT_CACHE_REPORTS_MAX  (8)
+
+// CCCD values
+#define GATT_CCCD_NOTIFY    (0x0001)
+#define GATT_CCCD_INDICATE  (0x0002)
+
+typedef struct {
+  uint16_t value_handle;
+  uint16_t cccd_handle;
+  uint16_t cccd_value;    // GATT_CCCD_NOTIFY or GATT_CCCD_INDICATE
+  uint8_t report_id;      // from the Report Reference descriptor
+  uint8_t reserved;
+} gatt_cache_report_t;
+
+typedef struct {
+  uint16_t service_start;   // HID service handle range
+  uint16_t service_end;
+  // Service Changed characteristic. 0 if the device does not have one.
+  uint16_t service_changed_handle;
+  uint16_t service_changed_cccd;
+  uint32_t report_count;
+  gatt_cache_report_t reports[GATT_CACHE_REPORTS_MAX];
+} gatt_cache_entry_t;
+
+/*
+ * Write one CCCD. Returns false if the write failed, for example because
+ * the handle is no longer a CCCD.
+ */
+typedef struct {
+  bool (*write_cccd)(void *ctx, uint16_t cccd_handle, uint16_t value);
+  void *ctx;
+} gatt_ops_t;
+
+/*
+ * Microsecond timestamps of the steps from connect to the first report.
+ * 0 means the step has not happened yet.
+ */
+typedef struct {
+  uint32_t disconnected;    // link lost before this reconnect, 0 if none
+  uint32_t connect_start;
+  uint32_t connected;
+  uint32_t subscribed;
+  uint32_t first_report;
+  bool from_cache;
+  bool from_profile;        // layout of the profile of the PnP ID
+  bool boot_protocol;
+} connect_timing_t;
+
+bool gatt_cache_load(const nv_store_t *store, const uint8_t peer[6],
+    gatt_cache_entry_t *entry);
+
+bool gatt_cache_save(const nv_store_t *store, const uint8_t peer[6],
+    const gatt_cache_entry_t *entry);
+
+bool gatt_cache_erase(const nv_store_t *store, const uint8_t peer[6]);
+
+/*
+ * Add a report to entry. Returns false if entry is full.
+ */
+bool gatt_cache_add_report(gatt_cache_entry_t *entry, uint16_t value_handle,
+    uint16_t cccd_handle, uint16_t cccd_value, uint8_t report_id);
+
+/*
+ * Enable notifications/indications of all reports in entry and of Service
+ * Changed. Returns false on the first failed write which means the cached
+ * handles are stale and the entry should be erased.
+ */
+bool gatt_cache_subscribe(const gatt_cache_entry_t *entry, const gatt_ops_t *ops);
+
+#endif  /* _GATT_CACHE_H_ */
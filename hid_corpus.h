@@ -0,0 +1,177 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2023 touchgadgetdev@gmail.com
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/*
+ * HID report descriptors and report streams with the expected decoded
+ * values. Used by the DEBUG_*_MAIN host programs.
+ * The descriptors cover the layouts seen on BLE mice, trackballs, and
+ * clickers: boot 8 bit, 16 bit, packed 12 bit with report IDs in a
+ * keyboard/consumer composite, unaligned fields, and button only.
+ * Add new devices to HID_Corpus[] at the end of this file.
+ */
+
+#ifndef _HID_CORPUS_H_
+#define _HID_CORPUS_H_
+
+#include "./report_desc.h"
+
+typedef struct {
+  uint8_t len;
+  uint8_t data[16];
+  mouse_values_t expect;  // buttons, x, y, wheel, pan, report_id
+} corpus_report_t;
+
+typedef struct {
+  const char *name;
+  const uint8_t *desc;
+  size_t desc_len;
+  bool report_id;
+  uint8_t mouse_kernel;   // expected kernel of the first mouse report
+  const corpus_report_t *reports;
+  size_t report_count;
+} corpus_device_t;
+
+#define CORPUS_DEVICE(name, desc, report_id, kernel, reports) \
+  { name, desc, sizeof(desc), report_id, kernel, reports, \
+    sizeof(reports) / sizeof(reports[0]) }
+
+// Boot protocol compatible mouse from the HID 1.11 spec appendix E.10.
+static const uint8_t boot_mouse_desc[] = {
+  0x05, 0x01, 0x09, 0x02, 0xA1, 0x01, 0x09, 0x01, 0xA1, 0x00, 0x05, 0x09,
+  0x19, 0x01, 0x29, 0x03, 0x15, 0x00, 0x25, 0x01, 0x95, 0x03, 0x75, 0x01,
+  0x81, 0x02, 0x95, 0x01, 0x75, 0x05, 0x81, 0x01, 0x05, 0x01, 0x09, 0x30,
+  0x09, 0x31, 0x15, 0x81, 0x25, 0x7F, 0x75, 0x08, 0x95, 0x02, 0x81, 0x06,
+  0xC0, 0xC0,
+};
+
+static const corpus_report_t boot_mouse_reports[] = {
+  { 3, { 0x00, 0x00, 0x00 }, { 0, 0, 0, 0, 0, 0 } },
+  { 3, { 0x07, 0x7F, 0x80 }, { 7, 127, -128, 0, 0, 0 } },
+  { 3, { 0xF9, 0x01, 0xFF }, { 1, 1, -1, 0, 0, 0 } },
+  { 3, { 0x02, 0x10, 0xF0 }, { 2, 16, -16, 0, 0, 0 } },
+};
+
+// 5 buttons, 16 bit X/Y, 8 bit wheel, no report ID.
+static const uint8_t mouse_xy16_desc[] = {
+  0x05, 0x01, 0x09, 0x02, 0xA1, 0x01, 0x09, 0x01, 0xA1, 0x00, 0x05, 0x09,
+  0x19, 0x01, 0x29, 0x05, 0x15, 0x00, 0x25, 0x01, 0x95, 0x05, 0x75, 0x01,
+  0x81, 0x02, 0x95, 0x01, 0x75, 0x03, 0x81, 0x01, 0x05, 0x01, 0x09, 0x30,
+  0x09, 0x31, 0x16, 0x01, 0x80, 0x26, 0xFF, 0x7F, 0x75, 0x10, 0x95, 0x02,
+  0x81, 0x06, 0x09, 0x38, 0x15, 0x81, 0x25, 0x7F, 0x75, 0x08, 0x95, 0x01,
+  0x81, 0x06, 0xC0, 0xC0,
+};
+
+static const corpus_report_t mouse_xy16_reports[] = {
+  { 6, { 0x1F, 0x34, 0x12, 0xCC, 0xED, 0x02 }, { 0x1F, 4660, -4660, 2, 0, 0 } },
+  { 6, { 0xFF, 0x01, 0x80, 0xFF, 0x7F, 0xFF }, { 0x1F, -32767, 32767, -1, 0, 0 } },
+  { 6, { 0x00, 0x05, 0x00, 0xFB, 0xFF, 0x00 }, { 0, 5, -5, 0, 0, 0 } },
+  // Truncated report. Y and wheel are not in the report.
+  { 4, { 0x01, 0x10, 0x00, 0x20 }, { 1, 16, 0, 0, 0, 0 } },
+};
+
+// Composite keyboard (ID 1), mouse (ID 2) with 8 buttons, X/Y packed as
+// 12 bits, 8 bit wheel, and consumer control (ID 3). Reports include the
+// report ID byte as they do over USB.
+static const uint8_t composite_xy12_desc[] = {
+  0x05, 0x01, 0x09, 0x06, 0xA1, 0x01, 0x85, 0x01, 0x05, 0x07, 0x19, 0xE0,
+  0x29, 0xE7, 0x15, 0x00, 0x25, 0x01, 0x75, 0x01, 0x95, 0x08, 0x81, 0x02,
+  0x95, 0x01, 0x75, 0x08, 0x81, 0x01, 0x95, 0x06, 0x75, 0x08, 0x15, 0x00,
+  0x26, 0xFF, 0x00, 0x05, 0x07, 0x19, 0x00, 0x29, 0xFF, 0x81, 0x00, 0xC0,
+  0x05, 0x01, 0x09, 0x02, 0xA1, 0x01, 0x85, 0x02, 0x09, 0x01, 0xA1, 0x00,
+  0x05, 0x09, 0x19, 0x01, 0x29, 0x08, 0x15, 0x00, 0x25, 0x01, 0x75, 0x01,
+  0x95, 0x08, 0x81, 0x02, 0x05, 0x01, 0x16, 0x01, 0xF8, 0x26, 0xFF, 0x07,
+  0x75, 0x0C, 0x95, 0x02, 0x09, 0x30, 0x09, 0x31, 0x81, 0x06, 0x15, 0x81,
+  0x25, 0x7F, 0x75, 0x08, 0x95, 0x01, 0x09, 0x38, 0x81, 0x06, 0xC0, 0xC0,
+  0x05, 0x0C, 0x09, 0x01, 0xA1, 0x01, 0x85, 0x03, 0x15, 0x00, 0x26, 0xFF,
+  0x03, 0x19, 0x00, 0x2A, 0xFF, 0x03, 0x75, 0x10, 0x95, 0x01, 0x81, 0x00,
+  0xC0,
+};
+
+static const corpus_report_t composite_xy12_reports[] = {
+  { 6, { 0x02, 0x01, 0xFD, 0x2F, 0x00, 0xFF }, { 0x01, -3, 2, -1, 0, 2 } },
+  { 6, { 0x02, 0x80, 0xFF, 0x07, 0x80, 0x01 }, { 0x80, 2047, -2048, 1, 0, 2 } },
+  // Keyboard and consumer reports are not mouse reports.
+  { 9, { 0x01, 0x00, 0x00, 0x04, 0x00, 0x00, 0x00, 0x00, 0x00 },
+    { 0, 0, 0, 0, 0, 0 } },
+  { 3, { 0x03, 0xE9, 0x00 }, { 0, 0, 0, 0, 0, 0 } },
+  { 6, { 0x02, 0x00, 0x00, 0x00, 0x00, 0x00 }, { 0, 0, 0, 0, 0, 2 } },
+};
+
+// 3 buttons followed by 16 bit X/Y that are not byte aligned. Y crosses
+// the first 32 bits of the report.
+static const uint8_t trackball_unaligned_desc[] = {
+  0x05, 0x01, 0x09, 0x02, 0xA1, 0x01, 0x09, 0x01, 0xA1, 0x00, 0x05, 0x09,
+  0x19, 0x01, 0x29, 0x03, 0x15, 0x00, 0x25, 0x01, 0x95, 0x03, 0x75, 0x01,
+  0x81, 0x02, 0x05, 0x01, 0x09, 0x30, 0x09, 0x31, 0x16, 0x01, 0x80, 0x26,
+  0xFF, 0x7F, 0x75, 0x10, 0x95, 0x02, 0x81, 0x06, 0x75, 0x05, 0x95, 0x01,
+  0x81, 0x01, 0xC0, 0xC0,
+};
+
+static const corpus_report_t trackball_unaligned_reports[] = {
+  { 5, { 0xA5, 0xF6, 0x47, 0x1F, 0x00 }, { 5, -300, 1000, 0, 0, 0 } },
+  { 5, { 0xFA, 0xFF, 0x03, 0x00, 0x04 }, { 2, 32767, -32768, 0, 0, 0 } },
+  { 5, { 0x00, 0x00, 0x00, 0x00, 0x00 }, { 0, 0, 0, 0, 0, 0 } },
+};
+
+// Button only clicker. 1 button and 7 bits padding in a mouse collection.
+static const uint8_t clicker_desc[] = {
+  0x05, 0x01, 0x09, 0x02, 0xA1, 0x01, 0x09, 0x01, 0xA1, 0x00, 0x05, 0x09,
+  0x19, 0x01, 0x29, 0x01, 0x15, 0x00, 0x25, 0x01, 0x95, 0x01, 0x75, 0x01,
+  0x81, 0x02, 0x95, 0x01, 0x75, 0x07, 0x81, 0x01, 0xC0, 0xC0,
+};
+
+static const corpus_report_t clicker_reports[] = {
+  { 1, { 0x01 }, { 1, 0, 0, 0, 0, 0 } },
+  { 1, { 0xFE }, { 0, 0, 0, 0, 0, 0 } },
+};
+
+// Clicker with 6 buttons and 2 bits padding.
+static const uint8_t clicker_6_button_desc[] = {
+  0x05, 0x01, 0x09, 0x02, 0xA1, 0x01, 0x09, 0x01, 0xA1, 0x00, 0x05, 0x09,
+  0x19, 0x01, 0x29, 0x06, 0x15, 0x00, 0x25, 0x01, 0x95, 0x06, 0x75, 0x01,
+  0x81, 0x02, 0x95, 0x01, 0x75, 0x02, 0x81, 0x01, 0xC0, 0xC0,
+};
+
+static const corpus_report_t clicker_6_button_reports[] = {
+  { 1, { 0x3F }, { 0x3F, 0, 0, 0, 0, 0 } },
+  { 1, { 0xC4 }, { 0x04, 0, 0, 0, 0, 0 } },
+  { 1, { 0x21 }, { 0x21, 0, 0, 0, 0, 0 } },
+};
+
+static const corpus_device_t HID_Corpus[] = {
+  CORPUS_DEVICE("boot_mouse", boot_mouse_desc, false,
+      HID_KERNEL_XY8, boot_mouse_reports),
+  CORPUS_DEVICE("mouse_xy16", mouse_xy16_desc, false,
+      HID_KERNEL_XY16, mouse_xy16_reports),
+  CORPUS_DEVICE("composite_xy12", composite_xy12_desc, true,
+      HID_KERNEL_XY12, composite_xy12_reports),
+  CORPUS_DEVICE("trackball_unaligned", trackball_unaligned_desc, false,
+      HID_KERNEL_GENERIC, trackball_unaligned_reports),
+  CORPUS_DEVICE("clicker", clicker_desc, false,
+      HID_KERNEL_GENERIC, clicker_reports),
+  CORPUS_DEVICE("clicker_6_button", clicker_6_button_desc, false,
+      HID_KERNEL_GENERIC, clicker_6_button_reports),
+};
+
+#endif  /* _HID_CORPUS_H_ */
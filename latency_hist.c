@@ -0,0 +1,162 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2023 touchgadgetdev@gmail.com
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <string.h>
+#include "./latency_hist.h"
+
+void latency_hist_init(latency_hist_t *h) {
+  memset(h, 0, sizeof(*h));
+}
+
+uint32_t latency_hist_bucket_low(uint32_t bucket) {
+  if (bucket < 4) return bucket;
+  uint32_t octave = bucket / 4 + 1;
+  return (4 + (bucket & 3)) << (octave - 2);
+}
+
+uint32_t latency_hist_percentile(const latency_hist_t *h, uint32_t permille) {
+  if (h->total == 0) return 0;
+  uint32_t rank = (uint32_t)(((uint64_t)h->total * permille + 999) / 1000);
+  if (rank == 0) rank = 1;
+  uint32_t seen = 0;
+  for (uint32_t b = 0; b < LATENCY_HIST_BUCKETS - 1; b++) {
+    seen += h->counts[b];
+    if (seen >= rank) {
+      uint32_t top = latency_hist_bucket_low(b + 1) - 1;
+      return (top < h->max) ? top : h->max;
+    }
+  }
+  return h->max;
+}
+
+void latency_hist_summary(const latency_hist_t *h, latency_summary_t *s) {
+  s->p50 = latency_hist_percentile(h, 500);
+  s->p99 = latency_hist_percentile(h, 990);
+  s->max = h->max;
+  s->count = h->total;
+}
+
+#if DEBUG_LATENCY_MAIN
+/*
+ * Build and run on Linux with
+ *   gcc -O2 -DDEBUG_LATENCY_MAIN=1 -o latency_test latency_hist.c
+ * Checks every value falls in a bucket no more than 25% wide that contains
+ * it, percentiles of known distributions are within one bucket of the
+ * exact answer, and prints the time to add a value.
+ */
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+static uint64_t now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+// Exact is the right answer. The histogram may return up to 25% more.
+static int check(const char *name, uint32_t got, uint32_t exact) {
+  bool ok = (got >= exact) && ((uint64_t)got * 4 <= (uint64_t)exact * 5 + 4);
+  printf("%-24s %8"PRIu32" exact %8"PRIu32" %s\n", name, got, exact,
+      ok ? "OK" : "FAIL");
+  return ok ? 0 : 1;
+}
+
+int main(void) {
+  int errors = 0;
+  static latency_hist_t h;
+
+  // Bucket boundaries
+  uint32_t prev = 0;
+  for (uint32_t v = 0; v < 2 * LATENCY_HIST_MAX_US; v += 1 + v / 64) {
+    uint32_t b = latency_hist_bucket(v);
+    if ((b < prev) || (b >= LATENCY_HIST_BUCKETS) ||
+        (latency_hist_bucket_low(b) > v)) {
+      printf("value %"PRIu32" bucket %"PRIu32" FAIL\n", v, b);
+      errors++;
+      break;
+    }
+    if (b < LATENCY_HIST_BUCKETS - 1) {
+      uint32_t low = latency_hist_bucket_low(b);
+      uint32_t high = latency_hist_bucket_low(b + 1);
+      if ((v >= high) || ((low >= 4) && ((high - low) * 4 > low))) {
+        printf("value %"PRIu32" bucket %"PRIu32" %"PRIu32"..%"PRIu32" FAIL\n",
+            v, b, low, high);
+        errors++;
+        break;
+      }
+    }
+    prev = b;
+  }
+  if (latency_hist_bucket_low(LATENCY_HIST_BUCKETS - 1) != LATENCY_HIST_MAX_US) {
+    printf("last bucket FAIL\n");
+    errors++;
+  }
+
+  latency_hist_init(&h);
+  if ((latency_hist_percentile(&h, 500) != 0) || (h.max != 0)) errors++;
+
+  // 1..10000 uniform
+  for (uint32_t v = 1; v <= 10000; v++) latency_hist_add(&h, v);
+  errors += check("uniform p50", latency_hist_percentile(&h, 500), 5000);
+  errors += check("uniform p99", latency_hist_percentile(&h, 990), 9900);
+  errors += check("uniform p100", latency_hist_percentile(&h, 1000), 10000);
+  errors += check("uniform max", h.max, 10000);
+
+  // Mostly fast with a slow tail, like BLE reports that miss a USB frame.
+  latency_hist_init(&h);
+  for (uint32_t i = 0; i < 9800; i++) latency_hist_add(&h, 120 + i % 10);
+  for (uint32_t i = 0; i < 200; i++) latency_hist_add(&h, 1000 + i);
+  errors += check("tail p50", latency_hist_percentile(&h, 500), 124);
+  errors += check("tail p99", latency_hist_percentile(&h, 990), 1099);
+  errors += check("tail max", h.max, 1199);
+
+  // Small values are exact, huge values saturate but max is kept.
+  latency_hist_init(&h);
+  latency_hist_add(&h, 0);
+  latency_hist_add(&h, 3);
+  latency_hist_add(&h, UINT32_MAX);
+  errors += check("small p33", latency_hist_percentile(&h, 333), 0);
+  errors += check("small p66", latency_hist_percentile(&h, 666), 3);
+  if ((latency_hist_percentile(&h, 1000) != UINT32_MAX) || (h.total != 3)) {
+    printf("saturate FAIL\n");
+    errors++;
+  }
+
+  // Cost of latency_hist_add()
+  latency_hist_init(&h);
+  uint32_t seed = 1;
+  const uint32_t n = 10000000;
+  uint64_t t0 = now_ns();
+  for (uint32_t i = 0; i < n; i++) {
+    seed = seed * 1103515245 + 12345;
+    latency_hist_add(&h, (seed >> 16) & 0xFFF);
+  }
+  uint64_t t1 = now_ns();
+  if (h.total != n) errors++;
+  printf("add %.2f ns per value, errors %d\n", (double)(t1 - t0) / n, errors);
+  return errors;
+}
+#endif
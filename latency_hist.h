@@ -0,0 +1,89 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2023 touchgadgetdev@gmail.com
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef _LATENCY_HIST_H_
+#define _LATENCY_HIST_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+/*
+ * Fixed size histogram of microsecond latencies. Values 0..3 have their
+ * own buckets. Above that each power of 2 is split into 4 buckets so a
+ * bucket is at most 25% wide. Values of LATENCY_HIST_MAX_US or more go in
+ * the last bucket; max is exact. Adding a value is a count leading zeros,
+ * two shifts and an increment, so it can be done on every report.
+ *
+ * One task adds values. Reading from another task gives a snapshot that
+ * may be off by the values being added.
+ */
+
+#define LATENCY_HIST_OCTAVES  (24)
+#define LATENCY_HIST_MAX_US   (1UL << LATENCY_HIST_OCTAVES)    // about 16 s
+// The last bucket holds LATENCY_HIST_MAX_US and up.
+#define LATENCY_HIST_BUCKETS  (4 * LATENCY_HIST_OCTAVES - 3)
+
+typedef struct {
+  uint32_t counts[LATENCY_HIST_BUCKETS];
+  uint32_t total;
+  uint32_t max;
+} latency_hist_t;
+
+typedef struct {
+  uint32_t p50;
+  uint32_t p99;
+  uint32_t max;
+  uint32_t count;
+} latency_summary_t;
+
+static inline uint32_t latency_hist_bucket(uint32_t us) {
+  if (us < 4) return us;
+  if (us >= LATENCY_HIST_MAX_US) return LATENCY_HIST_BUCKETS - 1;
+  uint32_t octave = 31 - __builtin_clz(us);
+  return 4 * (octave - 1) + ((us >> (octave - 2)) & 3);
+}
+
+static inline void latency_hist_add(latency_hist_t *h, uint32_t us) {
+  h->counts[latency_hist_bucket(us)]++;
+  h->total++;
+  if (us > h->max) h->max = us;
+}
+
+void latency_hist_init(latency_hist_t *h);
+
+/*
+ * Smallest value that falls in bucket.
+ */
+uint32_t latency_hist_bucket_low(uint32_t bucket);
+
+/*
+ * Value below which permille/1000 of the values fall. Returns the top of
+ * the bucket holding that value, capped at max. 0 if there are no values.
+ */
+uint32_t latency_hist_percentile(const latency_hist_t *h, uint32_t permille);
+
+void latency_hist_summary(const latency_hist_t *h, latency_summary_t *s);
+
+#endif  /* _LATENCY_HIST_H_ */
@@ -0,0 +1,110 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2023 touchgadgetdev@gmail.com
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include "./layout_cache.h"
+
+#define LAYOUT_CACHE_MAGIC    (0x4C444948UL)  // "HIDL"
+// Change when hid_layout_t or the parser output changes.
+#define LAYOUT_CACHE_VERSION  (1)
+
+typedef struct {
+  uint32_t magic;
+  uint16_t version;
+  uint16_t layout_size;
+  uint8_t peer[6];
+  uint32_t desc_hash;
+  uint32_t check;       // hash of layout
+  hid_layout_t layout;
+} layout_cache_record_t;
+
+layout_cache_stats_t Layout_Cache_Stats;
+
+uint32_t layout_cache_hash(const uint8_t *data, size_t len) {
+  uint32_t hash = 2166136261UL;
+  for (size_t i = 0; i < len; i++) {
+    hash = (hash ^ data[i]) * 16777619UL;
+  }
+  return hash;
+}
+
+static void cache_key(const uint8_t peer[6], char key[NV_STORE_KEY_MAX + 1]) {
+  snprintf(key, NV_STORE_KEY_MAX + 1, "L%02x%02x%02x%02x%02x%02x",
+      peer[5], peer[4], peer[3], peer[2], peer[1], peer[0]);
+}
+
+bool layout_cache_load(const nv_store_t *store, const uint8_t peer[6],
+    hid_layout_t *layout, uint32_t *desc_hash) {
+  static layout_cache_record_t record;
+  char key[NV_STORE_KEY_MAX + 1];
+  cache_key(peer, key);
+  if (!store->read(store->ctx, key, &record, sizeof(record))) {
+    Layout_Cache_Stats.misses++;
+    return false;
+  }
+  if ((record.magic != LAYOUT_CACHE_MAGIC) ||
+      (record.version != LAYOUT_CACHE_VERSION) ||
+      (record.layout_size != sizeof(hid_layout_t)) ||
+      (memcmp(record.peer, peer, sizeof(record.peer)) != 0) ||
+      (record.check != layout_cache_hash((const uint8_t *)&record.layout,
+                                         sizeof(record.layout)))) {
+    Layout_Cache_Stats.invalid++;
+    store->erase(store->ctx, key);
+    return false;
+  }
+  memcpy(layout, &record.layout, sizeof(*layout));
+  if (desc_hash != NULL) *desc_hash = record.desc_hash;
+  Layout_Cache_Stats.hits++;
+  return true;
+}
+
+bool layout_cache_save(const nv_store_t *store, const uint8_t peer[6],
+    uint32_t desc_hash, const hid_layout_t *layout) {
+  static layout_cache_record_t record;
+  char key[NV_STORE_KEY_MAX + 1];
+  memset(&record, 0, sizeof(record));
+  record.magic = LAYOUT_CACHE_MAGIC;
+  record.version = LAYOUT_CACHE_VERSION;
+  record.layout_size = sizeof(hid_layout_t);
+  memcpy(record.peer, peer, sizeof(record.peer));
+  record.desc_hash = desc_hash;
+  memcpy(&record.layout, layout, sizeof(record.layout));
+  record.check = layout_cache_hash((const uint8_t *)&record.layout,
+      sizeof(record.layout));
+  cache_key(peer, key);
+  if (!store->write(store->ctx, key, &record, sizeof(record))) return false;
+  Layout_Cache_Stats.saves++;
+  return true;
+}
+
+bool layout_cache_erase(const nv_store_t *store, const uint8_t peer[6]) {
+  char key[NV_STORE_KEY_MAX + 1];
+  cache_key(peer, key);
+  return store->erase(store->ctx, key);
+}
+
+bool layout_cache_clear(const nv_store_t *store) {
+  return store->erase_all(store->ctx);
+}
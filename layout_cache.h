@@ -0,0 +1,78 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2023 touchgadgetdev@gmail.com
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef _LAYOUT_CACHE_H_
+#define _LAYOUT_CACHE_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include "./report_desc.h"
+#include "./nv_store.h"
+
+/*
+ * Cache of parsed HID report layouts for bonded devices. After a reboot the
+ * layout is loaded from the cache so the HID_REPORT_MAP read and parse are
+ * skipped. Each entry is keyed by the peer address and records the hash of
+ * the descriptor it was parsed from.
+ */
+
+typedef struct {
+  uint32_t hits;
+  uint32_t misses;
+  uint32_t invalid;   // entry found but bad magic, version, size, or check
+  uint32_t saves;
+} layout_cache_stats_t;
+
+extern layout_cache_stats_t Layout_Cache_Stats;
+
+/*
+ * Return the hash of a report descriptor. FNV-1a 32 bit.
+ */
+uint32_t layout_cache_hash(const uint8_t *data, size_t len);
+
+/*
+ * Load the layout for peer (6 byte BLE address). Returns false and leaves
+ * layout unchanged if there is no valid entry. desc_hash may be NULL.
+ */
+bool layout_cache_load(const nv_store_t *store, const uint8_t peer[6],
+    hid_layout_t *layout, uint32_t *desc_hash);
+
+/*
+ * Save the layout parsed from a descriptor with hash desc_hash.
+ */
+bool layout_cache_save(const nv_store_t *store, const uint8_t peer[6],
+    uint32_t desc_hash, const hid_layout_t *layout);
+
+/*
+ * Remove the entry for peer, for example when it failed validation.
+ */
+bool layout_cache_erase(const nv_store_t *store, const uint8_t peer[6]);
+
+/*
+ * Remove all entries. Call when all bonds are deleted.
+ */
+bool layout_cache_clear(const nv_store_t *store);
+
+#endif  /* _LAYOUT_CACHE_H_ */
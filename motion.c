@@ -0,0 +1,199 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2023 touchgadgetdev@gmail.com
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <string.h>
+#include "./motion.h"
+
+#if (MOTION_EVENTS_MAX & (MOTION_EVENTS_MAX - 1)) != 0
+#error MOTION_EVENTS_MAX must be a power of 2
+#endif
+
+static inline int32_t sat_add(motion_t *m, int32_t sum, int32_t delta) {
+  int32_t result;
+  if (__builtin_add_overflow(sum, delta, &result)) {
+    m->saturated++;
+    return (delta > 0) ? INT32_MAX : INT32_MIN;
+  }
+  return result;
+}
+
+static inline bool has_motion(const motion_frame_t *f) {
+  return (f->dx | f->dy | f->wheel | f->pan) != 0;
+}
+
+void motion_init(motion_t *m) {
+  memset(m, 0, sizeof(*m));
+}
+
+void motion_set_buttons(motion_t *m, uint32_t buttons) {
+  if (buttons == m->pending.buttons) return;
+  // Close the pending frame so the motion before the change is sent with
+  // the old buttons, unless there is nothing in it to send.
+  if (has_motion(&m->pending) || (m->pending.buttons != m->sent_buttons)) {
+    if (m->event_count < MOTION_EVENTS_MAX) {
+      uint32_t tail = (m->event_head + m->event_count) & (MOTION_EVENTS_MAX - 1);
+      m->events[tail] = m->pending;
+      m->event_count++;
+      memset(&m->pending, 0, sizeof(m->pending));
+    } else {
+      // Keep the motion, lose the old button state.
+      m->events_merged++;
+    }
+  }
+  m->pending.buttons = buttons;
+}
+
+void motion_add(motion_t *m, const mouse_values_t *mv) {
+  m->reports++;
+  motion_set_buttons(m, mv->buttons);
+  m->pending.dx = sat_add(m, m->pending.dx, mv->x);
+  m->pending.dy = sat_add(m, m->pending.dy, mv->y);
+  m->pending.wheel = sat_add(m, m->pending.wheel, mv->wheel);
+  m->pending.pan = sat_add(m, m->pending.pan, mv->pan);
+}
+
+bool motion_take(motion_t *m, motion_frame_t *frame) {
+  if (m->event_count > 0) {
+    *frame = m->events[m->event_head];
+    m->event_head = (m->event_head + 1) & (MOTION_EVENTS_MAX - 1);
+    m->event_count--;
+  } else if (has_motion(&m->pending) || (m->pending.buttons != m->sent_buttons)) {
+    *frame = m->pending;
+    m->pending.dx = m->pending.dy = m->pending.wheel = m->pending.pan = 0;
+  } else {
+    return false;
+  }
+  m->sent_buttons = frame->buttons;
+  m->frames++;
+  return true;
+}
+
+#if DEBUG_MOTION_MAIN
+/*
+ * Throughput test. Build and run on Linux with
+ *   gcc -O2 -DDEBUG_MOTION_MAIN=1 -o motion_test motion.c
+ * Feeds reports at 1 to 64 times the frame rate with random motion and a
+ * button change about every 10 frames, taking one frame per simulated USB
+ * frame. Checks the motion summed over all frames equals the motion of all
+ * reports and every button change appears in the frames.
+ */
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#define TEST_FRAMES (200000)
+
+static int run(uint32_t reports_per_frame) {
+  motion_t m;
+  motion_frame_t f;
+  int64_t in_x = 0, in_y = 0, in_w = 0, out_x = 0, out_y = 0, out_w = 0;
+  uint32_t in_transitions = 0, out_transitions = 0;
+  uint32_t buttons = 0, out_buttons = 0;
+  int errors = 0;
+
+  motion_init(&m);
+  srand(reports_per_frame);
+  for (uint32_t frame = 0; frame < TEST_FRAMES; frame++) {
+    uint32_t click_at = ((rand() % 10) == 0) ? rand() % reports_per_frame : UINT32_MAX;
+    for (uint32_t r = 0; r < reports_per_frame; r++) {
+      mouse_values_t mv = {0};
+      mv.x = (rand() % 255) - 127;
+      mv.y = (rand() % 255) - 127;
+      mv.wheel = (rand() % 3) - 1;
+      if (r == click_at) {
+        buttons ^= 1u << (rand() % 3);
+        in_transitions++;
+      }
+      mv.buttons = buttons;
+      in_x += mv.x;
+      in_y += mv.y;
+      in_w += mv.wheel;
+      motion_add(&m, &mv);
+    }
+    // USB sends one frame per frame period
+    if (motion_take(&m, &f)) {
+      out_x += f.dx;
+      out_y += f.dy;
+      out_w += f.wheel;
+      if (f.buttons != out_buttons) out_transitions++;
+      out_buttons = f.buttons;
+    }
+  }
+  // Flush
+  while (motion_take(&m, &f)) {
+    out_x += f.dx;
+    out_y += f.dy;
+    out_w += f.wheel;
+    if (f.buttons != out_buttons) out_transitions++;
+    out_buttons = f.buttons;
+  }
+  if ((in_x != out_x) || (in_y != out_y) || (in_w != out_w)) errors++;
+  if (out_buttons != buttons) errors++;
+  if ((out_transitions != in_transitions) || (m.events_merged != 0)) errors++;
+  if (m.saturated != 0) errors++;
+  printf("%2"PRIu32" reports/frame: reports %"PRIu32" frames %"PRIu32
+      " motion in %"PRId64",%"PRId64" out %"PRId64",%"PRId64
+      " button changes in %"PRIu32" out %"PRIu32" merged %"PRIu32" %s\n",
+      reports_per_frame, m.reports, m.frames, in_x, in_y, out_x, out_y,
+      in_transitions, out_transitions, m.events_merged,
+      errors ? "FAIL" : "ok");
+  return errors;
+}
+
+int main(void) {
+  int errors = 0;
+  for (uint32_t rate = 1; rate <= 64; rate *= 2) {
+    errors += run(rate);
+  }
+
+  // Saturation
+  motion_t m;
+  motion_frame_t f;
+  mouse_values_t mv = {0};
+  motion_init(&m);
+  mv.x = INT32_MAX;
+  mv.y = INT32_MIN;
+  motion_add(&m, &mv);
+  motion_add(&m, &mv);
+  if (!motion_take(&m, &f) || (f.dx != INT32_MAX) || (f.dy != INT32_MIN) ||
+      (m.saturated != 2)) {
+    printf("saturation FAIL\n");
+    errors++;
+  }
+  // Press and release between two frames are two frames.
+  motion_init(&m);
+  mv = (mouse_values_t){0};
+  mv.buttons = 1;
+  motion_add(&m, &mv);
+  mv.buttons = 0;
+  motion_add(&m, &mv);
+  if (!motion_take(&m, &f) || (f.buttons != 1) ||
+      !motion_take(&m, &f) || (f.buttons != 0) || motion_take(&m, &f)) {
+    printf("click FAIL\n");
+    errors++;
+  }
+  printf("errors %d\n", errors);
+  return errors;
+}
+#endif
@@ -0,0 +1,83 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2023 touchgadgetdev@gmail.com
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef _MOTION_H_
+#define _MOTION_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include "./report_desc.h"
+
+/*
+ * Coalesces decoded mouse reports into USB joystick frames. X, Y, wheel and
+ * pan are relative so the deltas of all reports between two frames are
+ * summed. Button changes are never merged: every report that changes the
+ * buttons closes the frame so each press and release reaches USB.
+ */
+
+#define MOTION_EVENTS_MAX   (16)    // must be a power of 2
+
+typedef struct {
+  int32_t dx;
+  int32_t dy;
+  int32_t wheel;
+  int32_t pan;
+  uint32_t buttons;
+} motion_frame_t;
+
+typedef struct {
+  motion_frame_t pending;       // motion since the last frame, current buttons
+  uint32_t sent_buttons;        // buttons of the last frame taken
+  // Frames closed by button changes, waiting to be taken
+  motion_frame_t events[MOTION_EVENTS_MAX];
+  uint32_t event_head;
+  uint32_t event_count;
+  // Statistics
+  uint32_t reports;             // reports added
+  uint32_t frames;              // frames taken
+  uint32_t saturated;           // sums clamped to INT32_MIN/MAX
+  uint32_t events_merged;       // button changes lost, events[] full
+} motion_t;
+
+void motion_init(motion_t *m);
+
+/*
+ * Add one decoded report.
+ */
+void motion_add(motion_t *m, const mouse_values_t *mv);
+
+/*
+ * Change the buttons without a report, for example to release the buttons
+ * of a device that disconnected. Closes the frame like a report would.
+ */
+void motion_set_buttons(motion_t *m, uint32_t buttons);
+
+/*
+ * Take the next frame to send. Returns false if there is no motion and no
+ * button change since the last frame.
+ */
+bool motion_take(motion_t *m, motion_frame_t *frame);
+
+#endif  /* _MOTION_H_ */
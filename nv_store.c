@@ -0,0 +1,130 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2023 touchgadgetdev@gmail.com
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include "./nv_store.h"
+
+#if defined(ARDUINO)
+#include <nvs.h>
+
+static bool nvs_read(void *ctx, const char *key, void *data, size_t len) {
+  size_t stored_len = len;
+  if (nvs_get_blob((nvs_handle_t)(uintptr_t)ctx, key, data, &stored_len) != ESP_OK) {
+    return false;
+  }
+  return stored_len == len;
+}
+
+static bool nvs_write(void *ctx, const char *key, const void *data, size_t len) {
+  nvs_handle_t handle = (nvs_handle_t)(uintptr_t)ctx;
+  if (nvs_set_blob(handle, key, data, len) != ESP_OK) return false;
+  return nvs_commit(handle) == ESP_OK;
+}
+
+static bool nvs_erase(void *ctx, const char *key) {
+  nvs_handle_t handle = (nvs_handle_t)(uintptr_t)ctx;
+  esp_err_t err = nvs_erase_key(handle, key);
+  if ((err != ESP_OK) && (err != ESP_ERR_NVS_NOT_FOUND)) return false;
+  return nvs_commit(handle) == ESP_OK;
+}
+
+static bool nvs_erase_everything(void *ctx) {
+  nvs_handle_t handle = (nvs_handle_t)(uintptr_t)ctx;
+  if (nvs_erase_all(handle) != ESP_OK) return false;
+  return nvs_commit(handle) == ESP_OK;
+}
+
+bool nv_store_nvs_init(nv_store_t *store, const char *name_space) {
+  nvs_handle_t handle;
+  memset(store, 0, sizeof(*store));
+  if (nvs_open(name_space, NVS_READWRITE, &handle) != ESP_OK) return false;
+  store->read = nvs_read;
+  store->write = nvs_write;
+  store->erase = nvs_erase;
+  store->erase_all = nvs_erase_everything;
+  store->ctx = (void *)(uintptr_t)handle;
+  return true;
+}
+
+#else   // Linux host
+#include <dirent.h>
+
+static void file_path(void *ctx, const char *key, char *path, size_t len) {
+  snprintf(path, len, "%s/%s.bin", (const char *)ctx, key);
+}
+
+static bool file_read(void *ctx, const char *key, void *data, size_t len) {
+  char path[256];
+  file_path(ctx, key, path, sizeof(path));
+  FILE *f = fopen(path, "rb");
+  if (f == NULL) return false;
+  bool ok = (fread(data, 1, len, f) == len) && (fgetc(f) == EOF);
+  fclose(f);
+  return ok;
+}
+
+static bool file_write(void *ctx, const char *key, const void *data, size_t len) {
+  char path[256];
+  file_path(ctx, key, path, sizeof(path));
+  FILE *f = fopen(path, "wb");
+  if (f == NULL) return false;
+  bool ok = fwrite(data, 1, len, f) == len;
+  return (fclose(f) == 0) && ok;
+}
+
+static bool file_erase(void *ctx, const char *key) {
+  char path[256];
+  file_path(ctx, key, path, sizeof(path));
+  remove(path);
+  return true;
+}
+
+static bool file_erase_all(void *ctx) {
+  DIR *dir = opendir((const char *)ctx);
+  if (dir == NULL) return false;
+  struct dirent *entry;
+  while ((entry = readdir(dir)) != NULL) {
+    size_t len = strlen(entry->d_name);
+    if ((len > 4) && (strcmp(&entry->d_name[len - 4], ".bin") == 0)) {
+      char path[512];
+      snprintf(path, sizeof(path), "%s/%s", (const char *)ctx, entry->d_name);
+      remove(path);
+    }
+  }
+  closedir(dir);
+  return true;
+}
+
+bool nv_store_file_init(nv_store_t *store, const char *dir) {
+  memset(store, 0, sizeof(*store));
+  if (dir == NULL) return false;
+  store->read = file_read;
+  store->write = file_write;
+  store->erase = file_erase;
+  store->erase_all = file_erase_all;
+  store->ctx = (void *)dir;
+  return true;
+}
+#endif
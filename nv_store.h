@@ -0,0 +1,63 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2023 touchgadgetdev@gmail.com
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef _NV_STORE_H_
+#define _NV_STORE_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+// Keys are at most this many characters. Same limit as ESP32 NVS.
+#define NV_STORE_KEY_MAX  (15)
+
+/*
+ * Key/blob storage that survives reboot. On the ESP32 this is NVS. On a
+ * Linux host it is one file per key so the caches can be tested without
+ * hardware. read() fails if the key does not exist or the stored blob is
+ * not exactly len bytes.
+ */
+typedef struct {
+  bool (*read)(void *ctx, const char *key, void *data, size_t len);
+  bool (*write)(void *ctx, const char *key, const void *data, size_t len);
+  bool (*erase)(void *ctx, const char *key);
+  bool (*erase_all)(void *ctx);
+  void *ctx;
+} nv_store_t;
+
+#if defined(ARDUINO)
+/*
+ * Use the NVS namespace name_space. NVS flash must already be initialized.
+ * NimBLEDevice::init() does this because bonds are stored in NVS.
+ */
+bool nv_store_nvs_init(nv_store_t *store, const char *name_space);
+#else
+/*
+ * Store each key in a file in directory dir. The directory must exist and
+ * the string must stay valid while the store is used.
+ */
+bool nv_store_file_init(nv_store_t *store, const char *dir);
+#endif
+
+#endif  /* _NV_STORE_H_ */
@@ -22,9 +22,18 @@
  * SOFTWARE.
  */
 
+#include <inttypes.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include "./report_desc.h"
+
 #if defined(USB_HID_DEBUG) && USB_HID_DEBUG
 #if defined(ARDUINO)
-#define printf(...)   Serial.printf(__VA_ARGS__)
+// Deferred to the sketch's log task so tracing extract_mouse_values()
+// does not slow it down. Needs USB_DEBUG in the sketch.
+#include "./binlog.h"
+#define printf(...)   BINLOG(&Debug_Log, __VA_ARGS__)
 #endif
 #else
 #define LOG_ON  0
@@ -36,11 +45,6 @@
 #define UINT16(p) (*p|(*(p + 1) << 8))
 #define UINT32(p) (*p|(*(p + 1) << 8)|(*(p + 2) << 16)|(*(p + 3) << 24))
 
-#include <inttypes.h>
-#include <stdint.h>
-#include <stdio.h>
-#include <string.h>
-#include "./report_desc.h"
 
 typedef struct {
   uint8_t bSize:2;
@@ -126,23 +130,6 @@ static const char *LOCAL_ITEM_NAMES[] = {
   /* 15 */ NULL,
 };
 
-typedef union {
-  uint8_t u8;
-  int8_t i8;
-  uint16_t u16;
-  int16_t i16;
-  uint32_t u32;
-  int32_t i32;
-} ITEM_VALUE_t;
-
-typedef struct {
-  ITEM_VALUE_t value;
-  int8_t size;
-} ITEM_VALUE_TYPE_t;
-
-static ITEM_VALUE_TYPE_t Global_Item_Values[16] = {0};
-static ITEM_VALUE_TYPE_t Local_Item_Values[16] = {0};
-
 static void print_items(const char *item_name[], ITEM_VALUE_TYPE_t *item_values) {
   for (size_t i = 0; i < 12; i++) {
     if (item_name[i] != NULL) {
@@ -157,9 +144,6 @@ static void print_items(const char *item_name[], ITEM_VALUE_TYPE_t *item_values)
   }
 }
 
-static uint16_t Usage_Items[8];
-static uint32_t Usage_Item_Count = 0;
-
 #if LOG_ON
 static const char *MAIN_ITEM_NAMES[] = {
   /*  0 */ NULL,
@@ -197,19 +181,13 @@ enum {
 };
 
 enum {
+  GENERIC_DESKTOP_POINTER = 0x01,
+  GENERIC_DESKTOP_MOUSE = 0x02,
   GENERIC_DESKTOP_X = 0x30,
   GENERIC_DESKTOP_Y = 0x31,
   GENERIC_DESKTOP_WHEEL = 0x38,
 };
 
-typedef struct {
-  uint32_t usage;
-  uint8_t offset_byte;
-  uint8_t offset_bit;
-  uint8_t len_in_bits;
-  uint8_t filler;
-} field_t;
-
 #if 0
 typedef struct {
   field_t bit_fields[8];
@@ -225,10 +203,6 @@ typedef struct {
 } hid_mouse_report_t;
 #endif
 
-#define MOUSE_FIELDS_MAX  (32)
-static field_t mouse_fields[MOUSE_FIELDS_MAX];
-static uint32_t Mouse_Field_Count = 0;
-
 enum {
   USAGE_BUTTON = 0x00090000UL,
   USAGE_X = 0x00010030UL,
@@ -238,9 +212,50 @@ enum {
   USAGE_FILLER = 0x0001FFFFUL,
 };
 
-static uint32_t total_offset_bit = 0;
+static hid_report_layout_t *get_report_layout(hid_parser_ctx_t *ctx,
+    uint8_t report_id) {
+  for (size_t i = 0; i < ctx->layout->report_count; i++) {
+    if (ctx->layout->reports[i].report_id == report_id) {
+      return &ctx->layout->reports[i];
+    }
+  }
+  if (ctx->layout->report_count >= HID_REPORT_LAYOUTS_MAX) {
+    printf("Too many report IDs\n");
+    return NULL;
+  }
+  hid_report_layout_t *layout = &ctx->layout->reports[ctx->layout->report_count++];
+  memset(layout, 0, sizeof(*layout));
+  layout->report_id = report_id;
+  layout->app_usage = ctx->app_usage;
+  if (ctx->layout->has_report_id && report_id) {
+    layout->fields[0].usage = USAGE_REPORT_ID;
+    layout->fields[0].len_in_bits = 8;
+    layout->field_count = 1;
+    layout->total_bits = 8;
+  }
+  printf("New layout report ID %u app usage 0x%08"PRIX32"\n",
+      report_id, ctx->app_usage);
+  return layout;
+}
+
+static hid_report_layout_t *current_report_layout(hid_parser_ctx_t *ctx) {
+  return get_report_layout(ctx, ctx->global_items[GLOBAL_REPORT_ID].value.u8);
+}
 
-static void parse_main_item(size_t bTag, const uint8_t *report_desc, size_t bSize) {
+static void add_field(hid_report_layout_t *layout, uint32_t usage,
+    uint32_t len_in_bits) {
+  if (layout->field_count < HID_REPORT_FIELDS_MAX) {
+    field_t *field = &layout->fields[layout->field_count++];
+    field->usage = usage;
+    field->len_in_bits = len_in_bits;
+    field->offset_byte = layout->total_bits / 8;
+    field->offset_bit = layout->total_bits % 8;
+    printf("field_count %"PRIu32"\n", layout->field_count);
+  }
+  layout->total_bits += len_in_bits;
+}
+
+static void parse_main_item(hid_parser_ctx_t *ctx, size_t bTag, const uint8_t *report_desc, size_t bSize) {
 #if LOG_ON
   const char *tag_name;
 
@@ -257,86 +272,56 @@ static void parse_main_item(size_t bTag, const uint8_t *report_desc, size_t bSiz
     case 1:
       printf("%s (%02x)\n", tag_name, *report_desc);
       if (bTag == MAIN_INPUT) {
-        print_items(GLOBAL_ITEM_NAMES, Global_Item_Values);
-        print_items(LOCAL_ITEM_NAMES, Local_Item_Values);
-        uint32_t usage_page = Global_Item_Values[GLOBAL_USAGE_PAGE].value.u32;
+        print_items(GLOBAL_ITEM_NAMES, ctx->global_items);
+        print_items(LOCAL_ITEM_NAMES, ctx->local_items);
+        hid_report_layout_t *layout = current_report_layout(ctx);
+        if (layout == NULL) break;
+        uint32_t usage_page = ctx->global_items[GLOBAL_USAGE_PAGE].value.u32;
+        uint32_t report_size = ctx->global_items[GLOBAL_REPORT_SIZE].value.u32;
+        uint32_t report_count = ctx->global_items[GLOBAL_REPORT_COUNT].value.u32;
         if (usage_page == BUTTON_PAGE) {
-          printf("buttons size %"PRIu32" count %"PRIu32" total_offset_bit %"PRIu32"\n",
-              Global_Item_Values[GLOBAL_REPORT_SIZE].value.u32,
-              Global_Item_Values[GLOBAL_REPORT_COUNT].value.u32,
-              total_offset_bit);
-          if (Usage_Item_Count == 0) {
-            if ((Local_Item_Values[LOCAL_USAGE_MINIMUM].value.u32 == 0) &&
-                (Local_Item_Values[LOCAL_USAGE_MAXIMUM].value.u32 == 0)) {
-              mouse_fields[Mouse_Field_Count].usage = USAGE_FILLER;
-            } else {
-              mouse_fields[Mouse_Field_Count].usage = USAGE_BUTTON;
-            }
+          printf("buttons size %"PRIu32" count %"PRIu32" total_bits %"PRIu32"\n",
+              report_size, report_count, layout->total_bits);
+          if ((ctx->usage_item_count == 0) &&
+              (ctx->local_items[LOCAL_USAGE_MINIMUM].value.u32 == 0) &&
+              (ctx->local_items[LOCAL_USAGE_MAXIMUM].value.u32 == 0)) {
+            add_field(layout, USAGE_FILLER, report_size * report_count);
+          } else {
+            add_field(layout, USAGE_BUTTON, report_size * report_count);
           }
-          mouse_fields[Mouse_Field_Count].len_in_bits =
-            Global_Item_Values[GLOBAL_REPORT_SIZE].value.u32 *
-            Global_Item_Values[GLOBAL_REPORT_COUNT].value.u32;
-          printf("len_in_bits %d\n", mouse_fields[Mouse_Field_Count].len_in_bits);
-          mouse_fields[Mouse_Field_Count].offset_byte = total_offset_bit / 8;
-          mouse_fields[Mouse_Field_Count].offset_bit = total_offset_bit % 8;
-          total_offset_bit += mouse_fields[Mouse_Field_Count].len_in_bits;
-          Mouse_Field_Count++;
-          printf("total_offset_bit %"PRIu32" Mouse_Field_Count %"PRIu32"\n",
-              total_offset_bit, Mouse_Field_Count);
-        } else if (usage_page == GENERIC_DESKTOP_PAGE) {
-          printf("Generic Desktop | Usage_Item_Count %"PRIu32", size %"PRIu32", count %"PRIu32", total_offset_bit %"PRIu32"\n",
-              Usage_Item_Count,
-              Global_Item_Values[GLOBAL_REPORT_SIZE].value.u32,
-              Global_Item_Values[GLOBAL_REPORT_COUNT].value.u32,
-              total_offset_bit);
-          for (size_t i = 0; i < Usage_Item_Count; i++) {
-            printf("Usage (0x%02X)", Usage_Items[i]);
-            switch (Usage_Items[i]) {
+        } else if ((usage_page == GENERIC_DESKTOP_PAGE) && (ctx->usage_item_count > 0)) {
+          printf("Generic Desktop | ctx->usage_item_count %"PRIu32", size %"PRIu32", count %"PRIu32", total_bits %"PRIu32"\n",
+              ctx->usage_item_count, report_size, report_count, layout->total_bits);
+          for (size_t i = 0; i < ctx->usage_item_count; i++) {
+            printf("Usage (0x%02X)", ctx->usage_items[i]);
+            switch (ctx->usage_items[i]) {
               case GENERIC_DESKTOP_X:
                 printf(" X control\n");
-                mouse_fields[Mouse_Field_Count].usage = USAGE_X;
-                mouse_fields[Mouse_Field_Count].len_in_bits =
-                  Global_Item_Values[GLOBAL_REPORT_SIZE].value.u32;
+                add_field(layout, USAGE_X, report_size);
                 break;
               case GENERIC_DESKTOP_Y:
                 printf(" Y control\n");
-                mouse_fields[Mouse_Field_Count].usage = USAGE_Y;
-                mouse_fields[Mouse_Field_Count].len_in_bits =
-                  Global_Item_Values[GLOBAL_REPORT_SIZE].value.u32;
+                add_field(layout, USAGE_Y, report_size);
                 break;
               case GENERIC_DESKTOP_WHEEL:
                 printf(" wheel control\n");
-                mouse_fields[Mouse_Field_Count].usage = USAGE_WHEEL;
-                mouse_fields[Mouse_Field_Count].len_in_bits =
-                  Global_Item_Values[GLOBAL_REPORT_SIZE].value.u32;
+                add_field(layout, USAGE_WHEEL, report_size);
                 break;
               default:
                 printf("\n");
-                mouse_fields[Mouse_Field_Count].usage = USAGE_FILLER;
-                if (Usage_Item_Count == 0) {
-                  mouse_fields[Mouse_Field_Count].len_in_bits =
-                    Global_Item_Values[GLOBAL_REPORT_SIZE].value.u32 *
-                    Global_Item_Values[GLOBAL_REPORT_COUNT].value.u32;
-                } else {
-                  mouse_fields[Mouse_Field_Count].len_in_bits =
-                    Global_Item_Values[GLOBAL_REPORT_SIZE].value.u32;
-                }
+                add_field(layout, USAGE_FILLER, report_size);
                 break;
             }
-            mouse_fields[Mouse_Field_Count].offset_byte = total_offset_bit / 8;
-            mouse_fields[Mouse_Field_Count].offset_bit = total_offset_bit % 8;
-            total_offset_bit += mouse_fields[Mouse_Field_Count].len_in_bits;
-            if (Mouse_Field_Count < (MOUSE_FIELDS_MAX - 1)) {
-              Mouse_Field_Count++;
-              printf("Mouse_Field_Count %"PRIu32"\n", Mouse_Field_Count);
-            }
           }
         } else {
-          total_offset_bit += Global_Item_Values[GLOBAL_REPORT_SIZE].value.u32 *
-            Global_Item_Values[GLOBAL_REPORT_COUNT].value.u32;
+          // Keyboard, consumer, vendor, or padding bits. Skip over them.
+          layout->total_bits += report_size * report_count;
         }
       } else if ((bTag == MAIN_COLLECTION) && (*report_desc == 0x01)) {
-        total_offset_bit = 0;
+        // Application collection. Its usage tells what kind of device
+        // owns the reports inside it.
+        ctx->app_usage = (ctx->global_items[GLOBAL_USAGE_PAGE].value.u32 << 16) |
+          ((ctx->usage_item_count > 0) ? ctx->usage_items[0] : 0);
       }
       break;
     case 2:
@@ -349,14 +334,14 @@ static void parse_main_item(size_t bTag, const uint8_t *report_desc, size_t bSiz
 }
 
 
-static void main_item(const uint8_t *report_desc, size_t bTag, size_t bSize) {
-  parse_main_item(bTag, report_desc, bSize);
-  Usage_Item_Count = 0;
-  memset((uint8_t *)Local_Item_Values, 0, sizeof(Local_Item_Values));
+static void main_item(hid_parser_ctx_t *ctx, const uint8_t *report_desc, size_t bTag, size_t bSize) {
+  parse_main_item(ctx, bTag, report_desc, bSize);
+  ctx->usage_item_count = 0;
+  memset((uint8_t *)ctx->local_items, 0, sizeof(ctx->local_items));
 }
 
-static void parse_global_item(int bTag, const uint8_t *report_desc,
-    size_t bSize, bool report_id) {
+static void parse_global_item(hid_parser_ctx_t *ctx, int bTag, const uint8_t *report_desc,
+    size_t bSize) {
 #if LOG_ON
   const char *tag_name;
 
@@ -373,26 +358,26 @@ static void parse_global_item(int bTag, const uint8_t *report_desc,
       break;
     case 1:
       if (*report_desc & 0x80) {
-        Global_Item_Values[bTag].size = -1;
-        Global_Item_Values[bTag].value.i32 = *(int8_t *)report_desc;
-        printf("%s (%"PRIi32")\n", tag_name, Global_Item_Values[bTag].value.i32);
+        ctx->global_items[bTag].size = -1;
+        ctx->global_items[bTag].value.i32 = *(int8_t *)report_desc;
+        printf("%s (%"PRIi32")\n", tag_name, ctx->global_items[bTag].value.i32);
       } else {
-        Global_Item_Values[bTag].size = 1;
-        Global_Item_Values[bTag].value.u32 = *report_desc;
-        printf("%s (%"PRIu32")\n", tag_name, Global_Item_Values[bTag].value.u32);
+        ctx->global_items[bTag].size = 1;
+        ctx->global_items[bTag].value.u32 = *report_desc;
+        printf("%s (%"PRIu32")\n", tag_name, ctx->global_items[bTag].value.u32);
       }
       break;
     case 2:
       {
         uint16_t u16 = UINT16(report_desc);
         if (u16 & 0x8000) {
-          Global_Item_Values[bTag].size = -2;
-          Global_Item_Values[bTag].value.i32 = (int16_t)u16;
-          printf("%s (%"PRIi32")\n", tag_name, Global_Item_Values[bTag].value.i32);
+          ctx->global_items[bTag].size = -2;
+          ctx->global_items[bTag].value.i32 = (int16_t)u16;
+          printf("%s (%"PRIi32")\n", tag_name, ctx->global_items[bTag].value.i32);
         } else {
-          Global_Item_Values[bTag].size = 2;
-          Global_Item_Values[bTag].value.u32 = u16;
-          printf("%s (%"PRIu32")\n", tag_name, Global_Item_Values[bTag].value.i32);
+          ctx->global_items[bTag].size = 2;
+          ctx->global_items[bTag].value.u32 = u16;
+          printf("%s (%"PRIu32")\n", tag_name, ctx->global_items[bTag].value.i32);
         }
       }
       break;
@@ -400,35 +385,29 @@ static void parse_global_item(int bTag, const uint8_t *report_desc,
       {
         uint32_t u32 = UINT32(report_desc);
         if (u32 & 0x80000000) {
-          Global_Item_Values[bTag].size = -4;
-          Global_Item_Values[bTag].value.i32 = (int32_t)u32;
-          printf("%s (%"PRIi32")\n", tag_name, Global_Item_Values[bTag].value.i32);
+          ctx->global_items[bTag].size = -4;
+          ctx->global_items[bTag].value.i32 = (int32_t)u32;
+          printf("%s (%"PRIi32")\n", tag_name, ctx->global_items[bTag].value.i32);
         } else {
-          Global_Item_Values[bTag].size = 4;
-          Global_Item_Values[bTag].value.u32 = u32;
+          ctx->global_items[bTag].size = 4;
+          ctx->global_items[bTag].value.u32 = u32;
           printf("%s (%"PRIu32")\n", tag_name, u32);
         }
       }
       break;
   }
-  if (report_id && (bTag == GLOBAL_REPORT_ID)) {
-    if (Global_Item_Values[GLOBAL_REPORT_ID].value.u8) {
-      mouse_fields[Mouse_Field_Count].usage = USAGE_REPORT_ID;
-      mouse_fields[Mouse_Field_Count].len_in_bits = 8;
-      total_offset_bit += mouse_fields[Mouse_Field_Count].len_in_bits;
-      Mouse_Field_Count++;
-      printf("total_offset_bit %"PRIu32" Mouse_Field_Count %"PRIu32"\n",
-          total_offset_bit, Mouse_Field_Count);
-    }
+  if (bTag == GLOBAL_REPORT_ID) {
+    // Create the layout now so the report ID field comes first.
+    current_report_layout(ctx);
   }
 }
 
-static void global_item(const uint8_t *report_desc, size_t bTag, size_t bSize,
-    bool report_id) {
-  parse_global_item(bTag, report_desc, bSize, report_id);
+static void global_item(hid_parser_ctx_t *ctx, const uint8_t *report_desc, size_t bTag, size_t bSize) {
+  parse_global_item(ctx, bTag, report_desc, bSize);
 }
 
-static void parse_local_item(int bTag, const uint8_t *report_desc, size_t bSize) {
+
+static void parse_local_item(hid_parser_ctx_t *ctx, int bTag, const uint8_t *report_desc, size_t bSize) {
 #if LOG_ON
   const char *tag_name;
 
@@ -444,19 +423,19 @@ static void parse_local_item(int bTag, const uint8_t *report_desc, size_t bSize)
       break;
     case 1:
       if (*report_desc & 0x80) {
-        Local_Item_Values[bTag].size = -1;
-        Local_Item_Values[bTag].value.i32 = *(int8_t *)report_desc;
-        printf("%s (%"PRIi32")\n", tag_name, Local_Item_Values[bTag].value.i32);
+        ctx->local_items[bTag].size = -1;
+        ctx->local_items[bTag].value.i32 = *(int8_t *)report_desc;
+        printf("%s (%"PRIi32")\n", tag_name, ctx->local_items[bTag].value.i32);
       } else {
-        Local_Item_Values[bTag].size = 1;
-        Local_Item_Values[bTag].value.u32 = *report_desc;
-        printf("%s (%"PRIu32")\n", tag_name, Local_Item_Values[bTag].value.u32);
+        ctx->local_items[bTag].size = 1;
+        ctx->local_items[bTag].value.u32 = *report_desc;
+        printf("%s (%"PRIu32")\n", tag_name, ctx->local_items[bTag].value.u32);
       }
       if (bTag == LOCAL_USAGE) {
-        if (Usage_Item_Count > 7) {
+        if (ctx->usage_item_count > 7) {
           printf("Too many usage items\n");
         } else {
-          Usage_Items[Usage_Item_Count++] = *report_desc;
+          ctx->usage_items[ctx->usage_item_count++] = *report_desc;
         }
       }
       printf("%s (0x%02X)\n", tag_name, *report_desc);
@@ -465,20 +444,20 @@ static void parse_local_item(int bTag, const uint8_t *report_desc, size_t bSize)
       {
         uint16_t u16 = UINT16(report_desc);
         if (u16 & 0x8000) {
-          Local_Item_Values[bTag].size = -2;
-          Local_Item_Values[bTag].value.i32 = (int16_t)u16;
-          printf("%s (%"PRIi32")\n", tag_name, Local_Item_Values[bTag].value.i32);
+          ctx->local_items[bTag].size = -2;
+          ctx->local_items[bTag].value.i32 = (int16_t)u16;
+          printf("%s (%"PRIi32")\n", tag_name, ctx->local_items[bTag].value.i32);
         } else {
-          Local_Item_Values[bTag].size = 2;
-          Local_Item_Values[bTag].value.u32 = u16;
-          printf("%s (%"PRIu32")\n", tag_name, Local_Item_Values[bTag].value.i32);
+          ctx->local_items[bTag].size = 2;
+          ctx->local_items[bTag].value.u32 = u16;
+          printf("%s (%"PRIu32")\n", tag_name, ctx->local_items[bTag].value.i32);
         }
       }
       if (bTag == LOCAL_USAGE) {
-        if (Usage_Item_Count > 7) {
+        if (ctx->usage_item_count > 7) {
           printf("Too many usage items\n");
         } else {
-          Usage_Items[Usage_Item_Count++] = UINT16(report_desc);
+          ctx->usage_items[ctx->usage_item_count++] = UINT16(report_desc);
         }
       }
       printf("%s (0x%04X)\n", tag_name, UINT16(report_desc));
@@ -487,12 +466,12 @@ static void parse_local_item(int bTag, const uint8_t *report_desc, size_t bSize)
       {
         uint32_t u32 = UINT32(report_desc);
         if (u32 & 0x80000000) {
-          Local_Item_Values[bTag].size = -4;
-          Local_Item_Values[bTag].value.i32 = (int32_t)u32;
-          printf("%s (%"PRIi32")\n", tag_name, Local_Item_Values[bTag].value.i32);
+          ctx->local_items[bTag].size = -4;
+          ctx->local_items[bTag].value.i32 = (int32_t)u32;
+          printf("%s (%"PRIi32")\n", tag_name, ctx->local_items[bTag].value.i32);
         } else {
-          Local_Item_Values[bTag].size = 4;
-          Local_Item_Values[bTag].value.u32 = u32;
+          ctx->local_items[bTag].size = 4;
+          ctx->local_items[bTag].value.u32 = u32;
           printf("%s (%"PRIu32")\n", tag_name, u32);
         }
       }
@@ -504,16 +483,84 @@ static void parse_local_item(int bTag, const uint8_t *report_desc, size_t bSize)
   }
 }
 
-static void local_item(const uint8_t *report_desc, size_t bTag, size_t bSize) {
-  parse_local_item(bTag, report_desc, bSize);
+static void local_item(hid_parser_ctx_t *ctx, const uint8_t *report_desc, size_t bTag, size_t bSize) {
+  parse_local_item(ctx, bTag, report_desc, bSize);
 }
 
-void parse_hid_report_descriptor(const uint8_t *report_desc, size_t desc_len,
+static const field_t *find_field(const hid_report_layout_t *layout,
+    uint32_t usage) {
+  for (size_t i = 0; i < layout->field_count; i++) {
+    if (layout->fields[i].usage == usage) return &layout->fields[i];
+  }
+  return NULL;
+}
+
+/*
+ * Pick the extraction kernel for a layout. Most mice have 8 or fewer buttons
+ * in the first byte followed by byte aligned 8 or 16 bit X/Y or by X/Y packed
+ * as two 12 bit values in 3 bytes. Those get a straight line decoder.
+ * Everything else uses the generic bit reader.
+ */
+static void classify_report_layout(hid_report_layout_t *layout) {
+  layout->kernel = HID_KERNEL_GENERIC;
+  if (!layout->is_mouse) return;
+  const field_t *buttons = find_field(layout, USAGE_BUTTON);
+  const field_t *x = find_field(layout, USAGE_X);
+  const field_t *y = find_field(layout, USAGE_Y);
+  const field_t *wheel = find_field(layout, USAGE_WHEEL);
+  if ((x == NULL) || (y == NULL) || (x->offset_bit != 0)) return;
+  if (buttons != NULL) {
+    if ((buttons->offset_bit != 0) || (buttons->len_in_bits > 8)) return;
+    layout->buttons_offset = buttons->offset_byte;
+    layout->buttons_mask = (uint8_t)((1U << buttons->len_in_bits) - 1);
+  } else {
+    layout->buttons_offset = 0;
+    layout->buttons_mask = 0;
+  }
+  if (wheel != NULL) {
+    if ((wheel->offset_bit != 0) || (wheel->len_in_bits != 8)) return;
+    layout->wheel_offset = wheel->offset_byte;
+  } else {
+    layout->wheel_offset = HID_NO_FIELD;
+  }
+  layout->x_offset = x->offset_byte;
+  layout->y_offset = y->offset_byte;
+  uint32_t end;
+  if ((x->len_in_bits == 8) && (y->len_in_bits == 8) && (y->offset_bit == 0)) {
+    layout->kernel = HID_KERNEL_XY8;
+    end = y->offset_byte + 1;
+  } else if ((x->len_in_bits == 16) && (y->len_in_bits == 16) &&
+      (y->offset_bit == 0)) {
+    layout->kernel = HID_KERNEL_XY16;
+    end = y->offset_byte + 2;
+  } else if ((x->len_in_bits == 12) && (y->len_in_bits == 12) &&
+      (y->offset_byte == x->offset_byte + 1) && (y->offset_bit == 4)) {
+    layout->kernel = HID_KERNEL_XY12;
+    end = x->offset_byte + 3;
+  } else {
+    return;
+  }
+  if ((buttons != NULL) && (end < buttons->offset_byte + 1U)) {
+    end = buttons->offset_byte + 1;
+  }
+  if ((wheel != NULL) && (end < wheel->offset_byte + 1U)) {
+    end = wheel->offset_byte + 1;
+  }
+  layout->min_report_len = end;
+  printf("kernel %u min_report_len %u\n", layout->kernel, layout->min_report_len);
+}
+
+void hid_parser_init(hid_parser_ctx_t *ctx, hid_layout_t *layout,
     bool report_id) {
+  memset(ctx, 0, sizeof(*ctx));
+  memset(layout, 0, sizeof(*layout));
+  ctx->layout = layout;
+  layout->has_report_id = report_id;
+}
+
+void hid_parser_run(hid_parser_ctx_t *ctx, const uint8_t *report_desc,
+    size_t desc_len) {
   if ((report_desc == NULL) || (desc_len == 0)) return;
-  Mouse_Field_Count = 0;
-  memset((void *)Global_Item_Values, 0, sizeof(Global_Item_Values));
-  memset((void *)Local_Item_Values, 0, sizeof(Local_Item_Values));
   while (desc_len > 0) {
     HID_Item_Prefix_t *prefix = (HID_Item_Prefix_t *)report_desc;
     report_desc++;
@@ -521,57 +568,149 @@ void parse_hid_report_descriptor(const uint8_t *report_desc, size_t desc_len,
     switch (prefix->bType) {
       case BTYPE_MAIN:    // Main items
         printf("M: ");
-        main_item(report_desc, prefix->bTag, prefix->bSize);
+        main_item(ctx, report_desc, prefix->bTag, prefix->bSize);
         break;
       case BTYPE_GLOBAL:  // Global items
         printf("G: ");
-        global_item(report_desc, prefix->bTag, prefix->bSize, report_id);
+        global_item(ctx, report_desc, prefix->bTag, prefix->bSize);
         break;
       case BTYPE_LOCAL:   // Local items
         printf("L: ");
-        local_item(report_desc, prefix->bTag, prefix->bSize);
+        local_item(ctx, report_desc, prefix->bTag, prefix->bSize);
         break;
       default:
         printf("Invalid bType = %d\n", prefix->bType);
         break;
     }
     size_t skip_bytes = (prefix->bSize == 3) ? 4 : prefix->bSize;
+    if (skip_bytes > desc_len) break;
     report_desc += skip_bytes;
     desc_len -= skip_bytes;
   }
+  for (size_t i = 0; i < ctx->layout->report_count; i++) {
+    hid_report_layout_t *layout = &ctx->layout->reports[i];
+    bool has_xy = false;
+    bool has_buttons = false;
+    for (size_t f = 0; f < layout->field_count; f++) {
+      uint32_t usage = layout->fields[f].usage;
+      has_xy |= (usage == USAGE_X) || (usage == USAGE_Y);
+      has_buttons |= (usage == USAGE_BUTTON);
+    }
+    // A mouse report has X/Y or is a button only report (clicker) inside a
+    // mouse or pointer application collection.
+    layout->is_mouse = has_xy || (has_buttons &&
+        ((layout->app_usage == ((GENERIC_DESKTOP_PAGE << 16) | GENERIC_DESKTOP_MOUSE)) ||
+         (layout->app_usage == ((GENERIC_DESKTOP_PAGE << 16) | GENERIC_DESKTOP_POINTER))));
+    printf("Report ID %u is_mouse %d\n", layout->report_id, layout->is_mouse);
+    classify_report_layout(layout);
+  }
 }
 
-void extract_mouse_values(const uint8_t *report, mouse_values_t *mouse_values) {
-  mouse_values->report_id = 0;
-  mouse_values->x = 0;
-  mouse_values->y = 0;
-  mouse_values->wheel = 0;
-  mouse_values->pan = 0;
-  mouse_values->buttons = 0;
-  printf("Mouse_Field_Count %"PRIu32"\n", Mouse_Field_Count);
-  for (size_t i = 0; i < Mouse_Field_Count; i++) {
-    printf("offset_byte %u", mouse_fields[i].offset_byte);
-    printf(" offset_bit %u", mouse_fields[i].offset_bit);
-    printf(" len_in_bits %u", mouse_fields[i].len_in_bits);
-    printf(" usage %"PRIu32"\n", mouse_fields[i].usage);
-    printf("%x, %x, %x, %x\n", report[0], report[1], report[2], report[3]);
-    uint32_t u32 = UINT32(&report[mouse_fields[i].offset_byte]);
-    printf("u32 %"PRIu32"\n", u32);
-    uint8_t offset_bit =  mouse_fields[i].offset_bit;
-    u32 >>= offset_bit;
-    printf("u32 %"PRIu32"\n", u32);
-    uint8_t bit_len = mouse_fields[i].len_in_bits;
-    uint32_t mask = (1 << bit_len) - 1;
-    printf("mask %"PRIu32"\n", mask);
-    u32 = (u32 & mask);
-    int32_t i32;
-    if (u32 & (1 << (bit_len - 1))) {
-      i32 = (int32_t)(~mask | u32);
-    } else {
-      i32 = (int32_t)u32;
+void hid_layout_parse(hid_layout_t *layout, const uint8_t *report_desc,
+    size_t desc_len, bool report_id) {
+  hid_parser_ctx_t ctx;
+  hid_parser_init(&ctx, layout, report_id);
+  hid_parser_run(&ctx, report_desc, desc_len);
+}
+
+const hid_report_layout_t *hid_layout_find_report(const hid_layout_t *layout,
+    uint8_t report_id) {
+  for (size_t i = 0; i < layout->report_count; i++) {
+    if (layout->reports[i].report_id == report_id) {
+      return &layout->reports[i];
+    }
+  }
+  return NULL;
+}
+
+const hid_report_layout_t *hid_layout_first_mouse(const hid_layout_t *layout) {
+  for (size_t i = 0; i < layout->report_count; i++) {
+    if (layout->reports[i].is_mouse) {
+      return &layout->reports[i];
+    }
+  }
+  return NULL;
+}
+
+void hid_layout_boot_mouse(hid_layout_t *layout) {
+  memset(layout, 0, sizeof(*layout));
+  hid_report_layout_t *report = &layout->reports[0];
+  layout->report_count = 1;
+  report->app_usage = (GENERIC_DESKTOP_PAGE << 16) | GENERIC_DESKTOP_MOUSE;
+  report->is_mouse = true;
+  add_field(report, USAGE_BUTTON, 3);
+  add_field(report, USAGE_FILLER, 5);
+  add_field(report, USAGE_X, 8);
+  add_field(report, USAGE_Y, 8);
+  report->kernel = HID_KERNEL_BOOT;
+  report->min_report_len = HID_BOOT_MOUSE_REPORT_LEN;
+  report->buttons_offset = 0;
+  report->buttons_mask = HID_BOOT_MOUSE_BUTTONS;
+  report->x_offset = 1;
+  report->y_offset = 2;
+  report->wheel_offset = HID_NO_FIELD;
+}
+
+bool hid_layout_boot_compatible(const hid_layout_t *layout) {
+  const hid_report_layout_t *mouse = hid_layout_first_mouse(layout);
+  if (mouse == NULL) return false;
+  uint32_t buttons = 0;
+  for (size_t i = 0; i < mouse->field_count; i++) {
+    const field_t *field = &mouse->fields[i];
+    if (field->usage == USAGE_BUTTON) buttons += field->len_in_bits;
+    if (((field->usage == USAGE_X) || (field->usage == USAGE_Y)) &&
+        (field->len_in_bits > 8)) {
+      return false;
     }
-    printf("u32 %"PRIu32", i32 %"PRIi32"\n", u32, i32);
-    switch (mouse_fields[i].usage) {
+  }
+  return buttons <= 3;
+}
+
+/*
+ * Read len_in_bits bits (up to 32) starting at bit_offset. Works for fields
+ * at any bit offset including fields that cross a 32 bit boundary. Returns
+ * false if the field is not completely inside the report.
+ */
+static inline bool read_bits(const uint8_t *report, size_t report_len,
+    uint32_t bit_offset, uint32_t len_in_bits, uint32_t *bits) {
+  if ((len_in_bits == 0) || (len_in_bits > 32)) return false;
+  if (bit_offset + len_in_bits > report_len * 8) return false;
+  size_t first = bit_offset / 8;
+  const uint8_t *p = &report[first];
+  uint8_t tail[5] = {0};
+  if (first + sizeof(tail) > report_len) {
+    // Near the end of the report. Read only the bytes that are there.
+    memcpy(tail, p, report_len - first);
+    p = tail;
+  }
+  uint64_t u64 = (uint64_t)UINT32(p) | ((uint64_t)p[4] << 32);
+  u64 >>= bit_offset % 8;
+  *bits = (uint32_t)(u64 & ((1ULL << len_in_bits) - 1));
+  return true;
+}
+
+static inline int32_t sign_extend(uint32_t u32, uint32_t len_in_bits) {
+  uint32_t shift = 32 - len_in_bits;
+  return (int32_t)(u32 << shift) >> shift;
+}
+
+static void extract_generic(const hid_report_layout_t *layout,
+    const uint8_t *report, size_t report_len, mouse_values_t *mouse_values) {
+  const field_t *fields = layout->fields;
+  printf("field_count %"PRIu32"\n", layout->field_count);
+  for (size_t i = 0; i < layout->field_count; i++) {
+    uint32_t usage = fields[i].usage;
+    if ((usage == USAGE_FILLER) || (usage == USAGE_REPORT_ID)) continue;
+    uint32_t bit_len = fields[i].len_in_bits;
+    uint32_t u32;
+    if (!read_bits(report, report_len,
+          fields[i].offset_byte * 8 + fields[i].offset_bit, bit_len, &u32)) {
+      printf("usage %"PRIu32" not in report\n", usage);
+      continue;
+    }
+    int32_t i32 = sign_extend(u32, bit_len);
+    printf("usage %"PRIu32" u32 %"PRIu32", i32 %"PRIi32"\n", usage, u32, i32);
+    switch (usage) {
       case USAGE_X:
         mouse_values->x = i32;
         break;
@@ -584,51 +723,541 @@ void extract_mouse_values(const uint8_t *report, mouse_values_t *mouse_values) {
       case USAGE_BUTTON:
         mouse_values->buttons = u32;
         break;
-      case USAGE_REPORT_ID:
-        mouse_values->report_id = u32;
+    }
+  }
+}
+
+void extract_report_values(const hid_report_layout_t *layout,
+    const uint8_t *report, size_t report_len, mouse_values_t *mouse_values) {
+  mouse_values->report_id = 0;
+  mouse_values->x = 0;
+  mouse_values->y = 0;
+  mouse_values->wheel = 0;
+  mouse_values->pan = 0;
+  mouse_values->buttons = 0;
+  if (layout == NULL) return;
+  mouse_values->report_id = layout->report_id;
+  if ((layout->kernel == HID_KERNEL_BOOT) &&
+      (report_len >= HID_BOOT_MOUSE_REPORT_LEN)) {
+    mouse_values->buttons = report[0] & HID_BOOT_MOUSE_BUTTONS;
+    mouse_values->x = (int8_t)report[1];
+    mouse_values->y = (int8_t)report[2];
+    return;
+  }
+  if ((layout->kernel == HID_KERNEL_GENERIC) ||
+      (report_len < layout->min_report_len)) {
+    extract_generic(layout, report, report_len, mouse_values);
+    return;
+  }
+  mouse_values->buttons = report[layout->buttons_offset] & layout->buttons_mask;
+  if (layout->wheel_offset != HID_NO_FIELD) {
+    mouse_values->wheel = (int8_t)report[layout->wheel_offset];
+  }
+  const uint8_t *p = &report[layout->x_offset];
+  switch (layout->kernel) {
+    case HID_KERNEL_XY8:
+      mouse_values->x = (int8_t)p[0];
+      mouse_values->y = (int8_t)report[layout->y_offset];
+      break;
+    case HID_KERNEL_XY16:
+      mouse_values->x = (int16_t)UINT16(p);
+      mouse_values->y = (int16_t)UINT16(&report[layout->y_offset]);
+      break;
+    case HID_KERNEL_XY12:
+      mouse_values->x = sign_extend(p[0] | ((p[1] & 0x0F) << 8), 12);
+      mouse_values->y = sign_extend((p[1] >> 4) | (p[2] << 4), 12);
+      break;
+  }
+}
+
+void hid_layout_extract(const hid_layout_t *layout, const uint8_t *report,
+    size_t report_len, mouse_values_t *mouse_values) {
+  const hid_report_layout_t *report_layout;
+  if (layout->has_report_id) {
+    // The first byte is the report ID. Non-mouse reports have no layout.
+    report_layout = hid_layout_find_report(layout, report[0]);
+    if ((report_layout != NULL) && !report_layout->is_mouse) report_layout = NULL;
+  } else {
+    report_layout = hid_layout_first_mouse(layout);
+  }
+  extract_report_values(report_layout, report, report_len, mouse_values);
+}
+
+/*
+ * Batch decoding. Each loop reads one field at the same offset of every
+ * report and writes one output array, so the compiler can vectorize it.
+ * The values are the same as from extract_report_values().
+ */
+static void extract_generic_batch(const hid_report_layout_t *layout,
+    const uint8_t *reports, size_t stride, size_t report_len, size_t count,
+    mouse_values_batch_t *values) {
+  for (size_t f = 0; f < layout->field_count; f++) {
+    const field_t *field = &layout->fields[f];
+    int32_t *out;
+    switch (field->usage) {
+      case USAGE_X:
+        out = values->x;
         break;
+      case USAGE_Y:
+        out = values->y;
+        break;
+      case USAGE_WHEEL:
+        out = values->wheel;
+        break;
+      case USAGE_BUTTON:
+        out = (int32_t *)values->buttons;
+        break;
+      default:
+        continue;
     }
+    // Same checks as read_bits(). report_len is the same for every report.
+    uint32_t len_in_bits = field->len_in_bits;
+    uint32_t bit_offset = field->offset_byte * 8 + field->offset_bit;
+    if ((len_in_bits == 0) || (len_in_bits > 32) ||
+        (bit_offset + len_in_bits > report_len * 8)) {
+      continue;
+    }
+    const uint8_t *p = &reports[bit_offset / 8];
+    uint32_t shift = bit_offset % 8;
+    size_t bytes = (shift + len_in_bits + 7) / 8;
+    uint64_t mask = (1ULL << len_in_bits) - 1;
+    // Buttons are not sign extended.
+    uint32_t sign = (field->usage == USAGE_BUTTON) ? 0 : 32 - len_in_bits;
+    for (size_t i = 0; i < count; i++) {
+      const uint8_t *r = &p[i * stride];
+      uint64_t u64 = 0;
+      for (size_t b = 0; b < bytes; b++) u64 |= (uint64_t)r[b] << (8 * b);
+      uint32_t u32 = (uint32_t)((u64 >> shift) & mask);
+      out[i] = (int32_t)(u32 << sign) >> sign;
+    }
+  }
+}
+
+void extract_report_batch(const hid_report_layout_t *layout,
+    const uint8_t *reports, size_t stride, size_t report_len, size_t count,
+    mouse_values_batch_t *values) {
+  memset(values->buttons, 0, count * sizeof(values->buttons[0]));
+  memset(values->x, 0, count * sizeof(values->x[0]));
+  memset(values->y, 0, count * sizeof(values->y[0]));
+  memset(values->wheel, 0, count * sizeof(values->wheel[0]));
+  memset(values->pan, 0, count * sizeof(values->pan[0]));
+  memset(values->report_id, (layout == NULL) ? 0 : layout->report_id,
+      count * sizeof(values->report_id[0]));
+  if (layout == NULL) return;
+  uint32_t *buttons = values->buttons;
+  int32_t *x = values->x;
+  int32_t *y = values->y;
+  if ((layout->kernel == HID_KERNEL_BOOT) &&
+      (report_len >= HID_BOOT_MOUSE_REPORT_LEN)) {
+    for (size_t i = 0; i < count; i++) {
+      buttons[i] = reports[i * stride] & HID_BOOT_MOUSE_BUTTONS;
+    }
+    for (size_t i = 0; i < count; i++) x[i] = (int8_t)reports[i * stride + 1];
+    for (size_t i = 0; i < count; i++) y[i] = (int8_t)reports[i * stride + 2];
+    return;
+  }
+  if ((layout->kernel == HID_KERNEL_GENERIC) ||
+      (report_len < layout->min_report_len)) {
+    extract_generic_batch(layout, reports, stride, report_len, count, values);
+    return;
+  }
+  const uint8_t *b = &reports[layout->buttons_offset];
+  uint8_t mask = layout->buttons_mask;
+  for (size_t i = 0; i < count; i++) buttons[i] = b[i * stride] & mask;
+  if (layout->wheel_offset != HID_NO_FIELD) {
+    const uint8_t *w = &reports[layout->wheel_offset];
+    int32_t *wheel = values->wheel;
+    for (size_t i = 0; i < count; i++) wheel[i] = (int8_t)w[i * stride];
+  }
+  const uint8_t *px = &reports[layout->x_offset];
+  const uint8_t *py = &reports[layout->y_offset];
+  switch (layout->kernel) {
+    case HID_KERNEL_XY8:
+      for (size_t i = 0; i < count; i++) x[i] = (int8_t)px[i * stride];
+      for (size_t i = 0; i < count; i++) y[i] = (int8_t)py[i * stride];
+      break;
+    case HID_KERNEL_XY16:
+      for (size_t i = 0; i < count; i++) {
+        x[i] = (int16_t)UINT16(&px[i * stride]);
+      }
+      for (size_t i = 0; i < count; i++) {
+        y[i] = (int16_t)UINT16(&py[i * stride]);
+      }
+      break;
+    case HID_KERNEL_XY12:
+      for (size_t i = 0; i < count; i++) {
+        const uint8_t *p = &px[i * stride];
+        x[i] = sign_extend(p[0] | ((p[1] & 0x0F) << 8), 12);
+      }
+      for (size_t i = 0; i < count; i++) {
+        const uint8_t *p = &px[i * stride];
+        y[i] = sign_extend((p[1] >> 4) | (p[2] << 4), 12);
+      }
+      break;
   }
 }
 
+void hid_layout_extract_batch(const hid_layout_t *layout,
+    const uint8_t *reports, size_t stride, size_t count,
+    mouse_values_batch_t *values) {
+  if (!layout->has_report_id) {
+    extract_report_batch(hid_layout_first_mouse(layout), reports, stride,
+        stride, count, values);
+    return;
+  }
+  // Most devices have one mouse report. Decode every report with it, then
+  // clear the reports with other IDs so the loops stay vectorized.
+  const hid_report_layout_t *mouse = NULL;
+  size_t mice = 0;
+  for (size_t i = 0; i < layout->report_count; i++) {
+    if (layout->reports[i].is_mouse) {
+      mouse = &layout->reports[i];
+      mice++;
+    }
+  }
+  if (mice <= 1) {
+    extract_report_batch(mouse, reports, stride, stride, count, values);
+    if (mouse == NULL) return;
+    for (size_t i = 0; i < count; i++) {
+      uint32_t keep = -(uint32_t)(reports[i * stride] == mouse->report_id);
+      values->buttons[i] &= keep;
+      values->x[i] &= keep;
+      values->y[i] &= keep;
+      values->wheel[i] &= keep;
+      values->pan[i] &= keep;
+      values->report_id[i] &= keep;
+    }
+    return;
+  }
+  size_t start = 0;
+  while (start < count) {
+    uint8_t report_id = reports[start * stride];
+    size_t end = start + 1;
+    while ((end < count) && (reports[end * stride] == report_id)) end++;
+    // Non-mouse reports have no layout.
+    const hid_report_layout_t *report_layout =
+      hid_layout_find_report(layout, report_id);
+    if ((report_layout != NULL) && !report_layout->is_mouse) report_layout = NULL;
+    mouse_values_batch_t run = {
+      &values->buttons[start], &values->x[start], &values->y[start],
+      &values->wheel[start], &values->pan[start], &values->report_id[start],
+    };
+    extract_report_batch(report_layout, &reports[start * stride], stride,
+        stride, end - start, &run);
+    start = end;
+  }
+}
+
+/*
+ * The functions below keep the original single device API. They use one
+ * static layout so they are not reentrant.
+ */
+static hid_layout_t Default_Layout;
+
+void parse_hid_report_descriptor(const uint8_t *report_desc, size_t desc_len,
+    bool report_id) {
+  if ((report_desc == NULL) || (desc_len == 0)) return;
+  hid_layout_parse(&Default_Layout, report_desc, desc_len, report_id);
+}
+
+const hid_report_layout_t *find_report_layout(uint8_t report_id) {
+  return hid_layout_find_report(&Default_Layout, report_id);
+}
+
+const hid_report_layout_t *first_mouse_report_layout(void) {
+  return hid_layout_first_mouse(&Default_Layout);
+}
+
+void extract_mouse_values(const uint8_t *report, mouse_values_t *mouse_values) {
+  // The report length is not known so trust the descriptor.
+  size_t report_len = 0;
+  for (size_t i = 0; i < Default_Layout.report_count; i++) {
+    size_t len = (Default_Layout.reports[i].total_bits + 7) / 8;
+    if (len > report_len) report_len = len;
+  }
+  hid_layout_extract(&Default_Layout, report, report_len, mouse_values);
+}
+
 #if DEBUG_HID_MAIN
-#include "./hid_desc.h"
-#include "./perixx.h"
-#include "./black_trackpad.h"
-#include "./jellycomb.h"
-#include "./microsoft_ble_mouse.h"
-#include "./trackball_ble.h"
-#include "./clicker_1_button.h"
-#include "./clicker_6_button.h"
+/*
+ * Host regression test and benchmark. Build and run on Linux with
+ *   gcc -O2 -pthread -DDEBUG_HID_MAIN=1 -o hid_test report_desc.c && ./hid_test
+ * Checks the decoded values of every report in hid_corpus.h and the boot
+ * protocol kernel, and that batch decoding gives the same values as one
+ * report at a time. PARSE_THREADS threads then parse every descriptor at
+ * once and each layout must be byte for byte the one parsed by a single
+ * thread. Build with -fsanitize=thread to also check the parser shares no
+ * state between threads. Then prints parse time per descriptor and extraction
+ * throughput per device, and reports per second one at a time against
+ * in batches of BATCH_REPORTS. The boot protocol row has no descriptor to
+ * parse. Exit status is the number of failures.
+ */
+#undef printf
+#include <pthread.h>
+#include <stdlib.h>
+#include <time.h>
+#include "./hid_corpus.h"
+
+#define PARSE_LOOPS   (20000)
+#define PARSE_THREADS (8)
+#define PARSE_THREAD_LOOPS (200)
+#define EXTRACT_BATCH (64)
+#define EXTRACT_LOOPS (20000)
+#define BATCH_REPORTS (4096)
+#define BATCH_LOOPS   (500)
+
+static uint64_t nanos(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static int cmp_double(const void *a, const void *b) {
+  double x = *(const double *)a;
+  double y = *(const double *)b;
+  return (x > y) - (x < y);
+}
+
+static int check_device(const corpus_device_t *dev, const hid_layout_t *layout) {
+  int failures = 0;
+  const hid_report_layout_t *mouse = hid_layout_first_mouse(layout);
+  if ((mouse == NULL) || (mouse->kernel != dev->mouse_kernel)) {
+    printf("FAIL %s: kernel %d expected %u\n", dev->name,
+        (mouse == NULL) ? -1 : mouse->kernel, dev->mouse_kernel);
+    failures++;
+  }
+  for (size_t i = 0; i < dev->report_count; i++) {
+    const corpus_report_t *rpt = &dev->reports[i];
+    mouse_values_t m;
+    hid_layout_extract(layout, rpt->data, rpt->len, &m);
+    if ((m.buttons != rpt->expect.buttons) || (m.x != rpt->expect.x) ||
+        (m.y != rpt->expect.y) || (m.wheel != rpt->expect.wheel) ||
+        (m.pan != rpt->expect.pan) || (m.report_id != rpt->expect.report_id)) {
+      printf("FAIL %s report %zu: id %u buttons %"PRIx32" x %"PRIi32
+          " y %"PRIi32" wheel %"PRIi32" pan %"PRIi32"\n", dev->name, i,
+          m.report_id, m.buttons, m.x, m.y, m.wheel, m.pan);
+      failures++;
+    }
+  }
+  return failures;
+}
+
+static void bench_device(const corpus_device_t *dev, const hid_layout_t *layout) {
+  hid_layout_t scratch;
+  uint64_t start = nanos();
+  for (size_t i = 0; i < PARSE_LOOPS; i++) {
+    hid_layout_parse(&scratch, dev->desc, dev->desc_len, dev->report_id);
+  }
+  double parse_ns = (double)(nanos() - start) / PARSE_LOOPS;
+
+  // Time batches because one report takes less than the clock resolution.
+  static double batch_ns[EXTRACT_LOOPS];
+  volatile int32_t sink = 0;
+  size_t r = 0;
+  uint64_t total = 0;
+  for (size_t i = 0; i < EXTRACT_LOOPS; i++) {
+    start = nanos();
+    for (size_t j = 0; j < EXTRACT_BATCH; j++) {
+      const corpus_report_t *rpt = &dev->reports[r];
+      mouse_values_t m;
+      hid_layout_extract(layout, rpt->data, rpt->len, &m);
+      sink += m.x + m.y + m.buttons;
+      if (++r >= dev->report_count) r = 0;
+    }
+    uint64_t elapsed = nanos() - start;
+    total += elapsed;
+    batch_ns[i] = (double)elapsed / EXTRACT_BATCH;
+  }
+  qsort(batch_ns, EXTRACT_LOOPS, sizeof(batch_ns[0]), cmp_double);
+  double reports = (double)EXTRACT_LOOPS * EXTRACT_BATCH;
+  printf("%-20s %5zu %10.0f %12.0f %8.2f %8.2f %8.2f\n", dev->name,
+      dev->desc_len, parse_ns, reports * 1e9 / total, total / reports,
+      batch_ns[EXTRACT_LOOPS / 2], batch_ns[EXTRACT_LOOPS * 99 / 100]);
+}
+
+/*
+ * Copy the reports of dev, repeated, to a buffer with one report every
+ * stride bytes. stride is the longest report. Shorter reports are padded
+ * with 0s, which is what a device sending its longest report would send.
+ */
+static uint8_t Batch_Reports[BATCH_REPORTS * sizeof(((corpus_report_t *)0)->data)];
+static uint32_t Batch_Buttons[BATCH_REPORTS];
+static int32_t Batch_X[BATCH_REPORTS];
+static int32_t Batch_Y[BATCH_REPORTS];
+static int32_t Batch_Wheel[BATCH_REPORTS];
+static int32_t Batch_Pan[BATCH_REPORTS];
+static uint8_t Batch_Report_ID[BATCH_REPORTS];
+static mouse_values_batch_t Batch_Values = {
+  Batch_Buttons, Batch_X, Batch_Y, Batch_Wheel, Batch_Pan, Batch_Report_ID,
+};
+
+static size_t fill_batch(const corpus_device_t *dev) {
+  size_t stride = 0;
+  for (size_t i = 0; i < dev->report_count; i++) {
+    if (dev->reports[i].len > stride) stride = dev->reports[i].len;
+  }
+  for (size_t i = 0; i < BATCH_REPORTS; i++) {
+    memcpy(&Batch_Reports[i * stride], dev->reports[i % dev->report_count].data,
+        stride);
+  }
+  return stride;
+}
+
+static bool batch_matches(size_t i, const mouse_values_t *m) {
+  return (m->buttons == Batch_Buttons[i]) && (m->x == Batch_X[i]) &&
+    (m->y == Batch_Y[i]) && (m->wheel == Batch_Wheel[i]) &&
+    (m->pan == Batch_Pan[i]) && (m->report_id == Batch_Report_ID[i]);
+}
+
+static int check_batch(const corpus_device_t *dev, const hid_layout_t *layout) {
+  int failures = 0;
+  size_t stride = fill_batch(dev);
+  hid_layout_extract_batch(layout, Batch_Reports, stride, BATCH_REPORTS,
+      &Batch_Values);
+  for (size_t i = 0; i < BATCH_REPORTS; i++) {
+    mouse_values_t m;
+    hid_layout_extract(layout, &Batch_Reports[i * stride], stride, &m);
+    if (!batch_matches(i, &m)) {
+      printf("FAIL %s batch report %zu\n", dev->name, i);
+      failures++;
+      break;
+    }
+  }
+  // Short reports fall back to the generic kernel.
+  const hid_report_layout_t *mouse = hid_layout_first_mouse(layout);
+  for (size_t len = 0; len <= stride; len++) {
+    extract_report_batch(mouse, Batch_Reports, stride, len,
+        dev->report_count, &Batch_Values);
+    for (size_t i = 0; i < dev->report_count; i++) {
+      mouse_values_t m;
+      extract_report_values(mouse, &Batch_Reports[i * stride], len, &m);
+      if (!batch_matches(i, &m)) {
+        printf("FAIL %s batch report %zu length %zu\n", dev->name, i, len);
+        failures++;
+        len = stride;
+        break;
+      }
+    }
+  }
+  return failures;
+}
+
+static void bench_batch(const corpus_device_t *dev, const hid_layout_t *layout) {
+  size_t stride = fill_batch(dev);
+  volatile int32_t sink = 0;
+  uint64_t start = nanos();
+  for (size_t n = 0; n < BATCH_LOOPS; n++) {
+    for (size_t i = 0; i < BATCH_REPORTS; i++) {
+      mouse_values_t m;
+      hid_layout_extract(layout, &Batch_Reports[i * stride], stride, &m);
+      Batch_X[i] = m.x;
+    }
+    sink += Batch_X[n % BATCH_REPORTS];
+  }
+  uint64_t scalar = nanos() - start;
+  start = nanos();
+  for (size_t n = 0; n < BATCH_LOOPS; n++) {
+    hid_layout_extract_batch(layout, Batch_Reports, stride, BATCH_REPORTS,
+        &Batch_Values);
+    sink += Batch_X[n % BATCH_REPORTS];
+  }
+  uint64_t batch = nanos() - start;
+  double reports = (double)BATCH_LOOPS * BATCH_REPORTS;
+  printf("%-20s %6zu %14.0f %14.0f %8.2f\n", dev->name, stride,
+      reports * 1e9 / scalar, reports * 1e9 / batch, (double)scalar / batch);
+}
+
+#define CORPUS_COUNT (sizeof(HID_Corpus) / sizeof(HID_Corpus[0]))
+
+// Parsed by main() on one thread before the parse threads start.
+static hid_layout_t Layouts[CORPUS_COUNT];
+
+typedef struct {
+  uint32_t start;       // first descriptor, so threads start on different ones
+  uint32_t mismatches;
+} parse_thread_t;
+
+static void *parse_thread(void *arg) {
+  parse_thread_t *t = (parse_thread_t *)arg;
+  hid_layout_t layout;
+  for (uint32_t loop = 0; loop < PARSE_THREAD_LOOPS; loop++) {
+    for (size_t n = 0; n < CORPUS_COUNT; n++) {
+      size_t i = (t->start + n) % CORPUS_COUNT;
+      const corpus_device_t *dev = &HID_Corpus[i];
+      hid_layout_parse(&layout, dev->desc, dev->desc_len, dev->report_id);
+      if (memcmp(&layout, &Layouts[i], sizeof(layout)) != 0) t->mismatches++;
+    }
+  }
+  return NULL;
+}
+
+static int check_parallel_parse(void) {
+  pthread_t threads[PARSE_THREADS];
+  parse_thread_t state[PARSE_THREADS];
+  int failures = 0;
+  for (uint32_t i = 0; i < PARSE_THREADS; i++) {
+    state[i].start = i;
+    state[i].mismatches = 0;
+    if (pthread_create(&threads[i], NULL, parse_thread, &state[i]) != 0) {
+      printf("FAIL parse thread %u not started\n", i);
+      return 1;
+    }
+  }
+  for (uint32_t i = 0; i < PARSE_THREADS; i++) {
+    pthread_join(threads[i], NULL);
+    if (state[i].mismatches != 0) {
+      printf("FAIL parse thread %u: %u layouts differ from one thread\n", i,
+          state[i].mismatches);
+      failures++;
+    }
+  }
+  return failures;
+}
 
 int main(void) {
-  printf("## HID_Descriptor\n");
-  parse_hid_report_descriptor(HID_Descriptor, sizeof(HID_Descriptor), true);
-  printf("\n## Perixx 0\n");
-  parse_hid_report_descriptor(HID_Descriptor_Perixx_0,
-      sizeof(HID_Descriptor_Perixx_0), true);
-  printf("\n## Perixx 1\n");
-  parse_hid_report_descriptor(HID_Descriptor_Perixx_1,
-      sizeof(HID_Descriptor_Perixx_1), true);
-  printf("\n## Black Trackpad 1\n");
-  parse_hid_report_descriptor(black_trackpad_1, sizeof(black_trackpad_1), true);
-  printf("\n## Black Trackpad 2\n");
-  parse_hid_report_descriptor(black_trackpad_2, sizeof(black_trackpad_2), true);
-  printf("\n## Jelly Comb\n");
-  parse_hid_report_descriptor(jellycomb_ble, sizeof(jellycomb_ble), true);
-  printf("\n## Microsoft BLE mouse\n");
-  parse_hid_report_descriptor(microsoft_ble_mouse, sizeof(microsoft_ble_mouse), true);
-  printf("\n## Clicker 1 button\n");
-  parse_hid_report_descriptor(clicker_1_button, sizeof(clicker_1_button), true);
-  printf("\n## Clicker 6 button\n");
-  parse_hid_report_descriptor(clicker_6_button, sizeof(clicker_6_button), true);
-  printf("\n## Trackball BLE\n");
-  parse_hid_report_descriptor(trackball_ble, sizeof(trackball_ble), false);
-  mouse_values_t mouse_values;
-  uint8_t report[] = {0x1F, 0xFF, 0x01, 0x01, 0x80};
-  extract_mouse_values(report, &mouse_values);
-  printf("id %d, buttons %x, x %d, y %d\n", mouse_values.report_id,
-      mouse_values.buttons, mouse_values.x, mouse_values.y);
-  return 0;
+  const size_t count = CORPUS_COUNT;
+  hid_layout_t *layouts = Layouts;
+  int failures = 0;
+  for (size_t i = 0; i < count; i++) {
+    const corpus_device_t *dev = &HID_Corpus[i];
+    hid_layout_parse(&layouts[i], dev->desc, dev->desc_len, dev->report_id);
+    failures += check_device(dev, &layouts[i]);
+  }
+  // Boot protocol: the boot_mouse reports are boot reports. Only devices
+  // with 3 buttons and 8 bit X, Y may use it.
+  static const bool boot_ok[] = { true, false, false, false, true, false };
+  static hid_layout_t boot_layout;
+  hid_layout_boot_mouse(&boot_layout);
+  corpus_device_t boot = HID_Corpus[0];
+  boot.name = "boot protocol";
+  boot.desc = NULL;
+  boot.desc_len = 0;
+  boot.mouse_kernel = HID_KERNEL_BOOT;
+  failures += check_device(&boot, &boot_layout);
+  for (size_t i = 0; i < count; i++) {
+    if (hid_layout_boot_compatible(&layouts[i]) != boot_ok[i]) {
+      printf("FAIL %s: boot compatible %d\n", HID_Corpus[i].name, !boot_ok[i]);
+      failures++;
+    }
+  }
+  for (size_t i = 0; i < count; i++) {
+    failures += check_batch(&HID_Corpus[i], &layouts[i]);
+  }
+  failures += check_batch(&boot, &boot_layout);
+  failures += check_parallel_parse();
+  printf("%zu devices, %d failures\n\n", count, failures);
+  printf("%-20s %5s %10s %12s %8s %8s %8s\n", "device", "bytes",
+      "parse ns", "reports/s", "ns/rpt", "p50", "p99");
+  for (size_t i = 0; i < count; i++) {
+    bench_device(&HID_Corpus[i], &layouts[i]);
+  }
+  bench_device(&boot, &boot_layout);
+  printf("\n%-20s %6s %14s %14s %8s\n", "device", "stride",
+      "scalar rpt/s", "batch rpt/s", "speedup");
+  for (size_t i = 0; i < count; i++) {
+    bench_batch(&HID_Corpus[i], &layouts[i]);
+  }
+  bench_batch(&boot, &boot_layout);
+  return failures;
 }
 #endif
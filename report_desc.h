@@ -24,8 +24,12 @@
 
 #ifndef _REPORT_DESC_H_
 #define _REPORT_DESC_H_
+#ifndef DEBUG_HID_MAIN
 #define DEBUG_HID_MAIN 0
+#endif
+#ifndef USB_HID_DEBUG
 #define USB_HID_DEBUG 0
+#endif
 
 #include <stdint.h>
 #include <stddef.h>
@@ -40,9 +44,193 @@ typedef struct {
   uint8_t report_id;
 } mouse_values_t;
 
+#define HID_REPORT_FIELDS_MAX   (32)
+#define HID_REPORT_LAYOUTS_MAX  (8)
+
+// Extraction kernels chosen when the descriptor is parsed
+enum {
+  HID_KERNEL_GENERIC,   // bit reader, any layout
+  HID_KERNEL_XY8,       // byte aligned int8_t X, Y
+  HID_KERNEL_XY16,      // byte aligned int16_t X, Y
+  HID_KERNEL_XY12,      // X, Y packed as two 12 bit values in 3 bytes
+  HID_KERNEL_BOOT,      // boot protocol mouse report, 3 buttons, int8_t X, Y
+};
+
+// Boot protocol mouse report: buttons 1..3 in the low bits of byte 0, the
+// rest of the byte is device specific, then int8_t X and Y. Devices may
+// send more bytes after Y.
+#define HID_BOOT_MOUSE_REPORT_LEN (3)
+#define HID_BOOT_MOUSE_BUTTONS    (0x07)
+
+#define HID_NO_FIELD  (0xFF)
+
+typedef struct {
+  uint32_t usage;
+  uint8_t offset_byte;
+  uint8_t offset_bit;
+  uint8_t len_in_bits;
+  uint8_t filler;
+} field_t;
+
+/*
+ * Where the fields are in the input report with one report ID.
+ * app_usage is the usage page and usage of the application collection
+ * the report belongs to, for example 0x00010002 for a mouse.
+ */
+typedef struct {
+  field_t fields[HID_REPORT_FIELDS_MAX];
+  uint32_t field_count;
+  uint32_t total_bits;
+  uint32_t app_usage;
+  uint8_t report_id;
+  bool is_mouse;
+  // Used by the fast kernels. Byte offsets of the fields and the report
+  // length they need. Shorter reports use the generic bit reader.
+  uint8_t kernel;
+  uint8_t min_report_len;
+  uint8_t buttons_offset;
+  uint8_t buttons_mask;
+  uint8_t x_offset;
+  uint8_t y_offset;
+  uint8_t wheel_offset;
+} hid_report_layout_t;
+
+/*
+ * All input report layouts of one device. A layout is written only by the
+ * parser. After parsing it is not modified so it may be shared with
+ * extract functions running on another core or thread without locks.
+ * has_report_id is true if reports start with the report ID byte.
+ */
+typedef struct {
+  hid_report_layout_t reports[HID_REPORT_LAYOUTS_MAX];
+  uint32_t report_count;
+  bool has_report_id;
+} hid_layout_t;
+
+typedef union {
+  uint8_t u8;
+  int8_t i8;
+  uint16_t u16;
+  int16_t i16;
+  uint32_t u32;
+  int32_t i32;
+} ITEM_VALUE_t;
+
+typedef struct {
+  ITEM_VALUE_t value;
+  int8_t size;
+} ITEM_VALUE_TYPE_t;
+
+/*
+ * Parser state for one descriptor. Each thread parsing a descriptor uses
+ * its own context and output layout.
+ */
+typedef struct {
+  ITEM_VALUE_TYPE_t global_items[16];
+  ITEM_VALUE_TYPE_t local_items[16];
+  uint16_t usage_items[8];
+  uint32_t usage_item_count;
+  // Usage page and usage of the current application collection
+  uint32_t app_usage;
+  hid_layout_t *layout;
+} hid_parser_ctx_t;
+
+/*
+ * Prepare ctx to parse a descriptor into layout. report_id has the same
+ * meaning as for parse_hid_report_descriptor().
+ */
+void hid_parser_init(hid_parser_ctx_t *ctx, hid_layout_t *layout,
+    bool report_id);
+
+/*
+ * Parse a complete HID report descriptor into the layout given to
+ * hid_parser_init().
+ */
+void hid_parser_run(hid_parser_ctx_t *ctx, const uint8_t *report_desc,
+    size_t desc_len);
+
+/*
+ * Parse a HID report descriptor into layout using a context on the stack.
+ */
+void hid_layout_parse(hid_layout_t *layout, const uint8_t *report_desc,
+    size_t desc_len, bool report_id);
+
+/*
+ * Return the layout for report_id or NULL if there is none.
+ */
+const hid_report_layout_t *hid_layout_find_report(const hid_layout_t *layout,
+    uint8_t report_id);
+
 /*
- * Parse a HID report descriptor. This only saves information about
- * HID mouse devices.
+ * Return the first mouse report layout or NULL if there is none.
+ */
+const hid_report_layout_t *hid_layout_first_mouse(const hid_layout_t *layout);
+
+/*
+ * Fill layout with the fixed boot protocol mouse report. No descriptor is
+ * needed: the report uses HID_KERNEL_BOOT.
+ */
+void hid_layout_boot_mouse(hid_layout_t *layout);
+
+/*
+ * Return true if the first mouse report of layout loses nothing in boot
+ * protocol: at most 3 buttons and X, Y of at most 8 bits. Wheel and pan
+ * are not checked because the joystick has no axes for them.
+ */
+bool hid_layout_boot_compatible(const hid_layout_t *layout);
+
+/*
+ * Same as extract_mouse_values() but using the given device layout.
+ * report_len is the number of bytes in report.
+ */
+void hid_layout_extract(const hid_layout_t *layout, const uint8_t *report,
+    size_t report_len, mouse_values_t *mouse_values);
+
+/*
+ * Decoded values of a batch of reports, one array per value. Each array
+ * holds at least as many values as there are reports in the batch.
+ */
+typedef struct {
+  uint32_t *buttons;
+  int32_t *x;
+  int32_t *y;
+  int32_t *wheel;
+  int32_t *pan;
+  uint8_t *report_id;
+} mouse_values_batch_t;
+
+/*
+ * Decode count reports with the same report layout. Report i starts at
+ * reports + i * stride and has report_len bytes, report_len <= stride.
+ * Gives the same values as extract_report_values() on each report but
+ * decodes one field of every report per loop so the loops can be
+ * vectorized and nothing is printed.
+ */
+void extract_report_batch(const hid_report_layout_t *layout,
+    const uint8_t *reports, size_t stride, size_t report_len, size_t count,
+    mouse_values_batch_t *values);
+
+/*
+ * Same as hid_layout_extract() on count reports of stride bytes each,
+ * for example a capture of one device. With report IDs the reports are
+ * decoded with the mouse report layout and the others cleared. If the
+ * device has more than one mouse report, each run of reports with the
+ * same ID is decoded as one batch.
+ */
+void hid_layout_extract_batch(const hid_layout_t *layout,
+    const uint8_t *reports, size_t stride, size_t count,
+    mouse_values_batch_t *values);
+
+/*
+ * The functions below use one static layout shared by all callers. They are
+ * kept for single device programs. Use the hid_layout_t functions above when
+ * more than one layout is needed or when parsing on more than one thread.
+ */
+
+/*
+ * Parse a HID report descriptor. This saves one layout per input report ID.
+ * Only mouse fields (buttons, X, Y, wheel) are saved. Reports from other
+ * collections such as keyboard or consumer control are marked not mouse.
  * report_desc points to the descriptor bytes.
  * report_id if false, ignore the report ID field. Used for ESP32.
  * desc_len is the number of descriptor bytes.
@@ -50,6 +238,29 @@ typedef struct {
 void parse_hid_report_descriptor(const uint8_t *report_desc, size_t desc_len,
     bool report_id);
 
+/*
+ * Return the layout for report_id saved by the last
+ * parse_hid_report_descriptor() or NULL if there is none. Use report_id 0
+ * for descriptors without report IDs. Check is_mouse before using the
+ * layout to decode mouse reports.
+ */
+const hid_report_layout_t *find_report_layout(uint8_t report_id);
+
+/*
+ * Return the first mouse layout or NULL if the device has no mouse reports.
+ */
+const hid_report_layout_t *first_mouse_report_layout(void);
+
+/*
+ * Extract mouse parameters from a HID report using the given report layout.
+ * Use this when the caller knows which report it has, for example from the
+ * BLE Report Reference descriptor. If layout is NULL, all values are 0.
+ * report_len is the number of bytes in report. Fields that do not fit in
+ * report_len bytes are returned as 0.
+ */
+void extract_report_values(const hid_report_layout_t *layout,
+    const uint8_t *report, size_t report_len, mouse_values_t *mouse_values);
+
 /*
  * Extract mouse parameters from a HID report.
  *
@@ -59,6 +270,10 @@ void parse_hid_report_descriptor(const uint8_t *report_desc, size_t desc_len,
  *
  * report is the HID report sent via an interrupt endpoint
  * mouse_values are the extract mouse parameter values.
+ *
+ * If the descriptor was parsed with report_id true, the layout is chosen by
+ * the report ID in the first byte and non-mouse reports return all 0s.
+ * Otherwise the first mouse layout is used.
  */
 void extract_mouse_values(const uint8_t *report, mouse_values_t *mouse_values);
 
@@ -0,0 +1,164 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2023 touchgadgetdev@gmail.com
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <string.h>
+#include "./report_queue.h"
+
+// head and tail are free running counters. The entry index is the counter
+// modulo REPORT_QUEUE_SIZE. The producer publishes an entry with a release
+// store of head; the consumer frees it with a release store of tail.
+// Entries up to head_seen were published by an acquire load of head, so
+// the consumer can take them without loading head again. Likewise the
+// producer can fill entries up to tail_seen + REPORT_QUEUE_SIZE.
+#define QUEUE_MASK  (REPORT_QUEUE_SIZE - 1)
+
+#if (REPORT_QUEUE_SIZE & QUEUE_MASK) != 0
+#error REPORT_QUEUE_SIZE must be a power of 2
+#endif
+
+void report_queue_init(report_queue_t *q) {
+  memset(q, 0, sizeof(*q));
+}
+
+bool report_queue_push(report_queue_t *q, uint32_t timestamp_us,
+    uint8_t device, const hid_report_layout_t *layout, uint16_t handle,
+    const uint8_t *data, size_t len) {
+  uint32_t head = q->head;
+  if ((head - q->tail_seen) >= REPORT_QUEUE_SIZE) {
+    q->tail_seen = __atomic_load_n(&q->tail, __ATOMIC_ACQUIRE);
+    if ((head - q->tail_seen) >= REPORT_QUEUE_SIZE) {
+      q->dropped++;
+      return false;
+    }
+  }
+  if (len > REPORT_QUEUE_DATA_MAX) {
+    q->truncated++;
+    len = REPORT_QUEUE_DATA_MAX;
+  }
+  report_entry_t *entry = &q->entries[head & QUEUE_MASK];
+  entry->timestamp_us = timestamp_us;
+  entry->layout = layout;
+  entry->handle = handle;
+  entry->len = (uint8_t)len;
+  entry->device = device;
+  memcpy(entry->data, data, len);
+  __atomic_store_n(&q->head, head + 1, __ATOMIC_RELEASE);
+  return true;
+}
+
+const report_entry_t *report_queue_peek(report_queue_t *q) {
+  uint32_t tail = q->tail;
+  if (q->head_seen == tail) {
+    q->head_seen = __atomic_load_n(&q->head, __ATOMIC_ACQUIRE);
+    if (q->head_seen == tail) return NULL;
+    if ((q->head_seen - tail) > q->high_water) {
+      q->high_water = q->head_seen - tail;
+    }
+  }
+  return &q->entries[tail & QUEUE_MASK];
+}
+
+void report_queue_pop(report_queue_t *q) {
+  __atomic_store_n(&q->tail, q->tail + 1, __ATOMIC_RELEASE);
+}
+
+uint32_t report_queue_count(const report_queue_t *q) {
+  return __atomic_load_n(&q->head, __ATOMIC_ACQUIRE) -
+    __atomic_load_n(&q->tail, __ATOMIC_ACQUIRE);
+}
+
+#if DEBUG_REPORT_QUEUE_MAIN
+/*
+ * Two thread stress test. Build and run on Linux with
+ *   gcc -O2 -pthread -DDEBUG_REPORT_QUEUE_MAIN=1 -o queue_test report_queue.c
+ * The producer pushes numbered reports as fast as it can, retrying when the
+ * queue is full. The consumer checks every report it pops is the next
+ * number, so nothing is lost, duplicated or reordered. Then the overflow
+ * accounting is checked with the consumer stopped.
+ */
+#include <inttypes.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+
+#define STRESS_REPORTS  (2000000UL)
+
+static report_queue_t Queue;
+
+static void *producer(void *arg) {
+  (void)arg;
+  for (uint32_t seq = 0; seq < STRESS_REPORTS; seq++) {
+    uint8_t data[8];
+    for (size_t i = 0; i < sizeof(data); i++) data[i] = (uint8_t)(seq >> (i * 4));
+    while (!report_queue_push(&Queue, seq, (uint8_t)seq, NULL, (uint16_t)seq, data,
+          1 + (seq % sizeof(data)))) {
+      sched_yield();
+    }
+  }
+  return NULL;
+}
+
+int main(void) {
+  pthread_t thread;
+  uint32_t errors = 0;
+  uint32_t expect = 0;
+  report_queue_init(&Queue);
+  pthread_create(&thread, NULL, producer, NULL);
+  while (expect < STRESS_REPORTS) {
+    const report_entry_t *entry = report_queue_peek(&Queue);
+    if (entry == NULL) {
+      sched_yield();
+      continue;
+    }
+    if ((entry->timestamp_us != expect) || (entry->handle != (uint16_t)expect) ||
+        (entry->device != (uint8_t)expect) ||
+        (entry->len != 1 + (expect % 8))) {
+      errors++;
+    }
+    for (size_t i = 0; i < entry->len; i++) {
+      if (entry->data[i] != (uint8_t)(expect >> (i * 4))) errors++;
+    }
+    report_queue_pop(&Queue);
+    expect++;
+  }
+  pthread_join(thread, NULL);
+  uint32_t busy_drops = Queue.dropped;
+  if (report_queue_count(&Queue) != 0) errors++;
+
+  // Overflow: with nobody popping, exactly REPORT_QUEUE_SIZE reports fit.
+  uint8_t big[REPORT_QUEUE_DATA_MAX + 8] = {0};
+  for (size_t i = 0; i < REPORT_QUEUE_SIZE + 3; i++) {
+    bool ok = report_queue_push(&Queue, 0, 0, NULL, 0, big, sizeof(big));
+    if (ok != (i < REPORT_QUEUE_SIZE)) errors++;
+  }
+  if (Queue.dropped - busy_drops != 3) errors++;
+  if (Queue.truncated != REPORT_QUEUE_SIZE) errors++;
+  if (report_queue_peek(&Queue)->len != REPORT_QUEUE_DATA_MAX) errors++;
+
+  printf("reports %lu full retries %"PRIu32" high water %"PRIu32
+      " errors %"PRIu32"\n", STRESS_REPORTS, busy_drops, Queue.high_water,
+      errors);
+  return errors != 0;
+}
+#endif
@@ -0,0 +1,94 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2023 touchgadgetdev@gmail.com
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef _REPORT_QUEUE_H_
+#define _REPORT_QUEUE_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include "./report_desc.h"
+
+/*
+ * Bounded lock-free queue of HID reports from one producer (the BLE
+ * notification callback) to one consumer (the bridge loop). Neither side
+ * ever blocks. If the queue is full the new report is not queued and
+ * dropped is incremented.
+ */
+
+#define REPORT_QUEUE_SIZE       (32)    // must be a power of 2
+#define REPORT_QUEUE_DATA_MAX   (32)
+
+typedef struct {
+  uint32_t timestamp_us;
+  const hid_report_layout_t *layout;
+  uint16_t handle;
+  uint8_t len;
+  uint8_t device;       // index of the connected device that sent it
+  uint8_t data[REPORT_QUEUE_DATA_MAX];
+} report_entry_t;
+
+typedef struct {
+  // head is written only by the producer and tail only by the consumer.
+  // They are on separate cache lines. Each side keeps its last copy of the
+  // other's counter on its own line and reads the other line again only
+  // when the queue looks full or empty, so with the producer and consumer
+  // on different cores a report moves the lines once each way.
+  uint32_t head __attribute__((aligned(64)));
+  uint32_t tail_seen;   // producer's copy of tail
+  uint32_t dropped;     // reports lost because the queue was full
+  uint32_t truncated;   // reports longer than REPORT_QUEUE_DATA_MAX
+  uint32_t tail __attribute__((aligned(64)));
+  uint32_t head_seen;   // consumer's copy of head
+  uint32_t high_water;  // most entries seen queued by the consumer
+  report_entry_t entries[REPORT_QUEUE_SIZE] __attribute__((aligned(64)));
+} report_queue_t;
+
+void report_queue_init(report_queue_t *q);
+
+/*
+ * Producer only. Copy a report into the queue. Returns false if the queue
+ * is full.
+ */
+bool report_queue_push(report_queue_t *q, uint32_t timestamp_us,
+    uint8_t device, const hid_report_layout_t *layout, uint16_t handle,
+    const uint8_t *data, size_t len);
+
+/*
+ * Consumer only. Return the oldest entry or NULL if the queue is empty.
+ * The entry stays valid until report_queue_pop().
+ */
+const report_entry_t *report_queue_peek(report_queue_t *q);
+
+/*
+ * Consumer only. Remove the entry returned by report_queue_peek().
+ */
+void report_queue_pop(report_queue_t *q);
+
+/*
+ * Number of queued entries. Exact only when called by the consumer.
+ */
+uint32_t report_queue_count(const report_queue_t *q);
+
+#endif  /* _REPORT_QUEUE_H_ */
@@ -0,0 +1,369 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2023 touchgadgetdev@gmail.com
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <string.h>
+#include "./scan_policy.h"
+
+static void params_for(scan_policy_state_t state, scan_params_t *params) {
+  switch (state) {
+    case SCAN_POLICY_BURST:
+      *params = (scan_params_t){ SCAN_POLICY_BURST_INTERVAL,
+        SCAN_POLICY_BURST_WINDOW, true };
+      break;
+    case SCAN_POLICY_SLOW:
+      *params = (scan_params_t){ SCAN_POLICY_SLOW_INTERVAL,
+        SCAN_POLICY_SLOW_WINDOW, false };
+      break;
+    default:
+      *params = (scan_params_t){ SCAN_POLICY_OPEN_INTERVAL,
+        SCAN_POLICY_OPEN_WINDOW, false };
+      break;
+  }
+}
+
+static int expected_index(const scan_policy_t *p, const uint8_t address[6]) {
+  for (uint32_t i = 0; i < p->expected_count; i++) {
+    if (memcmp(address, p->expected[i], sizeof(p->expected[i])) == 0) return i;
+  }
+  return -1;
+}
+
+static void forget(scan_policy_t *p, int i) {
+  p->expected_count--;
+  memmove(p->expected[i], p->expected[i + 1],
+      (p->expected_count - i) * sizeof(p->expected[0]));
+  memmove(&p->lost_us[i], &p->lost_us[i + 1],
+      (p->expected_count - i) * sizeof(p->lost_us[0]));
+}
+
+void scan_policy_init(scan_policy_t *p) {
+  memset(p, 0, sizeof(*p));
+  p->state = SCAN_POLICY_IDLE;
+}
+
+void scan_policy_lost(scan_policy_t *p, uint32_t now_us,
+    const uint8_t address[6]) {
+  int i = expected_index(p, address);
+  if (i >= 0) forget(p, i);
+  if (p->expected_count == SCAN_POLICY_EXPECTED_MAX) forget(p, 0);
+  memcpy(p->expected[p->expected_count], address, sizeof(p->expected[0]));
+  p->lost_us[p->expected_count++] = now_us;
+}
+
+void scan_policy_start(scan_policy_t *p, uint32_t now_us, bool bonds,
+    scan_params_t *params) {
+  p->state = bonds ? SCAN_POLICY_BURST : SCAN_POLICY_OPEN;
+  p->start_us = now_us;
+  p->holding = false;
+  p->stats.scans++;
+  params_for(p->state, params);
+}
+
+static scan_decision_t found(scan_policy_t *p) {
+  p->stats.found[p->state]++;
+  p->holding = false;
+  return SCAN_CONNECT;
+}
+
+scan_decision_t scan_policy_result(scan_policy_t *p, uint32_t now_us,
+    const uint8_t address[6], bool bonded) {
+  if (p->state == SCAN_POLICY_IDLE) return SCAN_IGNORE;
+  if ((p->state == SCAN_POLICY_BURST) && !bonded) return SCAN_IGNORE;
+  if (p->expected_count == 0) return found(p);
+  int i = expected_index(p, address);
+  if (i >= 0) {
+    if (p->holding) p->stats.preferred++;
+    p->stats.lost_us = now_us - p->lost_us[i];
+    forget(p, i);
+    return found(p);
+  }
+  if (p->holding) return SCAN_IGNORE;
+  memcpy(p->held, address, sizeof(p->held));
+  p->holding = true;
+  p->held_us = now_us;
+  p->stats.held++;
+  return SCAN_HOLD;
+}
+
+scan_tick_t scan_policy_tick(scan_policy_t *p, uint32_t now_us,
+    scan_params_t *params, uint8_t address[6]) {
+  if (p->state == SCAN_POLICY_IDLE) return SCAN_TICK_NONE;
+  if (p->holding && ((now_us - p->held_us) >= SCAN_POLICY_HOLD_US)) {
+    memcpy(address, p->held, sizeof(p->held));
+    found(p);
+    return SCAN_TICK_CONNECT_HELD;
+  }
+  uint32_t scanning = now_us - p->start_us;
+  scan_policy_state_t state = p->state;
+  if ((state == SCAN_POLICY_BURST) && (scanning >= SCAN_POLICY_BURST_US)) {
+    state = SCAN_POLICY_OPEN;
+  }
+  if ((state == SCAN_POLICY_OPEN) && (scanning >= SCAN_POLICY_OPEN_US)) {
+    state = SCAN_POLICY_SLOW;
+  }
+  if (state == p->state) return SCAN_TICK_NONE;
+  p->state = state;
+  p->stats.scans++;
+  params_for(state, params);
+  return SCAN_TICK_RESTART;
+}
+
+void scan_policy_stop(scan_policy_t *p) {
+  p->state = SCAN_POLICY_IDLE;
+  p->holding = false;
+}
+
+const char *scan_policy_state_name(scan_policy_state_t state) {
+  switch (state) {
+    case SCAN_POLICY_IDLE: return "idle";
+    case SCAN_POLICY_BURST: return "burst";
+    case SCAN_POLICY_OPEN: return "open";
+    case SCAN_POLICY_SLOW: return "slow";
+  }
+  return "?";
+}
+
+#if DEBUG_SCAN_POLICY_MAIN
+/*
+ * Scan and reconnect test against simulated advertisers in virtual time.
+ * Build and run on Linux with
+ *   gcc -O2 -DDEBUG_SCAN_POLICY_MAIN=1 -o scan_policy_test scan_policy.c
+ * Each advertiser starts at a given time and advertises every interval
+ * plus a random 0..10 ms delay, as BLE advertisers do. It is heard if the
+ * event falls inside a scan window and the accept list, if used, lets it
+ * through. Each device is reported once per scan, like the controller's
+ * duplicate filter. The scenarios check which device is connected and
+ * when, and the duty cycle of each state. The last part compares the time
+ * to find a returning mouse with the open 22/11 ms scan used before.
+ */
+#include <inttypes.h>
+#include <stdio.h>
+
+#define NEVER   (UINT32_MAX)
+#define ADV_MAX (4)
+
+typedef struct {
+  uint8_t address[6];
+  bool bonded;
+  uint32_t interval_ms;
+  uint32_t start_ms;
+  // Run state
+  uint32_t next_ms;
+  bool reported;
+} adv_t;
+
+typedef struct {
+  int connected;            // advertiser index, -1 if none
+  uint32_t found_ms;
+  double duty[3];           // burst, open, slow time in window / time
+} result_t;
+
+static uint32_t Seed = 12345;
+
+static uint32_t rnd(uint32_t n) {
+  Seed = Seed * 1103515245 + 12345;
+  return (Seed >> 8) % n;
+}
+
+// Scan from time 0 to end_ms or until a device is connected. The devices
+// in lost disconnected just before, the last one last.
+static result_t run(scan_policy_t *p, adv_t *adv, int n, bool bonds,
+    const uint8_t (*lost)[6], int lost_count, uint32_t end_ms) {
+  result_t r = { -1, NEVER, { 0, 0, 0 } };
+  uint32_t in_window[3] = { 0, 0, 0 };
+  uint32_t in_state[3] = { 0, 0, 0 };
+  scan_params_t params;
+  uint8_t address[6];
+  scan_policy_init(p);
+  // Real time does not start at 0
+  const uint32_t base_us = 123456789;
+  for (int i = 0; i < lost_count; i++) scan_policy_lost(p, base_us, lost[i]);
+  scan_policy_start(p, base_us, bonds, &params);
+  uint32_t scan_ms = 0;
+  for (int i = 0; i < n; i++) {
+    adv[i].next_ms = adv[i].start_ms + rnd(adv[i].interval_ms);
+    adv[i].reported = false;
+  }
+  for (uint32_t t = 0; t < end_ms; t++) {
+    uint32_t now_us = base_us + t * 1000;
+    bool listening = ((t - scan_ms) % params.interval) < params.window;
+    int s = p->state - SCAN_POLICY_BURST;
+    in_state[s]++;
+    if (listening) in_window[s]++;
+    for (int i = 0; i < n; i++) {
+      if (t != adv[i].next_ms) continue;
+      adv[i].next_ms += adv[i].interval_ms + rnd(11);
+      if (!listening || adv[i].reported) continue;
+      if (params.allowlist && !adv[i].bonded) continue;
+      adv[i].reported = true;
+      if (scan_policy_result(p, now_us, adv[i].address, adv[i].bonded) ==
+          SCAN_CONNECT) {
+        r.connected = i;
+        r.found_ms = t;
+      }
+    }
+    if ((r.connected < 0) && ((t % (SCAN_POLICY_TICK_US / 1000)) == 0)) {
+      switch (scan_policy_tick(p, now_us, &params, address)) {
+        case SCAN_TICK_RESTART:
+          scan_ms = t;
+          for (int i = 0; i < n; i++) adv[i].reported = false;
+          break;
+        case SCAN_TICK_CONNECT_HELD:
+          for (int i = 0; i < n; i++) {
+            if (memcmp(address, adv[i].address, 6) == 0) r.connected = i;
+          }
+          r.found_ms = t;
+          break;
+        default:
+          break;
+      }
+    }
+    if (r.connected >= 0) break;
+  }
+  for (int s = 0; s < 3; s++) {
+    r.duty[s] = in_state[s] ? (double)in_window[s] / in_state[s] : 0;
+  }
+  scan_policy_stop(p);
+  return r;
+}
+
+static int expect(const char *name, const result_t *r, int connected,
+    uint32_t min_ms, uint32_t max_ms) {
+  bool ok = (r->connected == connected) && (r->found_ms >= min_ms) &&
+    (r->found_ms <= max_ms);
+  printf("%-32s connected %2d at %6"PRIu32" ms %s\n", name, r->connected,
+      (r->connected < 0) ? 0 : r->found_ms, ok ? "OK" : "FAIL");
+  return ok ? 0 : 1;
+}
+
+int main(void) {
+  int errors = 0;
+  scan_policy_t p;
+  result_t r;
+  const uint8_t last[6] = { 1, 1, 1, 1, 1, 1 };
+  const uint8_t both[2][6] = { { 2, 2, 2, 2, 2, 2 }, { 1, 1, 1, 1, 1, 1 } };
+  adv_t mouse = { .address = { 1, 1, 1, 1, 1, 1 }, .bonded = true,
+    .interval_ms = 30 };
+  adv_t other = { .address = { 2, 2, 2, 2, 2, 2 }, .bonded = true,
+    .interval_ms = 30 };
+  adv_t stranger = { .address = { 3, 3, 3, 3, 3, 3 }, .bonded = false,
+    .interval_ms = 100 };
+  adv_t advs[ADV_MAX];
+
+  // Last used mouse wakes up after 300 ms. A stranger advertising from
+  // the start is not on the accept list.
+  advs[0] = stranger;
+  advs[1] = mouse;
+  advs[1].start_ms = 300;
+  r = run(&p, advs, 2, true, &last, 1, 60000);
+  errors += expect("expected device back", &r, 1, 300, 300 + 30 + 10);
+  if (p.stats.found[SCAN_POLICY_BURST] != 1) errors++;
+  if (p.stats.lost_us != r.found_ms * 1000) errors++;
+
+  // Another bonded device is held while the expected one may return.
+  advs[0] = other;
+  advs[0].start_ms = 1000;
+  r = run(&p, advs, 1, true, &last, 1, 60000);
+  errors += expect("other bonded device held", &r, 0,
+      1000 + SCAN_POLICY_HOLD_US / 1000,
+      1000 + 40 + SCAN_POLICY_HOLD_US / 1000 + SCAN_POLICY_TICK_US / 1000);
+  if (p.stats.held != 1) errors++;
+
+  // The expected device wins over one seen first.
+  advs[0] = other;
+  advs[0].start_ms = 100;
+  advs[1] = mouse;
+  advs[1].start_ms = 400;
+  r = run(&p, advs, 2, true, &last, 1, 60000);
+  errors += expect("expected preferred over held", &r, 1, 400, 440);
+  if (p.stats.preferred != 1) errors++;
+
+  // Two devices lost together. Both are expected, neither is held.
+  advs[0] = other;
+  advs[0].start_ms = 100;
+  r = run(&p, advs, 1, true, both, 2, 60000);
+  errors += expect("second expected device", &r, 0, 100, 140);
+  if ((p.stats.held != 0) || (p.expected_count != 1)) errors++;
+
+  // A stranger is only heard after the burst, then held.
+  advs[0] = stranger;
+  r = run(&p, advs, 1, true, &last, 1, 60000);
+  errors += expect("stranger after burst", &r, 0,
+      SCAN_POLICY_BURST_US / 1000 + SCAN_POLICY_HOLD_US / 1000,
+      SCAN_POLICY_BURST_US / 1000 + SCAN_POLICY_HOLD_US / 1000 + 1000);
+
+  // No bonds, nothing expected: the first HID device is connected.
+  advs[0] = stranger;
+  r = run(&p, advs, 1, false, NULL, 0, 60000);
+  errors += expect("no bonds, first device", &r, 0, 0, 500);
+  if (p.stats.found[SCAN_POLICY_OPEN] != 1) errors++;
+
+  // Expected device back after the scan slowed down.
+  advs[0] = mouse;
+  advs[0].start_ms = 40000;
+  r = run(&p, advs, 1, true, &last, 1, 60000);
+  errors += expect("expected device back late", &r, 0, 40000, 42000);
+  if (p.stats.found[SCAN_POLICY_SLOW] != 1) errors++;
+
+  // Duty cycle of each state with nothing to find.
+  r = run(&p, advs, 0, true, &last, 1, 60000);
+  printf("duty burst %.0f%% open %.0f%% slow %.1f%%\n", r.duty[0] * 100,
+      r.duty[1] * 100, r.duty[2] * 100);
+  if ((r.duty[0] < 0.99) || (r.duty[1] < 0.45) || (r.duty[1] > 0.55) ||
+      (r.duty[2] > 0.1)) {
+    errors++;
+  }
+
+  // Time to find the returning mouse, burst versus the open scan used
+  // before, over random wake up times.
+  const uint32_t intervals[] = { 20, 50, 100 };
+  for (size_t k = 0; k < sizeof(intervals) / sizeof(intervals[0]); k++) {
+    uint64_t sum[2] = { 0, 0 };
+    uint32_t max[2] = { 0, 0 };
+    const int trials = 1000;
+    for (int i = 0; i < trials; i++) {
+      uint32_t wake = rnd(2000);
+      for (int burst = 0; burst < 2; burst++) {
+        advs[0] = mouse;
+        advs[0].interval_ms = intervals[k];
+        advs[0].start_ms = wake;
+        uint32_t seed = Seed;
+        r = run(&p, advs, 1, burst, &last, burst, 60000);
+        Seed = seed;
+        uint32_t ms = r.found_ms - wake;
+        sum[burst] += ms;
+        if (ms > max[burst]) max[burst] = ms;
+      }
+      rnd(1);
+    }
+    printf("adv interval %3"PRIu32" ms to found: open mean %5.1f max %3"PRIu32
+        " ms, burst mean %5.1f max %3"PRIu32" ms\n", intervals[k],
+        (double)sum[0] / trials, max[0], (double)sum[1] / trials, max[1]);
+    if (sum[1] > sum[0]) errors++;
+  }
+
+  printf("errors %d\n", errors);
+  return errors;
+}
+#endif
@@ -0,0 +1,148 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2023 touchgadgetdev@gmail.com
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef _SCAN_POLICY_H_
+#define _SCAN_POLICY_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+/*
+ * Scan policy for finding devices to connect. Bonded devices are on the
+ * controller's filter accept list. When there are bonds, scanning starts
+ * with a burst that only reports them, with window equal to interval (100%
+ * duty) so the first advertisement of a device waking up is heard. After
+ * SCAN_POLICY_BURST_US it scans for any HID device at 50% duty so new
+ * devices can be paired, and after SCAN_POLICY_OPEN_US at a low duty cycle
+ * so the radio is mostly free for the devices already connected.
+ *
+ * Devices that disconnected are expected back and preferred. Any other
+ * device seen while one is expected is held for SCAN_POLICY_HOLD_US. If an
+ * expected device advertises meanwhile it is connected instead, otherwise
+ * the held device is connected. Without an expected device the first HID
+ * device seen is connected, as before.
+ *
+ * The policy does no I/O. Addresses are 6 bytes as in ble_addr_t.val.
+ * Scan interval and window are in ms as in NimBLEScan. Times are
+ * bridge_micros().
+ */
+
+#define SCAN_POLICY_BURST_US        (4000000)
+#define SCAN_POLICY_OPEN_US         (30000000)
+#define SCAN_POLICY_HOLD_US         (500000)
+// Devices expected back. The oldest is forgotten first.
+#define SCAN_POLICY_EXPECTED_MAX    (4)
+// Call scan_policy_tick() this often while scanning
+#define SCAN_POLICY_TICK_US         (100000)
+#define SCAN_POLICY_BURST_INTERVAL  (30)
+#define SCAN_POLICY_BURST_WINDOW    (30)
+#define SCAN_POLICY_OPEN_INTERVAL   (22)
+#define SCAN_POLICY_OPEN_WINDOW     (11)
+#define SCAN_POLICY_SLOW_INTERVAL   (320)
+#define SCAN_POLICY_SLOW_WINDOW     (30)
+
+typedef enum {
+  SCAN_POLICY_IDLE,           // not scanning
+  SCAN_POLICY_BURST,          // bonded devices only, 100% duty
+  SCAN_POLICY_OPEN,           // any device, 50% duty
+  SCAN_POLICY_SLOW,           // any device, low duty
+} scan_policy_state_t;
+
+typedef enum {
+  SCAN_IGNORE,                // not wanted, or already held
+  SCAN_HOLD,                  // keep the address, it may be connected later
+  SCAN_CONNECT,               // stop scanning and connect it
+} scan_decision_t;
+
+typedef enum {
+  SCAN_TICK_NONE,
+  SCAN_TICK_RESTART,          // restart the scan with new parameters
+  SCAN_TICK_CONNECT_HELD,     // stop scanning and connect the held device
+} scan_tick_t;
+
+typedef struct {
+  uint16_t interval;
+  uint16_t window;
+  bool allowlist;             // report only devices on the accept list
+} scan_params_t;
+
+typedef struct {
+  uint32_t scans;             // scans started, including restarts
+  uint32_t found[4];          // devices connected, by state
+  uint32_t held;              // devices held for the expected one
+  uint32_t preferred;         // expected device won over a held one
+  uint32_t lost_us;           // expected device lost to found, last one
+} scan_policy_stats_t;
+
+typedef struct {
+  scan_policy_state_t state;
+  uint32_t start_us;          // scan started
+  // Disconnected, not back yet. Newest last.
+  uint32_t expected_count;
+  uint8_t expected[SCAN_POLICY_EXPECTED_MAX][6];
+  uint32_t lost_us[SCAN_POLICY_EXPECTED_MAX];
+  bool holding;
+  uint8_t held[6];
+  uint32_t held_us;
+  scan_policy_stats_t stats;
+} scan_policy_t;
+
+void scan_policy_init(scan_policy_t *p);
+
+/*
+ * A device disconnected. It is expected back until it is connected again.
+ */
+void scan_policy_lost(scan_policy_t *p, uint32_t now_us,
+    const uint8_t address[6]);
+
+/*
+ * Start or restart scanning. bonds: the accept list is not empty. Fills
+ * params.
+ */
+void scan_policy_start(scan_policy_t *p, uint32_t now_us, bool bonds,
+    scan_params_t *params);
+
+/*
+ * A HID device advertised. bonded: it is on the accept list. A held device
+ * is connected from scan_policy_tick().
+ */
+scan_decision_t scan_policy_result(scan_policy_t *p, uint32_t now_us,
+    const uint8_t address[6], bool bonded);
+
+/*
+ * Call every SCAN_POLICY_TICK_US while scanning. Fills params for
+ * SCAN_TICK_RESTART and address for SCAN_TICK_CONNECT_HELD.
+ */
+scan_tick_t scan_policy_tick(scan_policy_t *p, uint32_t now_us,
+    scan_params_t *params, uint8_t address[6]);
+
+/*
+ * Scanning stopped, to connect a device or because no connection is free.
+ */
+void scan_policy_stop(scan_policy_t *p);
+
+const char *scan_policy_state_name(scan_policy_state_t state);
+
+#endif  /* _SCAN_POLICY_H_ */
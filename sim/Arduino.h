@@ -0,0 +1,92 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2023 touchgadgetdev@gmail.com
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef _SIM_ARDUINO_H_
+#define _SIM_ARDUINO_H_
+
+/*
+ * The parts of the Arduino ESP32 core and FreeRTOS used by blemouse2xac.ino,
+ * for the Linux host simulation. Time is the host monotonic clock.
+ */
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+#include <limits.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <string>
+
+extern "C" {
+#include "../bridge_os.h"
+#include "../nv_store.h"
+
+// NVS is replaced by the file store in Sim_Store_Dir. No store if NULL.
+bool nv_store_nvs_init(nv_store_t *store, const char *name_space);
+}
+extern const char *Sim_Store_Dir;
+
+#define HEX 16
+
+static inline uint32_t micros() { return bridge_micros(); }
+static inline uint32_t millis() { return bridge_micros() / 1000; }
+static inline void delay(uint32_t ms) { usleep(ms * 1000); }
+
+class HardwareSerial {
+ public:
+  void begin(unsigned long baud) { (void)baud; }
+  void end() {}
+  operator bool() const { return true; }
+  template <typename... Args> void printf(const char *fmt, Args... args) {
+    ::printf(fmt, args...);
+  }
+  void print(const char *s) { fputs(s, stdout); }
+  void print(char c) { putchar(c); }
+  void print(unsigned long v, int base = 10) {
+    ::printf((base == HEX) ? "%lX" : "%lu", v);
+  }
+  void println() { putchar('\n'); }
+  void println(const char *s) { puts(s); }
+  void println(unsigned long v) { ::printf("%lu\n", v); }
+  size_t write(const uint8_t *data, size_t len) {
+    return fwrite(data, 1, len, stdout);
+  }
+};
+extern HardwareSerial Serial;
+
+// FreeRTOS binary semaphore. Ticks are milliseconds.
+typedef struct sim_semaphore *SemaphoreHandle_t;
+typedef uint32_t TickType_t;
+#define pdTRUE            (1)
+#define pdFALSE           (0)
+#define pdMS_TO_TICKS(ms) ((TickType_t)(ms))
+#define portMAX_DELAY     (UINT32_MAX)
+
+SemaphoreHandle_t xSemaphoreCreateBinary();
+int xSemaphoreGive(SemaphoreHandle_t sem);
+int xSemaphoreTake(SemaphoreHandle_t sem, TickType_t ticks);
+void vTaskDelete(void *task);
+
+#endif  /* _SIM_ARDUINO_H_ */
@@ -0,0 +1,43 @@
+#ifndef _SIM_ESP32_FLIGHT_STICK_H_
+#define _SIM_ESP32_FLIGHT_STICK_H_
+
+/*
+ * Host simulation stand in for https://github.com/esp32beans/ESP32_flight_stick.
+ * Every write is appended to a log with its time instead of going to USB.
+ */
+
+#include <stdint.h>
+#include <stddef.h>
+
+typedef struct __attribute__((packed)) {
+  uint32_t x : 10;      // 0..1023
+  uint32_t y : 10;      // 0..1023
+  uint32_t hat : 4;
+  uint32_t twist : 8;   // 0..255
+  uint8_t buttons_a;
+  uint8_t slider;       // 0..255
+  uint8_t buttons_b;
+} FSJoystick_Report_t;
+
+typedef struct {
+  uint32_t timestamp_us;
+  FSJoystick_Report_t report;
+} sim_joy_write_t;
+
+#define SIM_JOY_LOG_MAX (1 << 20)
+
+class ESP32_flight_stick {
+ public:
+  void begin() {}
+  bool write();
+  bool write(void *report, size_t len);
+
+  FSJoystick_Report_t report = {};
+  // Writes in order. Written only by the task calling write().
+  sim_joy_write_t *log = nullptr;
+  uint32_t log_count = 0;
+  uint32_t log_overflow = 0;
+  uint32_t busy_writes = 0;   // written before the host took the last one
+};
+
+#endif  /* _SIM_ESP32_FLIGHT_STICK_H_ */
@@ -0,0 +1,70 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2023 touchgadgetdev@gmail.com
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef _SIM_LITTLEFS_H_
+#define _SIM_LITTLEFS_H_
+
+/*
+ * The part of the Arduino ESP32 LittleFS library used by blemouse2xac.ino,
+ * for the Linux host simulation. Files are in the directory Sim_Fs_Dir.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string>
+
+extern const char *Sim_Fs_Dir;
+
+#define FILE_WRITE "w"
+
+class File {
+ public:
+  File(FILE *f = nullptr) : f_(f) {}
+  operator bool() const { return f_ != nullptr; }
+  size_t write(const uint8_t *data, size_t len) {
+    return f_ ? fwrite(data, 1, len, f_) : 0;
+  }
+  void flush() { if (f_) fflush(f_); }
+  void close() {
+    if (f_) fclose(f_);
+    f_ = nullptr;
+  }
+ private:
+  FILE *f_;
+};
+
+class SimLittleFS {
+ public:
+  // No file system if Sim_Fs_Dir is NULL.
+  bool begin(bool format_on_fail = false) {
+    (void)format_on_fail;
+    return Sim_Fs_Dir != nullptr;
+  }
+  File open(const char *path, const char *mode) {
+    return File(fopen((std::string(Sim_Fs_Dir) + path).c_str(), mode));
+  }
+};
+extern SimLittleFS LittleFS;
+
+#endif  /* _SIM_LITTLEFS_H_ */
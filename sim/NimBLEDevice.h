@@ -0,0 +1,345 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2023 touchgadgetdev@gmail.com
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef _SIM_NIMBLEDEVICE_H_
+#define _SIM_NIMBLEDEVICE_H_
+
+/*
+ * The subset of the NimBLE-Arduino client API used by blemouse2xac.ino,
+ * backed by the scripted peers in sim_ble.cpp. Calls that go over the air
+ * (connect, discovery, reads, writes) take sim_ble_config().att_rtt_us
+ * each so connect times can be compared.
+ */
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include <functional>
+
+#define NIMBLE_MAX_CONNECTIONS  (3)
+#define BLE_HS_CONN_HANDLE_NONE (0xFFFF)
+
+#define BLE_HCI_ADV_TYPE_ADV_IND            (0)
+#define BLE_HCI_ADV_TYPE_ADV_DIRECT_IND_HD  (1)
+#define BLE_HCI_ADV_TYPE_ADV_SCAN_IND       (2)
+#define BLE_HCI_ADV_TYPE_ADV_NONCONN_IND    (3)
+#define BLE_HCI_ADV_TYPE_ADV_DIRECT_IND_LD  (4)
+#define BLE_HCI_SCAN_FILT_NO_WL             (0)
+#define BLE_HCI_SCAN_FILT_USE_WL            (1)
+
+#define BLE_GAP_EVENT_CONN_UPDATE (3)
+#define BLE_GAP_EVENT_NOTIFY_RX (12)
+#define BLE_HS_ENOTCONN         (7)
+#define BLE_ERR_UNACCEPT_CONN_PARAMS  (0x23b)
+#define BLE_HS_ATT_ERR(x)       (0x100 + (x))
+
+typedef enum {
+  ESP_PWR_LVL_N12 = 0,
+  ESP_PWR_LVL_P9 = 7,
+} esp_power_level_t;
+
+struct os_mbuf {
+  const uint8_t *data;
+  uint16_t len;
+};
+
+struct ble_gap_event {
+  uint8_t type;
+  struct {
+    struct os_mbuf *om;
+    uint16_t attr_handle;
+    uint16_t conn_handle;
+    uint8_t indication;
+  } notify_rx;
+  struct {
+    int status;
+    uint16_t conn_handle;
+  } conn_update;
+};
+
+struct ble_gap_sec_state {
+  unsigned encrypted:1;
+  unsigned authenticated:1;
+  unsigned bonded:1;
+};
+
+struct ble_gap_conn_desc {
+  struct ble_gap_sec_state sec_state;
+  uint16_t conn_handle;
+  uint16_t conn_itvl;
+  uint16_t conn_latency;
+  uint16_t supervision_timeout;
+};
+
+struct ble_gap_upd_params {
+  uint16_t itvl_min;
+  uint16_t itvl_max;
+  uint16_t latency;
+  uint16_t supervision_timeout;
+  uint16_t min_ce_len;
+  uint16_t max_ce_len;
+};
+
+struct ble_gatt_error {
+  uint16_t status;
+  uint16_t att_handle;
+};
+
+struct ble_gatt_attr {
+  uint16_t handle;
+  uint16_t offset;
+  struct os_mbuf *om;
+};
+
+typedef int ble_gap_event_fn(struct ble_gap_event *event, void *arg);
+typedef int ble_gatt_attr_fn(uint16_t conn_handle,
+    const struct ble_gatt_error *error, struct ble_gatt_attr *attr, void *arg);
+
+int ble_gattc_write_flat(uint16_t conn_handle, uint16_t attr_handle,
+    const void *data, uint16_t data_len, ble_gatt_attr_fn *cb, void *cb_arg);
+int ble_hs_mbuf_to_flat(const struct os_mbuf *om, void *flat,
+    uint16_t max_len, uint16_t *out_copy_len);
+int ble_gap_conn_find(uint16_t handle, struct ble_gap_conn_desc *out_desc);
+
+class NimBLEUUID {
+ public:
+  NimBLEUUID() : uuid16(0) {}
+  NimBLEUUID(uint16_t uuid) : uuid16(uuid) {}
+  NimBLEUUID(const char *uuid) : uuid16((uint16_t)strtoul(uuid, nullptr, 16)) {}
+  bool operator==(const NimBLEUUID &rhs) const { return uuid16 == rhs.uuid16; }
+  bool operator!=(const NimBLEUUID &rhs) const { return uuid16 != rhs.uuid16; }
+  std::string toString() const;
+  uint16_t uuid16;
+};
+
+class NimBLEAddress {
+ public:
+  NimBLEAddress() { memset(addr, 0, sizeof(addr)); }
+  NimBLEAddress(const uint8_t address[6]) { memcpy(addr, address, sizeof(addr)); }
+  const uint8_t *getNative() const { return addr; }
+  std::string toString() const;
+  bool operator==(const NimBLEAddress &rhs) const {
+    return memcmp(addr, rhs.addr, sizeof(addr)) == 0;
+  }
+  bool operator!=(const NimBLEAddress &rhs) const { return !(*this == rhs); }
+  uint8_t addr[6];
+};
+
+class NimBLERemoteCharacteristic;
+class NimBLERemoteService;
+class NimBLEClient;
+
+typedef std::function<void(NimBLERemoteCharacteristic *pChr, uint8_t *pData,
+    size_t length, bool isNotify)> notify_callback;
+
+class NimBLERemoteDescriptor {
+ public:
+  NimBLERemoteDescriptor(NimBLEClient *client, NimBLEUUID uuid, uint16_t handle)
+    : m_client(client), m_uuid(uuid), m_handle(handle) {}
+  uint16_t getHandle() const { return m_handle; }
+  NimBLEUUID getUUID() const { return m_uuid; }
+  std::string readValue();
+ private:
+  NimBLEClient *m_client;
+  NimBLEUUID m_uuid;
+  uint16_t m_handle;
+};
+
+class NimBLERemoteCharacteristic {
+ public:
+  NimBLERemoteCharacteristic(NimBLERemoteService *service, NimBLEUUID uuid,
+      uint16_t handle, uint8_t props);
+  ~NimBLERemoteCharacteristic();
+  uint16_t getHandle() const { return m_handle; }
+  NimBLEUUID getUUID() const { return m_uuid; }
+  bool canRead() const;
+  bool canNotify() const;
+  bool canIndicate() const;
+  bool canWrite() const;
+  bool canWriteNoResponse() const;
+  std::string readValue();
+  bool writeValue(const uint8_t *data, size_t length, bool response = false);
+  NimBLERemoteDescriptor *getDescriptor(const NimBLEUUID &uuid);
+  bool subscribe(bool notifications = true, notify_callback cb = nullptr,
+      bool response = false);
+  bool unsubscribe(bool response = false);
+  std::string toString() const;
+  NimBLERemoteService *getRemoteService() const { return m_service; }
+  // Used by the simulated host to deliver notifications.
+  notify_callback m_notify_cb;
+ private:
+  NimBLERemoteService *m_service;
+  NimBLEClient *m_client;
+  NimBLEUUID m_uuid;
+  uint16_t m_handle;
+  uint8_t m_props;
+  std::vector<NimBLERemoteDescriptor *> m_descriptors;
+  bool m_discovered = false;
+};
+
+class NimBLERemoteService {
+ public:
+  NimBLERemoteService(NimBLEClient *client, NimBLEUUID uuid, uint16_t start,
+      uint16_t end) : m_client(client), m_uuid(uuid), m_start(start), m_end(end) {}
+  ~NimBLERemoteService();
+  NimBLERemoteCharacteristic *getCharacteristic(const NimBLEUUID &uuid);
+  std::vector<NimBLERemoteCharacteristic *> *getCharacteristics(bool refresh = false);
+  uint16_t getStartHandle() const { return m_start; }
+  uint16_t getEndHandle() const { return m_end; }
+  NimBLEUUID getUUID() const { return m_uuid; }
+  NimBLEClient *getClient() const { return m_client; }
+  std::string toString() const;
+  // Simulation. Does not discover.
+  NimBLERemoteCharacteristic *findCharacteristic(uint16_t handle);
+ private:
+  NimBLEClient *m_client;
+  NimBLEUUID m_uuid;
+  uint16_t m_start;
+  uint16_t m_end;
+  std::vector<NimBLERemoteCharacteristic *> m_characteristics;
+  bool m_discovered = false;
+};
+
+class NimBLEClientCallbacks {
+ public:
+  virtual ~NimBLEClientCallbacks() {}
+  virtual void onConnect(NimBLEClient *pClient) { (void)pClient; }
+  virtual void onDisconnect(NimBLEClient *pClient) { (void)pClient; }
+  virtual bool onConnParamsUpdateRequest(NimBLEClient *pClient,
+      const ble_gap_upd_params *params) { (void)pClient; (void)params; return true; }
+  virtual uint32_t onPassKeyRequest() { return 123456; }
+  virtual bool onConfirmPIN(uint32_t pin) { (void)pin; return true; }
+  virtual void onAuthenticationComplete(ble_gap_conn_desc *desc) { (void)desc; }
+};
+
+class NimBLEAdvertisedDevice {
+ public:
+  uint8_t getAdvType() const { return m_adv_type; }
+  bool haveServiceUUID() const { return !m_services.empty(); }
+  bool isAdvertisingService(const NimBLEUUID &uuid) const;
+  NimBLEAddress getAddress() const { return m_address; }
+  std::string toString() const;
+  NimBLEAddress m_address;
+  uint8_t m_adv_type = BLE_HCI_ADV_TYPE_ADV_IND;
+  std::vector<NimBLEUUID> m_services;
+  std::string m_name;
+};
+
+class NimBLEClient {
+ public:
+  bool connect(const NimBLEAddress &address, bool deleteAttributes = true);
+  bool disconnect(uint8_t reason = 0x13);
+  bool isConnected() const { return m_connected; }
+  NimBLEAddress getPeerAddress() const { return m_peer; }
+  uint16_t getConnId() const { return m_conn_id; }
+  uint16_t getMTU() const { return m_connected ? 247 : 0; }
+  int getRssi() const { return -50; }
+  void updateConnParams(uint16_t minInterval, uint16_t maxInterval,
+      uint16_t latency, uint16_t timeout);
+  void setConnectionParams(uint16_t minInterval, uint16_t maxInterval,
+      uint16_t latency, uint16_t timeout, uint16_t scanInterval = 16,
+      uint16_t scanWindow = 16);
+  void setConnectTimeout(uint32_t seconds) { (void)seconds; }
+  void setClientCallbacks(NimBLEClientCallbacks *callbacks,
+      bool deleteCallbacks = true) { (void)deleteCallbacks; m_callbacks = callbacks; }
+  NimBLERemoteService *getService(const NimBLEUUID &uuid);
+  bool secureConnection();
+  // Simulation
+  ~NimBLEClient();
+  void deleteServices();
+  void peerDisconnected();
+  NimBLERemoteCharacteristic *findCharacteristic(uint16_t handle);
+  NimBLEClientCallbacks *m_callbacks = nullptr;
+  NimBLEAddress m_peer;
+  uint16_t m_conn_id = BLE_HS_CONN_HANDLE_NONE;
+  bool m_connected = false;
+  // Connection interval in 1.25 ms units, timeout in 10 ms units
+  uint16_t m_interval = 12;
+  uint16_t m_latency = 0;
+  uint16_t m_timeout = 51;
+  // From setConnectionParams(), used by connect()
+  uint16_t m_connect_interval = 12;
+  uint16_t m_connect_latency = 0;
+  uint16_t m_connect_timeout = 51;
+ private:
+  std::vector<NimBLERemoteService *> m_services;
+};
+
+class NimBLEScanResults {
+};
+
+class NimBLEAdvertisedDeviceCallbacks {
+ public:
+  virtual ~NimBLEAdvertisedDeviceCallbacks() {}
+  virtual void onResult(NimBLEAdvertisedDevice *advertisedDevice) = 0;
+};
+
+class NimBLEScan {
+ public:
+  void setAdvertisedDeviceCallbacks(NimBLEAdvertisedDeviceCallbacks *callbacks,
+      bool wantDuplicates = false) { (void)wantDuplicates; m_callbacks = callbacks; }
+  void setInterval(uint16_t interval_ms) { m_interval_ms = interval_ms; }
+  void setWindow(uint16_t window_ms) { m_window_ms = window_ms; }
+  void setActiveScan(bool active) { (void)active; }
+  void setFilterPolicy(uint8_t filter) { m_filter_policy = filter; }
+  bool start(uint32_t duration, void (*scanCompleteCB)(NimBLEScanResults),
+      bool is_continue = false);
+  bool stop();
+  bool isScanning() const;
+  // Simulation
+  NimBLEAdvertisedDeviceCallbacks *m_callbacks = nullptr;
+  uint16_t m_interval_ms = 100;
+  uint16_t m_window_ms = 100;
+  uint8_t m_filter_policy = BLE_HCI_SCAN_FILT_NO_WL;
+};
+
+class NimBLEDevice {
+ public:
+  static void init(const std::string &deviceName) { (void)deviceName; }
+  static int setMTU(uint16_t mtu) { (void)mtu; return 0; }
+  static uint16_t getMTU() { return 247; }
+  static void setCustomGapHandler(ble_gap_event_fn *handler);
+  static void setSecurityAuth(bool bonding, bool mitm, bool sc) {
+    (void)bonding; (void)mitm; (void)sc;
+  }
+  static void setPower(esp_power_level_t power) { (void)power; }
+  static NimBLEScan *getScan();
+  static size_t getClientListSize();
+  static NimBLEClient *getClientByPeerAddress(const NimBLEAddress &address);
+  static NimBLEClient *getClientByID(uint16_t conn_id);
+  static NimBLEClient *getDisconnectedClient();
+  static NimBLEClient *createClient();
+  static bool deleteClient(NimBLEClient *client);
+  static bool isBonded(const NimBLEAddress &address);
+  static int getNumBonds();
+  static NimBLEAddress getBondedAddress(int index);
+  static void deleteAllBonds();
+  static bool whiteListAdd(const NimBLEAddress &address);
+  static bool onWhiteList(const NimBLEAddress &address);
+};
+
+#endif  /* _SIM_NIMBLEDEVICE_H_ */
@@ -0,0 +1,11 @@
+#ifndef _SIM_USB_H_
+#define _SIM_USB_H_
+
+// Host simulation stand in for the Arduino ESP32 USB class.
+class ESPUSB {
+ public:
+  bool begin() { return true; }
+};
+extern ESPUSB USB;
+
+#endif  /* _SIM_USB_H_ */
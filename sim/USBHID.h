@@ -0,0 +1,12 @@
+#ifndef _SIM_USBHID_H_
+#define _SIM_USBHID_H_
+
+// Host simulation stand in for the Arduino ESP32 USBHID class. The
+// endpoint is busy from a write until the host polls it at the next 1 ms
+// USB frame.
+class USBHID {
+ public:
+  bool ready();
+};
+
+#endif  /* _SIM_USBHID_H_ */
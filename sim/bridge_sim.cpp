@@ -0,0 +1,481 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2023 touchgadgetdev@gmail.com
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/*
+ * Host simulation of the whole bridge. blemouse2xac.ino is compiled
+ * unchanged against the fakes in this directory. The main thread plays the
+ * NimBLE host task and scripted peers from hid_corpus.h: each advertises
+ * while the bridge scans and waits for the bridge to subscribe. Then all
+ * peers send their device's reports at a fixed interval at the same time,
+ * one thread each. Every FSJoy.write() is printed with its time so runs can
+ * be compared, followed by the bridge latency histograms. The buttons still
+ * held at the end must be the OR of the last buttons of every peer.
+ *
+ * Build and run on Linux from the top directory with
+ *   gcc -O2 -c bridge.c bridge_os.c report_queue.c motion.c report_desc.c \
+ *     layout_cache.c gatt_cache.c nv_store.c latency_hist.c conn_policy.c \
+ *     curve.c usb_out.c scan_policy.c device_profile.c capture.c \
+ *     status_display.c
+ *   g++ -O2 -pthread -Isim -o bridge_sim sim/bridge_sim.cpp sim/sim_ble.cpp \
+ *     sim/sim_arduino.cpp bridge.o bridge_os.o report_queue.o motion.o \
+ *     report_desc.o layout_cache.o gatt_cache.o nv_store.o latency_hist.o \
+ *     conn_policy.o curve.o usb_out.o scan_policy.o device_profile.o \
+ *     capture.o status_display.o -lm
+ *   ./bridge_sim -d mouse_xy16 -n 1000 -i 7500
+ *   ./bridge_sim -d trackball_unaligned,clicker,clicker_6_button -q
+ *
+ * Every peer has a PnP ID, vendor 0xFFFF and product the corpus index + 1.
+ * boot_mouse matches the host test profile in device_profiles.h, which
+ * the firmware leaves out, and must connect without a report map read.
+ *
+ * Every peer with a mouse report supports boot protocol. With -p the bridge
+ * uses it and the peers send boot reports made from the expected values of
+ * their reports while in boot protocol.
+ *
+ * With -l the last peer connects halfway through the reports of the others,
+ * which must not lose reports or be held up: the total latency must stay
+ * below BRIDGE_IDLE_US.
+ *
+ * -t picks the task topology. With split the main and peer threads, which
+ * call the scan callback and notifyCB() like the NimBLE host, and the
+ * connect task are pinned to CPU 0 and the bridge task to CPU 1, if the
+ * host has them. Compare the latency and jitter lines of runs with
+ * -t shared and -t split, with -l to connect a peer while the others send.
+ */
+
+#include <getopt.h>
+#include <inttypes.h>
+#include <sys/stat.h>
+#include <algorithm>
+#include <thread>
+#include <vector>
+#include "Arduino.h"
+#include "../blemouse2xac.ino"
+#include "sim_ble.h"
+extern "C" {
+#include "../hid_corpus.h"
+}
+
+static uint64_t now_us(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static void sleep_until(uint64_t us) {
+  struct timespec ts = { (time_t)(us / 1000000), (long)(us % 1000000) * 1000 };
+  while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) != 0) {
+  }
+}
+
+// Wait up to timeout_ms for done() to return true.
+template <typename F> static bool wait_for(F done, uint32_t timeout_ms) {
+  uint64_t deadline = now_us() + (uint64_t)timeout_ms * 1000;
+  while (!done()) {
+    if (now_us() > deadline) return false;
+    usleep(100);
+  }
+  return true;
+}
+
+static void print_latency(const char *name, const latency_hist_t *h) {
+  latency_summary_t s;
+  latency_hist_summary(h, &s);
+  printf("%s latency us: p50 %" PRIu32 " p99 %" PRIu32 " max %" PRIu32
+      " count %" PRIu32 "\n", name, s.p50, s.p99, s.max, s.count);
+}
+
+static void usage(const char *prog) {
+  fprintf(stderr, "usage: %s [-d device[,device...]] [-n reports]"
+      " [-i interval_us] [-c connections] [-r att_rtt_us] [-m min_interval]"
+      " [-s store_dir] [-w capture_dir] [-t topology] [-b] [-l] [-p] [-q]\n"
+      "  -d  devices from hid_corpus.h, up to %d connected at once"
+      " (default boot_mouse)\n"
+      "  -n  reports per connection of each device (default 1000)\n"
+      "  -i  time between reports of each device (default 7500)\n"
+      "  -c  connections, the peers disconnect between them (default 1)\n"
+      "  -r  time of each simulated ATT request (default 7500)\n"
+      "  -m  shortest connection interval of the peers, 1.25 ms units (default 6)\n"
+      "  -s  directory for the layout and GATT caches (default none)\n"
+      "  -w  record a capture to capture.bin in capture_dir\n"
+      "  -t  task topology, shared or split (default %s)\n"
+      "  -b  the peers are bonded\n"
+      "  -p  use boot protocol for mice that fit it\n"
+      "  -l  the last device connects while the others send\n"
+      "  -q  print only the summary\n"
+      "devices:", prog, NIMBLE_MAX_CONNECTIONS, Topology->name);
+  for (size_t i = 0; i < sizeof(HID_Corpus) / sizeof(HID_Corpus[0]); i++) {
+    fprintf(stderr, " %s", HID_Corpus[i].name);
+  }
+  fprintf(stderr, "\n");
+}
+
+// Bluetooth SIG company ID for testing
+#define SIM_VENDOR_ID (0xFFFF)
+
+typedef struct {
+  const corpus_device_t *dev;
+  hid_layout_t layout;
+  int peer;
+  uint8_t address[6];
+  uint16_t product_id;      // PnP ID, vendor SIM_VENDOR_ID
+  uint32_t mouse_attempted;  // mouse reports sent or lost
+  uint32_t last_buttons;    // of the last mouse report sent
+} sim_device_t;
+
+static sim_device_t Sim_Devices[NIMBLE_MAX_CONNECTIONS];
+static size_t Sim_Device_Count;
+
+static const task_topology_t *find_topology(const char *name) {
+  for (size_t i = 0; i < sizeof(Task_Topologies) / sizeof(Task_Topologies[0]); i++) {
+    if (strcmp(Task_Topologies[i].name, name) == 0) return &Task_Topologies[i];
+  }
+  return NULL;
+}
+
+static const corpus_device_t *find_device(const char *name, size_t len) {
+  for (size_t i = 0; i < sizeof(HID_Corpus) / sizeof(HID_Corpus[0]); i++) {
+    if ((strlen(HID_Corpus[i].name) == len) &&
+        (strncmp(HID_Corpus[i].name, name, len) == 0)) {
+      return &HID_Corpus[i];
+    }
+  }
+  return NULL;
+}
+
+// The bridge slot of a simulated device, nullptr if not connected.
+static const hid_device_t *bridge_device(const sim_device_t *sd) {
+  for (auto &dev: Devices) {
+    if (dev.in_use && (memcmp(dev.address.getNative(), sd->address, 6) == 0)) {
+      return &dev;
+    }
+  }
+  return nullptr;
+}
+
+static int8_t clip_int8(int32_t v) {
+  return (int8_t)std::max<int32_t>(INT8_MIN, std::min<int32_t>(INT8_MAX, v));
+}
+
+// Send a mouse report in boot protocol. Buttons past 3 go in the device
+// specific bits, which the bridge does not decode.
+static bool send_boot_report(sim_device_t *sd, const corpus_report_t *report) {
+  const uint8_t boot[HID_BOOT_MOUSE_REPORT_LEN] = {
+    (uint8_t)report->expect.buttons,
+    (uint8_t)clip_int8(report->expect.x),
+    (uint8_t)clip_int8(report->expect.y),
+  };
+  sd->mouse_attempted++;
+  if (!sim_ble_notify_boot(sd->peer, boot, sizeof(boot))) return false;
+  sd->last_buttons = report->expect.buttons & HID_BOOT_MOUSE_BUTTONS;
+  return true;
+}
+
+// Send reports from one peer at interval_us, like a mouse moving.
+static void send_reports(sim_device_t *sd, uint32_t reports,
+    uint32_t interval_us) {
+  const corpus_device_t *dev = sd->dev;
+  // Each peer thread calls notifyCB() as the NimBLE host would.
+  if (Topology->ble_core != BRIDGE_CORE_ANY) bridge_thread_pin(Topology->ble_core);
+  uint64_t t0 = now_us();
+  for (uint32_t r = 0; r < reports; r++) {
+    const corpus_report_t *report = &dev->reports[r % dev->report_count];
+    const uint8_t *data = report->data;
+    size_t len = report->len;
+    uint8_t report_id = 0;
+    if (dev->report_id) {
+      report_id = data[0];
+      data++;
+      len--;
+    }
+    sleep_until(t0 + (uint64_t)r * interval_us);
+    const hid_report_layout_t *rl = hid_layout_find_report(&sd->layout, report_id);
+    if (sim_ble_boot_protocol(sd->peer)) {
+      if (rl && rl->is_mouse) send_boot_report(sd, report);
+      continue;
+    }
+    bool mouse = rl && rl->is_mouse;
+    if (mouse) sd->mouse_attempted++;
+    if (sim_ble_notify(sd->peer, report_id, data, len) && mouse) {
+      sd->last_buttons = report->expect.buttons;
+    }
+  }
+}
+
+// Advertise every SIM_ADV_INTERVAL_US, as a mouse waking up does, until
+// the bridge has connected connects times.
+static const uint32_t SIM_ADV_INTERVAL_US = 20000;
+
+static bool advertise(const sim_device_t *sd, uint32_t connects,
+    uint32_t timeout_ms) {
+  uint64_t deadline = now_us() + (uint64_t)timeout_ms * 1000;
+  while (sim_ble_stats(sd->peer)->connects < connects) {
+    if (now_us() > deadline) return false;
+    sim_ble_advertise(sd->peer);
+    usleep(SIM_ADV_INTERVAL_US);
+  }
+  return true;
+}
+
+int main(int argc, char *argv[]) {
+  const char *devices = "boot_mouse";
+  uint32_t reports = 1000;
+  uint32_t interval_us = 7500;
+  uint32_t connections = 1;
+  uint16_t min_interval = 6;
+  bool bonded = false;
+  bool quiet = false;
+  bool late = false;
+  int opt;
+  while ((opt = getopt(argc, argv, "d:n:i:c:r:m:s:w:t:blpqh")) != -1) {
+    switch (opt) {
+      case 'd': devices = optarg; break;
+      case 'n': reports = strtoul(optarg, NULL, 0); break;
+      case 'i': interval_us = strtoul(optarg, NULL, 0); break;
+      case 'c': connections = strtoul(optarg, NULL, 0); break;
+      case 'r': sim_ble_config()->att_rtt_us = strtoul(optarg, NULL, 0); break;
+      case 'm': min_interval = strtoul(optarg, NULL, 0); break;
+      case 's': Sim_Store_Dir = optarg; mkdir(optarg, 0755); break;
+      case 'w': Sim_Fs_Dir = optarg; Capture_To = CAPTURE_FLASH; break;
+      case 't': {
+        const task_topology_t *topology = find_topology(optarg);
+        if (topology == NULL) {
+          usage(argv[0]);
+          return 2;
+        }
+        Topology = topology;
+        break;
+      }
+      case 'b': bonded = true; break;
+      case 'p': Boot_Protocol = true; break;
+      case 'l': late = true; break;
+      case 'q': quiet = true; break;
+      default: usage(argv[0]); return 2;
+    }
+  }
+  for (const char *name = devices; *name != '\0'; ) {
+    size_t len = strcspn(name, ",");
+    const corpus_device_t *dev = find_device(name, len);
+    if ((dev == NULL) || (Sim_Device_Count >= NIMBLE_MAX_CONNECTIONS)) {
+      usage(argv[0]);
+      return 2;
+    }
+    sim_device_t *sd = &Sim_Devices[Sim_Device_Count];
+    sd->dev = dev;
+    hid_layout_parse(&sd->layout, dev->desc, dev->desc_len, false);
+    const uint8_t address[6] = {
+      (uint8_t)(0x01 + Sim_Device_Count), 0x02, 0x03, 0x04, 0x05, 0xC6
+    };
+    memcpy(sd->address, address, sizeof(address));
+    // The product ID is the corpus index + 1. boot_mouse, the first, has
+    // the profile "Test boot mouse".
+    sd->product_id = (uint16_t)(dev - HID_Corpus + 1);
+    sim_peer_t peer_cfg = {
+      dev->name, { 0 }, dev->desc, dev->desc_len, bonded, min_interval,
+      hid_layout_first_mouse(&sd->layout) != NULL, SIM_VENDOR_ID,
+      sd->product_id,
+    };
+    memcpy(peer_cfg.address, address, sizeof(address));
+    sd->peer = sim_ble_add_peer(&peer_cfg);
+    Sim_Device_Count++;
+    name += len;
+    if (*name == ',') name++;
+  }
+  uint32_t start = micros();
+  setup();
+  // The main thread advertises like the NimBLE host.
+  if (Topology->ble_core != BRIDGE_CORE_ANY) bridge_thread_pin(Topology->ble_core);
+
+  int errors = 0;
+  // Advertise until the bridge connects and subscribes.
+  auto connect_peer = [&](sim_device_t *sd, uint32_t c) {
+    if (advertise(sd, c + 1, 5000) &&
+        wait_for([&] {
+          const hid_device_t *dev = bridge_device(sd);
+          return dev && (__atomic_load_n(&dev->timing.subscribed,
+                __ATOMIC_ACQUIRE) != 0);
+          }, 10000)) {
+      return true;
+    }
+    printf("connection %" PRIu32 " %s FAIL\n", c, sd->dev->name);
+    errors++;
+    return false;
+  };
+  // With -l the last peer connects while the others send.
+  size_t streaming = (late && (Sim_Device_Count > 1)) ?
+    Sim_Device_Count - 1 : Sim_Device_Count;
+  for (uint32_t c = 0; (c < connections) && (errors == 0); c++) {
+    // The bridge scans again after each connect while it has a free slot.
+    for (size_t i = 0; (i < streaming) && connect_peer(&Sim_Devices[i], c); i++) {
+    }
+    if (errors) break;
+    // All peers send at once, each on its own connection.
+    std::vector<std::thread> threads;
+    for (size_t i = 0; i < streaming; i++) {
+      threads.emplace_back(send_reports, &Sim_Devices[i], reports, interval_us);
+    }
+    if (streaming < Sim_Device_Count) {
+      usleep(reports / 2 * interval_us);
+      sim_device_t *sd = &Sim_Devices[Sim_Device_Count - 1];
+      if (connect_peer(sd, c)) {
+        threads.emplace_back(send_reports, sd, reports, interval_us);
+      }
+    }
+    for (auto &t: threads) t.join();
+    if (errors) break;
+    // Let the bridge finish and center the stick.
+    usleep(3 * BRIDGE_IDLE_US);
+    for (size_t i = 0; i < Sim_Device_Count; i++) {
+      const hid_device_t *dev = bridge_device(&Sim_Devices[i]);
+      const connect_timing_t *timing = &dev->timing;
+      printf("connection %" PRIu32 " %s %s: connect %" PRIu32 " us, subscribe %"
+          PRIu32 " us, first report %" PRIu32 " us\n", c,
+          Sim_Devices[i].dev->name, timing->from_cache ? "(cached)" :
+          timing->boot_protocol ? "(boot protocol)" :
+          timing->from_profile ? "(profile)" : "(discovery)",
+          timing->connected - timing->connect_start,
+          timing->subscribed - timing->connected,
+          timing->first_report - timing->connect_start);
+      if (timing->disconnected) {
+        printf("connection %" PRIu32 " %s: disconnect to first report %"
+            PRIu32 " us\n", c, Sim_Devices[i].dev->name,
+            timing->first_report - timing->disconnected);
+      }
+    }
+    if (c + 1 < connections) {
+      for (size_t i = 0; i < Sim_Device_Count; i++) {
+        sim_ble_disconnect(Sim_Devices[i].peer);
+      }
+    }
+  }
+
+  uint32_t count = __atomic_load_n(&FSJoy.log_count, __ATOMIC_ACQUIRE);
+  if (!quiet) {
+    printf("time_us,x,y,buttons\n");
+    for (uint32_t i = 0; i < count; i++) {
+      const sim_joy_write_t *w = &FSJoy.log[i];
+      printf("%" PRIu32 ",%u,%u,0x%04x\n", w->timestamp_us - start,
+          (unsigned)w->report.x, (unsigned)w->report.y,
+          ((unsigned)w->report.buttons_b << 8) | w->report.buttons_a);
+    }
+  }
+  // Every device's last buttons are still held, ORed together.
+  uint32_t mouse_attempted = 0;
+  uint32_t expect_buttons = 0;
+  for (size_t i = 0; i < Sim_Device_Count; i++) {
+    mouse_attempted += Sim_Devices[i].mouse_attempted;
+    expect_buttons |= Sim_Devices[i].last_buttons;
+  }
+  uint32_t buttons = ((uint32_t)FSJoy.report.buttons_b << 8) |
+    FSJoy.report.buttons_a;
+  // Every mouse report sent must be handled, including any the bridge was
+  // not subscribed to when it was sent.
+  if ((Bridge.motion.reports != mouse_attempted) || (Report_Queue.dropped != 0) ||
+      (FSJoy.busy_writes != 0) || (buttons != expect_buttons)) {
+    errors++;
+  }
+  // Every queued report of every connection is in the histograms.
+  if (Bridge.decode_latency.total != Report_Queue.head) {
+    printf("decode latency count %" PRIu32 " of %" PRIu32 " queued reports FAIL\n",
+        Bridge.decode_latency.total, Report_Queue.head);
+    errors++;
+  }
+  printf("devices %s: mouse reports %" PRIu32 " handled %" PRIu32
+      " dropped %" PRIu32 " (queue high water %" PRIu32 ") joystick writes %"
+      PRIu32 " (idle %" PRIu32 "), buttons 0x%04" PRIx32 " expected 0x%04"
+      PRIx32 "\n", devices, mouse_attempted, Bridge.motion.reports,
+      Report_Queue.dropped, Report_Queue.high_water, count, Bridge.idle_writes, buttons, expect_buttons);
+  for (size_t i = 0; i < Sim_Device_Count; i++) {
+    const sim_device_t *sd = &Sim_Devices[i];
+    const sim_ble_stats_t *stats = sim_ble_stats(sd->peer);
+    const hid_device_t *dev = bridge_device(sd);
+    if (dev == nullptr) continue;
+    const conn_policy_t *policy = &dev->policy;
+    printf("%s: ATT ops %" PRIu32 " discoveries %" PRIu32 " report map reads %"
+        PRIu32 " CCCD writes %" PRIu32 " protocol mode writes %" PRIu32
+        " notifications %" PRIu32 "%s\n", sd->dev->name, stats->att_ops,
+        stats->discoveries, stats->report_map_reads, stats->cccd_writes,
+        stats->protocol_mode_writes, stats->notifications,
+        dev->boot ? ", boot protocol" : "");
+    // The profile of the PnP ID has the layout, the report map is not read
+    // unless a capture needs it.
+    if (device_profile_layout(device_profile_find(SIM_VENDOR_ID,
+            sd->product_id, 0)) &&
+        !Capture_On && (stats->report_map_reads != 0)) {
+      printf("%s: report map read with a profile FAIL\n", sd->dev->name);
+      errors++;
+    }
+    printf("%s: connection parameters: policy %s interval %u latency %u"
+        " requests %" PRIu32 " updates %" PRIu32 " failures %" PRIu32
+        " refused by peer %" PRIu32 ", wait for connection event avg %"
+        PRIu64 " max %" PRIu32 " us\n", sd->dev->name,
+        conn_policy_state_name(policy->state), stats->interval,
+        stats->latency, policy->stats.requests, policy->stats.updates,
+        policy->stats.failures, stats->conn_param_refused,
+        stats->notifications ? stats->air_delay_total_us / stats->notifications : 0,
+        stats->air_delay_max_us);
+  }
+  printf("scan: scans %" PRIu32 " found burst %" PRIu32 " open %" PRIu32
+      " slow %" PRIu32 " held %" PRIu32 " preferred %" PRIu32 "\n",
+      Scan_Policy.stats.scans, Scan_Policy.stats.found[SCAN_POLICY_BURST],
+      Scan_Policy.stats.found[SCAN_POLICY_OPEN],
+      Scan_Policy.stats.found[SCAN_POLICY_SLOW], Scan_Policy.stats.held,
+      Scan_Policy.stats.preferred);
+  printf("USB reports: submitted %" PRIu32 " sent %" PRIu32 " suppressed %"
+      PRIu32 " merged %" PRIu32 " busy %" PRIu32 ", writes to a busy endpoint %"
+      PRIu32 "\n", Usb_Out.stats.submitted, Usb_Out.stats.sent,
+      Usb_Out.stats.suppressed, Usb_Out.stats.merged, Usb_Out.stats.busy,
+      FSJoy.busy_writes);
+  print_latency("decode", &Bridge.decode_latency);
+  print_latency("write", &Bridge.write_latency);
+  print_latency("total", &Bridge.total_latency);
+  latency_summary_t total;
+  latency_hist_summary(&Bridge.total_latency, &total);
+  printf("topology %s on %ld CPUs: total latency jitter p99-p50 %" PRIu32
+      " us max-p50 %" PRIu32 " us\n", Topology->name,
+      sysconf(_SC_NPROCESSORS_ONLN), total.p99 - total.p50,
+      total.max - total.p50);
+  // Connecting must not hold up the reports of the peers already sending.
+  if (late && (total.max >= BRIDGE_IDLE_US)) {
+    printf("total latency max %" PRIu32 " us while a peer connected FAIL\n",
+        total.max);
+    errors++;
+  }
+  if (Capture_To != CAPTURE_OFF) {
+    // capture_task() writes out the rest.
+    if (!Capture_On || (Capture.lost_total != 0) ||
+        !wait_for([] {
+          return __atomic_load_n(&Capture.tail, __ATOMIC_ACQUIRE) ==
+            __atomic_load_n(&Capture.head, __ATOMIC_ACQUIRE);
+          }, 1000)) {
+      errors++;
+    }
+    usleep(2 * CAPTURE_DRAIN_MS * 1000);
+    printf("capture: records %" PRIu32 " lost %" PRIu32 " bytes %" PRIu32
+        "\n", Capture.records, Capture.lost_total, Capture.drained);
+  }
+  printf("errors %d\n", errors);
+  fflush(stdout);
+  _exit(errors);
+}
@@ -0,0 +1,6 @@
+#ifndef _SIM_ESP_WIFI_H_
+#define _SIM_ESP_WIFI_H_
+
+// Host simulation: WiFi is not used.
+
+#endif  /* _SIM_ESP_WIFI_H_ */
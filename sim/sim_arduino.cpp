@@ -0,0 +1,130 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2023 touchgadgetdev@gmail.com
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <stdlib.h>
+#include <time.h>
+#include "Arduino.h"
+#include "USB.h"
+#include "USBHID.h"
+#include "ESP32_flight_stick.h"
+#include "LittleFS.h"
+
+HardwareSerial Serial;
+ESPUSB USB;
+SimLittleFS LittleFS;
+const char *Sim_Store_Dir = nullptr;
+const char *Sim_Fs_Dir = nullptr;
+
+// The host takes the endpoint's report at the next 1 ms frame.
+static uint32_t Usb_Free_us;
+// Usb_Free_us is only meaningful after the first write, micros() may be
+// more than 2^31 from 0.
+static bool Usb_Written;
+
+static bool usb_free(void) {
+  return !Usb_Written || ((int32_t)(micros() - Usb_Free_us) >= 0);
+}
+
+bool USBHID::ready() {
+  return usb_free();
+}
+
+bool ESP32_flight_stick::write() {
+  return write(&report, sizeof(report));
+}
+
+bool ESP32_flight_stick::write(void *data, size_t len) {
+  if (len != sizeof(report)) return false;
+  memcpy(&report, data, len);
+  uint32_t now = micros();
+  if (!usb_free()) busy_writes++;
+  Usb_Free_us = (now / 1000 + 1) * 1000;
+  Usb_Written = true;
+  if (log == nullptr) {
+    log = (sim_joy_write_t *)malloc(SIM_JOY_LOG_MAX * sizeof(*log));
+  }
+  if ((log == nullptr) || (log_count >= SIM_JOY_LOG_MAX)) {
+    log_overflow++;
+    return true;
+  }
+  log[log_count].timestamp_us = micros();
+  log[log_count].report = report;
+  __atomic_store_n(&log_count, log_count + 1, __ATOMIC_RELEASE);
+  return true;
+}
+
+struct sim_semaphore {
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+  bool given;
+};
+
+SemaphoreHandle_t xSemaphoreCreateBinary() {
+  SemaphoreHandle_t sem = new sim_semaphore;
+  pthread_mutex_init(&sem->lock, NULL);
+  pthread_cond_init(&sem->cond, NULL);
+  sem->given = false;
+  return sem;
+}
+
+int xSemaphoreGive(SemaphoreHandle_t sem) {
+  pthread_mutex_lock(&sem->lock);
+  bool was_given = sem->given;
+  sem->given = true;
+  pthread_cond_signal(&sem->cond);
+  pthread_mutex_unlock(&sem->lock);
+  return was_given ? pdFALSE : pdTRUE;
+}
+
+int xSemaphoreTake(SemaphoreHandle_t sem, TickType_t ticks) {
+  struct timespec deadline;
+  clock_gettime(CLOCK_REALTIME, &deadline);
+  deadline.tv_sec += ticks / 1000;
+  deadline.tv_nsec += (long)(ticks % 1000) * 1000000;
+  if (deadline.tv_nsec >= 1000000000) {
+    deadline.tv_sec++;
+    deadline.tv_nsec -= 1000000000;
+  }
+  pthread_mutex_lock(&sem->lock);
+  while (!sem->given) {
+    if (ticks == portMAX_DELAY) {
+      pthread_cond_wait(&sem->cond, &sem->lock);
+    } else if (pthread_cond_timedwait(&sem->cond, &sem->lock, &deadline) != 0) {
+      break;
+    }
+  }
+  bool taken = sem->given;
+  sem->given = false;
+  pthread_mutex_unlock(&sem->lock);
+  return taken ? pdTRUE : pdFALSE;
+}
+
+void vTaskDelete(void *task) {
+  if (task == NULL) pthread_exit(NULL);
+}
+
+bool nv_store_nvs_init(nv_store_t *store, const char *name_space) {
+  (void)name_space;
+  return nv_store_file_init(store, Sim_Store_Dir);
+}
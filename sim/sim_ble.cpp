@@ -0,0 +1,827 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2023 touchgadgetdev@gmail.com
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <time.h>
+#include <unistd.h>
+#include <algorithm>
+#include <mutex>
+#include "NimBLEDevice.h"
+#include "sim_ble.h"
+extern "C" {
+#include "../report_desc.h"
+}
+
+// Characteristic properties
+#define PROP_READ     (0x02)
+#define PROP_WRITE_NR (0x04)
+#define PROP_NOTIFY   (0x10)
+#define PROP_INDICATE (0x20)
+
+#define UUID_DIS_SERVICE        (0x180A)
+#define UUID_DIS_PNP_ID         (0x2A50)
+#define UUID_HID_SERVICE        (0x1812)
+#define UUID_HID_REPORT_MAP     (0x2A4B)
+#define UUID_HID_REPORT_DATA    (0x2A4D)
+#define UUID_HID_PROTOCOL_MODE  (0x2A4E)
+#define UUID_HID_BOOT_MOUSE     (0x2A33)
+#define UUID_REPORT_REFERENCE   (0x2908)
+#define UUID_CCCD               (0x2902)
+
+#define DIS_SERVICE_START       (0x0008)
+#define HID_SERVICE_START       (0x0010)
+
+typedef struct {
+  uint8_t report_id;
+  uint16_t value_handle;
+  uint16_t cccd_handle;
+  uint16_t ref_handle;
+  bool enabled;
+} sim_report_chr_t;
+
+typedef struct {
+  sim_peer_t cfg;
+  // Device Information Service: service, PnP ID declaration and value
+  uint16_t pnp_handle;
+  uint16_t service_start;
+  uint16_t service_end;
+  uint16_t map_handle;
+  sim_report_chr_t reports[HID_REPORT_LAYOUTS_MAX];
+  uint32_t report_count;
+  // Boot protocol. boot.ref_handle is 0, there is no Report Reference.
+  uint16_t protocol_handle;
+  sim_report_chr_t boot;
+  bool boot_protocol;
+  NimBLEAdvertisedDevice adv;
+  bool reported;            // seen by the current scan, duplicates dropped
+  NimBLEClient *client;
+  bool connected;
+  uint64_t anchor_us;       // a connection event
+  sim_ble_stats_t stats;
+} sim_peer_state_t;
+
+// Guards the peers and the client list. Never held while calling into
+// the bridge except to deliver a notification, which does not call back.
+static std::recursive_mutex Lock;
+static sim_peer_state_t Peers[SIM_PEERS_MAX];
+static int Peer_Count;
+static sim_ble_config_t Config = { 7500 };
+static std::vector<NimBLEClient *> Clients;
+static NimBLEScan Scan;
+static bool Scanning;
+// Filter accept list
+static std::vector<NimBLEAddress> White_List;
+static ble_gap_event_fn *Gap_Handler;
+static uint16_t Next_Conn_Id = 1;
+
+static uint64_t now_us(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static sim_peer_state_t *peer_by_address(const NimBLEAddress &address) {
+  for (int i = 0; i < Peer_Count; i++) {
+    if (memcmp(Peers[i].cfg.address, address.getNative(), 6) == 0) return &Peers[i];
+  }
+  return nullptr;
+}
+
+static sim_peer_state_t *peer_of(const NimBLEClient *client) {
+  sim_peer_state_t *peer = peer_by_address(client->getPeerAddress());
+  return (peer && (peer->client == client) && peer->connected) ? peer : nullptr;
+}
+
+// One ATT request/response on the connection of client.
+static void att_op(const NimBLEClient *client) {
+  {
+    std::lock_guard<std::recursive_mutex> guard(Lock);
+    sim_peer_state_t *peer = peer_of(client);
+    if (peer) peer->stats.att_ops++;
+  }
+  if (Config.att_rtt_us) usleep(Config.att_rtt_us);
+}
+
+static sim_report_chr_t *report_by_handle(sim_peer_state_t *peer, uint16_t handle) {
+  for (uint32_t i = 0; i < peer->report_count; i++) {
+    sim_report_chr_t *report = &peer->reports[i];
+    if ((report->value_handle == handle) || (report->cccd_handle == handle) ||
+        (report->ref_handle == handle)) {
+      return report;
+    }
+  }
+  if (peer->cfg.boot_mouse && ((peer->boot.value_handle == handle) ||
+        (peer->boot.cccd_handle == handle))) {
+    return &peer->boot;
+  }
+  return nullptr;
+}
+
+sim_ble_config_t *sim_ble_config(void) {
+  return &Config;
+}
+
+int sim_ble_add_peer(const sim_peer_t *cfg) {
+  std::lock_guard<std::recursive_mutex> guard(Lock);
+  if (Peer_Count >= SIM_PEERS_MAX) return -1;
+  sim_peer_state_t *peer = &Peers[Peer_Count];
+  peer->cfg = *cfg;
+  if (cfg->vendor_id) peer->pnp_handle = DIS_SERVICE_START + 2;
+  // Handles: service, report map declaration and value, then declaration,
+  // value, CCCD, and Report Reference for each input report.
+  uint16_t handle = HID_SERVICE_START;
+  peer->service_start = handle++;
+  handle++;
+  peer->map_handle = handle++;
+  hid_layout_t layout;
+  hid_layout_parse(&layout, cfg->report_map, cfg->report_map_len, false);
+  for (uint32_t i = 0; i < layout.report_count; i++) {
+    sim_report_chr_t *report = &peer->reports[peer->report_count++];
+    report->report_id = layout.reports[i].report_id;
+    handle++;
+    report->value_handle = handle++;
+    report->cccd_handle = handle++;
+    report->ref_handle = handle++;
+  }
+  if (cfg->boot_mouse) {
+    // Protocol Mode declaration and value, then Boot Mouse Input Report
+    // declaration, value, and CCCD.
+    handle++;
+    peer->protocol_handle = handle++;
+    handle++;
+    peer->boot.value_handle = handle++;
+    peer->boot.cccd_handle = handle++;
+  }
+  peer->service_end = handle - 1;
+  peer->adv.m_address = NimBLEAddress(cfg->address);
+  peer->adv.m_services.push_back(NimBLEUUID((uint16_t)UUID_HID_SERVICE));
+  peer->adv.m_name = cfg->name;
+  return Peer_Count++;
+}
+
+bool sim_ble_is_scanning(void) {
+  return __atomic_load_n(&Scanning, __ATOMIC_ACQUIRE);
+}
+
+bool sim_ble_advertise(int index) {
+  if (!sim_ble_is_scanning() || (Scan.m_callbacks == nullptr)) return false;
+  // The controller drops advertisers not on the filter accept list.
+  if ((Scan.m_filter_policy == BLE_HCI_SCAN_FILT_USE_WL) &&
+      !NimBLEDevice::onWhiteList(Peers[index].adv.getAddress())) {
+    return true;
+  }
+  if (__atomic_exchange_n(&Peers[index].reported, true, __ATOMIC_ACQ_REL)) {
+    return true;
+  }
+  Scan.m_callbacks->onResult(&Peers[index].adv);
+  return true;
+}
+
+bool sim_ble_is_connected(int index) {
+  std::lock_guard<std::recursive_mutex> guard(Lock);
+  return Peers[index].connected;
+}
+
+// Sleep until the next connection event of peer. Returns the time slept
+// or -1 if the peer is not connected.
+static int64_t wait_connection_event(sim_peer_state_t *peer) {
+  uint64_t wait_us;
+  {
+    std::lock_guard<std::recursive_mutex> guard(Lock);
+    if (!peer->connected) return -1;
+    uint64_t interval_us = (uint64_t)peer->client->m_interval * 1250;
+    uint64_t since = (now_us() - peer->anchor_us) % interval_us;
+    wait_us = (since == 0) ? 0 : interval_us - since;
+  }
+  if (wait_us) usleep(wait_us);
+  return (int64_t)wait_us;
+}
+
+// Deliver a notification of report to the bridge. Called with Lock held.
+static void deliver(sim_peer_state_t *peer, const sim_report_chr_t *report,
+    const uint8_t *data, size_t len, uint64_t wait_us) {
+  peer->stats.notifications++;
+  peer->stats.air_delay_total_us += wait_us;
+  if (wait_us > peer->stats.air_delay_max_us) peer->stats.air_delay_max_us = (uint32_t)wait_us;
+  // NimBLE passes every notification to the custom GAP handler, then to
+  // the characteristic callback if NimBLEClient knows the characteristic.
+  if (Gap_Handler) {
+    os_mbuf om = { data, (uint16_t)len };
+    ble_gap_event event = {};
+    event.type = BLE_GAP_EVENT_NOTIFY_RX;
+    event.notify_rx.om = &om;
+    event.notify_rx.attr_handle = report->value_handle;
+    event.notify_rx.conn_handle = peer->client->getConnId();
+    Gap_Handler(&event, nullptr);
+  }
+  NimBLERemoteCharacteristic *chr = peer->client->findCharacteristic(report->value_handle);
+  if (chr && chr->m_notify_cb) {
+    chr->m_notify_cb(chr, (uint8_t *)data, len, true);
+  }
+}
+
+bool sim_ble_notify(int index, uint8_t report_id, const uint8_t *data,
+    size_t len) {
+  sim_peer_state_t *peer = &Peers[index];
+  // The peer sends at the next connection event.
+  int64_t wait_us = wait_connection_event(peer);
+  if (wait_us < 0) return false;
+  std::lock_guard<std::recursive_mutex> guard(Lock);
+  if (!peer->connected || peer->boot_protocol) return false;
+  sim_report_chr_t *report = nullptr;
+  for (uint32_t i = 0; i < peer->report_count; i++) {
+    if (peer->reports[i].report_id == report_id) report = &peer->reports[i];
+  }
+  if ((report == nullptr) || !report->enabled) return false;
+  deliver(peer, report, data, len, (uint64_t)wait_us);
+  return true;
+}
+
+bool sim_ble_boot_protocol(int index) {
+  std::lock_guard<std::recursive_mutex> guard(Lock);
+  return Peers[index].connected && Peers[index].boot_protocol;
+}
+
+bool sim_ble_notify_boot(int index, const uint8_t *data, size_t len) {
+  sim_peer_state_t *peer = &Peers[index];
+  int64_t wait_us = wait_connection_event(peer);
+  if (wait_us < 0) return false;
+  std::lock_guard<std::recursive_mutex> guard(Lock);
+  if (!peer->connected || !peer->boot_protocol || !peer->boot.enabled) {
+    return false;
+  }
+  deliver(peer, &peer->boot, data, len, (uint64_t)wait_us);
+  return true;
+}
+
+void sim_ble_disconnect(int index) {
+  NimBLEClient *client;
+  {
+    std::lock_guard<std::recursive_mutex> guard(Lock);
+    if (!Peers[index].connected) return;
+    client = Peers[index].client;
+  }
+  client->peerDisconnected();
+}
+
+const sim_ble_stats_t *sim_ble_stats(int index) {
+  return &Peers[index].stats;
+}
+
+int ble_gattc_write_flat(uint16_t conn_handle, uint16_t attr_handle,
+    const void *data, uint16_t data_len, ble_gatt_attr_fn *cb, void *cb_arg) {
+  NimBLEClient *client = NimBLEDevice::getClientByID(conn_handle);
+  if (client == nullptr) return BLE_HS_ATT_ERR(0x0E);
+  att_op(client);
+  ble_gatt_error error = { 0, attr_handle };
+  {
+    std::lock_guard<std::recursive_mutex> guard(Lock);
+    sim_peer_state_t *peer = peer_of(client);
+    sim_report_chr_t *report = peer ? report_by_handle(peer, attr_handle) : nullptr;
+    if ((report == nullptr) || (report->cccd_handle != attr_handle) ||
+        (data_len != 2)) {
+      error.status = BLE_HS_ATT_ERR(0x01);   // invalid handle
+    } else {
+      report->enabled = (((const uint8_t *)data)[0] & 0x03) != 0;
+      peer->stats.cccd_writes++;
+    }
+  }
+  cb(conn_handle, &error, nullptr, cb_arg);
+  return 0;
+}
+
+int ble_gap_conn_find(uint16_t handle, struct ble_gap_conn_desc *out_desc) {
+  NimBLEClient *client = NimBLEDevice::getClientByID(handle);
+  if (client == nullptr) return BLE_HS_ENOTCONN;
+  std::lock_guard<std::recursive_mutex> guard(Lock);
+  memset(out_desc, 0, sizeof(*out_desc));
+  out_desc->conn_handle = handle;
+  out_desc->conn_itvl = client->m_interval;
+  out_desc->conn_latency = client->m_latency;
+  out_desc->supervision_timeout = client->m_timeout;
+  return 0;
+}
+
+int ble_hs_mbuf_to_flat(const struct os_mbuf *om, void *flat,
+    uint16_t max_len, uint16_t *out_copy_len) {
+  uint16_t len = std::min(om->len, max_len);
+  memcpy(flat, om->data, len);
+  if (out_copy_len) *out_copy_len = len;
+  return (len < om->len) ? 1 : 0;
+}
+
+std::string NimBLEUUID::toString() const {
+  char buf[8];
+  snprintf(buf, sizeof(buf), "0x%04x", uuid16);
+  return buf;
+}
+
+std::string NimBLEAddress::toString() const {
+  char buf[18];
+  snprintf(buf, sizeof(buf), "%02x:%02x:%02x:%02x:%02x:%02x",
+      addr[5], addr[4], addr[3], addr[2], addr[1], addr[0]);
+  return buf;
+}
+
+std::string NimBLERemoteDescriptor::readValue() {
+  att_op(m_client);
+  std::lock_guard<std::recursive_mutex> guard(Lock);
+  sim_peer_state_t *peer = peer_of(m_client);
+  if (peer == nullptr) return "";
+  sim_report_chr_t *report = report_by_handle(peer, m_handle);
+  if ((report == nullptr) || (report->ref_handle != m_handle)) return "";
+  const char ref[2] = { (char)report->report_id, 1 };   // input report
+  return std::string(ref, sizeof(ref));
+}
+
+NimBLERemoteCharacteristic::NimBLERemoteCharacteristic(NimBLERemoteService *service,
+    NimBLEUUID uuid, uint16_t handle, uint8_t props)
+  : m_service(service), m_client(service->getClient()), m_uuid(uuid),
+    m_handle(handle), m_props(props) {
+}
+
+NimBLERemoteCharacteristic::~NimBLERemoteCharacteristic() {
+  for (auto desc : m_descriptors) delete desc;
+}
+
+bool NimBLERemoteCharacteristic::canRead() const {
+  return (m_props & PROP_READ) != 0;
+}
+
+bool NimBLERemoteCharacteristic::canNotify() const {
+  return (m_props & PROP_NOTIFY) != 0;
+}
+
+bool NimBLERemoteCharacteristic::canIndicate() const {
+  return (m_props & PROP_INDICATE) != 0;
+}
+
+bool NimBLERemoteCharacteristic::canWrite() const {
+  return false;
+}
+
+bool NimBLERemoteCharacteristic::canWriteNoResponse() const {
+  return (m_props & PROP_WRITE_NR) != 0;
+}
+
+// Only Protocol Mode is writable. 0 is boot protocol, 1 report protocol.
+bool NimBLERemoteCharacteristic::writeValue(const uint8_t *data, size_t length,
+    bool response) {
+  (void)response;
+  att_op(m_client);
+  std::lock_guard<std::recursive_mutex> guard(Lock);
+  sim_peer_state_t *peer = peer_of(m_client);
+  if ((peer == nullptr) || !peer->cfg.boot_mouse ||
+      (m_handle != peer->protocol_handle) || (length != 1) || (data[0] > 1)) {
+    return false;
+  }
+  peer->boot_protocol = (data[0] == 0);
+  peer->stats.protocol_mode_writes++;
+  return true;
+}
+
+std::string NimBLERemoteCharacteristic::readValue() {
+  att_op(m_client);
+  std::lock_guard<std::recursive_mutex> guard(Lock);
+  sim_peer_state_t *peer = peer_of(m_client);
+  if (peer == nullptr) return "";
+  if (peer->pnp_handle && (m_handle == peer->pnp_handle)) {
+    // Vendor ID source 1 is the Bluetooth SIG. Version 1.00.
+    const char pnp_id[7] = {
+      1, (char)peer->cfg.vendor_id, (char)(peer->cfg.vendor_id >> 8),
+      (char)peer->cfg.product_id, (char)(peer->cfg.product_id >> 8), 0, 1
+    };
+    return std::string(pnp_id, sizeof(pnp_id));
+  }
+  if (m_handle != peer->map_handle) return "";
+  peer->stats.report_map_reads++;
+  return std::string((const char *)peer->cfg.report_map, peer->cfg.report_map_len);
+}
+
+NimBLERemoteDescriptor *NimBLERemoteCharacteristic::getDescriptor(const NimBLEUUID &uuid) {
+  if (!m_discovered) {
+    att_op(m_client);
+    std::lock_guard<std::recursive_mutex> guard(Lock);
+    sim_peer_state_t *peer = peer_of(m_client);
+    sim_report_chr_t *report = peer ? report_by_handle(peer, m_handle) : nullptr;
+    if (report) {
+      m_descriptors.push_back(new NimBLERemoteDescriptor(m_client,
+            NimBLEUUID((uint16_t)UUID_CCCD), report->cccd_handle));
+    }
+    if (report && report->ref_handle) {
+      m_descriptors.push_back(new NimBLERemoteDescriptor(m_client,
+            NimBLEUUID((uint16_t)UUID_REPORT_REFERENCE), report->ref_handle));
+    }
+    m_discovered = true;
+  }
+  for (auto desc : m_descriptors) {
+    if (desc->getUUID() == uuid) return desc;
+  }
+  return nullptr;
+}
+
+bool NimBLERemoteCharacteristic::subscribe(bool notifications, notify_callback cb,
+    bool response) {
+  (void)response;
+  if (notifications ? !canNotify() : !canIndicate()) return false;
+  att_op(m_client);
+  std::lock_guard<std::recursive_mutex> guard(Lock);
+  sim_peer_state_t *peer = peer_of(m_client);
+  sim_report_chr_t *report = peer ? report_by_handle(peer, m_handle) : nullptr;
+  if (report == nullptr) return false;
+  m_notify_cb = cb;
+  report->enabled = true;
+  peer->stats.cccd_writes++;
+  return true;
+}
+
+bool NimBLERemoteCharacteristic::unsubscribe(bool response) {
+  (void)response;
+  att_op(m_client);
+  std::lock_guard<std::recursive_mutex> guard(Lock);
+  sim_peer_state_t *peer = peer_of(m_client);
+  sim_report_chr_t *report = peer ? report_by_handle(peer, m_handle) : nullptr;
+  if (report == nullptr) return false;
+  m_notify_cb = nullptr;
+  report->enabled = false;
+  peer->stats.cccd_writes++;
+  return true;
+}
+
+std::string NimBLERemoteCharacteristic::toString() const {
+  char buf[64];
+  snprintf(buf, sizeof(buf), "Characteristic: uuid: %s, handle: %u",
+      m_uuid.toString().c_str(), m_handle);
+  return buf;
+}
+
+NimBLERemoteService::~NimBLERemoteService() {
+  for (auto chr : m_characteristics) delete chr;
+}
+
+std::vector<NimBLERemoteCharacteristic *> *NimBLERemoteService::getCharacteristics(bool refresh) {
+  if (refresh || !m_discovered) {
+    att_op(m_client);
+    std::lock_guard<std::recursive_mutex> guard(Lock);
+    for (auto chr : m_characteristics) delete chr;
+    m_characteristics.clear();
+    sim_peer_state_t *peer = peer_of(m_client);
+    if (peer && (m_uuid == NimBLEUUID((uint16_t)UUID_DIS_SERVICE))) {
+      peer->stats.discoveries++;
+      m_characteristics.push_back(new NimBLERemoteCharacteristic(this,
+            NimBLEUUID((uint16_t)UUID_DIS_PNP_ID), peer->pnp_handle, PROP_READ));
+    } else if (peer) {
+      peer->stats.discoveries++;
+      m_characteristics.push_back(new NimBLERemoteCharacteristic(this,
+            NimBLEUUID((uint16_t)UUID_HID_REPORT_MAP), peer->map_handle, PROP_READ));
+      for (uint32_t i = 0; i < peer->report_count; i++) {
+        m_characteristics.push_back(new NimBLERemoteCharacteristic(this,
+              NimBLEUUID((uint16_t)UUID_HID_REPORT_DATA),
+              peer->reports[i].value_handle, PROP_READ | PROP_NOTIFY));
+      }
+      if (peer->cfg.boot_mouse) {
+        m_characteristics.push_back(new NimBLERemoteCharacteristic(this,
+              NimBLEUUID((uint16_t)UUID_HID_PROTOCOL_MODE), peer->protocol_handle,
+              PROP_READ | PROP_WRITE_NR));
+        m_characteristics.push_back(new NimBLERemoteCharacteristic(this,
+              NimBLEUUID((uint16_t)UUID_HID_BOOT_MOUSE), peer->boot.value_handle,
+              PROP_READ | PROP_NOTIFY));
+      }
+    }
+    m_discovered = true;
+  }
+  return &m_characteristics;
+}
+
+NimBLERemoteCharacteristic *NimBLERemoteService::getCharacteristic(const NimBLEUUID &uuid) {
+  for (auto chr : *getCharacteristics(false)) {
+    if (chr->getUUID() == uuid) return chr;
+  }
+  return nullptr;
+}
+
+NimBLERemoteCharacteristic *NimBLERemoteService::findCharacteristic(uint16_t handle) {
+  for (auto chr : m_characteristics) {
+    if (chr->getHandle() == handle) return chr;
+  }
+  return nullptr;
+}
+
+std::string NimBLERemoteService::toString() const {
+  char buf[64];
+  snprintf(buf, sizeof(buf), "Service: uuid: %s, start: %u, end: %u",
+      m_uuid.toString().c_str(), m_start, m_end);
+  return buf;
+}
+
+bool NimBLEAdvertisedDevice::isAdvertisingService(const NimBLEUUID &uuid) const {
+  return std::find(m_services.begin(), m_services.end(), uuid) != m_services.end();
+}
+
+std::string NimBLEAdvertisedDevice::toString() const {
+  return "Name: " + m_name + ", Address: " + m_address.toString();
+}
+
+NimBLEClient::~NimBLEClient() {
+  deleteServices();
+}
+
+void NimBLEClient::deleteServices() {
+  std::lock_guard<std::recursive_mutex> guard(Lock);
+  for (auto svc : m_services) delete svc;
+  m_services.clear();
+}
+
+bool NimBLEClient::connect(const NimBLEAddress &address, bool deleteAttributes) {
+  sim_peer_state_t *peer;
+  {
+    std::lock_guard<std::recursive_mutex> guard(Lock);
+    peer = peer_by_address(address);
+    if ((peer == nullptr) || peer->connected) return false;
+  }
+  if (Config.att_rtt_us) usleep(Config.att_rtt_us);
+  {
+    std::lock_guard<std::recursive_mutex> guard(Lock);
+    if (deleteAttributes || (m_peer != address)) deleteServices();
+    m_peer = address;
+    m_conn_id = Next_Conn_Id++;
+    m_connected = true;
+    m_interval = m_connect_interval;
+    m_latency = m_connect_latency;
+    m_timeout = m_connect_timeout;
+    peer->client = this;
+    peer->connected = true;
+    for (uint32_t i = 0; i < peer->report_count; i++) peer->reports[i].enabled = false;
+    // Every connection starts in report protocol.
+    peer->boot.enabled = false;
+    peer->boot_protocol = false;
+    peer->stats.connects++;
+    peer->stats.interval = m_interval;
+    peer->stats.latency = m_latency;
+    peer->anchor_us = now_us();
+  }
+  if (m_callbacks) m_callbacks->onConnect(this);
+  // A peer that cannot do the interval asks for the shortest it can.
+  if (m_interval < peer->cfg.min_interval) {
+    ble_gap_upd_params params = {
+      peer->cfg.min_interval, peer->cfg.min_interval, 0, 300, 0, 0
+    };
+    if ((m_callbacks == nullptr) ||
+        m_callbacks->onConnParamsUpdateRequest(this, &params)) {
+      {
+        std::lock_guard<std::recursive_mutex> guard(Lock);
+        m_interval = params.itvl_max;
+        m_latency = params.latency;
+        m_timeout = params.supervision_timeout;
+        peer->anchor_us = now_us();
+        peer->stats.conn_param_updates++;
+        peer->stats.interval = m_interval;
+        peer->stats.latency = m_latency;
+      }
+      ble_gap_event event = {};
+      event.type = BLE_GAP_EVENT_CONN_UPDATE;
+      event.conn_update.conn_handle = m_conn_id;
+      if (Gap_Handler) Gap_Handler(&event, nullptr);
+    }
+  }
+  return true;
+}
+
+void NimBLEClient::peerDisconnected() {
+  {
+    std::lock_guard<std::recursive_mutex> guard(Lock);
+    if (!m_connected) return;
+    sim_peer_state_t *peer = peer_of(this);
+    if (peer) {
+      peer->connected = false;
+      peer->stats.disconnects++;
+    }
+    m_connected = false;
+  }
+  if (m_callbacks) m_callbacks->onDisconnect(this);
+  std::lock_guard<std::recursive_mutex> guard(Lock);
+  m_conn_id = BLE_HS_CONN_HANDLE_NONE;
+}
+
+bool NimBLEClient::disconnect(uint8_t reason) {
+  (void)reason;
+  peerDisconnected();
+  return true;
+}
+
+// The peer takes the shortest interval it supports in the range or
+// refuses. The result is reported to the GAP handler like the NimBLE host.
+void NimBLEClient::updateConnParams(uint16_t minInterval, uint16_t maxInterval,
+    uint16_t latency, uint16_t timeout) {
+  ble_gap_event event = {};
+  event.type = BLE_GAP_EVENT_CONN_UPDATE;
+  {
+    std::lock_guard<std::recursive_mutex> guard(Lock);
+    sim_peer_state_t *peer = peer_of(this);
+    if (peer == nullptr) return;
+    uint16_t interval = std::max(minInterval, peer->cfg.min_interval);
+    if (interval > maxInterval) {
+      event.conn_update.status = BLE_ERR_UNACCEPT_CONN_PARAMS;
+      peer->stats.conn_param_refused++;
+    } else {
+      m_interval = interval;
+      m_latency = latency;
+      m_timeout = timeout;
+      peer->anchor_us = now_us();
+      peer->stats.conn_param_updates++;
+      peer->stats.interval = interval;
+      peer->stats.latency = latency;
+    }
+    event.conn_update.conn_handle = m_conn_id;
+  }
+  if (Gap_Handler) Gap_Handler(&event, nullptr);
+}
+
+void NimBLEClient::setConnectionParams(uint16_t minInterval, uint16_t maxInterval,
+    uint16_t latency, uint16_t timeout, uint16_t scanInterval, uint16_t scanWindow) {
+  (void)minInterval;
+  (void)scanInterval;
+  (void)scanWindow;
+  m_connect_interval = maxInterval;
+  m_connect_latency = latency;
+  m_connect_timeout = timeout;
+}
+
+NimBLERemoteService *NimBLEClient::getService(const NimBLEUUID &uuid) {
+  {
+    std::lock_guard<std::recursive_mutex> guard(Lock);
+    for (auto svc : m_services) {
+      if (svc->getUUID() == uuid) return svc;
+    }
+  }
+  att_op(this);
+  std::lock_guard<std::recursive_mutex> guard(Lock);
+  sim_peer_state_t *peer = peer_of(this);
+  if (peer == nullptr) return nullptr;
+  NimBLERemoteService *svc;
+  // The peers only have the HID service and maybe Device Information.
+  if (uuid == NimBLEUUID((uint16_t)UUID_HID_SERVICE)) {
+    svc = new NimBLERemoteService(this, uuid, peer->service_start,
+        peer->service_end);
+  } else if (peer->pnp_handle && (uuid == NimBLEUUID((uint16_t)UUID_DIS_SERVICE))) {
+    svc = new NimBLERemoteService(this, uuid, DIS_SERVICE_START,
+        peer->pnp_handle);
+  } else {
+    return nullptr;
+  }
+  m_services.push_back(svc);
+  return svc;
+}
+
+bool NimBLEClient::secureConnection() {
+  att_op(this);
+  std::lock_guard<std::recursive_mutex> guard(Lock);
+  sim_peer_state_t *peer = peer_of(this);
+  return peer && peer->cfg.bonded;
+}
+
+NimBLERemoteCharacteristic *NimBLEClient::findCharacteristic(uint16_t handle) {
+  for (auto svc : m_services) {
+    NimBLERemoteCharacteristic *chr = svc->findCharacteristic(handle);
+    if (chr) return chr;
+  }
+  return nullptr;
+}
+
+bool NimBLEScan::start(uint32_t duration, void (*scanCompleteCB)(NimBLEScanResults),
+    bool is_continue) {
+  (void)duration;
+  (void)scanCompleteCB;
+  (void)is_continue;
+  for (int i = 0; i < Peer_Count; i++) {
+    __atomic_store_n(&Peers[i].reported, false, __ATOMIC_RELEASE);
+  }
+  return !__atomic_exchange_n(&Scanning, true, __ATOMIC_ACQ_REL);
+}
+
+bool NimBLEScan::stop() {
+  __atomic_store_n(&Scanning, false, __ATOMIC_RELEASE);
+  return true;
+}
+
+bool NimBLEScan::isScanning() const {
+  return sim_ble_is_scanning();
+}
+
+void NimBLEDevice::setCustomGapHandler(ble_gap_event_fn *handler) {
+  Gap_Handler = handler;
+}
+
+NimBLEScan *NimBLEDevice::getScan() {
+  return &Scan;
+}
+
+size_t NimBLEDevice::getClientListSize() {
+  std::lock_guard<std::recursive_mutex> guard(Lock);
+  return Clients.size();
+}
+
+NimBLEClient *NimBLEDevice::getClientByPeerAddress(const NimBLEAddress &address) {
+  std::lock_guard<std::recursive_mutex> guard(Lock);
+  for (auto client : Clients) {
+    if (client->getPeerAddress() == address) return client;
+  }
+  return nullptr;
+}
+
+NimBLEClient *NimBLEDevice::getClientByID(uint16_t conn_id) {
+  std::lock_guard<std::recursive_mutex> guard(Lock);
+  for (auto client : Clients) {
+    if (client->isConnected() && (client->getConnId() == conn_id)) return client;
+  }
+  return nullptr;
+}
+
+NimBLEClient *NimBLEDevice::getDisconnectedClient() {
+  std::lock_guard<std::recursive_mutex> guard(Lock);
+  for (auto client : Clients) {
+    if (!client->isConnected()) return client;
+  }
+  return nullptr;
+}
+
+NimBLEClient *NimBLEDevice::createClient() {
+  std::lock_guard<std::recursive_mutex> guard(Lock);
+  NimBLEClient *client = new NimBLEClient();
+  Clients.push_back(client);
+  return client;
+}
+
+bool NimBLEDevice::deleteClient(NimBLEClient *client) {
+  if (client->isConnected()) client->disconnect();
+  std::lock_guard<std::recursive_mutex> guard(Lock);
+  auto it = std::find(Clients.begin(), Clients.end(), client);
+  if (it == Clients.end()) return false;
+  Clients.erase(it);
+  for (int i = 0; i < Peer_Count; i++) {
+    if (Peers[i].client == client) Peers[i].client = nullptr;
+  }
+  delete client;
+  return true;
+}
+
+bool NimBLEDevice::isBonded(const NimBLEAddress &address) {
+  std::lock_guard<std::recursive_mutex> guard(Lock);
+  sim_peer_state_t *peer = peer_by_address(address);
+  return peer && peer->cfg.bonded;
+}
+
+int NimBLEDevice::getNumBonds() {
+  std::lock_guard<std::recursive_mutex> guard(Lock);
+  int bonds = 0;
+  for (int i = 0; i < Peer_Count; i++) {
+    if (Peers[i].cfg.bonded) bonds++;
+  }
+  return bonds;
+}
+
+NimBLEAddress NimBLEDevice::getBondedAddress(int index) {
+  std::lock_guard<std::recursive_mutex> guard(Lock);
+  for (int i = 0; i < Peer_Count; i++) {
+    if (Peers[i].cfg.bonded && (index-- == 0)) return NimBLEAddress(Peers[i].cfg.address);
+  }
+  return NimBLEAddress();
+}
+
+bool NimBLEDevice::whiteListAdd(const NimBLEAddress &address) {
+  std::lock_guard<std::recursive_mutex> guard(Lock);
+  if (sim_ble_is_scanning()) return false;    // as the controller
+  if (!onWhiteList(address)) White_List.push_back(address);
+  return true;
+}
+
+bool NimBLEDevice::onWhiteList(const NimBLEAddress &address) {
+  std::lock_guard<std::recursive_mutex> guard(Lock);
+  return std::find(White_List.begin(), White_List.end(), address) != White_List.end();
+}
+
+void NimBLEDevice::deleteAllBonds() {
+  std::lock_guard<std::recursive_mutex> guard(Lock);
+  for (int i = 0; i < Peer_Count; i++) Peers[i].cfg.bonded = false;
+}
@@ -0,0 +1,129 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2023 touchgadgetdev@gmail.com
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef _SIM_BLE_H_
+#define _SIM_BLE_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+/*
+ * Scripted BLE HID peers for the host simulation. Each peer has a HID
+ * service built from its report map: the report map characteristic and one
+ * input report characteristic (with CCCD and Report Reference) per input
+ * report ID. A peer with boot_mouse also has the Protocol Mode and Boot
+ * Mouse Input Report characteristics; after the bridge writes boot
+ * protocol it only sends boot reports. A peer with a vendor_id also has a
+ * Device Information Service with only the PnP ID characteristic. The simulation driver plays the
+ * NimBLE host task: it
+ * advertises a peer while the bridge scans, sends notifications, and
+ * disconnects. Connection parameter updates from the bridge are applied at
+ * once and reported with BLE_GAP_EVENT_CONN_UPDATE.
+ */
+
+#define SIM_PEERS_MAX (4)
+
+typedef struct {
+  const char *name;
+  uint8_t address[6];
+  const uint8_t *report_map;
+  size_t report_map_len;
+  bool bonded;
+  uint16_t min_interval;    // shortest interval accepted, 1.25 ms units
+  bool boot_mouse;          // supports boot protocol
+  uint16_t vendor_id;       // PnP ID, 0 if no Device Information Service
+  uint16_t product_id;
+} sim_peer_t;
+
+typedef struct {
+  uint32_t att_rtt_us;      // each connect, discovery, read, or write
+} sim_ble_config_t;
+
+typedef struct {
+  uint32_t connects;
+  uint32_t disconnects;
+  uint32_t att_ops;
+  uint32_t discoveries;
+  uint32_t report_map_reads;
+  uint32_t cccd_writes;
+  uint32_t protocol_mode_writes;
+  uint32_t notifications;   // delivered to the bridge
+  uint32_t conn_param_updates;
+  uint32_t conn_param_refused;
+  uint16_t interval;        // in use, 1.25 ms units
+  uint16_t latency;
+  // Time notifications waited for a connection event
+  uint64_t air_delay_total_us;
+  uint32_t air_delay_max_us;
+} sim_ble_stats_t;
+
+sim_ble_config_t *sim_ble_config(void);
+
+/*
+ * Add a peer. Returns its index or -1 if there are too many.
+ */
+int sim_ble_add_peer(const sim_peer_t *peer);
+
+/*
+ * Deliver the advertisement of peer to the scan callback. Like the
+ * controller, drops it if the scan uses the filter accept list and peer is
+ * not on it, or peer was already reported since the scan started. Returns
+ * false if the bridge is not scanning.
+ */
+bool sim_ble_advertise(int peer);
+
+bool sim_ble_is_scanning(void);
+
+bool sim_ble_is_connected(int peer);
+
+/*
+ * Notify the input report with report_id. data does not include the report
+ * ID, as over BLE. Waits for the next connection event. Returns false if
+ * the report is not subscribed or the peer is in boot protocol.
+ */
+bool sim_ble_notify(int peer, uint8_t report_id, const uint8_t *data,
+    size_t len);
+
+/*
+ * True while the bridge has the peer in boot protocol. Reports are then
+ * sent with sim_ble_notify_boot() instead of sim_ble_notify().
+ */
+bool sim_ble_boot_protocol(int peer);
+
+/*
+ * Notify the boot mouse input report. Waits for the next connection event.
+ * Returns false if the peer is not in boot protocol or the report is not
+ * subscribed.
+ */
+bool sim_ble_notify_boot(int peer, const uint8_t *data, size_t len);
+
+/*
+ * Peer initiated disconnect.
+ */
+void sim_ble_disconnect(int peer);
+
+const sim_ble_stats_t *sim_ble_stats(int peer);
+
+#endif  /* _SIM_BLE_H_ */
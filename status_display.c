@@ -0,0 +1,475 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2023 touchgadgetdev@gmail.com
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include "./status_display.h"
+
+// Short enough for 10 columns, the AtomS3 at text size 2.
+static const struct {
+  const char *label;
+  uint16_t color;
+} STATES[STATUS_STATES] = {
+  [STATUS_STARTING] = { "BLE to XAC", STATUS_WHITE },
+  [STATUS_SCANNING] = { "Scanning", STATUS_YELLOW },
+  [STATUS_CONNECTED] = { "Connected", STATUS_WHITE },
+  [STATUS_RECONNECTED] = { "Reconnect", STATUS_GREEN },
+  [STATUS_RECONNECT_FAILED] = { "Recon fail", STATUS_YELLOW },
+  [STATUS_CONNECT_FAILED] = { "Conn fail", STATUS_YELLOW },
+  [STATUS_DISCONNECTED] = { "Disconnect", STATUS_YELLOW },
+  [STATUS_ACTIVE] = { "Mouse XAC", STATUS_GREEN },
+};
+
+enum {
+  ROW_STATE,
+  ROW_NAME,
+  ROW_RATE,
+  ROW_LATENCY,
+  ROW_RSSI,
+  ROW_MESSAGE,
+};
+
+static void set_text(char *dst, uint32_t *gen, const char *text) {
+  strncpy(dst, text, STATUS_TEXT_MAX - 1);
+  dst[STATUS_TEXT_MAX - 1] = '\0';
+  __atomic_store_n(gen, *gen + 1, __ATOMIC_RELEASE);
+}
+
+void status_set_name(status_model_t *m, const char *name) {
+  set_text(m->name, &m->name_gen, name);
+}
+
+void status_set_message(status_model_t *m, const char *message,
+    uint16_t color) {
+  __atomic_store_n(&m->message_color, color, __ATOMIC_RELAXED);
+  set_text(m->message, &m->message_gen, message);
+}
+
+/*
+ * Copy a model string if it changed. If it changes while being copied the
+ * copy may be torn; the generation is not taken so it is copied again.
+ */
+static void copy_text(char *dst, uint32_t *dst_gen, const char *src,
+    const uint32_t *src_gen) {
+  uint32_t gen = __atomic_load_n(src_gen, __ATOMIC_ACQUIRE);
+  if (gen == *dst_gen) return;
+  memcpy(dst, src, STATUS_TEXT_MAX);
+  dst[STATUS_TEXT_MAX - 1] = '\0';
+  if (__atomic_load_n(src_gen, __ATOMIC_ACQUIRE) == gen) *dst_gen = gen;
+}
+
+static void clear_frame(status_frame_t *f) {
+  memset(f->text, ' ', sizeof(f->text));
+  memset(f->color, 0, sizeof(f->color));
+}
+
+void status_display_init(status_display_t *d, uint8_t rows, uint8_t cols,
+    status_draw_fn draw, status_led_fn led, void *ctx) {
+  memset(d, 0, sizeof(*d));
+  d->rows = (rows > STATUS_ROWS_MAX) ? STATUS_ROWS_MAX : rows;
+  d->cols = (cols > STATUS_COLS_MAX) ? STATUS_COLS_MAX : cols;
+  d->draw = draw;
+  d->led = led;
+  d->ctx = ctx;
+  clear_frame(&d->shown);
+}
+
+static void put_row(status_display_t *d, uint8_t row, const char *text,
+    uint16_t color) {
+  if (row >= d->rows) return;
+  size_t len = strlen(text);
+  if (len > d->cols) len = d->cols;
+  memcpy(d->next.text[row], text, len);
+  for (size_t i = 0; i < len; i++) d->next.color[row][i] = color;
+}
+
+static void update_rate(status_display_t *d, uint32_t reports,
+    uint32_t now_us) {
+  if (!d->rate_started) {
+    d->rate_started = true;
+    d->rate_start_us = now_us;
+    d->rate_start_reports = reports;
+    return;
+  }
+  uint32_t elapsed = now_us - d->rate_start_us;
+  if (elapsed < STATUS_RATE_US) return;
+  d->rate = (uint32_t)((uint64_t)(reports - d->rate_start_reports) *
+      1000000 / elapsed);
+  d->rate_valid = true;
+  d->rate_start_us = now_us;
+  d->rate_start_reports = reports;
+}
+
+static void layout(status_display_t *d, const status_model_t *m,
+    uint32_t now_us) {
+  char line[STATUS_COLS_MAX + 1];
+  clear_frame(&d->next);
+  uint8_t state = __atomic_load_n(&m->state, __ATOMIC_RELAXED);
+  if (state >= STATUS_STATES) state = STATUS_STARTING;
+  put_row(d, ROW_STATE, STATES[state].label, STATES[state].color);
+  copy_text(d->name, &d->name_gen, m->name, &m->name_gen);
+  put_row(d, ROW_NAME, d->name, STATUS_WHITE);
+  update_rate(d, __atomic_load_n(&m->reports, __ATOMIC_RELAXED), now_us);
+  if (d->rate_valid) {
+    snprintf(line, sizeof(line), "%lu rep/s", (unsigned long)d->rate);
+    put_row(d, ROW_RATE, line, STATUS_WHITE);
+  }
+  uint32_t p50 = __atomic_load_n(&m->p50_us, __ATOMIC_RELAXED);
+  uint32_t p99 = __atomic_load_n(&m->p99_us, __ATOMIC_RELAXED);
+  if (p99 != 0) {
+    snprintf(line, sizeof(line), "lat %lu/%lu us", (unsigned long)p50,
+        (unsigned long)p99);
+    put_row(d, ROW_LATENCY, line, STATUS_GREEN);
+  }
+  int8_t rssi = __atomic_load_n(&m->rssi, __ATOMIC_RELAXED);
+  if (rssi != 0) {
+    snprintf(line, sizeof(line), "RSSI %d", rssi);
+    put_row(d, ROW_RSSI, line, STATUS_WHITE);
+  }
+  copy_text(d->message, &d->message_gen, m->message, &m->message_gen);
+  put_row(d, ROW_MESSAGE, d->message,
+      __atomic_load_n(&m->message_color, __ATOMIC_RELAXED));
+}
+
+// A space looks the same in any color.
+static bool cell_differs(const status_frame_t *a, const status_frame_t *b,
+    uint8_t row, uint8_t col) {
+  char ca = a->text[row][col];
+  if (ca != b->text[row][col]) return true;
+  return (ca != ' ') && (a->color[row][col] != b->color[row][col]);
+}
+
+/*
+ * Draw the cells of row from the first to the last that changed, one draw
+ * per run of one color. Returns the number of draws.
+ */
+static uint32_t draw_row(status_display_t *d, uint8_t row) {
+  int first = -1, last = -1;
+  for (int col = 0; col < d->cols; col++) {
+    if (cell_differs(&d->next, &d->shown, row, col)) {
+      if (first < 0) first = col;
+      last = col;
+    }
+  }
+  if (first < 0) return 0;
+  uint32_t draws = 0;
+  const char *text = d->next.text[row];
+  const uint16_t *color = d->next.color[row];
+  for (int start = first; start <= last; ) {
+    // The run takes the color of its first non-space cell.
+    int end = start;
+    bool colored = false;
+    uint16_t run_color = STATUS_WHITE;
+    for (; end <= last; end++) {
+      if (text[end] == ' ') continue;
+      if (!colored) {
+        colored = true;
+        run_color = color[end];
+      } else if (color[end] != run_color) {
+        break;
+      }
+    }
+    d->draw(d->ctx, row, (uint8_t)start, &text[start], end - start, run_color);
+    draws++;
+    d->cells += end - start;
+    start = end;
+  }
+  memcpy(&d->shown.text[row][first], &text[first], last - first + 1);
+  memcpy(&d->shown.color[row][first], &color[first],
+      (last - first + 1) * sizeof(color[0]));
+  return draws;
+}
+
+uint32_t status_display_render(status_display_t *d, const status_model_t *m,
+    uint32_t now_us) {
+  layout(d, m, now_us);
+  uint32_t draws = 0;
+  for (uint8_t row = 0; row < d->rows; row++) draws += draw_row(d, row);
+  uint32_t led = __atomic_load_n(&m->led, __ATOMIC_RELAXED);
+  if ((d->led != NULL) && (!d->led_shown || (led != d->led_rgb))) {
+    d->led(d->ctx, led);
+    d->led_shown = true;
+    d->led_rgb = led;
+  }
+  d->frames++;
+  d->draws += draws;
+  return draws;
+}
+
+#if DEBUG_STATUS_DISPLAY_MAIN
+/*
+ * Build and run on Linux.
+ *   gcc -O2 -pthread -DDEBUG_STATUS_DISPLAY_MAIN=1 -o status_display_test \
+ *     status_display.c
+ *   ./status_display_test
+ * Renders into a text framebuffer and checks what is drawn, then compares
+ * the pixels sent to the screen with clearing and printing on every
+ * change as the sketch used to.
+ */
+#include <inttypes.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdlib.h>
+
+#define ROWS    (5)       // T-Dongle-S3 at text size 2: 160x80, 12x16 cells
+#define COLS    (13)
+#define CELL_W  (12)
+#define CELL_H  (16)
+
+typedef struct {
+  char text[ROWS][COLS];
+  uint16_t color[ROWS][COLS];
+  uint32_t draws;
+  uint32_t cells;
+  uint32_t led;
+  uint32_t led_sets;
+} screen_t;
+
+static int Errors;
+
+static void screen_draw(void *ctx, uint8_t row, uint8_t col, const char *text,
+    size_t len, uint16_t color) {
+  screen_t *s = (screen_t *)ctx;
+  if ((row >= ROWS) || (col + len > COLS) || (len == 0)) {
+    printf("FAIL draw row %u col %u len %zu\n", row, col, len);
+    Errors++;
+    return;
+  }
+  memcpy(&s->text[row][col], text, len);
+  for (size_t i = 0; i < len; i++) s->color[row][col + i] = color;
+  s->draws++;
+  s->cells += len;
+}
+
+static void screen_led(void *ctx, uint32_t rgb) {
+  screen_t *s = (screen_t *)ctx;
+  s->led = rgb;
+  s->led_sets++;
+}
+
+static void screen_clear(screen_t *s) {
+  memset(s, 0, sizeof(*s));
+  memset(s->text, ' ', sizeof(s->text));
+}
+
+static void expect_row(const screen_t *s, uint8_t row, const char *want,
+    uint16_t color) {
+  char padded[COLS + 1];
+  snprintf(padded, sizeof(padded), "%-*s", COLS, want);
+  if (memcmp(s->text[row], padded, COLS) != 0) {
+    printf("FAIL row %u: \"%.*s\" expected \"%s\"\n", row, COLS,
+        s->text[row], padded);
+    Errors++;
+  }
+  for (size_t i = 0; (i < strlen(want)) && (i < COLS); i++) {
+    if ((want[i] != ' ') && (s->color[row][i] != color)) {
+      printf("FAIL row %u col %zu color %04x expected %04x\n", row, i,
+          s->color[row][i], color);
+      Errors++;
+      break;
+    }
+  }
+}
+
+static void expect_draws(const char *what, const screen_t *s, uint32_t draws,
+    uint32_t cells) {
+  if ((s->draws != draws) || (s->cells != cells)) {
+    printf("FAIL %s: %" PRIu32 " draws %" PRIu32 " cells, expected %" PRIu32
+        " draws %" PRIu32 " cells\n", what, s->draws, s->cells, draws, cells);
+    Errors++;
+  }
+}
+
+static void test_render(void) {
+  static status_model_t m;
+  static status_display_t d;
+  screen_t s;
+  screen_clear(&s);
+  memset(&m, 0, sizeof(m));
+  status_display_init(&d, ROWS, COLS, screen_draw, screen_led, &s);
+  uint32_t now = 1000;
+  status_display_render(&d, &m, now);
+  expect_row(&s, 0, "BLE to XAC", STATUS_WHITE);
+  expect_draws("first frame", &s, 1, 10);
+  if (s.led_sets != 1) {
+    printf("FAIL led not set\n");
+    Errors++;
+  }
+
+  // Nothing changed, nothing drawn
+  s.draws = s.cells = 0;
+  status_display_render(&d, &m, now += 100000);
+  expect_draws("same frame", &s, 0, 0);
+
+  // Only the cells that differ: "Scanning" over "BLE to XAC"
+  status_set_state(&m, STATUS_SCANNING);
+  status_set_led(&m, 0xFFFF00);
+  status_display_render(&d, &m, now += 100000);
+  expect_row(&s, 0, "Scanning", STATUS_YELLOW);
+  expect_draws("state", &s, 1, 10);
+  if ((s.led != 0xFFFF00) || (s.led_sets != 2)) {
+    printf("FAIL led %06" PRIx32 " sets %" PRIu32 "\n", s.led, s.led_sets);
+    Errors++;
+  }
+
+  status_set_state(&m, STATUS_CONNECTED);
+  status_set_name(&m, "c6:05:04:03:02:01");
+  status_set_rssi(&m, -50);
+  status_display_render(&d, &m, now += 100000);
+  expect_row(&s, 0, "Connected", STATUS_WHITE);
+  expect_row(&s, 1, "c6:05:04:03:0", STATUS_WHITE);
+  expect_row(&s, 4, "RSSI -50", STATUS_WHITE);
+
+  // One digit of RSSI is one cell.
+  s.draws = s.cells = 0;
+  status_set_rssi(&m, -51);
+  status_display_render(&d, &m, now += 100000);
+  expect_row(&s, 4, "RSSI -51", STATUS_WHITE);
+  expect_draws("rssi", &s, 1, 1);
+
+  // A shorter name clears the rest of the old one.
+  status_set_name(&m, "Mouse");
+  status_display_render(&d, &m, now += 100000);
+  expect_row(&s, 1, "Mouse", STATUS_WHITE);
+
+  // Rate over the second from the first frame, then latency.
+  status_set_state(&m, STATUS_ACTIVE);
+  for (int i = 0; i < 133; i++) status_report(&m);
+  status_display_render(&d, &m, now = 1000 + 1000000);
+  expect_row(&s, 2, "133 rep/s", STATUS_WHITE);
+  status_set_latency(&m, 23, 79);
+  for (int i = 0; i < 125; i++) status_report(&m);
+  s.draws = s.cells = 0;
+  status_display_render(&d, &m, now += 1000000);
+  expect_row(&s, 0, "Mouse XAC", STATUS_GREEN);
+  expect_row(&s, 2, "125 rep/s", STATUS_WHITE);
+  expect_row(&s, 3, "lat 23/79 us", STATUS_GREEN);
+  expect_draws("rate and latency", &s, 2, 14);
+
+  // A message below the rows of the screen is not drawn.
+  s.draws = s.cells = 0;
+  status_set_message(&m, "Bonds Erased", STATUS_RED);
+  status_display_render(&d, &m, now += 100000);
+  expect_draws("message off screen", &s, 0, 0);
+
+  // Text in another color is drawn again, spaces are not.
+  for (int col = 0; col < COLS; col++) d.shown.color[0][col] = STATUS_YELLOW;
+  s.draws = s.cells = 0;
+  status_display_render(&d, &m, now += 100000);
+  expect_draws("recolor", &s, 1, 9);
+}
+
+// The renderer reads the model while another thread writes it. After the
+// writer stops, one more frame shows the final model.
+static status_model_t Shared;
+static volatile bool Writer_Done;
+
+static void *writer(void *arg) {
+  (void)arg;
+  static const char *names[] = { "first mouse", "a trackball", "x" };
+  for (uint32_t i = 0; i < 200000; i++) {
+    status_report(&Shared);
+    if ((i % 100) == 0) status_set_name(&Shared, names[(i / 100) % 3]);
+    if ((i % 1000) == 0) status_set_latency(&Shared, i % 97, i % 991);
+    if ((i % 64) == 0) sched_yield();
+  }
+  status_set_name(&Shared, "done");
+  __atomic_store_n(&Writer_Done, true, __ATOMIC_RELEASE);
+  return NULL;
+}
+
+static void test_threads(void) {
+  static status_display_t d;
+  screen_t s;
+  screen_clear(&s);
+  status_display_init(&d, ROWS, COLS, screen_draw, NULL, &s);
+  pthread_t thread;
+  pthread_create(&thread, NULL, writer, NULL);
+  uint32_t now = 0;
+  while (!__atomic_load_n(&Writer_Done, __ATOMIC_ACQUIRE)) {
+    status_display_render(&d, &Shared, now += 1000);
+    sched_yield();
+  }
+  pthread_join(thread, NULL);
+  status_display_render(&d, &Shared, now += 1000);
+  char latency[32];
+  snprintf(latency, sizeof(latency), "lat %" PRIu32 "/%" PRIu32 " us",
+      Shared.p50_us, Shared.p99_us);
+  expect_row(&s, 1, "done", STATUS_WHITE);
+  expect_row(&s, 3, latency, STATUS_GREEN);
+  printf("threads: %" PRIu32 " frames, %" PRIu32 " draws\n", d.frames,
+      d.draws);
+}
+
+static uint64_t nanos(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/*
+ * A minute at 10 frames per second with the report rate and latency
+ * changing every second, against clearing the screen and printing all the
+ * text at each change.
+ */
+static void bench(void) {
+  static status_model_t m;
+  static status_display_t d;
+  screen_t s;
+  screen_clear(&s);
+  memset(&m, 0, sizeof(m));
+  status_display_init(&d, ROWS, COLS, screen_draw, NULL, &s);
+  status_set_state(&m, STATUS_ACTIVE);
+  status_set_name(&m, "c6:05:04:03:02:01");
+  status_set_rssi(&m, -60);
+  uint32_t changes = 0;
+  uint64_t ns = 0;
+  uint32_t frames = 600;
+  for (uint32_t frame = 0; frame < frames; frame++) {
+    uint32_t now = frame * 100000;
+    for (int i = 0; i < 13; i++) status_report(&m);
+    if ((frame % 10) == 0) {
+      status_set_latency(&m, 20 + rand() % 10, 70 + rand() % 30);
+      changes++;
+    }
+    uint64_t start = nanos();
+    status_display_render(&d, &m, now);
+    ns += nanos() - start;
+  }
+  uint64_t pixels = (uint64_t)s.cells * CELL_W * CELL_H;
+  uint64_t full = (uint64_t)changes * (ROWS * CELL_H) * (COLS * CELL_W);
+  printf("%" PRIu32 " frames, %.2f us each: %" PRIu32 " draws, %" PRIu64
+      " pixels vs %" PRIu64 " clearing on %" PRIu32 " changes (%.1f%%)\n",
+      frames, ns / 1000.0 / frames, s.draws, pixels, full, changes,
+      100.0 * pixels / full);
+}
+
+int main(void) {
+  test_render();
+  test_threads();
+  bench();
+  printf("errors %d\n", Errors);
+  return Errors != 0;
+}
+#endif  /* DEBUG_STATUS_DISPLAY_MAIN */
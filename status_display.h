@@ -0,0 +1,170 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2023 touchgadgetdev@gmail.com
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef _STATUS_DISPLAY_H_
+#define _STATUS_DISPLAY_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+/*
+ * Status shown on the boards with a display and RGB LED. The BLE callbacks
+ * and the bridge task only store values in a status_model_t. A low
+ * priority task calls status_display_render() a few times per second; it
+ * lays the model out as rows of text cells, compares them with what is on
+ * the screen, and draws only the runs of cells that changed. Nothing is
+ * drawn when nothing changed, and the screen is never cleared.
+ *
+ * The model has one writer per field. The renderer may see a string being
+ * written; it draws it again when the write is done.
+ */
+
+#define STATUS_ROWS_MAX   (8)
+#define STATUS_COLS_MAX   (32)
+#define STATUS_TEXT_MAX   (24)      // name and message, with the 0
+#define STATUS_RATE_US    (1000000) // report rate is counted over this
+
+// RGB565, as TFT_eSPI and M5GFX take colors
+#define STATUS_BLACK      (0x0000)
+#define STATUS_WHITE      (0xFFFF)
+#define STATUS_YELLOW     (0xFFE0)
+#define STATUS_GREEN      (0x07E0)
+#define STATUS_RED        (0xF800)
+#define STATUS_MAGENTA    (0xF81F)
+
+enum {
+  STATUS_STARTING,
+  STATUS_SCANNING,
+  STATUS_CONNECTED,         // connected, reading the HID service
+  STATUS_RECONNECTED,
+  STATUS_RECONNECT_FAILED,
+  STATUS_CONNECT_FAILED,
+  STATUS_DISCONNECTED,
+  STATUS_ACTIVE,            // reports go to the XAC
+  STATUS_STATES,
+};
+
+typedef struct {
+  uint8_t state;
+  int8_t rssi;              // dBm of the last device connected, 0 unknown
+  uint16_t message_color;
+  uint32_t led;             // 0xRRGGBB
+  uint32_t reports;         // notifications received
+  uint32_t p50_us;          // notification to joystick write latency
+  uint32_t p99_us;
+  // Incremented after the string is written.
+  uint32_t name_gen;
+  uint32_t message_gen;
+  char name[STATUS_TEXT_MAX];     // device name or address
+  char message[STATUS_TEXT_MAX];
+} status_model_t;
+
+static inline void status_set_state(status_model_t *m, uint8_t state) {
+  __atomic_store_n(&m->state, state, __ATOMIC_RELAXED);
+}
+
+static inline void status_set_led(status_model_t *m, uint32_t rgb) {
+  __atomic_store_n(&m->led, rgb, __ATOMIC_RELAXED);
+}
+
+static inline void status_set_rssi(status_model_t *m, int8_t rssi) {
+  __atomic_store_n(&m->rssi, rssi, __ATOMIC_RELAXED);
+}
+
+// One writer: the task that receives notifications.
+static inline void status_report(status_model_t *m) {
+  __atomic_store_n(&m->reports, m->reports + 1, __ATOMIC_RELAXED);
+}
+
+static inline void status_set_latency(status_model_t *m, uint32_t p50_us,
+    uint32_t p99_us) {
+  __atomic_store_n(&m->p50_us, p50_us, __ATOMIC_RELAXED);
+  __atomic_store_n(&m->p99_us, p99_us, __ATOMIC_RELAXED);
+}
+
+void status_set_name(status_model_t *m, const char *name);
+
+void status_set_message(status_model_t *m, const char *message,
+    uint16_t color);
+
+/*
+ * Draw len characters of text starting at a cell, in color on black.
+ * Spaces are drawn too; they clear what was there.
+ */
+typedef void (*status_draw_fn)(void *ctx, uint8_t row, uint8_t col,
+    const char *text, size_t len, uint16_t color);
+
+/*
+ * Set the RGB LED, 0xRRGGBB.
+ */
+typedef void (*status_led_fn)(void *ctx, uint32_t rgb);
+
+typedef struct {
+  char text[STATUS_ROWS_MAX][STATUS_COLS_MAX];
+  uint16_t color[STATUS_ROWS_MAX][STATUS_COLS_MAX];
+} status_frame_t;
+
+typedef struct {
+  uint8_t rows;
+  uint8_t cols;
+  status_draw_fn draw;
+  status_led_fn led;
+  void *ctx;
+  status_frame_t shown;     // what is on the screen
+  status_frame_t next;
+  bool led_shown;
+  uint32_t led_rgb;
+  // Copies of the model strings and the generation they are from
+  char name[STATUS_TEXT_MAX];
+  uint32_t name_gen;
+  char message[STATUS_TEXT_MAX];
+  uint32_t message_gen;
+  // Report rate
+  uint32_t rate_start_us;
+  uint32_t rate_start_reports;
+  uint32_t rate;
+  bool rate_started;
+  bool rate_valid;
+  // Statistics
+  uint32_t frames;
+  uint32_t draws;
+  uint32_t cells;           // cells drawn
+} status_display_t;
+
+/*
+ * rows and cols are those of the screen, at most STATUS_ROWS_MAX and
+ * STATUS_COLS_MAX are used. The screen must be clear. led may be NULL.
+ */
+void status_display_init(status_display_t *d, uint8_t rows, uint8_t cols,
+    status_draw_fn draw, status_led_fn led, void *ctx);
+
+/*
+ * Lay out the model and draw the cells that changed. Returns the number of
+ * draw calls.
+ */
+uint32_t status_display_render(status_display_t *d, const status_model_t *m,
+    uint32_t now_us);
+
+#endif  /* _STATUS_DISPLAY_H_ */
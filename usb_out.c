@@ -0,0 +1,340 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2023 touchgadgetdev@gmail.com
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <string.h>
+#include "./usb_out.h"
+
+static inline uint8_t *slot(usb_out_t *u, uint32_t i) {
+  return u->queue[(u->head + i) & (USB_OUT_QUEUE_MAX - 1)];
+}
+
+static inline usb_out_stamp_t *slot_stamp(usb_out_t *u, uint32_t i) {
+  return &u->stamps[(u->head + i) & (USB_OUT_QUEUE_MAX - 1)];
+}
+
+static inline uint32_t earlier(uint32_t a, uint32_t b) {
+  return ((int32_t)(a - b) < 0) ? a : b;
+}
+
+// Keep the earlier times of a report merged into a queued one.
+static void merge_stamp(usb_out_stamp_t *into, const usb_out_stamp_t *stamp) {
+  if (!stamp->valid) return;
+  if (!into->valid) {
+    *into = *stamp;
+    return;
+  }
+  into->made_us = earlier(into->made_us, stamp->made_us);
+  into->oldest_us = earlier(into->oldest_us, stamp->oldest_us);
+}
+
+bool usb_out_init(usb_out_t *u, const usb_out_endpoint_t *ep, size_t len,
+    uint32_t interval_us) {
+  memset(u, 0, sizeof(*u));
+  if ((len == 0) || (len > USB_OUT_REPORT_MAX) || (ep->send == NULL)) {
+    return false;
+  }
+  u->ep = *ep;
+  u->len = len;
+  u->interval_us = (interval_us == 0) ? USB_OUT_INTERVAL_US : interval_us;
+  return true;
+}
+
+void usb_out_submit(usb_out_t *u, const void *report, bool event) {
+  usb_out_submit_stamped(u, report, event, NULL);
+}
+
+void usb_out_submit_stamped(usb_out_t *u, const void *report, bool event,
+    const usb_out_stamp_t *stamp) {
+  static const usb_out_stamp_t none = { 0, 0, false };
+  if (stamp == NULL) stamp = &none;
+  u->stats.submitted++;
+  if (u->count == 0) {
+    if (u->have_last && (memcmp(report, u->last, u->len) == 0)) {
+      u->stats.suppressed++;
+      return;
+    }
+    memcpy(slot(u, 0), report, u->len);
+    *slot_stamp(u, 0) = *stamp;
+    u->count = 1;
+    return;
+  }
+  if (event && (u->count < USB_OUT_QUEUE_MAX)) {
+    memcpy(slot(u, u->count), report, u->len);
+    *slot_stamp(u, u->count) = *stamp;
+    u->count++;
+    return;
+  }
+  if (event) u->stats.overflows++;
+  uint8_t *tail = slot(u, u->count - 1);
+  memcpy(tail, report, u->len);
+  merge_stamp(slot_stamp(u, u->count - 1), stamp);
+  u->stats.merged++;
+  // Changed back to what the host already has.
+  if ((u->count == 1) && u->have_last &&
+      (memcmp(tail, u->last, u->len) == 0)) {
+    u->count = 0;
+    u->stats.suppressed++;
+  }
+}
+
+uint32_t usb_out_poll(usb_out_t *u, uint32_t now_us) {
+  if (u->count == 0) return 0;
+  if (u->ep.ready != NULL) {
+    // The endpoint is busy until the host takes the last report, which
+    // limits it to one report per frame.
+    if (!u->ep.ready(u->ep.ctx)) {
+      u->stats.busy++;
+      return (u->interval_us >= 4) ? u->interval_us / 4 : 1;
+    }
+  } else if (u->have_last && ((now_us - u->last_us) < u->interval_us)) {
+    return u->interval_us - (now_us - u->last_us);
+  }
+  uint8_t *report = slot(u, 0);
+  if (!u->ep.send(u->ep.ctx, report, u->len)) {
+    u->stats.busy++;
+    return u->interval_us;
+  }
+  memcpy(u->last, report, u->len);
+  u->have_last = true;
+  u->last_us = now_us;
+  const usb_out_stamp_t *stamp = slot_stamp(u, 0);
+  if (stamp->valid && (u->ep.sent != NULL)) u->ep.sent(u->ep.ctx, stamp);
+  u->head = (u->head + 1) & (USB_OUT_QUEUE_MAX - 1);
+  u->count--;
+  u->stats.sent++;
+  return (u->count > 0) ? u->interval_us : 0;
+}
+
+#if DEBUG_USB_OUT_MAIN
+/*
+ * Fake endpoint test. Build and run on Linux with
+ *   gcc -O2 -DDEBUG_USB_OUT_MAIN=1 -o usb_out_test usb_out.c
+ * Virtual time. The host takes a report from the endpoint every
+ * USB_OUT_INTERVAL_US. The bridge submits mouse motion several times per
+ * frame, a button change every few frames, and the centered report every
+ * 32 ms while idle, like the bridge task. Checks fewer reports go on the
+ * wire than are submitted, never more than one per frame, every button
+ * change reaches the host in order, and the host never lags the bridge by
+ * more than two frames and a retry. The sent callback must see every
+ * report with the time its oldest merged submit was made.
+ */
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#define STEP_US     (25)
+#define RUN_US      (10000000)
+#define HISTORY     (1 << 16)
+#define STALE_US    (2 * USB_OUT_INTERVAL_US + USB_OUT_INTERVAL_US / 4 + STEP_US)
+
+typedef struct {
+  uint16_t x;
+  uint16_t y;
+  uint8_t buttons;
+  uint8_t pad[3];
+} test_report_t;
+
+typedef struct {
+  bool full;              // holds a report the host has not taken
+  test_report_t buffer;
+  test_report_t host;     // last report the host took
+  uint32_t wire;          // reports taken by the host
+  uint32_t polls;
+  uint32_t frames_with_two;
+} test_endpoint_t;
+
+static test_endpoint_t Ep;
+static uint32_t Now;
+// Submitted reports, for the staleness check
+static test_report_t Submitted[HISTORY];
+static uint32_t Submitted_us[HISTORY];
+static uint32_t Submitted_count;
+// Button values in order as submitted and as seen by the host
+static uint8_t Buttons_In[HISTORY];
+static uint32_t Buttons_In_count;
+static uint8_t Buttons_Out[HISTORY];
+static uint32_t Buttons_Out_count;
+// Sent callbacks and the longest a stamped report waited to be sent
+static uint32_t Stamps_Sent;
+static uint32_t Stamp_Wait_max;
+static usb_out_stamp_t Last_Stamp;
+
+static bool ep_ready(void *ctx) {
+  (void)ctx;
+  return !Ep.full;
+}
+
+static bool ep_send(void *ctx, const void *report, size_t len) {
+  (void)ctx;
+  if (Ep.full) {
+    Ep.frames_with_two++;
+    return false;
+  }
+  memcpy(&Ep.buffer, report, len);
+  Ep.full = true;
+  return true;
+}
+
+static void ep_sent(void *ctx, const usb_out_stamp_t *stamp) {
+  (void)ctx;
+  Stamps_Sent++;
+  Last_Stamp = *stamp;
+  if ((Now - stamp->made_us) > Stamp_Wait_max) {
+    Stamp_Wait_max = Now - stamp->made_us;
+  }
+}
+
+static void host_poll(void) {
+  Ep.polls++;
+  if (!Ep.full) return;
+  Ep.full = false;
+  Ep.wire++;
+  if (Ep.buffer.buttons != Ep.host.buttons) {
+    Buttons_Out[Buttons_Out_count++ & (HISTORY - 1)] = Ep.buffer.buttons;
+  }
+  Ep.host = Ep.buffer;
+}
+
+// The host state is no older than STALE_US: it matches a report submitted
+// since Now - STALE_US or, if none, the last one before.
+static bool fresh(void) {
+  for (uint32_t i = Submitted_count; i-- > 0;) {
+    const test_report_t *r = &Submitted[i & (HISTORY - 1)];
+    if (memcmp(r, &Ep.host, sizeof(*r)) == 0) return true;
+    if ((Now - Submitted_us[i & (HISTORY - 1)]) > STALE_US) return false;
+  }
+  return true;
+}
+
+int main(void) {
+  int errors = 0;
+  static usb_out_t u;
+  usb_out_endpoint_t ep = { ep_ready, ep_send, NULL, ep_sent };
+  usb_out_init(&u, &ep, sizeof(test_report_t), USB_OUT_INTERVAL_US);
+  test_report_t r = { 511, 511, 0, { 0 } };
+  Ep.host = r;
+  uint32_t retry_at = 0;
+  uint32_t next_motion = 0;
+  uint32_t next_idle = 0;
+  uint32_t stale = 0;
+  srand(1);
+  for (Now = 0; Now < RUN_US; Now += STEP_US) {
+    if ((Now % USB_OUT_INTERVAL_US) == 0) {
+      host_poll();
+      // Button events are a few frames apart here, so no backlog.
+      if (!fresh()) stale++;
+    }
+    bool submit = false;
+    bool event = false;
+    // Moving for 500 ms of every second, BLE reports several per frame.
+    bool moving = (Now % 1000000) < 500000;
+    if (moving && (Now >= next_motion)) {
+      next_motion = Now + 200 + (rand() % 600);
+      r.x = 511 + (rand() % 64) - 32;
+      r.y = 511 + (rand() % 64) - 32;
+      if ((rand() % 16) == 0) {
+        r.buttons ^= 1 << (rand() % 4);
+        event = true;
+        next_motion += 3 * USB_OUT_INTERVAL_US;
+      }
+      submit = true;
+    } else if (!moving && (Now >= next_idle)) {
+      next_idle = Now + 32000;
+      r.x = r.y = 511;
+      submit = true;
+    }
+    if (submit) {
+      Submitted[Submitted_count & (HISTORY - 1)] = r;
+      Submitted_us[Submitted_count & (HISTORY - 1)] = Now;
+      Submitted_count++;
+      if (event) Buttons_In[Buttons_In_count++ & (HISTORY - 1)] = r.buttons;
+      usb_out_stamp_t stamp = { Now, Now, true };
+      usb_out_submit_stamped(&u, &r, event, &stamp);
+      retry_at = Now;
+    }
+    if (retry_at && (Now >= retry_at)) {
+      uint32_t wait = usb_out_poll(&u, Now);
+      retry_at = wait ? Now + wait : 0;
+    }
+  }
+  // Every report sent in the run had a stamp.
+  uint32_t sent_in_run = u.stats.sent;
+  if ((Stamps_Sent != sent_in_run) || (Stamp_Wait_max > STALE_US)) errors++;
+  // Burst: several button changes in one frame all reach the host.
+  Now = (Now / USB_OUT_INTERVAL_US + 1) * USB_OUT_INTERVAL_US;
+  host_poll();
+  uint32_t burst_from = Buttons_Out_count;
+  for (int i = 0; i < 6; i++) {
+    r.buttons ^= 0x10;
+    Buttons_In[Buttons_In_count++ & (HISTORY - 1)] = r.buttons;
+    usb_out_submit(&u, &r, true);
+    usb_out_poll(&u, Now + i);
+  }
+  for (int i = 0; i < 8; i++) {
+    Now += USB_OUT_INTERVAL_US;
+    host_poll();
+    usb_out_poll(&u, Now + USB_OUT_INTERVAL_US / 4);
+  }
+  host_poll();
+  // The burst had no stamps.
+  if (Stamps_Sent != sent_in_run) errors++;
+  // A report merged into a queued one keeps the older time.
+  usb_out_stamp_t older = { Now - 700, Now - 900, true };
+  usb_out_stamp_t newer = { Now - 100, Now - 300, true };
+  r.x ^= 1;
+  usb_out_submit_stamped(&u, &r, false, &older);
+  r.x ^= 2;
+  usb_out_submit_stamped(&u, &r, false, &newer);
+  usb_out_poll(&u, Now);
+  host_poll();
+  if ((Stamps_Sent != sent_in_run + 1) ||
+      (Last_Stamp.made_us != older.made_us) ||
+      (Last_Stamp.oldest_us != older.oldest_us)) {
+    errors++;
+  }
+
+  bool order = (Buttons_In_count == Buttons_Out_count) &&
+    (memcmp(Buttons_In, Buttons_Out, Buttons_In_count) == 0);
+  if ((Buttons_Out_count - burst_from) != 6) order = false;
+  if (!order) errors++;
+  if (stale != 0) errors++;
+  if ((Ep.wire >= u.stats.submitted * 3 / 4) || (Ep.frames_with_two != 0)) {
+    errors++;
+  }
+  if (u.stats.sent != Ep.wire) errors++;
+  if (u.stats.submitted != u.stats.sent + u.stats.suppressed + u.stats.merged) {
+    errors++;
+  }
+  printf("submitted %"PRIu32" sent %"PRIu32" suppressed %"PRIu32" merged %"
+      PRIu32" busy %"PRIu32" overflows %"PRIu32", longest wait %"PRIu32
+      " us\n", u.stats.submitted, u.stats.sent, u.stats.suppressed,
+      u.stats.merged, u.stats.busy, u.stats.overflows, Stamp_Wait_max);
+  printf("host frames %"PRIu32" reports on the wire %"PRIu32" (%.1f%% of"
+      " submitted), stale frames %"PRIu32", button changes %"PRIu32"/%"PRIu32
+      " %s, errors %d\n", Ep.polls, Ep.wire,
+      100.0 * Ep.wire / u.stats.submitted, stale, Buttons_Out_count,
+      Buttons_In_count, order ? "in order" : "FAIL", errors);
+  return errors;
+}
+#endif
@@ -0,0 +1,114 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2023 touchgadgetdev@gmail.com
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef _USB_OUT_H_
+#define _USB_OUT_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+/*
+ * Paces joystick reports to the USB interrupt endpoint. A report equal to
+ * the last one sent is not sent again. Reports submitted while the
+ * endpoint is busy wait in a short queue: a plain update replaces the
+ * newest queued report, an event (button change) is queued behind it so
+ * the host sees every event. At most one report goes out per USB frame
+ * and nothing blocks: when the endpoint is busy usb_out_poll() says how
+ * long to wait before trying again.
+ */
+
+#define USB_OUT_REPORT_MAX  (16)
+#define USB_OUT_QUEUE_MAX   (8)       // must be a power of 2
+#define USB_OUT_INTERVAL_US (1000)    // full speed interrupt endpoint, bInterval 1
+
+/*
+ * Times kept with a queued report until it is sent. made_us is when the
+ * report was made and oldest_us when the oldest input in it arrived. A
+ * report that replaces a queued one keeps the earlier of each.
+ */
+typedef struct {
+  uint32_t made_us;
+  uint32_t oldest_us;
+  bool valid;
+} usb_out_stamp_t;
+
+typedef struct {
+  // True if the endpoint can take a report now. NULL to pace by time.
+  bool (*ready)(void *ctx);
+  // Start sending a report. Must not wait for the host.
+  bool (*send)(void *ctx, const void *report, size_t len);
+  void *ctx;
+  // Called after send() takes a report submitted with a stamp. May be NULL.
+  void (*sent)(void *ctx, const usb_out_stamp_t *stamp);
+} usb_out_endpoint_t;
+
+typedef struct {
+  uint32_t submitted;
+  uint32_t suppressed;    // same as the report last sent
+  uint32_t merged;        // replaced by a newer report before sending
+  uint32_t sent;
+  uint32_t busy;          // endpoint not ready, retried later
+  uint32_t overflows;     // queue full, an event was merged
+} usb_out_stats_t;
+
+typedef struct {
+  usb_out_endpoint_t ep;
+  uint32_t interval_us;
+  size_t len;
+  uint8_t last[USB_OUT_REPORT_MAX];   // last sent
+  bool have_last;
+  uint32_t last_us;
+  uint8_t queue[USB_OUT_QUEUE_MAX][USB_OUT_REPORT_MAX];
+  usb_out_stamp_t stamps[USB_OUT_QUEUE_MAX];
+  uint32_t head;
+  uint32_t count;
+  usb_out_stats_t stats;
+} usb_out_t;
+
+/*
+ * Reports are len bytes, at most USB_OUT_REPORT_MAX.
+ */
+bool usb_out_init(usb_out_t *u, const usb_out_endpoint_t *ep, size_t len,
+    uint32_t interval_us);
+
+/*
+ * Submit a report. event is true if it must reach the host even if a
+ * newer report follows in the same frame. Call usb_out_poll() after.
+ */
+void usb_out_submit(usb_out_t *u, const void *report, bool event);
+
+/*
+ * usb_out_submit() with times for the sent callback. stamp may be NULL.
+ */
+void usb_out_submit_stamped(usb_out_t *u, const void *report, bool event,
+    const usb_out_stamp_t *stamp);
+
+/*
+ * Send the next queued report if the endpoint and frame allow. Returns 0
+ * when the queue is empty, otherwise microseconds until the next try.
+ */
+uint32_t usb_out_poll(usb_out_t *u, uint32_t now_us);
+
+#endif  /* _USB_OUT_H_ */